@@ -46,6 +46,7 @@ make check
 %exclude %{_libdir}/security/pam_keeto.la
 %{_libdir}/security/pam_keeto_audit.so
 %exclude %{_libdir}/security/pam_keeto_audit.la
+%{_sbindir}/keetod
 %dir %attr(0755, root, root) /etc/ssh/authorized_keys
 %dir %attr(0755, root, root) /etc/ssh/cert_store
 %config(noreplace) %attr(0600, root, root) /etc/ssh/keeto.conf
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * keeto-authorized-keys prints the keystore of a user from the keystore
+ * db (see ssh_keystore_db). it is meant to be used as sshd's
+ * AuthorizedKeysCommand:
+ *
+ *   AuthorizedKeysCommand /usr/local/sbin/keeto-authorized-keys
+ *       /etc/ssh/keeto-keystore.db %u %f
+ *   AuthorizedKeysCommandUser nobody
+ *
+ * if the fingerprint of the offered key is given (%f) only the records
+ * of that key are printed. sha256 fingerprints are looked up in the
+ * fingerprint index of the db - for other fingerprints the whole
+ * keystore is printed. nothing is printed for users without keystore.
+ * only the shard file of the db holding the entries of the user is read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "keeto-error.h"
+#include "keeto-keydb.h"
+#include "keeto-log.h"
+
+#define SHA256_FP_PREFIX "SHA256:"
+#define USAGE "usage: %s <keystore db> <uid> [<fingerprint>]\n"
+
+/*
+ * returns the key of the fingerprint index in a newly allocated buffer
+ * or NULL if fp is not a sha256 fingerprint. an empty fingerprint would
+ * address the entry count of uid.
+ */
+static char *
+get_fp_key(const char *uid, const char *fp, size_t *ret_length)
+{
+    size_t prefix_length = strlen(SHA256_FP_PREFIX);
+    if (strncmp(fp, SHA256_FP_PREFIX, prefix_length) != 0) {
+        return NULL;
+    }
+    fp += prefix_length;
+    if (*fp == '\0') {
+        return NULL;
+    }
+    size_t uid_length = strlen(uid);
+    size_t fp_length = strlen(fp);
+    char *key = malloc(uid_length + 1 + fp_length);
+    if (key == NULL) {
+        return NULL;
+    }
+    memcpy(key, uid, uid_length + 1);
+    memcpy(key + uid_length + 1, fp, fp_length);
+    *ret_length = uid_length + 1 + fp_length;
+    return key;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *keydb_file = argv[1];
+    const char *uid = argv[2];
+    const char *fp = argc == 4 ? argv[3] : NULL;
+
+    int res = EXIT_FAILURE;
+
+    struct keeto_keydb *keydb = NULL;
+    /* only the shard holding the entries of uid is opened */
+    int rc = open_keydb(keydb_file, uid, &keydb);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_SUCH_VALUE:
+        res = EXIT_SUCCESS;
+        goto cleanup;
+    default:
+        fprintf(stderr, "failed to open keystore db '%s' (%s)\n", keydb_file,
+            keeto_strerror(rc));
+        goto cleanup;
+    }
+
+    size_t key_length = 0;
+    char *fp_key = fp != NULL ? get_fp_key(uid, fp, &key_length) : NULL;
+    const char *key = fp_key;
+    if (key == NULL) {
+        key = uid;
+        key_length = strlen(uid);
+    }
+    const char *keystore = NULL;
+    size_t keystore_length = 0;
+    rc = lookup_keydb(keydb, key, key_length, &keystore, &keystore_length);
+    free(fp_key);
+    switch (rc) {
+    case KEETO_OK:
+        if (fwrite(keystore, 1, keystore_length, stdout) != keystore_length ||
+            fflush(stdout) != 0) {
+            fprintf(stderr, "failed to write keystore of uid '%s'\n", uid);
+            break;
+        }
+        res = EXIT_SUCCESS;
+        break;
+    case KEETO_NO_SUCH_VALUE:
+        res = EXIT_SUCCESS;
+        break;
+    default:
+        fprintf(stderr, "failed to lookup uid '%s' in keystore db '%s' (%s)\n",
+            uid, keydb_file, keeto_strerror(rc));
+    }
+    close_keydb(keydb);
+
+cleanup:
+    closelog();
+    return res;
+}
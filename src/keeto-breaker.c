@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-breaker.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-util.h"
+
+static int
+init_breaker_file(int fd, void *map, bool resized)
+{
+    struct keeto_breaker_state *state = map;
+    if (resized || state->magic != KEETO_BREAKER_MAGIC ||
+        state->version != KEETO_BREAKER_VERSION) {
+
+        memset(state, 0, sizeof *state);
+        state->magic = KEETO_BREAKER_MAGIC;
+        state->version = KEETO_BREAKER_VERSION;
+        state->state = KEETO_BREAKER_CLOSED;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * the breaker file is shared between processes by mapping it into
+ * memory. the state is updated with atomic operations only.
+ */
+int
+open_breaker(const char *breaker_file, struct keeto_breaker **ret)
+{
+    if (breaker_file == NULL || ret == NULL) {
+        fatal("breaker_file or ret == NULL");
+    }
+
+    /* only trust files that cannot be altered by others */
+    int fd = -1;
+    void *map = NULL;
+    int rc = map_shared_file(breaker_file, "breaker",
+        sizeof (struct keeto_breaker_state), S_IWGRP | S_IWOTH,
+        &init_breaker_file, &fd, &map);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    struct keeto_breaker *breaker = malloc(sizeof *breaker);
+    if (breaker == NULL) {
+        log_error("failed to allocate memory for breaker buffer");
+        munmap(map, sizeof (struct keeto_breaker_state));
+        close(fd);
+        return KEETO_NO_MEMORY;
+    }
+    breaker->fd = fd;
+    breaker->state = map;
+    *ret = breaker;
+    return KEETO_OK;
+}
+
+void
+close_breaker(struct keeto_breaker *breaker)
+{
+    if (breaker == NULL) {
+        return;
+    }
+    munmap(breaker->state, sizeof (struct keeto_breaker_state));
+    close(breaker->fd);
+    free(breaker);
+}
+
+/*
+ * while the breaker is open no connection attempts are made. after
+ * interval seconds a single caller wins the race for the probe and
+ * moves the breaker to half open. if the probe does not report back
+ * (e.g. the process died) another probe is allowed after the next
+ * interval.
+ */
+bool
+allow_breaker_request(struct keeto_breaker *breaker, long interval)
+{
+    if (breaker == NULL) {
+        fatal("breaker == NULL");
+    }
+
+    struct keeto_breaker_state *state = breaker->state;
+    uint32_t current = __atomic_load_n(&state->state, __ATOMIC_ACQUIRE);
+    if (current == KEETO_BREAKER_CLOSED) {
+        return true;
+    }
+
+    int64_t now = time(NULL);
+    int64_t changed_at = __atomic_load_n(&state->changed_at,
+        __ATOMIC_ACQUIRE);
+    if (now - changed_at < interval && now >= changed_at) {
+        return false;
+    }
+    /* claim the probe slot */
+    if (!__atomic_compare_exchange_n(&state->changed_at, &changed_at, now,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    __atomic_store_n(&state->state, KEETO_BREAKER_HALF_OPEN,
+        __ATOMIC_RELEASE);
+    log_info("ldap circuit breaker half open (probing)");
+    return true;
+}
+
+void
+record_breaker_success(struct keeto_breaker *breaker)
+{
+    if (breaker == NULL) {
+        fatal("breaker == NULL");
+    }
+
+    struct keeto_breaker_state *state = breaker->state;
+    __atomic_store_n(&state->failures, 0, __ATOMIC_RELEASE);
+    uint32_t previous = __atomic_exchange_n(&state->state,
+        KEETO_BREAKER_CLOSED, __ATOMIC_ACQ_REL);
+    if (previous != KEETO_BREAKER_CLOSED) {
+        log_info("ldap circuit breaker closed");
+    }
+}
+
+void
+record_breaker_failure(struct keeto_breaker *breaker, long threshold)
+{
+    if (breaker == NULL) {
+        fatal("breaker == NULL");
+    }
+
+    struct keeto_breaker_state *state = breaker->state;
+    uint32_t failures = __atomic_add_fetch(&state->failures, 1,
+        __ATOMIC_ACQ_REL);
+    uint32_t current = __atomic_load_n(&state->state, __ATOMIC_ACQUIRE);
+    switch (current) {
+    case KEETO_BREAKER_HALF_OPEN:
+        /* failed probe */
+        __atomic_store_n(&state->changed_at, (int64_t) time(NULL),
+            __ATOMIC_RELEASE);
+        if (__atomic_compare_exchange_n(&state->state, &current,
+            KEETO_BREAKER_OPEN, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            log_info("ldap circuit breaker reopened");
+        }
+        break;
+    case KEETO_BREAKER_CLOSED:
+        if ((long) failures < threshold) {
+            break;
+        }
+        __atomic_store_n(&state->changed_at, (int64_t) time(NULL),
+            __ATOMIC_RELEASE);
+        if (__atomic_compare_exchange_n(&state->state, &current,
+            KEETO_BREAKER_OPEN, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            log_info("ldap circuit breaker opened after %u failures",
+                failures);
+        }
+        break;
+    default:
+        break;
+    }
+}
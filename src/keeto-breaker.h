@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_BREAKER_H
+#define KEETO_BREAKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEETO_BREAKER_MAGIC 0x4b544f42 /* KTOB */
+#define KEETO_BREAKER_VERSION 1
+
+enum keeto_breaker_states {
+    KEETO_BREAKER_CLOSED,
+    KEETO_BREAKER_OPEN,
+    KEETO_BREAKER_HALF_OPEN
+};
+
+/*
+ * layout of the breaker file shared by all processes. all fields
+ * besides magic and version are only accessed atomically.
+ */
+struct keeto_breaker_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state;
+    /* consecutive connection failures */
+    uint32_t failures;
+    /* time the breaker opened or the last probe has been started */
+    int64_t changed_at;
+};
+
+struct keeto_breaker {
+    int fd;
+    struct keeto_breaker_state *state;
+};
+
+int open_breaker(const char *breaker_file, struct keeto_breaker **ret);
+void close_breaker(struct keeto_breaker *breaker);
+bool allow_breaker_request(struct keeto_breaker *breaker, long interval);
+void record_breaker_success(struct keeto_breaker *breaker);
+void record_breaker_failure(struct keeto_breaker *breaker, long threshold);
+
+#endif /* KEETO_BREAKER_H */
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <confuse.h>
+
+#include "keeto-error.h"
+#include "keeto-ipc.h"
+#include "keeto-log.h"
+#include "keeto-util.h"
+
+/*
+ * keystore cache file layout (integers in network byte order):
+ *
+ *   magic
+ *   version
+ *   creation time (high and low 32 bit)
+ *   uid
+ *   ssh server uid
+ *   keystore records
+ *
+ * strings and keystore records use the same encoding as the keetod
+ * protocol.
+ */
+#define KEETO_CACHE_HEADER_SIZE (4 * sizeof (uint32_t))
+#define LOCK_FILE_SUFFIX ".lock"
+
+static int
+read_cache_file(int fd, unsigned char *buffer, size_t length)
+{
+    while (length > 0) {
+        ssize_t bytes_read = read(fd, buffer, length);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return KEETO_SYSTEM_ERR;
+        }
+        if (bytes_read == 0) {
+            /* file has been truncated in the meantime */
+            return KEETO_NO_CACHE_ENTRY;
+        }
+        buffer += bytes_read;
+        length -= bytes_read;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * cache entries younger than fresh_ttl seconds are used as they are.
+ * entries younger than stale_ttl seconds are used as well but are
+ * refreshed in the background. a ttl of 0 disables the state.
+ */
+time_t
+get_keystore_cache_max_age(time_t fresh_ttl, time_t stale_ttl)
+{
+    return stale_ttl > fresh_ttl ? stale_ttl : fresh_ttl;
+}
+
+int
+get_keystore_cache_state(time_t age, time_t fresh_ttl, time_t stale_ttl)
+{
+    if (age < 0) {
+        return KEETO_CACHE_EXPIRED;
+    }
+    if (age < fresh_ttl) {
+        return KEETO_CACHE_FRESH;
+    }
+    if (age < stale_ttl) {
+        return KEETO_CACHE_STALE;
+    }
+    return KEETO_CACHE_EXPIRED;
+}
+
+/*
+ * loads the keystore records of the cache file into info. the records
+ * point into a buffer that is handed over to info as well. the cache
+ * entry is only used if it belongs to the uid and ssh server in info
+ * and if it is younger than max_age seconds. a max_age of 0 accepts
+ * entries of any age.
+ */
+int
+load_keystore_cache(char *cache_file, struct keeto_info *info, time_t max_age,
+    time_t *ret_age)
+{
+    if (cache_file == NULL || info == NULL || ret_age == NULL) {
+        fatal("cache_file, info or ret_age == NULL");
+    }
+
+    if (info->uid == NULL || info->cfg == NULL) {
+        fatal("info->uid or info->cfg == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    int fd = open(cache_file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return KEETO_NO_CACHE_ENTRY;
+        }
+        log_error("failed to open keystore cache file '%s' (%s)", cache_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    /* only trust files that cannot be altered by others */
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat keystore cache file '%s' (%s)", cache_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    if (!S_ISREG(stat_buffer.st_mode) || stat_buffer.st_uid != geteuid() ||
+        (stat_buffer.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        log_error("refusing to use keystore cache file '%s' (insecure file)",
+            cache_file);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_a;
+    }
+    size_t buffer_length = stat_buffer.st_size;
+    if (buffer_length < KEETO_CACHE_HEADER_SIZE ||
+        buffer_length > KEETO_CACHE_MAX_SIZE) {
+        log_error("refusing to use keystore cache file '%s' (invalid size)",
+            cache_file);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_a;
+    }
+
+    unsigned char *buffer = malloc(buffer_length);
+    if (buffer == NULL) {
+        log_error("failed to allocate memory for keystore cache buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    rc = read_cache_file(fd, buffer, buffer_length);
+    if (rc != KEETO_OK) {
+        log_error("failed to read keystore cache file '%s'", cache_file);
+        res = rc;
+        goto cleanup_b;
+    }
+
+    /* check header */
+    if (get_uint32(buffer) != KEETO_CACHE_MAGIC ||
+        get_uint32(buffer + sizeof (uint32_t)) != KEETO_CACHE_VERSION) {
+        log_info("ignoring keystore cache file '%s' (unknown format)",
+            cache_file);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+    uint64_t created = (uint64_t) get_uint32(buffer + 2 * sizeof (uint32_t))
+        << 32 | get_uint32(buffer + 3 * sizeof (uint32_t));
+    time_t now = time(NULL);
+    if ((time_t) created > now ||
+        (max_age > 0 && now - (time_t) created >= max_age)) {
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+
+    unsigned char *ptr = buffer + KEETO_CACHE_HEADER_SIZE;
+    unsigned char *end = buffer + buffer_length;
+    char *uid = NULL;
+    char *ssh_server_uid = NULL;
+    if (get_field(&ptr, end, &uid) != KEETO_OK ||
+        get_field(&ptr, end, &ssh_server_uid) != KEETO_OK ||
+        uid == NULL || ssh_server_uid == NULL) {
+        log_error("failed to parse keystore cache file '%s'", cache_file);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+    if (strcmp(uid, info->uid) != 0 || strcmp(ssh_server_uid,
+        cfg_getstr(info->cfg, "ldap_ssh_server_uid")) != 0) {
+        log_info("ignoring keystore cache file '%s' (different uid or ssh "
+            "server)", cache_file);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+
+    struct keeto_keystore_records *keystore_records = NULL;
+    rc = get_keystore_records(&ptr, end, &keystore_records);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup_b;
+    default:
+        log_error("failed to parse keystore cache file '%s'", cache_file);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+    if (keystore_records == NULL || ptr != end) {
+        if (keystore_records != NULL) {
+            free_keystore_records(keystore_records);
+        }
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+
+    info->keystore_records = keystore_records;
+    info->keystore_records_buffer = (char *) buffer;
+    buffer = NULL;
+    *ret_age = now - (time_t) created;
+    res = KEETO_OK;
+
+cleanup_b:
+    free(buffer);
+cleanup_a:
+    close(fd);
+    return res;
+}
+
+int
+store_keystore_cache(char *cache_file, struct keeto_info *info)
+{
+    if (cache_file == NULL || info == NULL) {
+        fatal("cache_file or info == NULL");
+    }
+
+    if (info->uid == NULL || info->cfg == NULL ||
+        info->keystore_records == NULL) {
+        fatal("info->uid, info->cfg or info->keystore_records == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* serialize cache entry */
+    char *ssh_server_uid = cfg_getstr(info->cfg, "ldap_ssh_server_uid");
+    size_t buffer_length = KEETO_CACHE_HEADER_SIZE +
+        get_field_size(info->uid) + get_field_size(ssh_server_uid) +
+        get_keystore_records_size(info->keystore_records);
+    if (buffer_length > KEETO_CACHE_MAX_SIZE) {
+        log_error("failed to store keystore cache (entry too large)");
+        return KEETO_SYSTEM_ERR;
+    }
+    unsigned char *buffer = malloc(buffer_length);
+    if (buffer == NULL) {
+        log_error("failed to allocate memory for keystore cache buffer");
+        return KEETO_NO_MEMORY;
+    }
+    uint64_t created = time(NULL);
+    put_uint32(buffer, KEETO_CACHE_MAGIC);
+    put_uint32(buffer + sizeof (uint32_t), KEETO_CACHE_VERSION);
+    put_uint32(buffer + 2 * sizeof (uint32_t), created >> 32);
+    put_uint32(buffer + 3 * sizeof (uint32_t), created & 0xffffffff);
+    unsigned char *ptr = buffer + KEETO_CACHE_HEADER_SIZE;
+    ptr = put_field(ptr, info->uid);
+    ptr = put_field(ptr, ssh_server_uid);
+    put_keystore_records(ptr, info->keystore_records);
+
+    /* create temporary file */
+    char *template_suffix = "-XXXXXXX";
+    size_t tmp_cache_file_size = strlen(cache_file) + strlen(template_suffix) + 1;
+    char tmp_cache_file[tmp_cache_file_size];
+    strcpy(tmp_cache_file, cache_file);
+    strcat(tmp_cache_file, template_suffix);
+    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    int fd = mkstemp(tmp_cache_file);
+    umask(mask);
+    if (fd == -1) {
+        log_error("failed to create temporary keystore cache file '%s' (%s)",
+            tmp_cache_file, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+
+    ptr = buffer;
+    size_t length = buffer_length;
+    while (length > 0) {
+        ssize_t written = write(fd, ptr, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("failed to write temporary keystore cache file '%s' (%s)",
+                tmp_cache_file, strerror(errno));
+            res = KEETO_SYSTEM_ERR;
+            goto cleanup_b;
+        }
+        ptr += written;
+        length -= written;
+    }
+    int rc = rename(tmp_cache_file, cache_file);
+    if (rc == -1) {
+        log_error("failed to move temp keystore cache file from '%s' to '%s' "
+            "(%s)", tmp_cache_file, cache_file, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_b;
+    }
+    res = KEETO_OK;
+
+cleanup_b:
+    if (res != KEETO_OK) {
+        unlink(tmp_cache_file);
+    }
+    rc = close(fd);
+    if (rc == -1) {
+        log_error("failed to close temporary keystore cache file '%s' (%s)",
+            tmp_cache_file, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+    }
+cleanup_a:
+    free(buffer);
+    return res;
+}
+
+void
+remove_keystore_cache(char *cache_file)
+{
+    if (cache_file == NULL) {
+        fatal("cache_file == NULL");
+    }
+
+    int rc = unlink(cache_file);
+    if (rc == -1) {
+        switch (errno) {
+        case ENOENT:
+            break;
+        default:
+            log_error("failed to remove keystore cache file '%s' (%s)",
+                cache_file, strerror(errno));
+        }
+        return;
+    }
+    log_info("removed keystore cache file '%s'", cache_file);
+}
+
+/*
+ * tries to acquire the refresh lock of a cache file without blocking.
+ * on success ret holds the file descriptor of the lock file. the lock
+ * is held as long as the file descriptor (or a duplicate of it) is
+ * open. if another process holds the lock ret is set to -1.
+ */
+int
+try_lock_keystore_cache(char *cache_file, int *ret)
+{
+    if (cache_file == NULL || ret == NULL) {
+        fatal("cache_file or ret == NULL");
+    }
+
+    size_t lock_file_size = strlen(cache_file) + strlen(LOCK_FILE_SUFFIX) + 1;
+    char lock_file[lock_file_size];
+    strcpy(lock_file, cache_file);
+    strcat(lock_file, LOCK_FILE_SUFFIX);
+
+    int fd = open(lock_file, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        log_error("failed to open keystore cache lock file '%s' (%s)",
+            lock_file, strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    int rc = flock(fd, LOCK_EX | LOCK_NB);
+    if (rc == -1) {
+        int flock_errno = errno;
+        close(fd);
+        if (flock_errno == EWOULDBLOCK) {
+            *ret = -1;
+            return KEETO_OK;
+        }
+        log_error("failed to lock keystore cache lock file '%s' (%s)",
+            lock_file, strerror(flock_errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    *ret = fd;
+    return KEETO_OK;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_CACHE_H
+#define KEETO_CACHE_H
+
+#include <time.h>
+
+#include "keeto-ipc.h"
+#include "keeto-util.h"
+
+#define KEETO_CACHE_MAGIC 0x4b544f43 /* KTOC */
+#define KEETO_CACHE_VERSION 2
+/*
+ * a cache entry holds the same keystore records as a keetod response
+ * plus the header, the uid and the ssh server uid.
+ */
+#define KEETO_CACHE_MAX_SIZE (4 * sizeof (uint32_t) + \
+    2 * KEETOD_MAX_REQUEST_SIZE + KEETOD_MAX_MESSAGE_SIZE)
+
+enum keeto_cache_states {
+    KEETO_CACHE_EXPIRED,
+    KEETO_CACHE_FRESH,
+    KEETO_CACHE_STALE
+};
+
+time_t get_keystore_cache_max_age(time_t fresh_ttl, time_t stale_ttl);
+int get_keystore_cache_state(time_t age, time_t fresh_ttl, time_t stale_ttl);
+int load_keystore_cache(char *cache_file, struct keeto_info *info,
+    time_t max_age, time_t *ret_age);
+int store_keystore_cache(char *cache_file, struct keeto_info *info);
+void remove_keystore_cache(char *cache_file);
+int try_lock_keystore_cache(char *cache_file, int *ret);
+
+#endif /* KEETO_CACHE_H */
@@ -21,20 +21,51 @@
 
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 #include <ldap.h>
-#include <regex.h>
 
 #include "keeto-error.h"
 #include "keeto-log.h"
 #include "keeto-util.h"
 
 #define ERROR_MSG_BUFFER_SIZE 4096
+#define CONFIG_SNAPSHOT_MAGIC 0x4b544f43 /* KTOC */
+#define CONFIG_SNAPSHOT_VERSION 1
+
+/* state of the config file a snapshot has been created from */
+struct keeto_config_stamp {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    uint64_t size;
+};
+
+/*
+ * the header is followed by the path of the config file and a record
+ * per option: name length, name, type and value. string values include
+ * the terminating '\0'.
+ */
+struct keeto_config_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_length;
+    uint32_t count;
+    struct keeto_config_stamp stamp;
+};
 
 /*
  * function is called internally by libconfuse on error.
@@ -92,10 +123,26 @@ cfg_validate_ldap_uri(cfg_t *cfg, cfg_opt_t *opt)
         return -1;
     }
 
-    int rc = ldap_is_ldap_url(ldap_uri);
-    if (rc == 0) {
+    /* validate every uri of the list */
+    char ldap_uris[strlen(ldap_uri) + 1];
+    strcpy(ldap_uris, ldap_uri);
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *uri = strtok_r(ldap_uris, KEETO_LDAP_URI_SEPARATORS, &saveptr);
+        uri != NULL; uri = strtok_r(NULL, KEETO_LDAP_URI_SEPARATORS, &saveptr)) {
+
+        int rc = ldap_is_ldap_url(uri);
+        if (rc == 0) {
+            log_error("failed to validate ldap uri: option '%s', value '%s' "
+                "(invalid ldap uri)", cfg_opt_name(opt), uri);
+            return -1;
+        }
+        count++;
+    }
+    if (count == 0 || count > KEETO_LDAP_MAX_URIS) {
         log_error("failed to validate ldap uri: option '%s', value '%s' "
-            "(invalid ldap uri)", cfg_opt_name(opt), ldap_uri);
+            "(between 1 and %d uris required)", cfg_opt_name(opt), ldap_uri,
+            KEETO_LDAP_MAX_URIS);
         return -1;
     }
     return 0;
@@ -206,6 +253,33 @@ cfg_validate_cert_store_dir(cfg_t *cfg, cfg_opt_t *opt)
     return 0;
 }
 
+static int
+cfg_validate_crl_index(cfg_t *cfg, cfg_opt_t *opt)
+{
+    if (cfg == NULL || opt == NULL) {
+        fatal("cfg or opt == NULL");
+    }
+
+    const char *crl_index = cfg_opt_getnstr(opt, 0);
+    if (crl_index == NULL) {
+        log_error("failed to obtain crl_index option");
+        return -1;
+    }
+    /* empty value disables crl indexes */
+    if (crl_index[0] == '\0') {
+        return 0;
+    }
+    /* check if directory exists */
+    DIR *crl_index_stream = opendir(crl_index);
+    if (crl_index_stream == NULL) {
+        log_error("failed to validate crl index dir: option '%s', value '%s' "
+            "(%s)", cfg_opt_name(opt), crl_index, strerror(errno));
+        return -1;
+    }
+    closedir(crl_index_stream);
+    return 0;
+}
+
 static int
 cfg_validate_regex(cfg_t *cfg, cfg_opt_t *opt)
 {
@@ -219,24 +293,102 @@ cfg_validate_regex(cfg_t *cfg, cfg_opt_t *opt)
         return -1;
     }
     /* check if regex compiles */
-    regex_t regex_comp;
-    int rc = regcomp(&regex_comp, regex, REG_EXTENDED | REG_NOSUB);
-    if (rc != 0) {
-        log_error("failed to compile uid regex: option '%s', value '%s' (%d)",
-            cfg_opt_name(opt), regex, rc);
+    int rc = validate_uid_regex(regex);
+    if (rc != KEETO_OK) {
+        log_error("failed to compile uid regex: option '%s', value '%s' (%s)",
+            cfg_opt_name(opt), regex, keeto_strerror(rc));
         return -1;
     }
-    regfree(&regex_comp);
     return 0;
 }
 
-cfg_t *
-parse_config(const char *cfg_file)
+static int
+cfg_validate_keetod_socket(cfg_t *cfg, cfg_opt_t *opt)
 {
-    if (cfg_file == NULL) {
-        fatal("cfg_file == NULL");
+    if (cfg == NULL || opt == NULL) {
+        fatal("cfg or opt == NULL");
+    }
+
+    const char *keetod_socket = cfg_opt_getnstr(opt, 0);
+    if (keetod_socket == NULL) {
+        log_error("failed to obtain keetod_socket option");
+        return -1;
+    }
+    /* empty value disables keetod */
+    size_t keetod_socket_length = strlen(keetod_socket);
+    if (keetod_socket_length == 0) {
+        return 0;
+    }
+    if (keetod_socket[0] != '/') {
+        log_error("failed to validate keetod socket: option '%s', value '%s' "
+            "(path must be absolute)", cfg_opt_name(opt), keetod_socket);
+        return -1;
+    }
+    struct sockaddr_un addr;
+    if (keetod_socket_length >= sizeof addr.sun_path) {
+        log_error("failed to validate keetod socket: option '%s', value '%s' "
+            "(path too long)", cfg_opt_name(opt), keetod_socket);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+cfg_validate_absolute_path(cfg_t *cfg, cfg_opt_t *opt)
+{
+    if (cfg == NULL || opt == NULL) {
+        fatal("cfg or opt == NULL");
     }
 
+    const char *path = cfg_opt_getnstr(opt, 0);
+    if (path == NULL) {
+        log_error("failed to obtain %s option", cfg_opt_name(opt));
+        return -1;
+    }
+    /* empty value disables the feature */
+    if (path[0] != '\0' && path[0] != '/') {
+        log_error("failed to validate path: option '%s', value '%s' "
+            "(path must be absolute)", cfg_opt_name(opt), path);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+cfg_validate_positive_int(cfg_t *cfg, cfg_opt_t *opt)
+{
+    if (cfg == NULL || opt == NULL) {
+        fatal("cfg or opt == NULL");
+    }
+
+    long int value = cfg_opt_getnint(opt, 0);
+    if (value <= 0) {
+        log_error("failed to validate integer: option '%s', value '%li' "
+            "(value must be > 0)", cfg_opt_name(opt), value);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+cfg_validate_non_negative_int(cfg_t *cfg, cfg_opt_t *opt)
+{
+    if (cfg == NULL || opt == NULL) {
+        fatal("cfg or opt == NULL");
+    }
+
+    long int value = cfg_opt_getnint(opt, 0);
+    if (value < 0) {
+        log_error("failed to validate integer: option '%s', value '%li' "
+            "(value must be >= 0)", cfg_opt_name(opt), value);
+        return -1;
+    }
+    return 0;
+}
+
+static cfg_t *
+new_config()
+{
     /* setup config options */
     cfg_opt_t opts[] = {
         CFG_STR("syslog_facility", "LOG_LOCAL1", CFGF_NONE),
@@ -247,6 +399,11 @@ parse_config(const char *cfg_file)
         CFG_STR("ldap_bind_pwd", "test123", CFGF_NONE),
         CFG_INT("ldap_timeout", 10, CFGF_NONE),
         CFG_INT("ldap_strict", 0, CFGF_NONE),
+        CFG_INT("ldap_hedge_delay", 200, CFGF_NONE),
+        CFG_STR("ldap_health_file", "", CFGF_NONE),
+        CFG_STR("ldap_breaker_file", "", CFGF_NONE),
+        CFG_INT("ldap_breaker_threshold", 3, CFGF_NONE),
+        CFG_INT("ldap_breaker_interval", 30, CFGF_NONE),
 
         CFG_STR("ldap_ssh_server_search_base", "ou=servers,ou=ssh,dc=keeto,dc=io",
             CFGF_NONE),
@@ -258,16 +415,42 @@ parse_config(const char *cfg_file)
         CFG_STR("ldap_key_provider_uid_attr", "uid", CFGF_NONE),
         CFG_STR("ldap_key_provider_cert_attr", "userCertificate;binary",
             CFGF_NONE),
+        CFG_INT("ldap_key_provider_reverse_lookup", 0, CFGF_NONE),
+        CFG_STR("ldap_key_provider_search_base", "dc=keeto,dc=io", CFGF_NONE),
+        CFG_INT_CB("ldap_key_provider_search_scope", LDAP_SCOPE_SUB, CFGF_NONE,
+            &cfg_str_to_int_cb_libldap),
 
         CFG_STR("ldap_target_keystore_group_member_attr", "member", CFGF_NONE),
         CFG_STR("ldap_target_keystore_uid_attr", "uid", CFGF_NONE),
+        CFG_INT("ldap_target_keystore_reverse_lookup", 0, CFGF_NONE),
+        CFG_STR("ldap_target_keystore_search_base", "dc=keeto,dc=io",
+            CFGF_NONE),
+        CFG_INT_CB("ldap_target_keystore_search_scope", LDAP_SCOPE_SUB,
+            CFGF_NONE, &cfg_str_to_int_cb_libldap),
 
         CFG_STR("ssh_keystore_location", "/etc/ssh/authorized_keys/%u",
             CFGF_NONE),
+        CFG_STR("ssh_keystore_db", "", CFGF_NONE),
+        CFG_INT("ssh_keystore_expiry_time", 0, CFGF_NONE),
+        CFG_INT("ssh_keystore_max_lifetime", 0, CFGF_NONE),
+        CFG_STR("ssh_keystore_cache_location", "", CFGF_NONE),
+        CFG_INT("ssh_keystore_cache_fresh_ttl", 300, CFGF_NONE),
+        CFG_INT("ssh_keystore_cache_stale_ttl", 3600, CFGF_NONE),
         CFG_STR("cert_store_dir", "/etc/ssh/cert_store", CFGF_NONE),
         CFG_INT("check_crl", 1, CFGF_NONE),
+        CFG_STR("cert_store_snapshot", "", CFGF_NONE),
+        CFG_STR("crl_index", "", CFGF_NONE),
+        CFG_STR("cert_validation_cache_file", "", CFGF_NONE),
+        CFG_INT("cert_validation_cache_max_age", 3600, CFGF_NONE),
+        CFG_INT("cert_validation_threads", 1, CFGF_NONE),
+        CFG_INT("cert_issuer_check", 0, CFGF_NONE),
+        CFG_STR("ssh_key_cache_file", "", CFGF_NONE),
 
         CFG_STR("uid_regex", "^[a-z][-a-z0-9]{0,31}$", CFGF_NONE),
+
+        CFG_STR("keetod_socket", "", CFGF_NONE),
+        CFG_INT("keetod_timeout", 30, CFGF_NONE),
+        CFG_INT("keetod_workers", 8, CFGF_NONE),
         CFG_END()
     };
 
@@ -287,11 +470,66 @@ parse_config(const char *cfg_file)
     cfg_set_validate_func(cfg, "ldap_bind_dn", &cfg_validate_ldap_dn);
     cfg_set_validate_func(cfg, "ldap_timeout", &cfg_validate_ldap_timeout);
     cfg_set_validate_func(cfg, "ldap_strict", &cfg_validate_boolean);
+    cfg_set_validate_func(cfg, "ldap_hedge_delay",
+        &cfg_validate_non_negative_int);
+    cfg_set_validate_func(cfg, "ldap_health_file", &cfg_validate_absolute_path);
+    cfg_set_validate_func(cfg, "ldap_breaker_file",
+        &cfg_validate_absolute_path);
+    cfg_set_validate_func(cfg, "ldap_breaker_threshold",
+        &cfg_validate_positive_int);
+    cfg_set_validate_func(cfg, "ldap_breaker_interval",
+        &cfg_validate_positive_int);
     cfg_set_validate_func(cfg, "ldap_ssh_server_search_base",
         &cfg_validate_ldap_dn);
+    cfg_set_validate_func(cfg, "ldap_key_provider_reverse_lookup",
+        &cfg_validate_boolean);
+    cfg_set_validate_func(cfg, "ldap_key_provider_search_base",
+        &cfg_validate_ldap_dn);
+    cfg_set_validate_func(cfg, "ldap_target_keystore_reverse_lookup",
+        &cfg_validate_boolean);
+    cfg_set_validate_func(cfg, "ldap_target_keystore_search_base",
+        &cfg_validate_ldap_dn);
+    cfg_set_validate_func(cfg, "ssh_keystore_db", &cfg_validate_absolute_path);
+    cfg_set_validate_func(cfg, "ssh_keystore_expiry_time",
+        &cfg_validate_boolean);
+    cfg_set_validate_func(cfg, "ssh_keystore_max_lifetime",
+        &cfg_validate_non_negative_int);
+    cfg_set_validate_func(cfg, "ssh_keystore_cache_fresh_ttl",
+        &cfg_validate_non_negative_int);
+    cfg_set_validate_func(cfg, "ssh_keystore_cache_stale_ttl",
+        &cfg_validate_non_negative_int);
     cfg_set_validate_func(cfg, "cert_store_dir", &cfg_validate_cert_store_dir);
     cfg_set_validate_func(cfg, "check_crl", &cfg_validate_boolean);
+    cfg_set_validate_func(cfg, "cert_store_snapshot",
+        &cfg_validate_absolute_path);
+    cfg_set_validate_func(cfg, "crl_index", &cfg_validate_crl_index);
+    cfg_set_validate_func(cfg, "cert_validation_cache_file",
+        &cfg_validate_absolute_path);
+    cfg_set_validate_func(cfg, "cert_validation_cache_max_age",
+        &cfg_validate_positive_int);
+    cfg_set_validate_func(cfg, "cert_validation_threads",
+        &cfg_validate_positive_int);
+    cfg_set_validate_func(cfg, "cert_issuer_check", &cfg_validate_boolean);
+    cfg_set_validate_func(cfg, "ssh_key_cache_file",
+        &cfg_validate_absolute_path);
     cfg_set_validate_func(cfg, "uid_regex", &cfg_validate_regex);
+    cfg_set_validate_func(cfg, "keetod_socket", &cfg_validate_keetod_socket);
+    cfg_set_validate_func(cfg, "keetod_timeout", &cfg_validate_positive_int);
+    cfg_set_validate_func(cfg, "keetod_workers", &cfg_validate_positive_int);
+    return cfg;
+}
+
+cfg_t *
+parse_config(const char *cfg_file)
+{
+    if (cfg_file == NULL) {
+        fatal("cfg_file == NULL");
+    }
+
+    cfg_t *cfg = new_config();
+    if (cfg == NULL) {
+        return NULL;
+    }
 
     /* parse config */
     int rc = cfg_parse(cfg, cfg_file);
@@ -302,6 +540,299 @@ parse_config(const char *cfg_file)
     return cfg;
 }
 
+static int
+get_config_stamp(const char *cfg_file, struct keeto_config_stamp *ret)
+{
+    struct stat stat_buffer;
+    int rc = stat(cfg_file, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat config file '%s' (%s)", cfg_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    memset(ret, 0, sizeof *ret);
+    ret->dev = stat_buffer.st_dev;
+    ret->ino = stat_buffer.st_ino;
+    ret->mtime = stat_buffer.st_mtim.tv_sec;
+    ret->mtime_nsec = stat_buffer.st_mtim.tv_nsec;
+    ret->size = stat_buffer.st_size;
+    return KEETO_OK;
+}
+
+static bool
+write_config_snapshot_record(FILE *file, cfg_t *cfg, cfg_opt_t *opt)
+{
+    uint32_t name_length = strlen(opt->name);
+    uint32_t type = opt->type;
+    if (fwrite(&name_length, sizeof name_length, 1, file) != 1 ||
+        fwrite(opt->name, name_length, 1, file) != 1 ||
+        fwrite(&type, sizeof type, 1, file) != 1) {
+        return false;
+    }
+    if (type == CFGT_INT) {
+        int64_t value = cfg_getint(cfg, opt->name);
+        return fwrite(&value, sizeof value, 1, file) == 1;
+    }
+    const char *value = cfg_getstr(cfg, opt->name);
+    uint32_t length = value != NULL ? strlen(value) + 1 : 0;
+    return fwrite(&length, sizeof length, 1, file) == 1 &&
+        (length == 0 || fwrite(value, length, 1, file) == 1);
+}
+
+/*
+ * the snapshot contains the bind password - it is only readable by the
+ * owner.
+ */
+static int
+write_config_snapshot(const char *snapshot_file, const char *cfg_file,
+    struct keeto_config_stamp *stamp, cfg_t *cfg)
+{
+    struct keeto_config_snapshot_header header;
+    memset(&header, 0, sizeof header);
+    header.magic = CONFIG_SNAPSHOT_MAGIC;
+    header.version = CONFIG_SNAPSHOT_VERSION;
+    header.file_length = strlen(cfg_file);
+    header.stamp = *stamp;
+    for (int i = 0; cfg->opts[i].name != NULL; i++) {
+        if (cfg->opts[i].type != CFGT_INT && cfg->opts[i].type != CFGT_STR) {
+            fatal("unsupported type of option '%s'", cfg->opts[i].name);
+        }
+        header.count++;
+    }
+
+    /* write to temporary file and rename to replace the snapshot atomically */
+    char tmp_file[strlen(snapshot_file) + 8];
+    snprintf(tmp_file, sizeof tmp_file, "%s.XXXXXX", snapshot_file);
+    int fd = mkstemp(tmp_file);
+    if (fd == -1) {
+        log_error("failed to create config snapshot file '%s' (%s)", tmp_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    FILE *file = fdopen(fd, "w");
+    if (file == NULL) {
+        log_error("failed to open config snapshot file '%s' (%s)", tmp_file,
+            strerror(errno));
+        close(fd);
+        unlink(tmp_file);
+        return KEETO_SYSTEM_ERR;
+    }
+    bool written = fchmod(fd, S_IRUSR | S_IWUSR) == 0 &&
+        fwrite(&header, sizeof header, 1, file) == 1 &&
+        fwrite(cfg_file, header.file_length, 1, file) == 1;
+    for (int i = 0; written && cfg->opts[i].name != NULL; i++) {
+        written = write_config_snapshot_record(file, cfg, &cfg->opts[i]);
+    }
+    if (fclose(file) != 0) {
+        written = false;
+    }
+    if (!written || rename(tmp_file, snapshot_file) == -1) {
+        log_error("failed to write config snapshot file '%s' (%s)",
+            snapshot_file, strerror(errno));
+        unlink(tmp_file);
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
+
+static bool
+read_config_snapshot_bytes(const unsigned char *data, size_t size,
+    size_t *offset, void *dst, size_t length)
+{
+    if (size - *offset < length) {
+        return false;
+    }
+    memcpy(dst, data + *offset, length);
+    *offset += length;
+    return true;
+}
+
+/*
+ * sets the options of cfg from the records of the snapshot. returns
+ * false if the records do not match the options (e.g. after an
+ * update).
+ */
+static bool
+apply_config_snapshot_records(const unsigned char *data, size_t size,
+    size_t offset, uint32_t count, cfg_t *cfg)
+{
+    uint32_t option_count = 0;
+    while (cfg->opts[option_count].name != NULL) {
+        option_count++;
+    }
+    if (count != option_count) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t name_length = 0;
+        uint32_t type = 0;
+        if (!read_config_snapshot_bytes(data, size, &offset, &name_length,
+            sizeof name_length) || size - offset < name_length) {
+            return false;
+        }
+        const char *name = (const char *) data + offset;
+        offset += name_length;
+        if (!read_config_snapshot_bytes(data, size, &offset, &type,
+            sizeof type)) {
+            return false;
+        }
+        cfg_opt_t *opt = &cfg->opts[i];
+        if (strlen(opt->name) != name_length ||
+            memcmp(opt->name, name, name_length) != 0 ||
+            (uint32_t) opt->type != type) {
+            return false;
+        }
+
+        if (type == CFGT_INT) {
+            int64_t value = 0;
+            if (!read_config_snapshot_bytes(data, size, &offset, &value,
+                sizeof value)) {
+                return false;
+            }
+            cfg_setint(cfg, opt->name, value);
+            continue;
+        }
+        uint32_t length = 0;
+        if (!read_config_snapshot_bytes(data, size, &offset, &length,
+            sizeof length) || size - offset < length ||
+            (length > 0 && data[offset + length - 1] != '\0')) {
+            return false;
+        }
+        cfg_setstr(cfg, opt->name, length > 0 ?
+            (const char *) data + offset : NULL);
+        offset += length;
+    }
+    return offset == size;
+}
+
+/*
+ * returns KEETO_NO_CACHE_ENTRY if the snapshot does not exist or does
+ * not match the current state of the config file.
+ */
+static int
+load_config_snapshot(const char *snapshot_file, const char *cfg_file,
+    struct keeto_config_stamp *stamp, cfg_t **ret)
+{
+    int fd = open(snapshot_file, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return KEETO_NO_CACHE_ENTRY;
+        }
+        log_error("failed to open config snapshot file '%s' (%s)",
+            snapshot_file, strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* values of the snapshot are not validated again - only trust our own */
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat config snapshot file '%s' (%s)",
+            snapshot_file, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    if (!S_ISREG(stat_buffer.st_mode) || stat_buffer.st_uid != geteuid() ||
+        (stat_buffer.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        log_error("refusing to use config snapshot file '%s' (insecure file)",
+            snapshot_file);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    size_t size = stat_buffer.st_size;
+    struct keeto_config_snapshot_header header;
+    if (size < sizeof header) {
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_a;
+    }
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("failed to map config snapshot file '%s' (%s)",
+            snapshot_file, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    memcpy(&header, data, sizeof header);
+    size_t file_length = strlen(cfg_file);
+    if (header.magic != CONFIG_SNAPSHOT_MAGIC ||
+        header.version != CONFIG_SNAPSHOT_VERSION ||
+        header.file_length != file_length ||
+        size - sizeof header < file_length ||
+        memcmp(data + sizeof header, cfg_file, file_length) != 0 ||
+        memcmp(&header.stamp, stamp, sizeof header.stamp) != 0) {
+
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+
+    cfg_t *cfg = new_config();
+    if (cfg == NULL) {
+        res = KEETO_NO_MEMORY;
+        goto cleanup_b;
+    }
+    if (!apply_config_snapshot_records(data, size, sizeof header + file_length,
+        header.count, cfg)) {
+        free_config(cfg);
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+    *ret = cfg;
+    res = KEETO_OK;
+
+cleanup_b:
+    munmap(data, size);
+cleanup_a:
+    close(fd);
+    return res;
+}
+
+/*
+ * the config is taken from snapshot_file as long as cfg_file does not
+ * change. parsing and validating the config is skipped in this case.
+ * otherwise the config is parsed and the snapshot is (re)written.
+ */
+cfg_t *
+parse_config_with_snapshot(const char *cfg_file, const char *snapshot_file)
+{
+    if (cfg_file == NULL) {
+        fatal("cfg_file == NULL");
+    }
+
+    if (snapshot_file == NULL) {
+        return parse_config(cfg_file);
+    }
+
+    struct keeto_config_stamp stamp;
+    int rc = get_config_stamp(cfg_file, &stamp);
+    if (rc != KEETO_OK) {
+        return NULL;
+    }
+    cfg_t *cfg = NULL;
+    rc = load_config_snapshot(snapshot_file, cfg_file, &stamp, &cfg);
+    switch (rc) {
+    case KEETO_OK:
+        log_debug("using config snapshot '%s'", snapshot_file);
+        return cfg;
+    case KEETO_NO_CACHE_ENTRY:
+        break;
+    default:
+        log_error("failed to load config snapshot (%s)", keeto_strerror(rc));
+    }
+
+    cfg = parse_config(cfg_file);
+    if (cfg == NULL) {
+        return NULL;
+    }
+    rc = write_config_snapshot(snapshot_file, cfg_file, &stamp, cfg);
+    if (rc != KEETO_OK) {
+        log_error("failed to write config snapshot (%s)", keeto_strerror(rc));
+    }
+    return cfg;
+}
+
 void
 free_config(cfg_t *cfg)
 {
@@ -22,7 +22,13 @@
 
 #include <confuse.h>
 
+/* ldap_uri may contain a list of uris separated by these characters */
+#define KEETO_LDAP_URI_SEPARATORS " \t,"
+#define KEETO_LDAP_MAX_URIS 16
+
 cfg_t *parse_config(const char *cfg_file);
+cfg_t *parse_config_with_snapshot(const char *cfg_file,
+    const char *snapshot_file);
 void free_config(cfg_t *cfg);
 
 #endif /* KEETO_CONFIG_H */
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * keeto-crl-compile turns the crl's of the cert store directory into
+ * crl indexes. for every crl '<hash>.r<n>' an index '<hash>.i<n>' is
+ * written to the crl index directory after the signature of the crl
+ * has been verified against its issuer '<hash>.<m>'. indexes without
+ * a corresponding crl are removed.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "keeto-crl.h"
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-openssl.h"
+
+#define HASH_LENGTH 8
+
+/* checks for '<hash>.<type><n>' and returns the offset of <n> */
+static int
+parse_hashed_name(const char *name, char type)
+{
+    for (int i = 0; i < HASH_LENGTH; i++) {
+        if (!isxdigit((unsigned char) name[i])) {
+            return -1;
+        }
+    }
+    if (name[HASH_LENGTH] != '.' || name[HASH_LENGTH + 1] != type) {
+        return -1;
+    }
+    int offset = HASH_LENGTH + 2;
+    if (name[offset] == '\0') {
+        return -1;
+    }
+    for (const char *c = &name[offset]; *c != '\0'; c++) {
+        if (!isdigit((unsigned char) *c)) {
+            return -1;
+        }
+    }
+    return offset;
+}
+
+static X509_CRL *
+read_crl(const char *file)
+{
+    BIO *bio = BIO_new_file(file, "r");
+    if (bio == NULL) {
+        fprintf(stderr, "failed to open '%s'\n", file);
+        return NULL;
+    }
+    X509_CRL *crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    if (crl == NULL) {
+        fprintf(stderr, "failed to read crl from '%s'\n", file);
+    }
+    return crl;
+}
+
+/* the issuer of the crl is found under the same hash value */
+static bool
+verify_crl(const char *cert_store_dir, const char *hash, X509_CRL *crl)
+{
+    for (int n = 0; ; n++) {
+        char file[strlen(cert_store_dir) + HASH_LENGTH + 16];
+        snprintf(file, sizeof file, "%s/%.*s.%d", cert_store_dir, HASH_LENGTH,
+            hash, n);
+        BIO *bio = BIO_new_file(file, "r");
+        if (bio == NULL) {
+            return false;
+        }
+        X509 *issuer = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        BIO_free(bio);
+        if (issuer == NULL) {
+            continue;
+        }
+        bool verified = false;
+        if (X509_NAME_cmp(X509_get_subject_name(issuer),
+            X509_CRL_get_issuer(crl)) == 0) {
+
+            EVP_PKEY *pkey = X509_get_pubkey(issuer);
+            if (pkey != NULL) {
+                verified = X509_CRL_verify(crl, pkey) == 1;
+                EVP_PKEY_free(pkey);
+            }
+        }
+        X509_free(issuer);
+        if (verified) {
+            return true;
+        }
+    }
+}
+
+static int
+compile_crl(const char *cert_store_dir, const char *name, int offset,
+    const char *crl_index_dir, bool bloom)
+{
+    char crl_file[strlen(cert_store_dir) + strlen(name) + 2];
+    snprintf(crl_file, sizeof crl_file, "%s/%s", cert_store_dir, name);
+    char index_file[strlen(crl_index_dir) + strlen(name) + 2];
+    snprintf(index_file, sizeof index_file, "%s/%.*s.i%s", crl_index_dir,
+        HASH_LENGTH, name, &name[offset]);
+
+    X509_CRL *crl = read_crl(crl_file);
+    if (crl == NULL) {
+        return KEETO_X509_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    if (!verify_crl(cert_store_dir, name, crl)) {
+        fprintf(stderr, "failed to verify crl '%s' (issuer not found or "
+            "signature invalid)\n", crl_file);
+        res = KEETO_X509_ERR;
+        goto cleanup;
+    }
+
+    res = write_crl_index(crl, bloom, index_file);
+    if (res != KEETO_OK) {
+        fprintf(stderr, "failed to write crl index '%s' (%s)\n", index_file,
+            keeto_strerror(res));
+        goto cleanup;
+    }
+    printf("%s -> %s\n", crl_file, index_file);
+
+cleanup:
+    X509_CRL_free(crl);
+    return res;
+}
+
+static int
+remove_stale_indexes(const char *cert_store_dir, const char *crl_index_dir)
+{
+    DIR *dir = opendir(crl_index_dir);
+    if (dir == NULL) {
+        fprintf(stderr, "failed to open '%s' (%s)\n", crl_index_dir,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_OK;
+    for (struct dirent *entry = readdir(dir); entry != NULL;
+        entry = readdir(dir)) {
+
+        int offset = parse_hashed_name(entry->d_name, 'i');
+        if (offset == -1) {
+            continue;
+        }
+        char crl_file[strlen(cert_store_dir) + strlen(entry->d_name) + 2];
+        snprintf(crl_file, sizeof crl_file, "%s/%.*s.r%s", cert_store_dir,
+            HASH_LENGTH, entry->d_name, &entry->d_name[offset]);
+        if (access(crl_file, F_OK) == 0) {
+            continue;
+        }
+        char index_file[strlen(crl_index_dir) + strlen(entry->d_name) + 2];
+        snprintf(index_file, sizeof index_file, "%s/%s", crl_index_dir,
+            entry->d_name);
+        if (unlink(index_file) == -1) {
+            fprintf(stderr, "failed to remove '%s' (%s)\n", index_file,
+                strerror(errno));
+            res = KEETO_SYSTEM_ERR;
+            continue;
+        }
+        printf("removed %s\n", index_file);
+    }
+    closedir(dir);
+    return res;
+}
+
+int
+main(int argc, char **argv)
+{
+    bool bloom = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        switch (opt) {
+        case 'b':
+            bloom = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b] <cert store dir> <crl index "
+                "dir>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-b] <cert store dir> <crl index dir>\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *cert_store_dir = argv[optind];
+    const char *crl_index_dir = argv[optind + 1];
+
+    int res = EXIT_FAILURE;
+
+    init_openssl();
+    DIR *dir = opendir(cert_store_dir);
+    if (dir == NULL) {
+        fprintf(stderr, "failed to open '%s' (%s)\n", cert_store_dir,
+            strerror(errno));
+        goto cleanup;
+    }
+    bool failed = false;
+    for (struct dirent *entry = readdir(dir); entry != NULL;
+        entry = readdir(dir)) {
+
+        int offset = parse_hashed_name(entry->d_name, 'r');
+        if (offset == -1) {
+            continue;
+        }
+        int rc = compile_crl(cert_store_dir, entry->d_name, offset,
+            crl_index_dir, bloom);
+        if (rc != KEETO_OK) {
+            failed = true;
+        }
+    }
+    closedir(dir);
+    int rc = remove_stale_indexes(cert_store_dir, crl_index_dir);
+    if (rc != KEETO_OK) {
+        failed = true;
+    }
+    if (!failed) {
+        res = EXIT_SUCCESS;
+    }
+
+cleanup:
+    cleanup_openssl();
+    closelog();
+    return res;
+}
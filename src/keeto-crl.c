@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-crl.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <openssl/asn1.h>
+#include <openssl/x509.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-openssl.h"
+
+#define PAD8(length) (((length) + 7) & ~((size_t) 7))
+
+int64_t
+get_time_from_asn1_time(const ASN1_TIME *asn1_time, int64_t now)
+{
+    if (asn1_time == NULL) {
+        fatal("asn1_time == NULL");
+    }
+
+    int days = 0;
+    int seconds = 0;
+    int rc = ASN1_TIME_diff(&days, &seconds, NULL, asn1_time);
+    if (rc == 0) {
+        return now;
+    }
+    return now + (int64_t) days * 86400 + seconds;
+}
+
+/*
+ * keys are the der encoding of the serial number. this allows a plain
+ * memcmp() for comparison.
+ */
+static bool
+get_crl_index_key(const ASN1_INTEGER *serial,
+    unsigned char key[KEETO_CRL_INDEX_KEY_SIZE])
+{
+    int length = i2d_ASN1_INTEGER((ASN1_INTEGER *) serial, NULL);
+    if (length <= 0 || length > KEETO_CRL_INDEX_KEY_SIZE) {
+        return false;
+    }
+    memset(key, 0, KEETO_CRL_INDEX_KEY_SIZE);
+    unsigned char *p = key;
+    i2d_ASN1_INTEGER((ASN1_INTEGER *) serial, &p);
+    return true;
+}
+
+static int
+compare_crl_index_keys(const void *a, const void *b)
+{
+    return memcmp(a, b, KEETO_CRL_INDEX_KEY_SIZE);
+}
+
+/* double hashing based on fnv-1a */
+static void
+get_bloom_hashes(const unsigned char *key, uint64_t *h1, uint64_t *h2)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < KEETO_CRL_INDEX_KEY_SIZE; i++) {
+        hash = (hash ^ key[i]) * 1099511628211ULL;
+    }
+    *h1 = hash & 0xffffffff;
+    *h2 = (hash >> 32) | 1;
+}
+
+static void
+add_to_bloom(uint64_t *bloom, uint32_t words, const unsigned char *key)
+{
+    uint64_t h1, h2;
+    get_bloom_hashes(key, &h1, &h2);
+    uint64_t bits = (uint64_t) words * 64;
+    for (int i = 0; i < KEETO_CRL_INDEX_BLOOM_HASHES; i++) {
+        uint64_t bit = (h1 + i * h2) % bits;
+        bloom[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
+
+static bool
+check_bloom(const uint64_t *bloom, uint32_t words, const unsigned char *key)
+{
+    uint64_t h1, h2;
+    get_bloom_hashes(key, &h1, &h2);
+    uint64_t bits = (uint64_t) words * 64;
+    for (int i = 0; i < KEETO_CRL_INDEX_BLOOM_HASHES; i++) {
+        uint64_t bit = (h1 + i * h2) % bits;
+        if ((bloom[bit / 64] & ((uint64_t) 1 << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int
+write_crl_index_file(const char *index_file,
+    struct keeto_crl_index_header *header, unsigned char *issuer,
+    uint64_t *bloom_filter, unsigned char *keys)
+{
+    char tmp_file[strlen(index_file) + 8];
+    snprintf(tmp_file, sizeof tmp_file, "%s.XXXXXX", index_file);
+    int fd = mkstemp(tmp_file);
+    if (fd == -1) {
+        log_error("failed to create crl index file '%s' (%s)", tmp_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    FILE *file = fdopen(fd, "w");
+    if (file == NULL) {
+        log_error("failed to open crl index file '%s' (%s)", tmp_file,
+            strerror(errno));
+        close(fd);
+        unlink(tmp_file);
+        return KEETO_SYSTEM_ERR;
+    }
+    unsigned char padding[8] = { 0 };
+    size_t padding_length = PAD8((size_t) header->issuer_length) -
+        header->issuer_length;
+    bool written = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 &&
+        fwrite(header, sizeof *header, 1, file) == 1 &&
+        fwrite(issuer, header->issuer_length, 1, file) == 1 &&
+        (padding_length == 0 ||
+        fwrite(padding, padding_length, 1, file) == 1) &&
+        (header->bloom_words == 0 || fwrite(bloom_filter, sizeof (uint64_t),
+        header->bloom_words, file) == header->bloom_words) &&
+        (header->count == 0 || fwrite(keys, KEETO_CRL_INDEX_KEY_SIZE,
+        header->count, file) == header->count);
+    if (fclose(file) != 0) {
+        written = false;
+    }
+    if (!written || rename(tmp_file, index_file) == -1) {
+        log_error("failed to write crl index file '%s' (%s)", index_file,
+            strerror(errno));
+        unlink(tmp_file);
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * the crl has to be verified by the caller. the index file is written
+ * to a temporary file first and renamed afterwards so that readers
+ * either see the old or the new index.
+ */
+int
+write_crl_index(X509_CRL *crl, bool bloom, const char *index_file)
+{
+    if (crl == NULL || index_file == NULL) {
+        fatal("crl or index_file == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    struct keeto_crl_index_header header;
+    memset(&header, 0, sizeof header);
+    header.magic = KEETO_CRL_INDEX_MAGIC;
+    header.version = KEETO_CRL_INDEX_VERSION;
+    int64_t now = time(NULL);
+    header.this_update = get_time_from_asn1_time(
+        X509_CRL_get0_lastUpdate(crl), now);
+    header.next_update = INT64_MAX;
+    const ASN1_TIME *next_update = X509_CRL_get0_nextUpdate(crl);
+    if (next_update != NULL) {
+        header.next_update = get_time_from_asn1_time(next_update, now);
+    }
+
+    unsigned char *issuer = NULL;
+    int issuer_length = i2d_X509_NAME(X509_CRL_get_issuer(crl), &issuer);
+    if (issuer_length <= 0) {
+        log_error("failed to der encode crl issuer");
+        return KEETO_OPENSSL_ERR;
+    }
+    header.issuer_length = issuer_length;
+
+    /* collect and sort keys of revoked serial numbers */
+    STACK_OF(X509_REVOKED) *revoked = X509_CRL_get_REVOKED(crl);
+    int revoked_count = revoked == NULL ? 0 : sk_X509_REVOKED_num(revoked);
+    unsigned char *keys = calloc(revoked_count + 1, KEETO_CRL_INDEX_KEY_SIZE);
+    if (keys == NULL) {
+        log_error("failed to allocate memory for crl index keys");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    for (int i = 0; i < revoked_count; i++) {
+        const ASN1_INTEGER *serial = X509_REVOKED_get0_serialNumber(
+            sk_X509_REVOKED_value(revoked, i));
+        if (!get_crl_index_key(serial, &keys[header.count *
+            KEETO_CRL_INDEX_KEY_SIZE])) {
+
+            log_error("failed to encode revoked serial number");
+            res = KEETO_X509_ERR;
+            goto cleanup_b;
+        }
+        header.count++;
+    }
+    qsort(keys, header.count, KEETO_CRL_INDEX_KEY_SIZE,
+        &compare_crl_index_keys);
+    uint64_t unique = 0;
+    for (uint64_t i = 0; i < header.count; i++) {
+        if (unique > 0 && memcmp(&keys[(unique - 1) *
+            KEETO_CRL_INDEX_KEY_SIZE], &keys[i * KEETO_CRL_INDEX_KEY_SIZE],
+            KEETO_CRL_INDEX_KEY_SIZE) == 0) {
+
+            continue;
+        }
+        memmove(&keys[unique * KEETO_CRL_INDEX_KEY_SIZE],
+            &keys[i * KEETO_CRL_INDEX_KEY_SIZE], KEETO_CRL_INDEX_KEY_SIZE);
+        unique++;
+    }
+    header.count = unique;
+
+    uint64_t *bloom_filter = NULL;
+    if (bloom) {
+        header.bloom_words = header.count *
+            KEETO_CRL_INDEX_BLOOM_BITS_PER_ENTRY / 64 + 1;
+        bloom_filter = calloc(header.bloom_words, sizeof (uint64_t));
+        if (bloom_filter == NULL) {
+            log_error("failed to allocate memory for bloom filter");
+            res = KEETO_NO_MEMORY;
+            goto cleanup_b;
+        }
+        for (uint64_t i = 0; i < header.count; i++) {
+            add_to_bloom(bloom_filter, header.bloom_words,
+                &keys[i * KEETO_CRL_INDEX_KEY_SIZE]);
+        }
+    }
+
+    res = write_crl_index_file(index_file, &header, issuer, bloom_filter,
+        keys);
+    free(bloom_filter);
+
+cleanup_b:
+    free(keys);
+cleanup_a:
+    OPENSSL_free(issuer);
+    return res;
+}
+
+int
+open_crl_index(const char *index_file, struct keeto_crl_index **ret)
+{
+    if (index_file == NULL || ret == NULL) {
+        fatal("index_file or ret == NULL");
+    }
+
+    int fd = open(index_file, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return KEETO_NO_SUCH_VALUE;
+        }
+        log_error("failed to open crl index file '%s' (%s)", index_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* the index decides about revocation - only trust our own files */
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat crl index file '%s' (%s)", index_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    if (!S_ISREG(stat_buffer.st_mode) || stat_buffer.st_uid != geteuid() ||
+        (stat_buffer.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        log_error("refusing to use crl index file '%s' (insecure file)",
+            index_file);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    size_t size = stat_buffer.st_size;
+    if (size < sizeof (struct keeto_crl_index_header)) {
+        log_error("crl index file '%s' truncated", index_file);
+        res = KEETO_X509_ERR;
+        goto cleanup_a;
+    }
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("failed to map crl index file '%s' (%s)", index_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+
+    const struct keeto_crl_index_header *header =
+        (const struct keeto_crl_index_header *) data;
+    size_t available = size - sizeof *header;
+    size_t issuer_size = PAD8((size_t) header->issuer_length);
+    size_t bloom_size = (size_t) header->bloom_words * sizeof (uint64_t);
+    if (header->magic != KEETO_CRL_INDEX_MAGIC ||
+        header->version != KEETO_CRL_INDEX_VERSION ||
+        issuer_size > available || bloom_size > available - issuer_size ||
+        header->count != (available - issuer_size - bloom_size) /
+        KEETO_CRL_INDEX_KEY_SIZE) {
+
+        log_error("crl index file '%s' corrupt", index_file);
+        res = KEETO_X509_ERR;
+        goto cleanup_b;
+    }
+
+    struct keeto_crl_index *index = malloc(sizeof *index);
+    if (index == NULL) {
+        log_error("failed to allocate memory for crl index buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_b;
+    }
+    index->data = data;
+    index->size = size;
+    index->header = header;
+    index->issuer = data + sizeof *header;
+    index->bloom = (const uint64_t *) (index->issuer + issuer_size);
+    index->keys = index->issuer + issuer_size + bloom_size;
+    *ret = index;
+    close(fd);
+    return KEETO_OK;
+
+cleanup_b:
+    munmap(data, size);
+cleanup_a:
+    close(fd);
+    return res;
+}
+
+void
+close_crl_index(struct keeto_crl_index *index)
+{
+    if (index == NULL) {
+        return;
+    }
+    munmap(index->data, index->size);
+    free(index);
+}
+
+bool
+crl_index_matches_issuer(struct keeto_crl_index *index, X509_NAME *issuer)
+{
+    if (index == NULL || issuer == NULL) {
+        fatal("index or issuer == NULL");
+    }
+
+    unsigned char *der = NULL;
+    int length = i2d_X509_NAME(issuer, &der);
+    if (length <= 0) {
+        return false;
+    }
+    bool match = (uint32_t) length == index->header->issuer_length &&
+        memcmp(der, index->issuer, length) == 0;
+    OPENSSL_free(der);
+    return match;
+}
+
+/*
+ * serial numbers are looked up by a binary search over the sorted keys
+ * - O(log n) in the number of revoked certificates. the bloom filter
+ * (if present) answers most lookups of serials that are not revoked
+ * without touching the keys.
+ */
+int
+lookup_crl_index(struct keeto_crl_index *index, ASN1_INTEGER *serial,
+    bool *revoked)
+{
+    if (index == NULL || serial == NULL || revoked == NULL) {
+        fatal("index, serial or revoked == NULL");
+    }
+
+    /*
+     * serial numbers that do not fit into a key cannot be looked up.
+     * the revocation status is unknown in that case.
+     */
+    unsigned char key[KEETO_CRL_INDEX_KEY_SIZE];
+    if (!get_crl_index_key(serial, key)) {
+        log_error("failed to encode serial number for crl index lookup");
+        return KEETO_X509_ERR;
+    }
+    if (index->header->bloom_words > 0 && !check_bloom(index->bloom,
+        index->header->bloom_words, key)) {
+
+        *revoked = false;
+        return KEETO_OK;
+    }
+    *revoked = bsearch(key, index->keys, index->header->count,
+        KEETO_CRL_INDEX_KEY_SIZE, &compare_crl_index_keys) != NULL;
+    return KEETO_OK;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_CRL_H
+#define KEETO_CRL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/asn1.h>
+#include <openssl/x509.h>
+
+#define KEETO_CRL_INDEX_MAGIC 0x4b544f49 /* KTOI */
+#define KEETO_CRL_INDEX_VERSION 1
+/* der encoded serial numbers (up to 20 octets) padded with zeros */
+#define KEETO_CRL_INDEX_KEY_SIZE 24
+#define KEETO_CRL_INDEX_BLOOM_HASHES 4
+#define KEETO_CRL_INDEX_BLOOM_BITS_PER_ENTRY 10
+
+/*
+ * layout of a crl index file: header, der encoded issuer (padded to a
+ * multiple of 8), bloom filter and the sorted keys of all revoked
+ * serial numbers.
+ */
+struct keeto_crl_index_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t this_update;
+    /* INT64_MAX if the crl does not specify a next update */
+    int64_t next_update;
+    uint64_t count;
+    uint32_t bloom_words;
+    uint32_t issuer_length;
+};
+
+struct keeto_crl_index {
+    unsigned char *data;
+    size_t size;
+    const struct keeto_crl_index_header *header;
+    const unsigned char *issuer;
+    const uint64_t *bloom;
+    const unsigned char *keys;
+};
+
+int64_t get_time_from_asn1_time(const ASN1_TIME *asn1_time, int64_t now);
+int write_crl_index(X509_CRL *crl, bool bloom, const char *index_file);
+int open_crl_index(const char *index_file, struct keeto_crl_index **ret);
+void close_crl_index(struct keeto_crl_index *index);
+bool crl_index_matches_issuer(struct keeto_crl_index *index, X509_NAME *issuer);
+int lookup_crl_index(struct keeto_crl_index *index, ASN1_INTEGER *serial,
+    bool *revoked);
+
+#endif /* KEETO_CRL_H */
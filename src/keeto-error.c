@@ -76,6 +76,10 @@ keeto_strerror(int errnum)
         return "unknown digest algo";
     case KEETO_NO_SSH_SERVER:
         return "no ssh server found";
+    case KEETO_IPC_ERR:
+        return "ipc error";
+    case KEETO_NO_CACHE_ENTRY:
+        return "no cache entry";
 
     case KEETO_UNKNOWN_ERR:
         return "unknown error";
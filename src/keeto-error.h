@@ -50,6 +50,8 @@ enum {
     KEETO_UNSUPPORTED_KEY_TYPE,
     KEETO_UNKNOWN_DIGEST_ALGO,
     KEETO_NO_SSH_SERVER,
+    KEETO_IPC_ERR,
+    KEETO_NO_CACHE_ENTRY,
 
     KEETO_UNKNOWN_ERR
 };
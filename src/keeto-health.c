@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-health.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-util.h"
+
+/*
+ * every failure adds a penalty to the score of a server. the penalty
+ * is halved for every decay interval without a new failure so that a
+ * server recovers after some time.
+ */
+#define FAILURE_PENALTY 2000
+#define FAILURE_DECAY_INTERVAL 60
+/* weight of a new latency sample is 1 / EWMA_WEIGHT */
+#define EWMA_WEIGHT 8
+
+static int
+init_health_file(int fd, void *map, bool resized)
+{
+    struct keeto_health_table *table = map;
+    if (resized || table->magic != KEETO_HEALTH_MAGIC ||
+        table->version != KEETO_HEALTH_VERSION) {
+
+        memset(table, 0, sizeof *table);
+        table->magic = KEETO_HEALTH_MAGIC;
+        table->version = KEETO_HEALTH_VERSION;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * the health file is shared between processes by mapping it into
+ * memory. it only contains hints for ordering ldap servers so it is
+ * fine if a concurrent update gets lost.
+ */
+int
+open_health(const char *health_file, struct keeto_health **ret)
+{
+    if (health_file == NULL || ret == NULL) {
+        fatal("health_file or ret == NULL");
+    }
+
+    /* only trust files that cannot be altered by others */
+    int fd = -1;
+    void *map = NULL;
+    int rc = map_shared_file(health_file, "health",
+        sizeof (struct keeto_health_table), S_IWGRP | S_IWOTH,
+        &init_health_file, &fd, &map);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    struct keeto_health *health = malloc(sizeof *health);
+    if (health == NULL) {
+        log_error("failed to allocate memory for health buffer");
+        munmap(map, sizeof (struct keeto_health_table));
+        close(fd);
+        return KEETO_NO_MEMORY;
+    }
+    health->fd = fd;
+    health->table = map;
+    *ret = health;
+    return KEETO_OK;
+}
+
+void
+close_health(struct keeto_health *health)
+{
+    if (health == NULL) {
+        return;
+    }
+    munmap(health->table, sizeof (struct keeto_health_table));
+    close(health->fd);
+    free(health);
+}
+
+static struct keeto_health_server *
+get_health_server(struct keeto_health *health, const char *uri, bool create)
+{
+    struct keeto_health_table *table = health->table;
+    if (strlen(uri) >= KEETO_HEALTH_URI_SIZE) {
+        return NULL;
+    }
+
+    struct keeto_health_server *oldest = &table->servers[0];
+    for (int i = 0; i < KEETO_HEALTH_MAX_SERVERS; i++) {
+        struct keeto_health_server *server = &table->servers[i];
+        if (strncmp(server->uri, uri, KEETO_HEALTH_URI_SIZE) == 0) {
+            return server;
+        }
+        if (server->last_used < oldest->last_used) {
+            oldest = server;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    /* replace the server that has not been used for the longest time */
+    memset(oldest, 0, sizeof *oldest);
+    strcpy(oldest->uri, uri);
+    return oldest;
+}
+
+/*
+ * lower scores are better. servers without any history get a score of
+ * 0 so that they are tried before servers known to be slow.
+ */
+unsigned long
+get_health_score(struct keeto_health *health, const char *uri)
+{
+    if (health == NULL || uri == NULL) {
+        fatal("health or uri == NULL");
+    }
+
+    struct keeto_health_server *server = get_health_server(health, uri, false);
+    if (server == NULL) {
+        return 0;
+    }
+
+    unsigned long failures = server->failures;
+    time_t elapsed = time(NULL) - (time_t) server->last_failure;
+    for (time_t t = FAILURE_DECAY_INTERVAL; t <= elapsed && failures > 0;
+        t += FAILURE_DECAY_INTERVAL) {
+        failures /= 2;
+    }
+    return server->latency + failures * FAILURE_PENALTY;
+}
+
+void
+record_health_success(struct keeto_health *health, const char *uri,
+    unsigned long latency)
+{
+    if (health == NULL || uri == NULL) {
+        fatal("health or uri == NULL");
+    }
+
+    flock(health->fd, LOCK_EX);
+    struct keeto_health_server *server = get_health_server(health, uri, true);
+    if (server != NULL) {
+        if (server->latency == 0) {
+            server->latency = latency;
+        } else {
+            server->latency = (server->latency * (EWMA_WEIGHT - 1) + latency) /
+                EWMA_WEIGHT;
+        }
+        server->failures /= 2;
+        server->last_used = time(NULL);
+    }
+    flock(health->fd, LOCK_UN);
+}
+
+void
+record_health_failure(struct keeto_health *health, const char *uri)
+{
+    if (health == NULL || uri == NULL) {
+        fatal("health or uri == NULL");
+    }
+
+    flock(health->fd, LOCK_EX);
+    struct keeto_health_server *server = get_health_server(health, uri, true);
+    if (server != NULL) {
+        server->failures++;
+        server->last_failure = time(NULL);
+        server->last_used = server->last_failure;
+    }
+    flock(health->fd, LOCK_UN);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_HEALTH_H
+#define KEETO_HEALTH_H
+
+#include <stdint.h>
+
+#define KEETO_HEALTH_MAGIC 0x4b544f48 /* KTOH */
+#define KEETO_HEALTH_VERSION 1
+#define KEETO_HEALTH_MAX_SERVERS 16
+#define KEETO_HEALTH_URI_SIZE 256
+
+/* health of a single ldap server */
+struct keeto_health_server {
+    char uri[KEETO_HEALTH_URI_SIZE];
+    /* exponentially weighted moving average of connect latency (ms) */
+    uint32_t latency;
+    uint32_t failures;
+    int64_t last_used;
+    int64_t last_failure;
+};
+
+/* layout of the health file shared by all processes */
+struct keeto_health_table {
+    uint32_t magic;
+    uint32_t version;
+    struct keeto_health_server servers[KEETO_HEALTH_MAX_SERVERS];
+};
+
+struct keeto_health {
+    int fd;
+    struct keeto_health_table *table;
+};
+
+int open_health(const char *health_file, struct keeto_health **ret);
+void close_health(struct keeto_health *health);
+unsigned long get_health_score(struct keeto_health *health, const char *uri);
+void record_health_success(struct keeto_health *health, const char *uri,
+    unsigned long latency);
+void record_health_failure(struct keeto_health *health, const char *uri);
+
+#endif /* KEETO_HEALTH_H */
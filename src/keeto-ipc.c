@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-ipc.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-util.h"
+
+/*
+ * keetod protocol
+ *
+ * every message starts with a header consisting of the protocol
+ * version and the length of the payload that follows. integers are
+ * transmitted in network byte order.
+ *
+ * request payload:
+ *   uid (NUL terminated)
+ *
+ * response payload:
+ *   result (keeto error code)
+ *   ldap online flag
+ *   number of keystore records
+ *   keystore records
+ *
+ * every keystore record consists of KEETOD_RECORD_FIELDS fields. each
+ * field is a presence byte optionally followed by a NUL terminated
+ * string. this allows the receiver to point directly into the payload
+ * buffer.
+ */
+#define KEETOD_HEADER_SIZE (2 * sizeof (uint32_t))
+#define KEETOD_RECORD_FIELDS 8
+
+static int
+write_all(int fd, const void *buffer, size_t length)
+{
+    const char *ptr = buffer;
+    while (length > 0) {
+        ssize_t written = write(fd, ptr, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("failed to write to socket (%s)", strerror(errno));
+            return KEETO_IPC_ERR;
+        }
+        ptr += written;
+        length -= written;
+    }
+    return KEETO_OK;
+}
+
+static int
+read_all(int fd, void *buffer, size_t length)
+{
+    char *ptr = buffer;
+    while (length > 0) {
+        ssize_t bytes_read = read(fd, ptr, length);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("failed to read from socket (%s)", strerror(errno));
+            return KEETO_IPC_ERR;
+        }
+        if (bytes_read == 0) {
+            log_error("failed to read from socket (connection closed)");
+            return KEETO_IPC_ERR;
+        }
+        ptr += bytes_read;
+        length -= bytes_read;
+    }
+    return KEETO_OK;
+}
+
+void
+put_uint32(unsigned char *buffer, uint32_t value)
+{
+    uint32_t value_n = htonl(value);
+    memcpy(buffer, &value_n, sizeof value_n);
+}
+
+uint32_t
+get_uint32(const unsigned char *buffer)
+{
+    uint32_t value_n = 0;
+    memcpy(&value_n, buffer, sizeof value_n);
+    return ntohl(value_n);
+}
+
+static int
+send_message(int fd, unsigned char *payload, size_t payload_length)
+{
+    if (payload == NULL) {
+        fatal("payload == NULL");
+    }
+
+    if (payload_length > KEETOD_MAX_MESSAGE_SIZE) {
+        log_error("failed to send message (payload too large)");
+        return KEETO_IPC_ERR;
+    }
+
+    unsigned char header[KEETOD_HEADER_SIZE];
+    put_uint32(header, KEETOD_PROTOCOL_VERSION);
+    put_uint32(header + sizeof (uint32_t), payload_length);
+    int rc = write_all(fd, header, sizeof header);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    return write_all(fd, payload, payload_length);
+}
+
+static int
+receive_message(int fd, size_t max_length, unsigned char **ret,
+    size_t *ret_length)
+{
+    if (ret == NULL || ret_length == NULL) {
+        fatal("ret or ret_length == NULL");
+    }
+
+    unsigned char header[KEETOD_HEADER_SIZE];
+    int rc = read_all(fd, header, sizeof header);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    uint32_t version = get_uint32(header);
+    if (version != KEETOD_PROTOCOL_VERSION) {
+        log_error("failed to receive message (unsupported protocol version "
+            "%u)", version);
+        return KEETO_IPC_ERR;
+    }
+    uint32_t payload_length = get_uint32(header + sizeof (uint32_t));
+    if (payload_length == 0 || payload_length > max_length) {
+        log_error("failed to receive message (invalid payload length %u)",
+            payload_length);
+        return KEETO_IPC_ERR;
+    }
+
+    unsigned char *payload = malloc(payload_length);
+    if (payload == NULL) {
+        log_error("failed to allocate memory for message buffer");
+        return KEETO_NO_MEMORY;
+    }
+    rc = read_all(fd, payload, payload_length);
+    if (rc != KEETO_OK) {
+        free(payload);
+        return rc;
+    }
+    *ret = payload;
+    *ret_length = payload_length;
+    return KEETO_OK;
+}
+
+size_t
+get_field_size(const char *field)
+{
+    return field == NULL ? 1 : strlen(field) + 2;
+}
+
+unsigned char *
+put_field(unsigned char *buffer, const char *field)
+{
+    if (field == NULL) {
+        *buffer++ = 0;
+        return buffer;
+    }
+    *buffer++ = 1;
+    size_t field_size = strlen(field) + 1;
+    memcpy(buffer, field, field_size);
+    return buffer + field_size;
+}
+
+int
+get_field(unsigned char **buffer, unsigned char *end, char **ret)
+{
+    if (buffer == NULL || end == NULL || ret == NULL) {
+        fatal("buffer, end or ret == NULL");
+    }
+
+    unsigned char *ptr = *buffer;
+    if (ptr >= end) {
+        return KEETO_IPC_ERR;
+    }
+    if (*ptr == 0) {
+        *ret = NULL;
+        *buffer = ptr + 1;
+        return KEETO_OK;
+    }
+    ptr++;
+    unsigned char *field_end = memchr(ptr, '\0', end - ptr);
+    if (field_end == NULL) {
+        return KEETO_IPC_ERR;
+    }
+    *ret = (char *) ptr;
+    *buffer = field_end + 1;
+    return KEETO_OK;
+}
+
+size_t
+get_keystore_records_size(struct keeto_keystore_records *keystore_records)
+{
+    size_t size = sizeof (uint32_t);
+    if (keystore_records == NULL) {
+        return size;
+    }
+
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        size += get_keystore_record_size(keystore_record);
+    }
+    return size;
+}
+
+/*
+ * buffer must be at least get_keystore_records_size() bytes large.
+ * returns a pointer to the first byte after the keystore records.
+ */
+unsigned char *
+put_keystore_records(unsigned char *buffer,
+    struct keeto_keystore_records *keystore_records)
+{
+    if (buffer == NULL) {
+        fatal("buffer == NULL");
+    }
+
+    uint32_t record_count = 0;
+    unsigned char *ptr = buffer + sizeof (uint32_t);
+    struct keeto_keystore_record *keystore_record = NULL;
+    if (keystore_records != NULL) {
+        SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+            ptr = put_field(ptr, keystore_record->uid);
+            ptr = put_field(ptr, keystore_record->ssh_keytype);
+            ptr = put_field(ptr, keystore_record->ssh_key);
+            ptr = put_field(ptr, keystore_record->ssh_key_fp_md5);
+            ptr = put_field(ptr, keystore_record->ssh_key_fp_sha256);
+            ptr = put_field(ptr, keystore_record->command_option);
+            ptr = put_field(ptr, keystore_record->from_option);
+            ptr = put_field(ptr, keystore_record->expiry_time_option);
+            record_count++;
+        }
+    }
+    put_uint32(buffer, record_count);
+    return ptr;
+}
+
+/*
+ * the returned keystore records point into buffer. in case there are
+ * no records ret is set to NULL.
+ */
+int
+get_keystore_records(unsigned char **buffer, unsigned char *end,
+    struct keeto_keystore_records **ret)
+{
+    if (buffer == NULL || end == NULL || ret == NULL) {
+        fatal("buffer, end or ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    unsigned char *ptr = *buffer;
+    if (end - ptr < (ptrdiff_t) sizeof (uint32_t)) {
+        return KEETO_IPC_ERR;
+    }
+    uint32_t record_count = get_uint32(ptr);
+    ptr += sizeof (uint32_t);
+    if (record_count == 0) {
+        *buffer = ptr;
+        *ret = NULL;
+        return KEETO_OK;
+    }
+
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    if (keystore_records == NULL) {
+        log_error("failed to allocate memory for keystore records buffer");
+        return KEETO_NO_MEMORY;
+    }
+    for (uint32_t i = 0; i < record_count; i++) {
+        struct keeto_keystore_record *keystore_record = new_keystore_record();
+        if (keystore_record == NULL) {
+            log_error("failed to allocate memory for keystore record buffer");
+            res = KEETO_NO_MEMORY;
+            goto cleanup;
+        }
+        SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+
+        char **fields[KEETOD_RECORD_FIELDS] = {
+            &keystore_record->uid,
+            &keystore_record->ssh_keytype,
+            &keystore_record->ssh_key,
+            &keystore_record->ssh_key_fp_md5,
+            &keystore_record->ssh_key_fp_sha256,
+            &keystore_record->command_option,
+            &keystore_record->from_option,
+            &keystore_record->expiry_time_option
+        };
+        for (int j = 0; j < KEETOD_RECORD_FIELDS; j++) {
+            int rc = get_field(&ptr, end, fields[j]);
+            if (rc != KEETO_OK) {
+                log_error("failed to parse keystore record (malformed field)");
+                res = rc;
+                goto cleanup;
+            }
+        }
+        if (keystore_record->uid == NULL || keystore_record->ssh_keytype == NULL ||
+            keystore_record->ssh_key == NULL) {
+            log_error("failed to parse keystore record (incomplete record)");
+            res = KEETO_IPC_ERR;
+            goto cleanup;
+        }
+    }
+    *buffer = ptr;
+    *ret = keystore_records;
+    keystore_records = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    if (keystore_records != NULL) {
+        free_keystore_records(keystore_records);
+    }
+    return res;
+}
+
+int
+connect_to_keetod(const char *socket_path, int timeout, int *ret)
+{
+    if (socket_path == NULL || ret == NULL) {
+        fatal("socket_path or ret == NULL");
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof addr.sun_path) {
+        log_error("failed to connect to keetod (socket path too long)");
+        return KEETO_IPC_ERR;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        log_error("failed to create socket (%s)", strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    /* do not block the login forever if keetod hangs */
+    struct timeval tv = {
+        .tv_sec = timeout,
+        .tv_usec = 0
+    };
+    int rc = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    if (rc == 0) {
+        rc = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    }
+    if (rc == -1) {
+        log_error("failed to set socket timeout (%s)", strerror(errno));
+        close(fd);
+        return KEETO_SYSTEM_ERR;
+    }
+    rc = connect(fd, (struct sockaddr *) &addr, sizeof addr);
+    if (rc == -1) {
+        log_error("failed to connect to keetod '%s' (%s)", socket_path,
+            strerror(errno));
+        close(fd);
+        return KEETO_IPC_ERR;
+    }
+    *ret = fd;
+    return KEETO_OK;
+}
+
+int
+send_keetod_request(int fd, const char *uid)
+{
+    if (uid == NULL) {
+        fatal("uid == NULL");
+    }
+
+    size_t payload_length = strlen(uid) + 1;
+    if (payload_length > KEETOD_MAX_REQUEST_SIZE) {
+        log_error("failed to send request (uid too long)");
+        return KEETO_IPC_ERR;
+    }
+    return send_message(fd, (unsigned char *) uid, payload_length);
+}
+
+int
+receive_keetod_request(int fd, char **ret)
+{
+    if (ret == NULL) {
+        fatal("ret == NULL");
+    }
+
+    unsigned char *payload = NULL;
+    size_t payload_length = 0;
+    int rc = receive_message(fd, KEETOD_MAX_REQUEST_SIZE, &payload,
+        &payload_length);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    if (payload[payload_length - 1] != '\0' ||
+        strlen((char *) payload) != payload_length - 1) {
+        log_error("failed to receive request (malformed uid)");
+        free(payload);
+        return KEETO_IPC_ERR;
+    }
+    *ret = (char *) payload;
+    return KEETO_OK;
+}
+
+int
+send_keetod_response(int fd, int result, char ldap_online,
+    struct keeto_keystore_records *keystore_records)
+{
+    size_t payload_length = 2 * sizeof (uint32_t) +
+        get_keystore_records_size(keystore_records);
+    unsigned char *payload = malloc(payload_length);
+    if (payload == NULL) {
+        log_error("failed to allocate memory for response buffer");
+        return KEETO_NO_MEMORY;
+    }
+    put_uint32(payload, (uint32_t) result);
+    put_uint32(payload + sizeof (uint32_t), (uint32_t) ldap_online);
+    put_keystore_records(payload + 2 * sizeof (uint32_t), keystore_records);
+
+    int rc = send_message(fd, payload, payload_length);
+    free(payload);
+    return rc;
+}
+
+/*
+ * the keystore records added to info point directly into the payload
+ * buffer which is handed over to info as well.
+ */
+int
+receive_keetod_response(int fd, struct keeto_info *info, int *result)
+{
+    if (info == NULL || result == NULL) {
+        fatal("info or result == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    unsigned char *payload = NULL;
+    size_t payload_length = 0;
+    int rc = receive_message(fd, KEETOD_MAX_MESSAGE_SIZE, &payload,
+        &payload_length);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    if (payload_length < 2 * sizeof (uint32_t)) {
+        log_error("failed to receive response (payload too short)");
+        res = KEETO_IPC_ERR;
+        goto cleanup_a;
+    }
+    int result_tmp = (int32_t) get_uint32(payload);
+    char ldap_online = get_uint32(payload + sizeof (uint32_t));
+
+    unsigned char *ptr = payload + 2 * sizeof (uint32_t);
+    unsigned char *end = payload + payload_length;
+    struct keeto_keystore_records *keystore_records = NULL;
+    rc = get_keystore_records(&ptr, end, &keystore_records);
+    if (rc != KEETO_OK) {
+        log_error("failed to receive response (%s)", keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
+    }
+    if (ptr != end) {
+        log_error("failed to receive response (trailing data)");
+        res = KEETO_IPC_ERR;
+        goto cleanup_b;
+    }
+
+    *result = result_tmp;
+    info->ldap_online = ldap_online;
+    info->keystore_records = keystore_records;
+    keystore_records = NULL;
+    info->keystore_records_buffer = (char *) payload;
+    payload = NULL;
+    res = KEETO_OK;
+
+cleanup_b:
+    if (keystore_records != NULL) {
+        free_keystore_records(keystore_records);
+    }
+cleanup_a:
+    free(payload);
+    return res;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_IPC_H
+#define KEETO_IPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "keeto-util.h"
+
+#define KEETOD_PROTOCOL_VERSION 2
+/* a request only holds a uid */
+#define KEETOD_MAX_REQUEST_SIZE 4096
+/* a response holds up to all keystore records a uid can have */
+#define KEETOD_MAX_MESSAGE_SIZE (3 * sizeof (uint32_t) + \
+    (size_t) KEETO_KEYSTORE_MAX_RECORDS * KEETO_KEYSTORE_MAX_RECORD_SIZE)
+
+void put_uint32(unsigned char *buffer, uint32_t value);
+uint32_t get_uint32(const unsigned char *buffer);
+size_t get_field_size(const char *field);
+unsigned char *put_field(unsigned char *buffer, const char *field);
+int get_field(unsigned char **buffer, unsigned char *end, char **ret);
+size_t get_keystore_records_size(
+    struct keeto_keystore_records *keystore_records);
+unsigned char *put_keystore_records(unsigned char *buffer,
+    struct keeto_keystore_records *keystore_records);
+int get_keystore_records(unsigned char **buffer, unsigned char *end,
+    struct keeto_keystore_records **ret);
+int connect_to_keetod(const char *socket_path, int timeout, int *ret);
+int send_keetod_request(int fd, const char *uid);
+int receive_keetod_request(int fd, char **ret);
+int send_keetod_response(int fd, int result, char ldap_online,
+    struct keeto_keystore_records *keystore_records);
+int receive_keetod_response(int fd, struct keeto_info *info, int *result);
+
+#endif /* KEETO_IPC_H */
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-kcache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-util.h"
+
+#define KEETO_KCACHE_FIELDS 4
+
+static uint64_t
+get_kcache_checksum(const unsigned char *digest, const unsigned char *payload,
+    size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < KEETO_KCACHE_DIGEST_SIZE; i++) {
+        hash = (hash ^ digest[i]) * 0x100000001b3ULL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ payload[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* the digest is uniformly distributed - use its prefix as hash */
+static size_t
+get_kcache_slot(const unsigned char *digest)
+{
+    uint32_t hash;
+    memcpy(&hash, digest, sizeof hash);
+    return hash & (KEETO_KCACHE_SLOTS - 1);
+}
+
+/*
+ * probe the index for the record of digest. if there is none 0 is
+ * returned and slot is set to the free slot ending the probe (or to
+ * KEETO_KCACHE_SLOTS if the index is full). records are not aligned
+ * within data.
+ */
+static uint32_t
+find_kcache_record(struct keeto_kcache_table *table,
+    const unsigned char *digest, size_t *slot,
+    struct keeto_kcache_record *ret)
+{
+    size_t probe = get_kcache_slot(digest);
+    for (size_t i = 0; i < KEETO_KCACHE_SLOTS; i++) {
+        uint32_t position = __atomic_load_n(&table->index[probe],
+            __ATOMIC_ACQUIRE);
+        if (position == 0) {
+            *slot = probe;
+            return 0;
+        }
+        if (position - 1 <= KEETO_KCACHE_MAX_SIZE - sizeof *ret) {
+            memcpy(ret, table->data + position - 1, sizeof *ret);
+            if (memcmp(ret->digest, digest, KEETO_KCACHE_DIGEST_SIZE) == 0) {
+                *slot = probe;
+                return position;
+            }
+        }
+        probe = (probe + 1) & (KEETO_KCACHE_SLOTS - 1);
+    }
+    *slot = KEETO_KCACHE_SLOTS;
+    return 0;
+}
+
+/* a payload consists of exactly KEETO_KCACHE_FIELDS strings */
+static bool
+is_valid_kcache_payload(const unsigned char *payload, size_t length)
+{
+    if (length == 0 || payload[length - 1] != '\0') {
+        return false;
+    }
+    int fields = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (payload[i] == '\0') {
+            fields++;
+        }
+    }
+    return fields == KEETO_KCACHE_FIELDS;
+}
+
+/* records torn by a crash fail the check */
+static bool
+is_valid_kcache_record(struct keeto_kcache_record *record,
+    const unsigned char *payload)
+{
+    return record->checksum == get_kcache_checksum(record->digest, payload,
+        record->length) && is_valid_kcache_payload(payload, record->length);
+}
+
+static int
+init_kcache_file(int fd, void *map, bool resized)
+{
+    struct keeto_kcache_table *table = map;
+    if (!resized && table->magic == KEETO_KCACHE_MAGIC &&
+        table->version == KEETO_KCACHE_VERSION) {
+        return KEETO_OK;
+    }
+
+    if (ftruncate(fd, 0) == -1 ||
+        ftruncate(fd, sizeof (struct keeto_kcache_table)) == -1) {
+        return KEETO_SYSTEM_ERR;
+    }
+    /*
+     * records are written with pwrite() so that a full disk is reported
+     * instead of faulting on the mapping. only header and index are
+     * written through the mapping and therefore allocated upfront.
+     */
+    int rc = posix_fallocate(fd, 0,
+        offsetof(struct keeto_kcache_table, data));
+    if (rc != 0) {
+        errno = rc;
+        return KEETO_SYSTEM_ERR;
+    }
+    uint32_t header[2] = { KEETO_KCACHE_MAGIC, KEETO_KCACHE_VERSION };
+    if (pwrite(fd, header, sizeof header, 0) != sizeof header) {
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * the key cache file is shared between processes by mapping it into
+ * memory. lookups only probe the index and verify the matching record.
+ * the file lock is taken while initializing the file and while storing
+ * records.
+ */
+int
+open_kcache(const char *kcache_file, struct keeto_kcache **ret)
+{
+    if (kcache_file == NULL || ret == NULL) {
+        fatal("kcache_file or ret == NULL");
+    }
+
+    /*
+     * only trust files that cannot be altered by others. entries of the
+     * file end up in authorized_keys.
+     */
+    int fd = -1;
+    void *map = NULL;
+    int rc = map_shared_file(kcache_file, "key cache",
+        sizeof (struct keeto_kcache_table), S_IRWXG | S_IRWXO,
+        &init_kcache_file, &fd, &map);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    struct keeto_kcache *kcache = malloc(sizeof *kcache);
+    if (kcache == NULL) {
+        log_error("failed to allocate memory for key cache buffer");
+        munmap(map, sizeof (struct keeto_kcache_table));
+        close(fd);
+        return KEETO_NO_MEMORY;
+    }
+    kcache->fd = fd;
+    kcache->table = map;
+    pthread_mutex_init(&kcache->lock, NULL);
+    *ret = kcache;
+    return KEETO_OK;
+}
+
+void
+close_kcache(struct keeto_kcache *kcache)
+{
+    if (kcache == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&kcache->lock);
+    munmap(kcache->table, sizeof (struct keeto_kcache_table));
+    close(kcache->fd);
+    free(kcache);
+}
+
+void
+free_kcache_value(struct keeto_kcache_value *value)
+{
+    if (value == NULL) {
+        return;
+    }
+    free(value->keytype);
+    free(value->key);
+    free(value->fp_md5);
+    free(value->fp_sha256);
+    memset(value, 0, sizeof *value);
+}
+
+static int
+copy_kcache_value(const unsigned char *payload, struct keeto_kcache_value *ret)
+{
+    char *fields[KEETO_KCACHE_FIELDS];
+    const char *field = (const char *) payload;
+    for (int i = 0; i < KEETO_KCACHE_FIELDS; i++) {
+        fields[i] = strdup(field);
+        if (fields[i] == NULL) {
+            log_error("failed to duplicate key cache field");
+            for (int j = 0; j < i; j++) {
+                free(fields[j]);
+            }
+            return KEETO_NO_MEMORY;
+        }
+        field += strlen(field) + 1;
+    }
+    ret->keytype = fields[0];
+    ret->key = fields[1];
+    ret->fp_md5 = fields[2];
+    ret->fp_sha256 = fields[3];
+    return KEETO_OK;
+}
+
+/*
+ * lookups do not lock. the record is copied first and only used if the
+ * cache has not been rotated meanwhile.
+ */
+int
+lookup_kcache(struct keeto_kcache *kcache, const unsigned char *digest,
+    struct keeto_kcache_value *ret)
+{
+    if (kcache == NULL || digest == NULL || ret == NULL) {
+        fatal("kcache, digest or ret == NULL");
+    }
+
+    struct keeto_kcache_table *table = kcache->table;
+    uint32_t seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return KEETO_NO_CACHE_ENTRY;
+    }
+    size_t slot = 0;
+    struct keeto_kcache_record record;
+    uint32_t position = find_kcache_record(table, digest, &slot, &record);
+    if (position == 0) {
+        return KEETO_NO_CACHE_ENTRY;
+    }
+    size_t offset = position - 1 + sizeof record;
+    if (record.length == 0 || record.length > KEETO_KCACHE_MAX_SIZE - offset) {
+        return KEETO_NO_CACHE_ENTRY;
+    }
+    unsigned char *payload = malloc(record.length);
+    if (payload == NULL) {
+        log_error("failed to allocate memory for key cache buffer");
+        return KEETO_NO_MEMORY;
+    }
+    memcpy(payload, table->data + offset, record.length);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    int res = KEETO_NO_CACHE_ENTRY;
+    if (__atomic_load_n(&table->seq, __ATOMIC_RELAXED) == seq &&
+        is_valid_kcache_record(&record, payload)) {
+
+        res = copy_kcache_value(payload, ret);
+    }
+    free(payload);
+    return res;
+}
+
+/*
+ * records are never removed one by one. once the record area or the
+ * index is full all records are dropped and the cache starts over.
+ */
+static void
+rotate_kcache(struct keeto_kcache_table *table)
+{
+    log_info("rotating key cache file (%u records, %u bytes)", table->count,
+        table->used);
+
+    uint32_t seq = table->seq | 1;
+    __atomic_store_n(&table->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset(table->index, 0, sizeof table->index);
+    table->count = 0;
+    table->used = 0;
+    __atomic_store_n(&table->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int
+store_kcache(struct keeto_kcache *kcache, const unsigned char *digest,
+    const struct keeto_kcache_value *value)
+{
+    if (kcache == NULL || digest == NULL || value == NULL ||
+        value->keytype == NULL || value->key == NULL ||
+        value->fp_md5 == NULL || value->fp_sha256 == NULL) {
+
+        fatal("kcache, digest, value or value fields == NULL");
+    }
+
+    const char *fields[KEETO_KCACHE_FIELDS] = {
+        value->keytype, value->key, value->fp_md5, value->fp_sha256
+    };
+    size_t length = 0;
+    for (int i = 0; i < KEETO_KCACHE_FIELDS; i++) {
+        length += strlen(fields[i]) + 1;
+    }
+    size_t record_size = sizeof(struct keeto_kcache_record) + length;
+    if (record_size > KEETO_KCACHE_MAX_SIZE) {
+        log_info("key data exceeds key cache size (not stored)");
+        return KEETO_OK;
+    }
+    unsigned char *data = malloc(record_size);
+    if (data == NULL) {
+        log_error("failed to allocate memory for key cache buffer");
+        return KEETO_NO_MEMORY;
+    }
+    unsigned char *payload = data + sizeof(struct keeto_kcache_record);
+    size_t position = 0;
+    for (int i = 0; i < KEETO_KCACHE_FIELDS; i++) {
+        size_t field_length = strlen(fields[i]) + 1;
+        memcpy(payload + position, fields[i], field_length);
+        position += field_length;
+    }
+    struct keeto_kcache_record record;
+    memset(&record, 0, sizeof record);
+    record.length = length;
+    memcpy(record.digest, digest, KEETO_KCACHE_DIGEST_SIZE);
+    record.checksum = get_kcache_checksum(digest, payload, length);
+    memcpy(data, &record, sizeof record);
+
+    struct keeto_kcache_table *table = kcache->table;
+    pthread_mutex_lock(&kcache->lock);
+    int res = KEETO_UNKNOWN_ERR;
+    int rc = flock(kcache->fd, LOCK_EX);
+    if (rc == -1) {
+        log_error("failed to lock key cache file (%s)", strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+
+    /*
+     * another process might have stored the record meanwhile. a record
+     * torn by a crash is replaced. a rotation interrupted by a crash is
+     * completed.
+     */
+    size_t slot = KEETO_KCACHE_SLOTS;
+    struct keeto_kcache_record found;
+    uint32_t found_position = 0;
+    if ((table->seq & 1) == 0) {
+        found_position = find_kcache_record(table, digest, &slot, &found);
+    }
+    if (found_position != 0 && found.length <= KEETO_KCACHE_MAX_SIZE -
+        (found_position - 1) - sizeof found && is_valid_kcache_record(&found,
+        table->data + found_position - 1 + sizeof found)) {
+
+        res = KEETO_OK;
+        goto cleanup_b;
+    }
+    if (slot == KEETO_KCACHE_SLOTS || table->used > KEETO_KCACHE_MAX_SIZE -
+        record_size || (table->count + 1) * 2 > KEETO_KCACHE_SLOTS) {
+
+        rotate_kcache(table);
+        found_position = 0;
+        slot = get_kcache_slot(digest);
+    }
+
+    size_t offset = table->used;
+    ssize_t written = pwrite(kcache->fd, data, record_size,
+        offsetof(struct keeto_kcache_table, data) + offset);
+    if (written != (ssize_t) record_size) {
+        log_error("failed to write to key cache file (%s)",
+            written == -1 ? strerror(errno) : "short write");
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_b;
+    }
+    table->used = offset + record_size;
+    if (found_position == 0) {
+        table->count++;
+    }
+    /* the record is published after it has been written completely */
+    __atomic_store_n(&table->index[slot], offset + 1, __ATOMIC_RELEASE);
+    res = KEETO_OK;
+
+cleanup_b:
+    flock(kcache->fd, LOCK_UN);
+cleanup:
+    pthread_mutex_unlock(&kcache->lock);
+    free(data);
+    return res;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_KCACHE_H
+#define KEETO_KCACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEETO_KCACHE_MAGIC 0x4b544f4b /* KTOK */
+#define KEETO_KCACHE_VERSION 2
+#define KEETO_KCACHE_DIGEST_SIZE 32
+#define KEETO_KCACHE_SLOTS 65536
+/* the cache is rotated once its records exceed this size */
+#define KEETO_KCACHE_MAX_SIZE (16 * 1024 * 1024)
+
+/*
+ * header of a record. it is followed by length bytes of payload holding
+ * keytype, key, md5 and sha256 fingerprint as nul terminated strings.
+ * the checksum covers digest and payload and detects torn records.
+ */
+struct keeto_kcache_record {
+    uint32_t length;
+    uint32_t reserved;
+    uint64_t checksum;
+    unsigned char digest[KEETO_KCACHE_DIGEST_SIZE];
+};
+
+/* ssh key material derived from a certificate */
+struct keeto_kcache_value {
+    char *keytype;
+    char *key;
+    char *fp_md5;
+    char *fp_sha256;
+};
+
+/*
+ * layout of the key cache file shared by all processes. index is an open
+ * addressing hash table of record offsets + 1 into data (0 marks a free
+ * slot). seq is odd while the cache is being rotated.
+ */
+struct keeto_kcache_table {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t count;
+    uint32_t used;
+    uint32_t reserved;
+    uint32_t index[KEETO_KCACHE_SLOTS];
+    unsigned char data[KEETO_KCACHE_MAX_SIZE];
+};
+
+struct keeto_kcache {
+    int fd;
+    pthread_mutex_t lock;
+    struct keeto_kcache_table *table;
+};
+
+int open_kcache(const char *kcache_file, struct keeto_kcache **ret);
+void close_kcache(struct keeto_kcache *kcache);
+int lookup_kcache(struct keeto_kcache *kcache, const unsigned char *digest,
+    struct keeto_kcache_value *ret);
+int store_kcache(struct keeto_kcache *kcache, const unsigned char *digest,
+    const struct keeto_kcache_value *value);
+void free_kcache_value(struct keeto_kcache_value *value);
+
+#endif /* KEETO_KCACHE_H */
@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-keydb.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+
+#define KEETO_KEYDB_MIN_BUCKETS 64
+#define LOCK_FILE_SUFFIX ".lock"
+#define SHARD_SUFFIX_SIZE sizeof ".ff"
+
+static uint32_t
+get_keydb_hash(const char *key, size_t key_length)
+{
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < key_length; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static size_t
+get_keydb_records_offset(uint32_t bucket_count)
+{
+    return sizeof(struct keeto_keydb_header) +
+        (size_t) bucket_count * sizeof(struct keeto_keydb_bucket);
+}
+
+/* returns false if the record does not lie within the records section */
+static bool
+get_keydb_record(struct keeto_keydb *keydb, uint32_t offset,
+    struct keeto_keydb_record *ret)
+{
+    if (offset < get_keydb_records_offset(keydb->header->bucket_count) ||
+        offset > keydb->size || keydb->size - offset < sizeof *ret) {
+        return false;
+    }
+    memcpy(ret, keydb->data + offset, sizeof *ret);
+    size_t available = keydb->size - offset - sizeof *ret;
+    if (ret->key_length > available ||
+        ret->value_length > available - ret->key_length) {
+        return false;
+    }
+    return true;
+}
+
+static const char *
+get_keydb_record_key(struct keeto_keydb *keydb, uint32_t offset)
+{
+    return (const char *) keydb->data + offset +
+        sizeof(struct keeto_keydb_record);
+}
+
+static bool
+is_owned_by(const char *key, size_t key_length, const char *owner,
+    size_t owner_length)
+{
+    if (key_length < owner_length || memcmp(key, owner, owner_length) != 0) {
+        return false;
+    }
+    return key_length == owner_length || key[owner_length] == '\0';
+}
+
+/* shard_file has to hold strlen(keydb_file) + SHARD_SUFFIX_SIZE bytes */
+static void
+get_keydb_shard_file(const char *keydb_file, const char *owner,
+    char *shard_file, size_t shard_file_size)
+{
+    /* the low bits of the hash pick the bucket within the shard */
+    uint32_t shard = get_keydb_hash(owner, strlen(owner)) >>
+        (32 - KEETO_KEYDB_SHARD_BITS);
+    snprintf(shard_file, shard_file_size, "%s.%02x", keydb_file,
+        (unsigned int) shard);
+}
+
+static int
+open_keydb_shard(const char *keydb_file, struct keeto_keydb **ret)
+{
+    int fd = open(keydb_file, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return KEETO_NO_SUCH_VALUE;
+        }
+        log_error("failed to open keystore db '%s' (%s)", keydb_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /*
+     * entries of the db end up in authorized_keys. the db is written by
+     * root and read by the user running the authorized keys command.
+     */
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat keystore db '%s' (%s)", keydb_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    if (!S_ISREG(stat_buffer.st_mode) ||
+        (stat_buffer.st_uid != 0 && stat_buffer.st_uid != geteuid()) ||
+        (stat_buffer.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        log_error("refusing to use keystore db '%s' (insecure file)",
+            keydb_file);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    size_t size = stat_buffer.st_size;
+    if (size < sizeof(struct keeto_keydb_header) ||
+        size > KEETO_KEYDB_MAX_SIZE) {
+        log_error("refusing to use keystore db '%s' (invalid size)",
+            keydb_file);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("failed to map keystore db '%s' (%s)", keydb_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    const struct keeto_keydb_header *header =
+        (const struct keeto_keydb_header *) data;
+    if (header->magic != KEETO_KEYDB_MAGIC ||
+        header->version != KEETO_KEYDB_VERSION || header->size != size ||
+        header->bucket_count == 0 ||
+        (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        get_keydb_records_offset(header->bucket_count) > size) {
+
+        log_error("refusing to use keystore db '%s' (invalid header)",
+            keydb_file);
+        munmap(data, size);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+
+    struct keeto_keydb *keydb = malloc(sizeof *keydb);
+    if (keydb == NULL) {
+        log_error("failed to allocate memory for keystore db buffer");
+        munmap(data, size);
+        res = KEETO_NO_MEMORY;
+        goto cleanup;
+    }
+    keydb->data = data;
+    keydb->size = size;
+    keydb->header = header;
+    keydb->buckets = (const struct keeto_keydb_bucket *) (data +
+        sizeof *header);
+    *ret = keydb;
+    res = KEETO_OK;
+
+cleanup:
+    close(fd);
+    return res;
+}
+
+/* opens the shard holding the entries of owner */
+int
+open_keydb(const char *keydb_file, const char *owner,
+    struct keeto_keydb **ret)
+{
+    if (keydb_file == NULL || owner == NULL || ret == NULL) {
+        fatal("keydb_file, owner or ret == NULL");
+    }
+
+    char shard_file[strlen(keydb_file) + SHARD_SUFFIX_SIZE];
+    get_keydb_shard_file(keydb_file, owner, shard_file, sizeof shard_file);
+    return open_keydb_shard(shard_file, ret);
+}
+
+void
+close_keydb(struct keeto_keydb *keydb)
+{
+    if (keydb == NULL) {
+        return;
+    }
+    munmap(keydb->data, keydb->size);
+    free(keydb);
+}
+
+/*
+ * on success ret points to the value within the mapped file. it is
+ * valid until the db is closed and not nul terminated.
+ */
+int
+lookup_keydb(struct keeto_keydb *keydb, const char *key, size_t key_length,
+    const char **ret, size_t *ret_length)
+{
+    if (keydb == NULL || key == NULL || ret == NULL || ret_length == NULL) {
+        fatal("keydb, key, ret or ret_length == NULL");
+    }
+
+    uint32_t hash = get_keydb_hash(key, key_length);
+    size_t mask = keydb->header->bucket_count - 1;
+    size_t slot = hash & mask;
+    for (size_t probes = 0; probes < keydb->header->bucket_count; probes++) {
+        const struct keeto_keydb_bucket *bucket = &keydb->buckets[slot];
+        if (bucket->offset == 0) {
+            break;
+        }
+        if (bucket->hash == hash) {
+            struct keeto_keydb_record record;
+            if (!get_keydb_record(keydb, bucket->offset, &record)) {
+                log_error("failed to read keystore db record (corrupt db)");
+                return KEETO_SYSTEM_ERR;
+            }
+            const char *record_key = get_keydb_record_key(keydb,
+                bucket->offset);
+            if (record.key_length == key_length &&
+                memcmp(record_key, key, key_length) == 0) {
+
+                *ret = record_key + record.key_length;
+                *ret_length = record.value_length;
+                return KEETO_OK;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return KEETO_NO_SUCH_VALUE;
+}
+
+static int
+lock_keydb(const char *keydb_file)
+{
+    size_t lock_file_size = strlen(keydb_file) + strlen(LOCK_FILE_SUFFIX) + 1;
+    char lock_file[lock_file_size];
+    strcpy(lock_file, keydb_file);
+    strcat(lock_file, LOCK_FILE_SUFFIX);
+
+    int fd = open(lock_file, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+        S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        log_error("failed to open keystore db lock file '%s' (%s)", lock_file,
+            strerror(errno));
+        return -1;
+    }
+    int rc = flock(fd, LOCK_EX);
+    if (rc == -1) {
+        log_error("failed to lock keystore db lock file '%s' (%s)", lock_file,
+            strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * checks if the entries of owner in keydb are exactly the given ones.
+ * only the entries of owner are looked at.
+ */
+static bool
+is_keydb_unchanged(struct keeto_keydb *keydb, const char *owner,
+    const struct keeto_keydb_entry *entries, size_t count)
+{
+    if (keydb == NULL) {
+        return count == 0;
+    }
+
+    const char *value = NULL;
+    size_t value_length = 0;
+    int rc = lookup_keydb(keydb, owner, strlen(owner) + 1, &value,
+        &value_length);
+    if (rc != KEETO_OK) {
+        return rc == KEETO_NO_SUCH_VALUE && count == 0;
+    }
+    uint32_t owned = 0;
+    if (value_length != sizeof owned) {
+        return false;
+    }
+    memcpy(&owned, value, sizeof owned);
+    if (owned != count) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        rc = lookup_keydb(keydb, entries[i].key, entries[i].key_length,
+            &value, &value_length);
+        if (rc != KEETO_OK || value_length != entries[i].value_length ||
+            memcmp(value, entries[i].value, value_length) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+add_keydb_record(unsigned char *data, uint32_t bucket_count, size_t *offset,
+    const char *key, size_t key_length, const char *value,
+    size_t value_length)
+{
+    struct keeto_keydb_record record = { key_length, value_length };
+    memcpy(data + *offset, &record, sizeof record);
+    memcpy(data + *offset + sizeof record, key, key_length);
+    memcpy(data + *offset + sizeof record + key_length, value, value_length);
+
+    struct keeto_keydb_bucket *buckets = (struct keeto_keydb_bucket *) (data +
+        sizeof(struct keeto_keydb_header));
+    uint32_t hash = get_keydb_hash(key, key_length);
+    size_t slot = hash & (bucket_count - 1);
+    while (buckets[slot].offset != 0) {
+        slot = (slot + 1) & (bucket_count - 1);
+    }
+    buckets[slot].hash = hash;
+    buckets[slot].offset = *offset;
+    *offset += sizeof record + key_length + value_length;
+}
+
+static int
+replace_keydb_file(const char *keydb_file, const unsigned char *data,
+    size_t size)
+{
+    /* create temporary file */
+    char *template_suffix = "-XXXXXXX";
+    size_t tmp_keydb_size = strlen(keydb_file) + strlen(template_suffix) + 1;
+    char tmp_keydb[tmp_keydb_size];
+    strcpy(tmp_keydb, keydb_file);
+    strcat(tmp_keydb, template_suffix);
+    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    int fd = mkstemp(tmp_keydb);
+    umask(mask);
+    if (fd == -1) {
+        log_error("failed to create temporary keystore db '%s' (%s)",
+            tmp_keydb, strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t rc = write(fd, data + written, size - written);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc == -1) {
+            log_error("failed to write temporary keystore db '%s' (%s)",
+                tmp_keydb, strerror(errno));
+            res = KEETO_SYSTEM_ERR;
+            goto cleanup;
+        }
+        written += rc;
+    }
+    int rc = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (rc == -1) {
+        log_error("failed to set permissions for temporary keystore db '%s' "
+            "(%s)", tmp_keydb, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    rc = rename(tmp_keydb, keydb_file);
+    if (rc == -1) {
+        log_error("failed to move temporary keystore db from '%s' to '%s' "
+            "(%s)", tmp_keydb, keydb_file, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    res = KEETO_OK;
+
+cleanup:
+    if (res != KEETO_OK) {
+        unlink(tmp_keydb);
+    }
+    close(fd);
+    return res;
+}
+
+/*
+ * builds a new shard from the entries of keydb not owned by owner and
+ * entries.
+ */
+static int
+write_keydb(const char *keydb_file, struct keeto_keydb *keydb,
+    const char *owner, const struct keeto_keydb_entry *entries, size_t count)
+{
+    size_t owner_length = strlen(owner);
+    uint32_t owned = count;
+    size_t total = count;
+    size_t records_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        records_size += sizeof(struct keeto_keydb_record) +
+            entries[i].key_length + entries[i].value_length;
+    }
+    if (count > 0) {
+        total++;
+        records_size += sizeof(struct keeto_keydb_record) + owner_length + 1 +
+            sizeof owned;
+    }
+    uint32_t old_bucket_count = keydb != NULL ? keydb->header->bucket_count :
+        0;
+    for (uint32_t i = 0; i < old_bucket_count; i++) {
+        uint32_t offset = keydb->buckets[i].offset;
+        struct keeto_keydb_record record;
+        if (offset == 0 || !get_keydb_record(keydb, offset, &record) ||
+            is_owned_by(get_keydb_record_key(keydb, offset),
+            record.key_length, owner, owner_length)) {
+            continue;
+        }
+        total++;
+        records_size += sizeof record + record.key_length +
+            record.value_length;
+    }
+
+    /* keep the load factor below 1/2 */
+    uint32_t bucket_count = KEETO_KEYDB_MIN_BUCKETS;
+    while (bucket_count < 2 * total && bucket_count < UINT32_MAX / 2) {
+        bucket_count *= 2;
+    }
+    size_t size = get_keydb_records_offset(bucket_count) + records_size;
+    if (bucket_count < 2 * total || size > KEETO_KEYDB_MAX_SIZE) {
+        log_error("keystore db exceeds maximum size");
+        return KEETO_SYSTEM_ERR;
+    }
+    unsigned char *data = calloc(1, size);
+    if (data == NULL) {
+        log_error("failed to allocate memory for keystore db buffer");
+        return KEETO_NO_MEMORY;
+    }
+    struct keeto_keydb_header header = {
+        KEETO_KEYDB_MAGIC, KEETO_KEYDB_VERSION, bucket_count, total, size
+    };
+    memcpy(data, &header, sizeof header);
+
+    size_t offset = get_keydb_records_offset(bucket_count);
+    for (uint32_t i = 0; i < old_bucket_count; i++) {
+        uint32_t old_offset = keydb->buckets[i].offset;
+        struct keeto_keydb_record record;
+        if (old_offset == 0 || !get_keydb_record(keydb, old_offset, &record)) {
+            continue;
+        }
+        const char *key = get_keydb_record_key(keydb, old_offset);
+        if (is_owned_by(key, record.key_length, owner, owner_length)) {
+            continue;
+        }
+        add_keydb_record(data, bucket_count, &offset, key, record.key_length,
+            key + record.key_length, record.value_length);
+    }
+    for (size_t i = 0; i < count; i++) {
+        add_keydb_record(data, bucket_count, &offset, entries[i].key,
+            entries[i].key_length, entries[i].value, entries[i].value_length);
+    }
+    if (count > 0) {
+        add_keydb_record(data, bucket_count, &offset, owner, owner_length + 1,
+            (const char *) &owned, sizeof owned);
+    }
+
+    int rc = replace_keydb_file(keydb_file, data, size);
+    free(data);
+    return rc;
+}
+
+/*
+ * replaces all entries of owner with the given entries. the keys of
+ * entries must be owned by owner and unique. only the shard of owner
+ * is locked and rewritten. an unreadable shard is rebuilt from scratch.
+ * the shard file is left alone if nothing changed.
+ */
+int
+update_keydb(const char *keydb_file, const char *owner,
+    const struct keeto_keydb_entry *entries, size_t count)
+{
+    if (keydb_file == NULL || owner == NULL ||
+        (entries == NULL && count > 0)) {
+        fatal("keydb_file, owner or entries == NULL");
+    }
+
+    char shard_file[strlen(keydb_file) + SHARD_SUFFIX_SIZE];
+    get_keydb_shard_file(keydb_file, owner, shard_file, sizeof shard_file);
+    int lock_fd = lock_keydb(shard_file);
+    if (lock_fd == -1) {
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    struct keeto_keydb *keydb = NULL;
+    int rc = open_keydb_shard(shard_file, &keydb);
+    switch (rc) {
+    case KEETO_OK:
+    case KEETO_NO_SUCH_VALUE:
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup;
+    default:
+        log_info("rebuilding keystore db '%s'", shard_file);
+    }
+
+    if (is_keydb_unchanged(keydb, owner, entries, count)) {
+        res = KEETO_OK;
+    } else {
+        res = write_keydb(shard_file, keydb, owner, entries, count);
+    }
+    close_keydb(keydb);
+
+cleanup:
+    close(lock_fd);
+    return res;
+}
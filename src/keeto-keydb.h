@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_KEYDB_H
+#define KEETO_KEYDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEETO_KEYDB_MAGIC 0x4b544f44 /* KTOD */
+#define KEETO_KEYDB_VERSION 2
+/* offsets within a file are 32 bit */
+#define KEETO_KEYDB_MAX_SIZE (1024 * 1024 * 1024)
+/*
+ * the db is split into shards by a hash of the owner. each shard is a
+ * file of its own (db file name followed by the shard number in hex).
+ */
+#define KEETO_KEYDB_SHARD_BITS 8
+#define KEETO_KEYDB_SHARDS (1 << KEETO_KEYDB_SHARD_BITS)
+
+/*
+ * layout of a shard file: header, hash table of bucket_count buckets
+ * and the records. the file is never changed in place but rebuilt and
+ * renamed over the old one.
+ */
+struct keeto_keydb_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t bucket_count;
+    uint32_t count;
+    uint64_t size;
+};
+
+/* open addressing - offset 0 marks a free bucket */
+struct keeto_keydb_bucket {
+    uint32_t hash;
+    uint32_t offset;
+};
+
+/*
+ * header of a record. it is followed by key_length bytes of key and
+ * value_length bytes of value. records are not aligned within the
+ * file.
+ */
+struct keeto_keydb_record {
+    uint32_t key_length;
+    uint32_t value_length;
+};
+
+/*
+ * the owner of an entry is the part of the key up to the first nul
+ * byte. entries are replaced per owner. the number of entries of an
+ * owner is stored under the owner followed by a single nul byte.
+ */
+struct keeto_keydb_entry {
+    const char *key;
+    size_t key_length;
+    const char *value;
+    size_t value_length;
+};
+
+struct keeto_keydb {
+    unsigned char *data;
+    size_t size;
+    const struct keeto_keydb_header *header;
+    const struct keeto_keydb_bucket *buckets;
+};
+
+int open_keydb(const char *keydb_file, const char *owner,
+    struct keeto_keydb **ret);
+void close_keydb(struct keeto_keydb *keydb);
+int lookup_keydb(struct keeto_keydb *keydb, const char *key,
+    size_t key_length, const char **ret, size_t *ret_length);
+int update_keydb(const char *keydb_file, const char *owner,
+    const struct keeto_keydb_entry *entries, size_t count);
+
+#endif /* KEETO_KEYDB_H */
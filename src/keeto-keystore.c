@@ -0,0 +1,940 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-keystore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keeto-crl.h"
+#include "keeto-error.h"
+#include "keeto-keydb.h"
+#include "keeto-log.h"
+#include "keeto-openssl.h"
+#include "keeto-util.h"
+#include "keeto-x509.h"
+
+/*
+ * settings and rejection counters of the prevalidation. the counters
+ * are shared by all post processing threads.
+ */
+struct keeto_prevalidation {
+    bool check_issuer;
+    unsigned long rejects[KEETO_X509_REJECTS];
+};
+
+/*
+ * settings of the expiry time of keystore records. max_lifetime is 0 if
+ * the expiry time is not capped.
+ */
+struct keeto_expiry {
+    bool enabled;
+    time_t max_lifetime;
+};
+
+/* keys handed out to the post processing threads */
+struct keeto_post_process_job {
+    struct keeto_key **keys;
+    int *results;
+    size_t count;
+    size_t next;
+    struct keeto_prevalidation *prevalidation;
+    struct keeto_expiry *expiry;
+    struct keeto_x509_memo *x509_memo;
+};
+
+/*
+ * results of keys post processed in advance. if results is NULL keys
+ * are post processed when they are visited.
+ */
+struct keeto_post_process_results {
+    int *results;
+    size_t next;
+    struct keeto_prevalidation *prevalidation;
+    struct keeto_expiry *expiry;
+    struct keeto_x509_memo *x509_memo;
+};
+
+void
+remove_keystore(char *keystore)
+{
+    if (keystore == NULL) {
+        fatal("keystore == NULL");
+    }
+
+    int rc = unlink(keystore);
+    if (rc == -1) {
+        switch (errno) {
+        case ENOENT:
+            break;
+        default:
+            log_error("failed to remove keystore file '%s' (%s)", keystore,
+                strerror(errno));
+        }
+        return;
+    }
+    log_info("removed keystore file '%s'", keystore);
+}
+
+/* fingerprint index of the keystore db */
+struct keeto_keystore_fp_entry {
+    struct keeto_keystore_record *keystore_record;
+    size_t position;
+};
+
+static void
+render_keystore_record(FILE *keystore_stream,
+    struct keeto_keystore_record *keystore_record)
+{
+    fprintf(keystore_stream, "environment=\"KEETOREALUSER=%s\"",
+        keystore_record->uid);
+    bool command_option_set = keystore_record->command_option != NULL ?
+        true : false;
+    if (command_option_set) {
+        fprintf(keystore_stream, ",command=\"%s\"",
+            keystore_record->command_option);
+    }
+    bool from_option_set = keystore_record->from_option != NULL ?
+        true : false;
+    if (from_option_set) {
+        fprintf(keystore_stream, ",from=\"%s\"",
+            keystore_record->from_option);
+    }
+    if (keystore_record->expiry_time_option != NULL) {
+        fprintf(keystore_stream, ",expiry-time=\"%s\"",
+            keystore_record->expiry_time_option);
+    }
+    fprintf(keystore_stream, " %s %s\n\n", keystore_record->ssh_keytype,
+        keystore_record->ssh_key);
+}
+
+/*
+ * renders the keystore records into a newly allocated buffer in the
+ * format of an authorized_keys file.
+ */
+static int
+render_keystore(struct keeto_keystore_records *keystore_records,
+    char **ret, size_t *ret_length)
+{
+    if (keystore_records == NULL || ret == NULL || ret_length == NULL) {
+        fatal("keystore_records, ret or ret_length == NULL");
+    }
+
+    char *content = NULL;
+    size_t length = 0;
+    FILE *keystore_stream = open_memstream(&content, &length);
+    if (keystore_stream == NULL) {
+        log_error("failed to open memory stream for keystore content (%s)",
+            strerror(errno));
+        return KEETO_NO_MEMORY;
+    }
+
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        render_keystore_record(keystore_stream, keystore_record);
+    }
+
+    bool failed = ferror(keystore_stream) != 0 ? true : false;
+    int rc = fclose(keystore_stream);
+    if (failed || rc != 0) {
+        log_error("failed to render keystore content");
+        free(content);
+        return KEETO_NO_MEMORY;
+    }
+    *ret = content;
+    *ret_length = length;
+
+    return KEETO_OK;
+}
+
+/*
+ * returns true if the keystore file already holds exactly the given
+ * content and would not change when being rewritten. this includes
+ * owner and permissions as a rewrite would reset both.
+ */
+static bool
+is_keystore_unchanged(char *keystore, const char *content, size_t length)
+{
+    if (keystore == NULL || content == NULL) {
+        fatal("keystore or content == NULL");
+    }
+
+    int fd = open(keystore, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool res = false;
+
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1 || !S_ISREG(stat_buffer.st_mode) ||
+        stat_buffer.st_uid != geteuid() ||
+        (stat_buffer.st_mode & 07777) !=
+        (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) ||
+        (size_t) stat_buffer.st_size != length) {
+
+        goto cleanup;
+    }
+    if (length == 0) {
+        res = true;
+        goto cleanup;
+    }
+    const char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        goto cleanup;
+    }
+    res = memcmp(data, content, length) == 0 ? true : false;
+    munmap((void *) data, length);
+
+cleanup:
+    close(fd);
+    return res;
+}
+
+static int
+replace_keystore(char *keystore, const char *content, size_t length)
+{
+    if (keystore == NULL || content == NULL) {
+        fatal("keystore or content == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* create temporary file */
+    char *template_suffix = "-XXXXXXX";
+    size_t tmp_keystore_size = strlen(keystore) + strlen(template_suffix) + 1;
+    char tmp_keystore[tmp_keystore_size];
+    strcpy(tmp_keystore, keystore);
+    strcat(tmp_keystore, template_suffix);
+    /*
+     * in older versions of glibc mkstemp sets permission of temp file
+     * to 0666. being on the safe side...
+     */
+    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    int tmp_keystore_fd = mkstemp(tmp_keystore);
+    umask(mask);
+    if (tmp_keystore_fd == -1) {
+        log_error("failed to create temporary keystore file '%s' (%s)",
+            tmp_keystore, strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    FILE *tmp_keystore_file = fdopen(tmp_keystore_fd, "w");
+    if (tmp_keystore_file == NULL) {
+        log_error("failed to open temporary keystore file '%s' for writing (%s)",
+            tmp_keystore, strerror(errno));
+        int rc = close(tmp_keystore_fd);
+        if (rc == -1) {
+            log_error("failed to close file descriptor of temporary keystore "
+                "file '%s' (%s)", tmp_keystore, strerror(errno));
+        }
+        return KEETO_SYSTEM_ERR;
+    }
+
+    size_t written = fwrite(content, 1, length, tmp_keystore_file);
+    if (written != length) {
+        log_error("failed to write temporary keystore file '%s' (%s)",
+            tmp_keystore, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    int rc = fchmod(tmp_keystore_fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (rc == -1) {
+        log_error("failed to set permissions for temp keystore file '%s' (%s)",
+            tmp_keystore, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    rc = rename(tmp_keystore, keystore);
+    if (rc == -1) {
+        log_error("failed to move temp keystore file from '%s' to '%s' (%s)",
+            tmp_keystore, keystore, strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    res = KEETO_OK;
+
+cleanup:
+    rc = fclose(tmp_keystore_file);
+    if (rc != 0) {
+        log_error("failed to flush stream and close file descriptor of "
+            "temporary keystore file '%s' (%s)", tmp_keystore, strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    return res;
+}
+
+int
+write_keystore(char *keystore, struct keeto_keystore_records *keystore_records)
+{
+    if (keystore == NULL || keystore_records == NULL) {
+        fatal("keystore or keystore_records == NULL");
+    }
+
+    char *content = NULL;
+    size_t length = 0;
+    int rc = render_keystore(keystore_records, &content, &length);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    /* leave the keystore file alone if nothing changed */
+    if (is_keystore_unchanged(keystore, content, length)) {
+        log_info("keystore file '%s' is up to date", keystore);
+        free(content);
+        return KEETO_OK;
+    }
+    rc = replace_keystore(keystore, content, length);
+    free(content);
+    return rc;
+}
+
+/* orders by fingerprint and keeps the keystore order otherwise */
+static int
+compare_keystore_fp_entries(const void *a, const void *b)
+{
+    const struct keeto_keystore_fp_entry *entry_a = a;
+    const struct keeto_keystore_fp_entry *entry_b = b;
+
+    int rc = strcmp(entry_a->keystore_record->ssh_key_fp_sha256,
+        entry_b->keystore_record->ssh_key_fp_sha256);
+    if (rc != 0) {
+        return rc;
+    }
+    return entry_a->position < entry_b->position ? -1 : 1;
+}
+
+/*
+ * renders the records of every distinct fingerprint into a buffer of
+ * keys and values. each key '<uid>\0<sha256 fingerprint>' is directly
+ * followed by its value. key_offsets holds the offset of each key.
+ */
+static int
+render_keystore_fp_index(char *uid, struct keeto_keystore_fp_entry *fp_entries,
+    size_t count, char **ret, size_t *ret_length, size_t *key_offsets,
+    size_t *key_lengths, size_t *ret_groups)
+{
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *stream = open_memstream(&buffer, &length);
+    if (stream == NULL) {
+        log_error("failed to open memory stream for fingerprint index (%s)",
+            strerror(errno));
+        return KEETO_NO_MEMORY;
+    }
+
+    size_t groups = 0;
+    size_t uid_length = strlen(uid);
+    for (size_t i = 0; i < count; i++) {
+        char *fp = fp_entries[i].keystore_record->ssh_key_fp_sha256;
+        if (i == 0 ||
+            strcmp(fp, fp_entries[i - 1].keystore_record->ssh_key_fp_sha256)
+            != 0) {
+
+            key_offsets[groups] = ftell(stream);
+            key_lengths[groups] = uid_length + 1 + strlen(fp);
+            groups++;
+            fwrite(uid, 1, uid_length + 1, stream);
+            fputs(fp, stream);
+        }
+        render_keystore_record(stream, fp_entries[i].keystore_record);
+    }
+
+    bool failed = ferror(stream) != 0 ? true : false;
+    int rc = fclose(stream);
+    if (failed || rc != 0) {
+        log_error("failed to render fingerprint index");
+        free(buffer);
+        return KEETO_NO_MEMORY;
+    }
+    *ret = buffer;
+    *ret_length = length;
+    *ret_groups = groups;
+    return KEETO_OK;
+}
+
+/*
+ * stores the keystore of uid in the keystore db. the rendered keystore
+ * is stored under the uid. additionally the records of each ssh key
+ * are stored under the uid and the sha256 fingerprint of the key.
+ */
+int
+write_keystore_db(char *keystore_db, char *uid,
+    struct keeto_keystore_records *keystore_records)
+{
+    if (keystore_db == NULL || uid == NULL || keystore_records == NULL) {
+        fatal("keystore_db, uid or keystore_records == NULL");
+    }
+
+    char *content = NULL;
+    size_t length = 0;
+    int rc = render_keystore(keystore_records, &content, &length);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    /* an empty keystore is not stored at all */
+    if (length == 0) {
+        free(content);
+        return update_keydb(keystore_db, uid, NULL, 0);
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    size_t count = 0;
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        count++;
+    }
+    struct keeto_keystore_fp_entry *fp_entries = calloc(count,
+        sizeof *fp_entries);
+    struct keeto_keydb_entry *entries = calloc(count + 1, sizeof *entries);
+    size_t *key_offsets = calloc(count, sizeof *key_offsets);
+    size_t *key_lengths = calloc(count, sizeof *key_lengths);
+    char *fp_index = NULL;
+    if (fp_entries == NULL || entries == NULL || key_offsets == NULL ||
+        key_lengths == NULL) {
+        log_error("failed to allocate memory for fingerprint index buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup;
+    }
+
+    /* records without fingerprint cannot be found by fingerprint */
+    size_t fp_count = 0;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        if (keystore_record->ssh_key_fp_sha256 == NULL) {
+            continue;
+        }
+        fp_entries[fp_count].keystore_record = keystore_record;
+        fp_entries[fp_count].position = fp_count;
+        fp_count++;
+    }
+    qsort(fp_entries, fp_count, sizeof *fp_entries,
+        &compare_keystore_fp_entries);
+    size_t fp_index_length = 0;
+    size_t groups = 0;
+    rc = render_keystore_fp_index(uid, fp_entries, fp_count, &fp_index,
+        &fp_index_length, key_offsets, key_lengths, &groups);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup;
+    }
+
+    entries[0].key = uid;
+    entries[0].key_length = strlen(uid);
+    entries[0].value = content;
+    entries[0].value_length = length;
+    for (size_t i = 0; i < groups; i++) {
+        size_t value_offset = key_offsets[i] + key_lengths[i];
+        size_t value_end = i + 1 < groups ? key_offsets[i + 1] :
+            fp_index_length;
+        entries[i + 1].key = fp_index + key_offsets[i];
+        entries[i + 1].key_length = key_lengths[i];
+        entries[i + 1].value = fp_index + value_offset;
+        entries[i + 1].value_length = value_end - value_offset;
+    }
+    res = update_keydb(keystore_db, uid, entries, groups + 1);
+
+cleanup:
+    free(fp_index);
+    free(key_lengths);
+    free(key_offsets);
+    free(entries);
+    free(fp_entries);
+    free(content);
+    return res;
+}
+
+void
+remove_keystore_db(char *keystore_db, char *uid)
+{
+    if (keystore_db == NULL || uid == NULL) {
+        fatal("keystore_db or uid == NULL");
+    }
+
+    int rc = update_keydb(keystore_db, uid, NULL, 0);
+    if (rc != KEETO_OK) {
+        log_error("failed to remove uid '%s' from keystore db '%s' (%s)", uid,
+            keystore_db, keeto_strerror(rc));
+        return;
+    }
+    log_info("removed uid '%s' from keystore db '%s'", uid, keystore_db);
+}
+
+static int
+add_keystore_record(struct keeto_key_provider *key_provider,
+    struct keeto_keystore_options *keystore_options, struct keeto_key *key,
+    struct keeto_keystore_records *keystore_records)
+{
+    if (key_provider == NULL || key == NULL || keystore_records == NULL) {
+        fatal("key_provider, key or keystore_records == NULL");
+    }
+
+    struct keeto_keystore_record *keystore_record = new_keystore_record();
+    if (keystore_record == NULL) {
+        log_error("failed to allocate memory for keystore record buffer");
+        return KEETO_NO_MEMORY;
+    }
+
+    keystore_record->uid = key_provider->uid;
+    keystore_record->ssh_keytype = key->ssh_key->keytype;
+    keystore_record->ssh_key = key->ssh_key->key;
+    keystore_record->ssh_key_fp_md5 = key->ssh_key_fp_md5;
+    keystore_record->ssh_key_fp_sha256 = key->ssh_key_fp_sha256;
+    keystore_record->expiry_time_option = key->expiry_time_option;
+    if (keystore_options != NULL) {
+        keystore_record->command_option = keystore_options->command_option;
+        keystore_record->from_option = keystore_options->from_option;
+    }
+    SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+
+    return KEETO_OK;
+}
+
+/*
+ * keystore records of a key expire together with its certificate or
+ * max_lifetime after now, whatever comes first. every login writes the
+ * keystore again so that the cap only limits how long a key is used
+ * without its certificate being checked.
+ */
+static int
+add_expiry_time_from_x509(X509 *x509, struct keeto_expiry *expiry,
+    struct keeto_key *key)
+{
+    if (x509 == NULL || expiry == NULL || key == NULL) {
+        fatal("x509, expiry or key == NULL");
+    }
+
+    time_t now = time(NULL);
+    time_t not_after = get_time_from_asn1_time(X509_get_notAfter(x509), now);
+    if (expiry->max_lifetime > 0 && not_after - now > expiry->max_lifetime) {
+        not_after = now + expiry->max_lifetime;
+    }
+    return format_expiry_time(not_after, &key->expiry_time_option);
+}
+
+static int
+post_process_key(struct keeto_key *key,
+    struct keeto_prevalidation *prevalidation, struct keeto_expiry *expiry,
+    struct keeto_x509_memo *x509_memo)
+{
+    if (key == NULL || prevalidation == NULL || expiry == NULL) {
+        fatal("key, prevalidation or expiry == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* decode certificate */
+    struct keeto_x509_digest digest;
+    get_key_digest(key, &digest);
+    int rc = decode_key_x509(key, &digest, x509_memo);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    char *subject = NULL;
+    rc = get_subject_from_x509(key->x509, &subject);
+    switch (rc) {
+    case KEETO_OK:
+        log_info("processing key '%s'", subject);
+        free(subject);
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup;
+    default:
+        log_error("failed to obtain subject from certificate (%s)",
+            keeto_strerror(rc));
+    }
+
+    /* reject certificates that cannot be valid before building the chain */
+    enum keeto_x509_reject reject = prevalidate_x509(key->x509,
+        prevalidation->check_issuer);
+    if (reject != KEETO_X509_ACCEPTED) {
+        __atomic_fetch_add(&prevalidation->rejects[reject], 1,
+            __ATOMIC_RELAXED);
+        res = KEETO_INVALID_CERT;
+        goto cleanup;
+    }
+
+    /* check certificate */
+    if (!digest.valid) {
+        get_key_digest(key, &digest);
+    }
+    bool valid = false;
+    rc = validate_x509(key->x509, &digest, &valid);
+    if (rc != KEETO_OK) {
+        log_error("failed to validate certificate (%s)", keeto_strerror(rc));
+        res = KEETO_CERT_VALIDATION_ERR;
+        goto cleanup;
+    }
+    if (!valid) {
+        res = KEETO_INVALID_CERT;
+        goto cleanup;
+    }
+
+    /* add ssh key data */
+    rc = add_key_data_from_x509(key->x509, &digest, key);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup;
+    default:
+        log_error("failed to add key data (%s)", keeto_strerror(rc));
+        res = KEETO_KEY_TRANSFORM_ERR;
+        goto cleanup;
+    }
+
+    /* add expiry time */
+    if (expiry->enabled) {
+        rc = add_expiry_time_from_x509(key->x509, expiry, key);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+    }
+    res = KEETO_OK;
+
+cleanup:
+    release_key_x509(key);
+    return res;
+}
+
+static void *
+post_process_worker(void *arg)
+{
+    struct keeto_post_process_job *job = arg;
+
+    while (true) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) {
+            break;
+        }
+        job->results[i] = post_process_key(job->keys[i], job->prevalidation,
+            job->expiry, job->x509_memo);
+    }
+    return NULL;
+}
+
+/*
+ * keys are collected in the order post_process_access_profiles() visits
+ * them. this way the results can be consumed sequentially afterwards and
+ * keystore records are added in the same order as without threads.
+ */
+static int
+post_process_keys(struct keeto_access_profiles *access_profiles,
+    long threads, struct keeto_prevalidation *prevalidation,
+    struct keeto_expiry *expiry, struct keeto_x509_memo *x509_memo, int **ret)
+{
+    if (access_profiles == NULL || prevalidation == NULL || expiry == NULL ||
+        ret == NULL) {
+
+        fatal("access_profiles, prevalidation, expiry or ret == NULL");
+    }
+
+    struct keeto_post_process_job job = { NULL, NULL, 0, 0, prevalidation,
+        expiry, x509_memo };
+    struct keeto_access_profile *access_profile = NULL;
+    struct keeto_key_provider *key_provider = NULL;
+    struct keeto_key *key = NULL;
+    TAILQ_FOREACH(access_profile, access_profiles, next) {
+        TAILQ_FOREACH(key_provider, access_profile->key_providers, next) {
+            TAILQ_FOREACH(key, key_provider->keys, next) {
+                job.count++;
+            }
+        }
+    }
+    if (threads > (long) job.count) {
+        threads = job.count;
+    }
+    if (threads < 2) {
+        *ret = NULL;
+        return KEETO_OK;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    pthread_t *workers = NULL;
+    job.keys = malloc(sizeof(struct keeto_key *) * job.count);
+    job.results = malloc(sizeof(int) * job.count);
+    workers = malloc(sizeof(pthread_t) * threads);
+    if (job.keys == NULL || job.results == NULL || workers == NULL) {
+        log_error("failed to allocate memory for post processing buffers");
+        res = KEETO_NO_MEMORY;
+        goto cleanup;
+    }
+    size_t i = 0;
+    TAILQ_FOREACH(access_profile, access_profiles, next) {
+        TAILQ_FOREACH(key_provider, access_profile->key_providers, next) {
+            TAILQ_FOREACH(key, key_provider->keys, next) {
+                job.keys[i++] = key;
+            }
+        }
+    }
+
+    /* the calling thread is a worker too */
+    long started = 0;
+    for (long n = 1; n < threads; n++) {
+        int rc = pthread_create(&workers[started], NULL, &post_process_worker,
+            &job);
+        if (rc != 0) {
+            log_error("failed to create post processing thread (%s)",
+                strerror(rc));
+            break;
+        }
+        started++;
+    }
+    post_process_worker(&job);
+    for (long n = 0; n < started; n++) {
+        pthread_join(workers[n], NULL);
+    }
+    *ret = job.results;
+    job.results = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    free(workers);
+    free(job.results);
+    free(job.keys);
+    return res;
+}
+
+static int
+post_process_key_provider(struct keeto_key_provider *key_provider,
+    struct keeto_keystore_options *keystore_options,
+    struct keeto_post_process_results *results,
+    struct keeto_keystore_records *keystore_records)
+{
+    if (key_provider == NULL || results == NULL || keystore_records == NULL) {
+        fatal("key_provider, results or keystore_records == NULL");
+    }
+
+    if (key_provider->keys == NULL) {
+        fatal("key_provider->keys == NULL");
+    }
+
+    struct keeto_key *key = NULL;
+    struct keeto_key *key_tmp = NULL;
+    TAILQ_FOREACH_SAFE(key, key_provider->keys, next, key_tmp) {
+        int rc = KEETO_UNKNOWN_ERR;
+        if (results->results != NULL) {
+            rc = results->results[results->next++];
+        } else {
+            rc = post_process_key(key, results->prevalidation,
+                results->expiry, results->x509_memo);
+        }
+        switch (rc) {
+        case KEETO_OK:
+            /* add key to keystore records */
+            log_info("adding keystore record");
+            rc = add_keystore_record(key_provider, keystore_options, key,
+                keystore_records);
+            switch (rc) {
+            case KEETO_OK:
+                break;
+            case KEETO_NO_MEMORY:
+                return rc;
+            default:
+                log_error("failed to add keystore record");
+            }
+            break;
+        case KEETO_NO_MEMORY:
+            return rc;
+        default:
+            log_info("removing key (%s)", keeto_strerror(rc));
+            TAILQ_REMOVE(key_provider->keys, key, next);
+            free_key(key);
+        }
+    }
+    if (TAILQ_EMPTY(key_provider->keys)) {
+        return KEETO_NO_KEY;
+    }
+    return KEETO_OK;
+}
+
+static int
+post_process_access_profile(struct keeto_access_profile *access_profile,
+    struct keeto_post_process_results *results,
+    struct keeto_keystore_records *keystore_records)
+{
+    if (access_profile == NULL || results == NULL ||
+        keystore_records == NULL) {
+
+        fatal("access_profile, results or keystore_records == NULL");
+    }
+
+    if (access_profile->key_providers == NULL) {
+        fatal("access_profile->key_providers == NULL");
+    }
+
+    struct keeto_key_provider *key_provider = NULL;
+    struct keeto_key_provider *key_provider_tmp = NULL;
+    TAILQ_FOREACH_SAFE(key_provider, access_profile->key_providers, next,
+        key_provider_tmp) {
+
+        log_info("processing key provider '%s'", key_provider->uid);
+        int rc = post_process_key_provider(key_provider,
+            access_profile->keystore_options, results, keystore_records);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            return rc;
+        default:
+            log_info("removing key provider (%s)", keeto_strerror(rc));
+            TAILQ_REMOVE(access_profile->key_providers, key_provider, next);
+            free_key_provider(key_provider);
+        }
+    }
+    if (TAILQ_EMPTY(access_profile->key_providers)) {
+        return KEETO_NO_KEY_PROVIDER;
+    }
+    return KEETO_OK;
+}
+
+/* each reason is logged once instead of once per certificate */
+static void
+log_prevalidation_rejects(struct keeto_prevalidation *prevalidation)
+{
+    if (prevalidation == NULL) {
+        fatal("prevalidation == NULL");
+    }
+
+    for (int i = 0; i < KEETO_X509_REJECTS; i++) {
+        if (prevalidation->rejects[i] == 0) {
+            continue;
+        }
+        log_info("rejected %lu certificate(s) before validation (%s)",
+            prevalidation->rejects[i], get_x509_reject_string(i));
+    }
+}
+
+/*
+ * the cert store used for certificate validation has to be initialized
+ * by the caller.
+ */
+int
+post_process_access_profiles(struct keeto_info *info)
+{
+    if (info == NULL) {
+        fatal("info == NULL");
+    }
+
+    if (info->access_profiles == NULL || info->cfg == NULL) {
+        fatal("info->access_profiles or info->cfg == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    struct keeto_prevalidation prevalidation;
+    memset(&prevalidation, 0, sizeof prevalidation);
+    prevalidation.check_issuer = cfg_getint(info->cfg, "cert_issuer_check");
+    struct keeto_expiry expiry;
+    expiry.enabled = cfg_getint(info->cfg, "ssh_keystore_expiry_time");
+    expiry.max_lifetime = cfg_getint(info->cfg, "ssh_keystore_max_lifetime");
+    /* certificates are decoded once no matter how often they are used */
+    struct keeto_x509_memo *x509_memo = new_x509_memo();
+    if (x509_memo == NULL) {
+        log_error("failed to allocate memory for certificate memo buffer");
+        return KEETO_NO_MEMORY;
+    }
+    struct keeto_post_process_results results = { NULL, 0, &prevalidation,
+        &expiry, x509_memo };
+
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    if (keystore_records == NULL) {
+        log_error("failed to allocate memory for keystore records buffer");
+        free_x509_memo(x509_memo);
+        return KEETO_NO_MEMORY;
+    }
+
+    long threads = OPENSSL_THREAD_SAFE ?
+        cfg_getint(info->cfg, "cert_validation_threads") : 1;
+    int rc = post_process_keys(info->access_profiles, threads,
+        &prevalidation, &expiry, x509_memo, &results.results);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup;
+    }
+
+    struct keeto_access_profile *access_profile = NULL;
+    struct keeto_access_profile *access_profile_tmp = NULL;
+    TAILQ_FOREACH_SAFE(access_profile, info->access_profiles, next,
+        access_profile_tmp) {
+
+        log_info("processing access profile '%s'", access_profile->uid);
+        rc = post_process_access_profile(access_profile, &results,
+            keystore_records);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup;
+        default:
+            log_info("removing access profile (%s)", keeto_strerror(rc));
+            TAILQ_REMOVE(info->access_profiles, access_profile, next);
+            free_access_profile(access_profile);
+        }
+    }
+    log_prevalidation_rejects(&prevalidation);
+    if (TAILQ_EMPTY(info->access_profiles)) {
+        free_access_profiles(info->access_profiles);
+        info->access_profiles = NULL;
+        res = KEETO_NO_ACCESS_PROFILE_FOR_UID;
+        goto cleanup;
+    }
+
+    /* the same key can reach the keystore through several profiles */
+    size_t removed = 0;
+    rc = dedupe_keystore_records(keystore_records, &removed);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup;
+    }
+    if (removed > 0) {
+        log_info("removed %zu duplicate keystore records", removed);
+    }
+    limit_keystore_records(keystore_records, &removed);
+    if (removed > 0) {
+        log_error("removed %zu keystore records exceeding the keystore limits",
+            removed);
+    }
+    info->keystore_records = keystore_records;
+    keystore_records = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    free(results.results);
+    if (keystore_records != NULL) {
+        free_keystore_records(keystore_records);
+    }
+    log_debug("certificate memo: %u hits, %u misses", x509_memo->memo->hits,
+        x509_memo->memo->misses);
+    free_x509_memo(x509_memo);
+    return res;
+}
@@ -19,67 +19,69 @@
 
 #include "keeto-ldap.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
 
 #include <confuse.h>
 #include <lber.h>
 #include <ldap.h>
-#include <openssl/x509.h>
 
+#include "keeto-breaker.h"
+#include "keeto-config.h"
 #include "keeto-error.h"
+#include "keeto-health.h"
 #include "keeto-log.h"
+#include "keeto-openssl.h"
 #include "keeto-util.h"
 
 #define LDAP_SEARCH_FILTER_BUFFER_SIZE 1024
+#define LDAP_MEMO_BUCKET_COUNT 256
+/* operational attribute holding the dn of an entry (rfc 5020) */
+#define LDAP_DN_ATTR "entryDN"
+#define LDAP_PREFETCH_CHUNK_SIZE 128
+#define LDAP_TREE_MAX_DEPTH 2
 
 static int
-ldap_search_keeto(LDAP *ldap_handle, struct keeto_info *info, char *base,
-    int scope, char *filter, char *attrs[], LDAPMessage **ret)
+get_keeto_error_from_ldap_error(int ldap_error)
 {
-    if (ldap_handle == NULL || info == NULL || base == NULL || ret == NULL) {
-        fatal("ldap_handle, info, base or ret == NULL");
-    }
-
-    int res = KEETO_UNKNOWN_ERR;
-    int sizelimit = 1;
-    LDAPMessage *result_entry = NULL;
-
-    int rc = ldap_search_ext_s(ldap_handle, base, scope, filter, attrs, 0, NULL,
-        NULL, NULL, sizelimit, &result_entry);
-    switch (rc) {
+    switch (ldap_error) {
     case LDAP_SUCCESS:
-        break;
+        return KEETO_OK;
     case LDAP_SERVER_DOWN:
     case LDAP_TIMEOUT:
     case LDAP_TIMELIMIT_EXCEEDED:
     case LDAP_UNAVAILABLE:
-        log_error("failed to search ldap (%s)", ldap_err2string(rc));
-        res = KEETO_LDAP_CONNECTION_ERR;
-        goto cleanup;
+        return KEETO_LDAP_CONNECTION_ERR;
     case LDAP_NO_SUCH_OBJECT:
-        log_error("failed to search ldap (%s)", ldap_err2string(rc));
-        res = KEETO_LDAP_NO_SUCH_ENTRY;
-        goto cleanup;
+        return KEETO_LDAP_NO_SUCH_ENTRY;
     case LDAP_NO_MEMORY:
-        log_error("failed to search ldap (%s)", ldap_err2string(rc));
-        res = KEETO_NO_MEMORY;
-        goto cleanup;
+        return KEETO_NO_MEMORY;
     default:
-        log_error("failed to search ldap (%s)", ldap_err2string(rc));
-        res = KEETO_LDAP_ERR;
-        goto cleanup;
+        return KEETO_LDAP_ERR;
+    }
+}
+
+static int
+check_search_result(LDAP *ldap_handle, LDAPMessage *result)
+{
+    if (ldap_handle == NULL || result == NULL) {
+        fatal("ldap_handle or result == NULL");
     }
 
-    rc = ldap_count_entries(ldap_handle, result_entry);
+    int rc = ldap_count_entries(ldap_handle, result);
     switch (rc) {
     case -1:
         log_error("failed to parse ldap search result set");
-        res = KEETO_LDAP_ERR;
-        goto cleanup;
+        return KEETO_LDAP_ERR;
     /*
      * this case happens if a dn exists in the DIT but it is not part
      * of the result set e.g. because it was not matching filter
@@ -87,1663 +89,4418 @@ ldap_search_keeto(LDAP *ldap_handle, struct keeto_info *info, char *base,
      */
     case 0:
         log_error("ldap search result set is empty");
-        res = KEETO_LDAP_SCHEMA_ERR;
-        goto cleanup;
+        return KEETO_LDAP_SCHEMA_ERR;
     case 1:
-        break;
+        return KEETO_OK;
     default:
         /* impossible?! */
         log_error("ldap search result set contains more than one entry (%d)", rc);
-        res = KEETO_LDAP_ERR;
-        goto cleanup;
-    }
-    *ret = result_entry;
-    result_entry = NULL;
-    res = KEETO_OK;
-
-cleanup:
-    if (result_entry != NULL) {
-        ldap_msgfree(result_entry);
+        return KEETO_LDAP_ERR;
     }
-    return res;
 }
 
+/* the check suite enables the registry regardless of the build type */
+#ifndef KEETO_ATTR_PROJECTION
+#define KEETO_ATTR_PROJECTION DEBUG
+#endif
+
+#if KEETO_ATTR_PROJECTION
+/*
+ * debug builds record the attributes requested for every entry and
+ * abort if an attribute is read that has not been requested. this
+ * keeps the attribute lists of the searches in sync with the code
+ * reading the entries.
+ */
+struct keeto_attr_projection {
+    LDAPMessage *entry;
+    char **attrs;
+    struct keeto_attr_projection *next;
+};
+
+/* keetod workers search concurrently */
+static __thread struct keeto_attr_projection *attr_projections = NULL;
+
 static void
-free_attr_values_as_string(char **values)
+free_attr_projection_attrs(char **attrs)
 {
-    if (values == NULL) {
-        return;
-    }
-    for (int i = 0; values[i] != NULL; i++) {
-        free(values[i]);
+    for (int i = 0; attrs[i] != NULL; i++) {
+        free(attrs[i]);
     }
-    free(values);
+    free(attrs);
 }
 
 static void
-free_attr_values_as_binary(struct berval **values)
+free_attr_projections()
 {
-    if (values == NULL) {
-        return;
+    while (attr_projections != NULL) {
+        struct keeto_attr_projection *next = attr_projections->next;
+        free_attr_projection_attrs(attr_projections->attrs);
+        free(attr_projections);
+        attr_projections = next;
     }
-    ldap_value_free_len(values);
 }
 
-static int
-get_attr_values_as_string(LDAP *ldap_handle, LDAPMessage *entry, char *attr,
-    char ***ret)
+static void
+add_attr_projection(LDAPMessage *entry, char *attrs[])
 {
-    if (ldap_handle == NULL || entry == NULL || attr == NULL || ret == NULL) {
-        fatal("ldap_handle, entry, attr or ret == NULL");
+    if (entry == NULL || attrs == NULL) {
+        fatal("entry or attrs == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
-
-    /* get attribute values */
-    entry = ldap_first_entry(ldap_handle, entry);
-    if (entry == NULL) {
-        log_error("failed to parse ldap search result set");
-        return KEETO_LDAP_ERR;
+    int count = 0;
+    while (attrs[count] != NULL) {
+        count++;
     }
 
-    /* retrieve attribute value(s) */
-    struct berval **values = ldap_get_values_len(ldap_handle, entry, attr);
-    if (values == NULL) {
-        return KEETO_LDAP_NO_SUCH_ATTR;
+    /* memory of freed entries might be reused by newer entries */
+    struct keeto_attr_projection *projection = attr_projections;
+    while (projection != NULL && projection->entry != entry) {
+        projection = projection->next;
     }
-
-    /* count values so we know how wide our buffer has to be */
-    int count = ldap_count_values_len(values);
-    if (count == 0) {
-        log_error("ldap search result set empty for attribute '%s'", attr);
-        res = KEETO_LDAP_ERR;
-        goto cleanup_a;
+    if (projection != NULL) {
+        free_attr_projection_attrs(projection->attrs);
+    } else {
+        projection = malloc(sizeof *projection);
+        if (projection == NULL) {
+            fatal("failed to allocate memory for attribute projection "
+                "buffer");
+        }
+        projection->entry = entry;
+        projection->next = attr_projections;
+        attr_projections = projection;
     }
-
-    char **values_string = malloc(sizeof (char *) * (count + 1));
-    if (values_string == NULL) {
-        log_error("failed to allocate memory for attribute value buffer");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_a;
+    projection->attrs = calloc(count + 1, sizeof *projection->attrs);
+    if (projection->attrs == NULL) {
+        fatal("failed to allocate memory for attribute projection buffer");
     }
-
-    for (int i = 0; values[i] != NULL; i++) {
-        char *value = values[i]->bv_val;
-        ber_len_t len = values[i]->bv_len;
-        values_string[i] = strndup(value, len);
-        if (values_string[i] == NULL) {
-            log_error("failed to duplicate attribute value string");
-            res = KEETO_NO_MEMORY;
-            goto cleanup_b;
+    for (int i = 0; i < count; i++) {
+        projection->attrs[i] = strdup(attrs[i]);
+        if (projection->attrs[i] == NULL) {
+            fatal("failed to duplicate attribute name");
         }
     }
-    values_string[count] = NULL;
+}
 
-    *ret = values_string;
-    values_string = NULL;
-    res = KEETO_OK;
+static void
+register_attr_projection(LDAP *ldap_handle, LDAPMessage *result,
+    char *attrs[])
+{
+    if (ldap_handle == NULL || result == NULL) {
+        fatal("ldap_handle or result == NULL");
+    }
+    if (attrs == NULL) {
+        fatal("ldap search without attribute list");
+    }
 
-cleanup_b:
-    if (values_string != NULL) {
-        free_attr_values_as_string(values_string);
+    for (LDAPMessage *entry = ldap_first_entry(ldap_handle, result);
+        entry != NULL; entry = ldap_next_entry(ldap_handle, entry)) {
+        add_attr_projection(entry, attrs);
     }
-cleanup_a:
-    ldap_value_free_len(values);
-    return res;
 }
 
 static int
-get_attr_values_as_binary(LDAP *ldap_handle, LDAPMessage *entry, char *attr,
-    struct berval ***ret)
+get_attr_projection(LDAPMessage *entry, char *attr)
 {
-    if (ldap_handle == NULL || entry == NULL || attr == NULL || ret == NULL) {
-        fatal("ldap_handle, entry, attr or ret == NULL");
+    if (entry == NULL || attr == NULL) {
+        fatal("entry or attr == NULL");
     }
 
-    /* get attribute values */
-    entry = ldap_first_entry(ldap_handle, entry);
-    if (entry == NULL) {
-        log_error("failed to parse ldap search result set");
-        return KEETO_LDAP_ERR;
-    }
-    *ret = ldap_get_values_len(ldap_handle, entry, attr);
-    if (*ret == NULL) {
+    for (struct keeto_attr_projection *projection = attr_projections;
+        projection != NULL; projection = projection->next) {
+
+        if (projection->entry != entry) {
+            continue;
+        }
+        for (int i = 0; projection->attrs[i] != NULL; i++) {
+            if (strcasecmp(projection->attrs[i], attr) == 0) {
+                return KEETO_OK;
+            }
+        }
         return KEETO_LDAP_NO_SUCH_ATTR;
     }
-    return KEETO_OK;
+    return KEETO_LDAP_NO_SUCH_ENTRY;
 }
 
-static int
-get_group_member_entry(LDAP *ldap_handle, struct keeto_info *info,
-    char *group_dn, char *group_member_attr, LDAPMessage **ret)
+static void
+check_attr_projection(LDAPMessage *entry, char *attr)
 {
-    if (ldap_handle == NULL || info == NULL || group_dn == NULL ||
-        group_member_attr == NULL || ret == NULL) {
-        fatal("ldap_handle, info, group_dn, group_member_attr or ret == NULL");
+    int rc = get_attr_projection(entry, attr);
+    if (rc == KEETO_LDAP_NO_SUCH_ATTR) {
+        fatal("attribute '%s' read but not requested", attr);
     }
+    if (rc == KEETO_LDAP_NO_SUCH_ENTRY) {
+        fatal("attribute '%s' read from unregistered entry", attr);
+    }
+}
+#else
+#define free_attr_projections() do {} while (0)
+#define register_attr_projection(ldap_handle, result, attrs) do {} while (0)
+#define check_attr_projection(entry, attr) do {} while (0)
+#endif /* KEETO_ATTR_PROJECTION */
 
-    /* prepare ldap search */
-    char *attrs[] = {
-        group_member_attr,
-        NULL
-    };
+/*
+ * ldap_timeout is the budget of all ldap searches of a login and not
+ * of every single call. each call gets the time left until the
+ * deadline set in search_access_profiles().
+ */
+static int
+get_ldap_remaining_time(struct keeto_info *info, struct timeval *ret)
+{
+    if (info == NULL || ret == NULL) {
+        fatal("info or ret == NULL");
+    }
 
-    /* query ldap for group members */
-    LDAPMessage *group_member_entry = NULL;
-    int rc = ldap_search_keeto(ldap_handle, info, group_dn, LDAP_SCOPE_BASE,
-        NULL, attrs, &group_member_entry);
-    if (rc != KEETO_OK) {
-        log_error("failed to obtain group member entry (%s)",
-            keeto_strerror(rc));
-        return rc;
+    if (!get_remaining_time(&info->ldap_deadline, ret)) {
+        log_error("failed to search ldap (%s)", ldap_err2string(LDAP_TIMEOUT));
+        return KEETO_LDAP_CONNECTION_ERR;
     }
-    *ret = group_member_entry;
     return KEETO_OK;
 }
 
 static int
-check_target_keystores(LDAP *ldap_handle, struct keeto_info *info,
-    LDAPMessage *target_keystore_group_entry, char *target_keystore_member_attr,
-    bool *ret)
+ldap_search_keeto(LDAP *ldap_handle, struct keeto_info *info, char *base,
+    int scope, char *filter, char *attrs[], LDAPMessage **ret)
 {
-    if (ldap_handle == NULL || info == NULL ||
-        target_keystore_group_entry == NULL ||
-        target_keystore_member_attr == NULL || ret == NULL) {
-        fatal("ldap_handle, info, target_keystore_group_entry, "
-            "target_keystore_member_attr or ret == NULL");
+    if (ldap_handle == NULL || info == NULL || base == NULL || ret == NULL) {
+        fatal("ldap_handle, info, base or ret == NULL");
     }
 
     int res = KEETO_UNKNOWN_ERR;
-    bool relevant = false;
+    int sizelimit = 1;
+    LDAPMessage *result_entry = NULL;
 
-    /* check target keystores */
-    char **target_keystore_dns = NULL;
-    int rc = get_attr_values_as_string(ldap_handle, target_keystore_group_entry,
-        target_keystore_member_attr, &target_keystore_dns);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        return rc;
-    default:
-        log_error("failed to obtain target keystore dns: attribute '%s' (%s)",
-            target_keystore_member_attr, keeto_strerror(rc));
+    struct timeval ldap_timeout;
+    int rc = get_ldap_remaining_time(info, &ldap_timeout);
+    if (rc != KEETO_OK) {
         return rc;
     }
-
-    /* prepare ldap search */
-    char *target_keystore_uid_attr = cfg_getstr(info->cfg,
-        "ldap_target_keystore_uid_attr");
-    char *attrs[] = {
-        target_keystore_uid_attr,
-        NULL
-    };
-
-    for (int i = 0; target_keystore_dns[i] != NULL && !relevant; i++) {
-        char *target_keystore_dn = target_keystore_dns[i];
-        log_info("checking target keystore '%s'", target_keystore_dn);
-
-        LDAPMessage *target_keystore_entry = NULL;
-        rc = ldap_search_keeto(ldap_handle, info, target_keystore_dn,
-            LDAP_SCOPE_BASE, NULL, attrs, &target_keystore_entry);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_LDAP_CONNECTION_ERR:
-        case KEETO_NO_MEMORY:
-            res = rc;
-            goto cleanup;
-        default:
-            log_error("failed to obtain target keystore entry (%s)",
-                keeto_strerror(rc));
-            continue;
-        }
-
-        /* get uids of target keystore */
-        char **target_keystore_uids = NULL;
-        rc = get_attr_values_as_string(ldap_handle, target_keystore_entry,
-            target_keystore_uid_attr, &target_keystore_uids);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_NO_MEMORY:
-            res = rc;
-            ldap_msgfree(target_keystore_entry);
-            goto cleanup;
-        default:
-            log_error("failed to obtain target keystore uids: attribute '%s' (%s)",
-                target_keystore_uid_attr, keeto_strerror(rc));
-            goto cleanup_inner;
-        }
-
-        /* check uids */
-        for (int j = 0; target_keystore_uids[j] != NULL; j++) {
-            if (strcmp(target_keystore_uids[j], info->uid) == 0) {
-                relevant = true;
-                break;
-            }
-        }
-        free_attr_values_as_string(target_keystore_uids);
-    cleanup_inner:
-        ldap_msgfree(target_keystore_entry);
+    rc = ldap_search_ext_s(ldap_handle, base, scope, filter, attrs, 0, NULL,
+        NULL, &ldap_timeout, sizelimit, &result_entry);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to search ldap (%s)", ldap_err2string(rc));
+        res = get_keeto_error_from_ldap_error(rc);
+        goto cleanup;
     }
 
-    *ret = relevant;
+    rc = check_search_result(ldap_handle, result_entry);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup;
+    }
+    register_attr_projection(ldap_handle, result_entry, attrs);
+    *ret = result_entry;
+    result_entry = NULL;
     res = KEETO_OK;
 
 cleanup:
-    free_attr_values_as_string(target_keystore_dns);
+    if (result_entry != NULL) {
+        ldap_msgfree(result_entry);
+    }
     return res;
 }
 
 static int
-check_access_profile_relevance_aobp(LDAP *ldap_handle, struct keeto_info *info,
-    LDAPMessage *access_profile_entry, bool *ret)
+count_values(char **values)
 {
-    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
-        ret == NULL) {
-        fatal("ldap_handle, info, access_profile_entry or ret == NULL");
+    if (values == NULL) {
+        fatal("values == NULL");
     }
 
-    bool relevant = false;
-    log_info("checking target keystores");
-
-    /* check direct target keystores */
-    log_info("checking direct target keystores");
-    int rc = check_target_keystores(ldap_handle, info, access_profile_entry,
-        KEETO_AOBP_TARGET_KEYSTORE_ATTR, &relevant);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_LDAP_CONNECTION_ERR:
-    case KEETO_NO_MEMORY:
-        return rc;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no direct target keystores specified");
-        break;
-    default:
-        log_error("failed to check direct target keystores (%s)",
-            keeto_strerror(rc));
-        break;
-    }
-    if (relevant) {
-        *ret = true;
-        return KEETO_OK;
+    int count = 0;
+    while (values[count] != NULL) {
+        count++;
     }
+    return count;
+}
 
-    /* check target keystore groups */
-    log_info("checking target keystore groups");
-    char **target_keystore_group_dns = NULL;
-    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
-        KEETO_AOBP_TARGET_KEYSTORE_GROUP_ATTR, &target_keystore_group_dns);
-    switch (rc) {
-    case KEETO_OK:
-        ;
-        char *target_keystore_group_member_attr = cfg_getstr(info->cfg,
-            "ldap_target_keystore_group_member_attr");
-
-        for (int i = 0; target_keystore_group_dns[i] != NULL && !relevant; i++) {
-            char *target_keystore_group_dn = target_keystore_group_dns[i];
-            log_info("checking target keystore group '%s'",
-                target_keystore_group_dn);
-
-            LDAPMessage *group_member_entry = NULL;
-            rc = get_group_member_entry(ldap_handle, info,
-                target_keystore_group_dn, target_keystore_group_member_attr,
-                &group_member_entry);
-            switch (rc) {
-            case KEETO_OK:
-                break;
-            case KEETO_LDAP_CONNECTION_ERR:
-            case KEETO_NO_MEMORY:
-                free_attr_values_as_string(target_keystore_group_dns);
-                return rc;
-            default:
-                log_error("failed to check target keystore group (%s)",
-                    keeto_strerror(rc));
-                continue;
-            }
+/*
+ * value of the ldap memo. either holds the result of a search (NULL if
+ * the search failed), the der encoded certificates of a key provider or
+ * the sorted normalized member dns of an entry. the keys of a key
+ * provider reference the certificates - the memo must outlive them.
+ */
+struct keeto_ldap_memo_value {
+    LDAPMessage *result;
+    struct berval **certs;
+    char **member_dns;
+    size_t member_dn_count;
+};
 
-            rc = check_target_keystores(ldap_handle, info, group_member_entry,
-                target_keystore_group_member_attr, &relevant);
-            switch (rc) {
-            case KEETO_OK:
-                break;
-            case KEETO_LDAP_CONNECTION_ERR:
-            case KEETO_NO_MEMORY:
-                ldap_msgfree(group_member_entry);
-                free_attr_values_as_string(target_keystore_group_dns);
-                return rc;
-            case KEETO_LDAP_NO_SUCH_ATTR:
-                log_error("failed to obtain target keystore dns: attribute '%s' "
-                    "(%s)", target_keystore_group_member_attr, keeto_strerror(rc));
-                goto cleanup_inner;
-            default:
-                log_error("failed to check target keystore group (%s)",
-                    keeto_strerror(rc));
-                goto cleanup_inner;
-            }
-        cleanup_inner:
-            ldap_msgfree(group_member_entry);
-        }
-        free_attr_values_as_string(target_keystore_group_dns);
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no target keystore groups specified");
-        break;
-    default:
-        log_error("failed to obtain target keystore group dns: attribute '%s' "
-            "(%s)", KEETO_AOBP_TARGET_KEYSTORE_GROUP_ATTR, keeto_strerror(rc));
-        break;
+static void
+free_ldap_memo_value(void *value)
+{
+    struct keeto_ldap_memo_value *memo_value = value;
+    if (memo_value == NULL) {
+        return;
     }
-    if (relevant) {
-        *ret = true;
-        return KEETO_OK;
+    if (memo_value->result != NULL) {
+        ldap_msgfree(memo_value->result);
     }
-
-    *ret = false;
-    return KEETO_OK;
+    if (memo_value->certs != NULL) {
+        ldap_value_free_len(memo_value->certs);
+    }
+    for (size_t i = 0; i < memo_value->member_dn_count; i++) {
+        free(memo_value->member_dns[i]);
+    }
+    free(memo_value->member_dns);
+    free(memo_value);
 }
 
 static int
-check_access_profile_enabled(LDAP *ldap_handle,
-    LDAPMessage *access_profile_entry, bool *ret)
+get_ldap_memo(struct keeto_info *info, struct keeto_memo **ret)
 {
-    if (ldap_handle == NULL || access_profile_entry == NULL || ret == NULL) {
-        fatal("ldap_handle, access_profile_entry or ret == NULL");
+    if (info == NULL || ret == NULL) {
+        fatal("info or ret == NULL");
     }
 
-    /*
-     * determine state of access profile from KEETO_AP_ENABLED_ATTR
-     * attribute.
-     */
-    char **access_profile_state = NULL;
-    int rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
-        KEETO_AP_ENABLED_ATTR, &access_profile_state);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    default:
-        log_error("failed to obtain access profile state: attribute '%s' (%s)",
-            KEETO_AP_ENABLED_ATTR, keeto_strerror(rc));
-        return KEETO_LDAP_SCHEMA_ERR;
+    if (info->ldap_memo == NULL) {
+        info->ldap_memo = new_memo(LDAP_MEMO_BUCKET_COUNT,
+            &free_ldap_memo_value);
+        if (info->ldap_memo == NULL) {
+            log_error("failed to allocate memory for ldap memo buffer");
+            return KEETO_NO_MEMORY;
+        }
     }
-    *ret = strcmp(access_profile_state[0], LDAP_BOOL_TRUE) == 0 ? true : false;
-    free_attr_values_as_string(access_profile_state);
+    *ret = info->ldap_memo;
     return KEETO_OK;
 }
 
+/*
+ * takes ownership of result and certs in any case.
+ */
 static int
-check_access_profile_relevance_generic(LDAP *ldap_handle,
-    LDAPMessage *access_profile_entry, bool *ret)
+put_ldap_memo_value(struct keeto_memo *memo, char *key, LDAPMessage *result,
+    struct berval **certs)
 {
-    if (ldap_handle == NULL || access_profile_entry == NULL || ret == NULL) {
-        fatal("ldap_handle, access_profile_entry or ret == NULL");
+    if (memo == NULL || key == NULL) {
+        fatal("memo or key == NULL");
     }
 
-    /* check if acccess profile entry is enabled */
-    bool profile_enabled = false;
-    int rc = check_access_profile_enabled(ldap_handle, access_profile_entry,
-        &profile_enabled);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    default:
-        log_error("failed to check if profile is enabled (%s)",
-            keeto_strerror(rc));
-        return rc;
+    struct keeto_ldap_memo_value *memo_value = malloc(sizeof *memo_value);
+    if (memo_value == NULL) {
+        log_error("failed to allocate memory for ldap memo value buffer");
+        if (result != NULL) {
+            ldap_msgfree(result);
+        }
+        if (certs != NULL) {
+            ldap_value_free_len(certs);
+        }
+        return KEETO_NO_MEMORY;
     }
-    if (!profile_enabled) {
-        log_info("access profile disabled");
-        *ret = false;
-        return KEETO_OK;
+    memset(memo_value, 0, sizeof *memo_value);
+    memo_value->result = result;
+    memo_value->certs = certs;
+
+    int rc = memo_put(memo, key, memo_value);
+    if (rc != KEETO_OK) {
+        free_ldap_memo_value(memo_value);
+        return rc;
     }
-    /* do further checks here in the future */
-    *ret = true;
     return KEETO_OK;
 }
 
+/*
+ * the key of a search consists of everything that influences its
+ * result.
+ */
 static int
-check_access_profile_relevance(LDAP *ldap_handle, struct keeto_info *info,
-    struct keeto_access_profile *access_profile,
-    LDAPMessage *access_profile_entry, bool *ret)
+create_search_memo_key(char *base, int scope, char *filter, char *attrs[],
+    char **ret)
 {
-    if (ldap_handle == NULL || info == NULL || access_profile == NULL ||
-        access_profile_entry == NULL || ret == NULL) {
-        fatal("ldap_handle, info, access_profile, access_profile_entry or ret "
-            "== NULL");
+    if (base == NULL || ret == NULL) {
+        fatal("base or ret == NULL");
     }
 
-    bool relevant = false;
-    int rc = check_access_profile_relevance_generic(ldap_handle,
-        access_profile_entry, &relevant);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    default:
-        log_error("failed to check generic access profile relevance (%s)",
-            keeto_strerror(rc));
-        return rc;
+    size_t key_length = strlen("search\n") + 16 + strlen(base) + 3;
+    if (filter != NULL) {
+        key_length += strlen(filter);
     }
-    if (!relevant) {
-        *ret = false;
-        return KEETO_OK;
+    for (int i = 0; attrs != NULL && attrs[i] != NULL; i++) {
+        key_length += strlen(attrs[i]) + 1;
     }
 
-    /*
-     * an access on behalf profile is only relevant if there is a
-     * target keystore with a uid matching the uid of the user
-     * currently logging in.
-     */
-    if (access_profile->type == ACCESS_ON_BEHALF_PROFILE) {
-        bool relevant = false;
-        rc = check_access_profile_relevance_aobp(ldap_handle, info,
-            access_profile_entry, &relevant);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_LDAP_CONNECTION_ERR:
-        case KEETO_NO_MEMORY:
-            return rc;
-        default:
-            log_error("failed to check access on behalf profile relevance (%s)",
-                keeto_strerror(rc));
-            return rc;
-        }
-        if (!relevant) {
-            *ret = false;
-            return KEETO_OK;
-        }
+    char *key = malloc(key_length);
+    if (key == NULL) {
+        log_error("failed to allocate memory for ldap memo key buffer");
+        return KEETO_NO_MEMORY;
     }
-    *ret = true;
+    int offset = snprintf(key, key_length, "search\n%d\n%s\n", scope,
+        filter == NULL ? "" : filter);
+    for (int i = 0; attrs != NULL && attrs[i] != NULL; i++) {
+        offset += snprintf(key + offset, key_length - offset, "%s,", attrs[i]);
+    }
+    snprintf(key + offset, key_length - offset, "\n%s", base);
+    *ret = key;
     return KEETO_OK;
 }
 
-static int
-add_access_profile_type(LDAP *ldap_handle, LDAPMessage *access_profile_entry,
-    struct keeto_access_profile *access_profile)
+/*
+ * the results themselves are owned by the ldap memo of info.
+ */
+static void
+free_search_results(LDAPMessage **results)
 {
-    if (ldap_handle == NULL || access_profile_entry == NULL ||
-        access_profile == NULL) {
-        fatal("ldap_handle, access_profile_entry or access_profile == NULL");
-    }
+    free(results);
+}
 
-    /* determine access profile type from objectClass attribute */
-    char **objectclasses = NULL;
-    int rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
-        "objectClass", &objectclasses);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    default:
-        log_error("failed to obtain access profile type: attribute '%s' (%s)",
-            "objectClass", keeto_strerror(rc));
-        return KEETO_LDAP_SCHEMA_ERR;
+static void
+free_memo_keys(char **keys, int count)
+{
+    if (keys == NULL) {
+        return;
     }
-
-    int res = KEETO_UNKNOWN_ACCESS_PROFILE_TYPE;
-    /* search for access profile type */
-    for (int i = 0; objectclasses[i] != NULL; i++) {
-        char *objectclass = objectclasses[i];
-        if (strcmp(objectclass, KEETO_DAP_OBJCLASS) == 0) {
-            access_profile->type = DIRECT_ACCESS_PROFILE;
-            res = KEETO_OK;
-            break;
-        } else if (strcmp(objectclass, KEETO_AOBP_OBJCLASS) == 0) {
-            access_profile->type = ACCESS_ON_BEHALF_PROFILE;
-            res = KEETO_OK;
-            break;
-        }
+    for (int i = 0; i < count; i++) {
+        free(keys[i]);
     }
-    free_attr_values_as_string(objectclasses);
-    return res;
+    free(keys);
 }
 
+/*
+ * sends one search request for every base dn at once and collects the
+ * responses as they arrive. this way the latency of a whole batch is
+ * roughly one round trip instead of one round trip per entry.
+ *
+ * results are stored at the same index as their base dn so that they
+ * can be processed in the original order. a failed search results in
+ * a NULL entry. only errors that affect the whole batch (e.g. the
+ * connection is lost) are returned.
+ *
+ * every result is memoized in info so that entries referenced by
+ * several access profiles are only fetched once per login.
+ */
 static int
-add_keystore_options(LDAP *ldap_handle, LDAPMessage *keystore_options_entry,
-    struct keeto_access_profile *access_profile)
+ldap_search_keeto_batch(LDAP *ldap_handle, struct keeto_info *info,
+    char **bases, int scope, char *filter, char *attrs[], LDAPMessage ***ret)
 {
-    if (ldap_handle == NULL || keystore_options_entry == NULL ||
-        access_profile == NULL) {
-        fatal("ldap_handle, keystore_options_entry or access_profile == NULL");
+    if (ldap_handle == NULL || info == NULL || bases == NULL || ret == NULL) {
+        fatal("ldap_handle, info, bases or ret == NULL");
     }
 
     int res = KEETO_UNKNOWN_ERR;
+    int count = count_values(bases);
+    int sizelimit = 1;
 
-    /* create and populate keeto keystore options struct */
-    struct keeto_keystore_options *keystore_options = new_keystore_options();
-    if (keystore_options == NULL) {
-        log_error("failed to allocate memory for keystore options buffer");
+    struct keeto_memo *memo = NULL;
+    int rc = get_ldap_memo(info, &memo);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    LDAPMessage **results = calloc(count + 1, sizeof *results);
+    if (results == NULL) {
+        log_error("failed to allocate memory for ldap search result buffer");
         return KEETO_NO_MEMORY;
     }
-    keystore_options->dn = ldap_get_dn(ldap_handle, keystore_options_entry);
-    if (keystore_options->dn == NULL) {
-        log_error("failed to obtain dn from keystore options entry");
-        res = KEETO_LDAP_ERR;
+    int *msgids = malloc(sizeof (int) * (count + 1));
+    if (msgids == NULL) {
+        log_error("failed to allocate memory for ldap message id buffer");
+        res = KEETO_NO_MEMORY;
         goto cleanup_a;
     }
-    int rc = get_rdn_from_dn(keystore_options->dn, &keystore_options->uid);
-    if (rc != KEETO_OK) {
-        log_error("failed to obtain rdn from dn '%s' (%s)", keystore_options->dn,
-            keeto_strerror(rc));
-        res = rc;
-        goto cleanup_a;
+    for (int i = 0; i < count; i++) {
+        msgids[i] = -1;
+    }
+    char **keys = calloc(count + 1, sizeof *keys);
+    if (keys == NULL) {
+        log_error("failed to allocate memory for ldap memo key buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_b;
     }
 
-    /* get attribute values */
-    char **keystore_options_command = NULL;
-    rc = get_attr_values_as_string(ldap_handle, keystore_options_entry,
-        KEETO_KEYSTORE_OPTIONS_CMD_ATTR, &keystore_options_command);
-    switch (rc) {
-    case KEETO_OK:
-        keystore_options->command_option = strdup(keystore_options_command[0]);
-        if (keystore_options->command_option == NULL) {
-            log_error("failed to duplicate keystore option 'command'");
-            res = KEETO_NO_MEMORY;
-            goto cleanup_b;
+    /* send all search requests without waiting for responses */
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+        rc = create_search_memo_key(bases[i], scope, filter, attrs, &keys[i]);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_c;
         }
-        log_info("added keystore option 'command'");
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_a;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no keystore option 'command' specified");
-        break;
-    default:
-        log_error("failed to obtain keystore option 'command': attribute '%s' (%s)",
-            KEETO_KEYSTORE_OPTIONS_CMD_ATTR, keeto_strerror(rc));
-        res = rc;
-        goto cleanup_a;
+        void *memo_value = NULL;
+        rc = memo_get(memo, keys[i], &memo_value);
+        if (rc == KEETO_OK) {
+            log_debug("using memoized ldap search result: base '%s'", bases[i]);
+            results[i] = ((struct keeto_ldap_memo_value *) memo_value)->result;
+            if (results[i] != NULL) {
+                register_attr_projection(ldap_handle, results[i], attrs);
+            }
+            continue;
+        }
+
+        rc = ldap_search_ext(ldap_handle, bases[i], scope, filter, attrs, 0,
+            NULL, NULL, NULL, sizelimit, &msgids[i]);
+        if (rc != LDAP_SUCCESS) {
+            log_error("failed to send ldap search request: base '%s' (%s)",
+                bases[i], ldap_err2string(rc));
+            msgids[i] = -1;
+            rc = get_keeto_error_from_ldap_error(rc);
+            switch (rc) {
+            case KEETO_LDAP_CONNECTION_ERR:
+            case KEETO_NO_MEMORY:
+                res = rc;
+                goto cleanup_c;
+            default:
+                continue;
+            }
+        }
+        pending++;
     }
 
-    char **keystore_options_from = NULL;
-    rc = get_attr_values_as_string(ldap_handle, keystore_options_entry,
-        KEETO_KEYSTORE_OPTIONS_FROM_ATTR, &keystore_options_from);
-    switch (rc) {
-    case KEETO_OK:
-        keystore_options->from_option = strdup(keystore_options_from[0]);
-        if (keystore_options->from_option == NULL) {
-            log_error("failed to duplicate keystore option 'from'");
-            res = KEETO_NO_MEMORY;
+    /* collect responses in the order they arrive */
+    while (pending > 0) {
+        struct timeval ldap_timeout;
+        rc = get_ldap_remaining_time(info, &ldap_timeout);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_c;
+        }
+        LDAPMessage *result = NULL;
+        rc = ldap_result(ldap_handle, LDAP_RES_ANY, LDAP_MSG_ALL,
+            &ldap_timeout, &result);
+        switch (rc) {
+        case -1:
+            ldap_get_option(ldap_handle, LDAP_OPT_RESULT_CODE, &rc);
+            log_error("failed to obtain ldap search result (%s)",
+                ldap_err2string(rc));
+            res = get_keeto_error_from_ldap_error(rc);
+            if (res == KEETO_LDAP_ERR) {
+                res = KEETO_LDAP_CONNECTION_ERR;
+            }
+            goto cleanup_c;
+        case 0:
+            log_error("failed to obtain ldap search result (%s)",
+                ldap_err2string(LDAP_TIMEOUT));
+            res = KEETO_LDAP_CONNECTION_ERR;
             goto cleanup_c;
         }
-        log_info("added keystore option 'from'");
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_b;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no keystore option 'from' specified");
-        break;
-    default:
-        log_error("failed to obtain keystore option 'from': attribute '%s' (%s)",
-            KEETO_KEYSTORE_OPTIONS_FROM_ATTR, keeto_strerror(rc));
-        res = rc;
-        goto cleanup_b;
-    }
 
-    /* only add keystore options if at least one options has been set */
-    if (keystore_options->from_option == NULL &&
-        keystore_options->command_option == NULL) {
+        int msgid = ldap_msgid(result);
+        int index = -1;
+        for (int i = 0; i < count; i++) {
+            if (msgids[i] == msgid) {
+                index = i;
+                break;
+            }
+        }
+        if (index == -1) {
+            log_debug("discarding unexpected ldap message (%d)", msgid);
+            ldap_msgfree(result);
+            continue;
+        }
+        msgids[index] = -1;
+        pending--;
 
-        res = KEETO_NO_KEYSTORE_OPTION;
-        goto cleanup_c;
+        int ldap_error = LDAP_SUCCESS;
+        rc = ldap_parse_result(ldap_handle, result, &ldap_error, NULL, NULL,
+            NULL, NULL, 0);
+        if (rc != LDAP_SUCCESS) {
+            ldap_error = rc;
+        }
+        if (ldap_error != LDAP_SUCCESS) {
+            log_error("failed to search ldap: base '%s' (%s)", bases[index],
+                ldap_err2string(ldap_error));
+            ldap_msgfree(result);
+            result = NULL;
+            rc = get_keeto_error_from_ldap_error(ldap_error);
+            switch (rc) {
+            case KEETO_LDAP_CONNECTION_ERR:
+            case KEETO_NO_MEMORY:
+                res = rc;
+                goto cleanup_c;
+            default:
+                break;
+            }
+        } else {
+            rc = check_search_result(ldap_handle, result);
+            if (rc != KEETO_OK) {
+                log_error("failed to search ldap: base '%s' (%s)", bases[index],
+                    keeto_strerror(rc));
+                ldap_msgfree(result);
+                result = NULL;
+            } else {
+                register_attr_projection(ldap_handle, result, attrs);
+            }
+        }
+
+        /* the same base dn might be part of a batch more than once */
+        void *memo_value = NULL;
+        rc = memo_get(memo, keys[index], &memo_value);
+        if (rc == KEETO_OK) {
+            if (result != NULL) {
+                ldap_msgfree(result);
+            }
+            results[index] = ((struct keeto_ldap_memo_value *) memo_value)->result;
+            continue;
+        }
+
+        /* failed searches are memoized as well */
+        rc = put_ldap_memo_value(memo, keys[index], result, NULL);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_c;
+        }
+        results[index] = result;
     }
-    access_profile->keystore_options = keystore_options;
-    keystore_options = NULL;
+    *ret = results;
+    results = NULL;
     res = KEETO_OK;
 
 cleanup_c:
-    free_attr_values_as_string(keystore_options_from);
+    free_memo_keys(keys, count);
 cleanup_b:
-    free_attr_values_as_string(keystore_options_command);
-cleanup_a:
-    if (keystore_options != NULL) {
-        free_keystore_options(keystore_options);
+    /* do not leave requests behind in case of an error */
+    for (int i = 0; i < count && res != KEETO_OK; i++) {
+        if (msgids[i] != -1) {
+            ldap_abandon_ext(ldap_handle, msgids[i], NULL, NULL);
+        }
     }
+    free(msgids);
+cleanup_a:
+    free_search_results(results);
     return res;
 }
 
-static int
-add_key(struct berval *cert, struct keeto_keys *keys)
+static void
+free_attr_values_as_string(char **values)
 {
-    if (cert == NULL || keys == NULL) {
-        fatal("cert or keys == NULL");
-    }
-
-    int res = KEETO_UNKNOWN_ERR;
-
-    /* create and populate keeto key struct */
-    struct keeto_key *key = new_key();
-    if (key == NULL) {
-        log_error("failed to allocate memory for key buffer");
-        return KEETO_NO_MEMORY;
+    if (values == NULL) {
+        return;
     }
-
-    char *x509 = cert->bv_val;
-    ber_len_t x509_len = cert->bv_len;
-    key->x509 = d2i_X509(NULL, (const unsigned char **) &x509, (long) x509_len);
-    if (key->x509 == NULL) {
-        log_error("failed to decode certificate");
-        res = KEETO_X509_ERR;
-        goto cleanup;
+    for (int i = 0; values[i] != NULL; i++) {
+        free(values[i]);
     }
-    TAILQ_INSERT_TAIL(keys, key, next);
-    key = NULL;
-    res = KEETO_OK;
+    free(values);
+}
 
-cleanup:
-    if (key != NULL) {
-        free_key(key);
+static void
+free_attr_values_as_binary(struct berval **values)
+{
+    if (values == NULL) {
+        return;
     }
-    return res;
+    ldap_value_free_len(values);
 }
 
 static int
-add_keys(LDAP *ldap_handle, struct keeto_info *info,
-    LDAPMessage *key_provider_entry, struct keeto_key_provider *key_provider)
+get_attr_values_as_string(LDAP *ldap_handle, LDAPMessage *entry, char *attr,
+    char ***ret)
 {
-    if (ldap_handle == NULL || info == NULL || key_provider_entry == NULL ||
-        key_provider == NULL) {
-        fatal("ldap_handle, info, key_provider_entry or key_provider == NULL");
+    if (ldap_handle == NULL || entry == NULL || attr == NULL || ret == NULL) {
+        fatal("ldap_handle, entry, attr or ret == NULL");
     }
 
     int res = KEETO_UNKNOWN_ERR;
-    log_info("processing keys");
 
-    /* get certificates */
-    char *key_provider_cert_attr = cfg_getstr(info->cfg,
-        "ldap_key_provider_cert_attr");
-    struct berval **key_provider_certs = NULL;
-    int rc = get_attr_values_as_binary(ldap_handle, key_provider_entry,
-        key_provider_cert_attr, &key_provider_certs);
-    if (rc != KEETO_OK) {
-        log_error("failed to obtain key provider certificates: attribute '%s' (%s)",
-            key_provider_cert_attr, keeto_strerror(rc));
-        return KEETO_LDAP_SCHEMA_ERR;
+    /* get attribute values */
+    entry = ldap_first_entry(ldap_handle, entry);
+    if (entry == NULL) {
+        log_error("failed to parse ldap search result set");
+        return KEETO_LDAP_ERR;
     }
+    check_attr_projection(entry, attr);
 
-    /* create and populate keeto keys struct */
-    struct keeto_keys *keys = new_keys();
-    if (keys == NULL) {
-        log_error("failed to allocate memory for keys buffer");
+    /* retrieve attribute value(s) */
+    struct berval **values = ldap_get_values_len(ldap_handle, entry, attr);
+    if (values == NULL) {
+        return KEETO_LDAP_NO_SUCH_ATTR;
+    }
+
+    /* count values so we know how wide our buffer has to be */
+    int count = ldap_count_values_len(values);
+    if (count == 0) {
+        log_error("ldap search result set empty for attribute '%s'", attr);
+        res = KEETO_LDAP_ERR;
+        goto cleanup_a;
+    }
+
+    char **values_string = malloc(sizeof (char *) * (count + 1));
+    if (values_string == NULL) {
+        log_error("failed to allocate memory for attribute value buffer");
         res = KEETO_NO_MEMORY;
         goto cleanup_a;
     }
 
-    for (int i = 0; key_provider_certs[i] != NULL; i++) {
-        rc = add_key(key_provider_certs[i], keys);
-        switch (rc) {
-        case KEETO_OK:
-            log_info("added key");
-            break;
-        case KEETO_NO_MEMORY:
-            res = rc;
+    for (int i = 0; values[i] != NULL; i++) {
+        char *value = values[i]->bv_val;
+        ber_len_t len = values[i]->bv_len;
+        values_string[i] = strndup(value, len);
+        if (values_string[i] == NULL) {
+            log_error("failed to duplicate attribute value string");
+            res = KEETO_NO_MEMORY;
             goto cleanup_b;
-        default:
-            log_error("failed to add key (%s)", keeto_strerror(rc));
         }
     }
-    /* check if not empty */
-    if (TAILQ_EMPTY(keys)) {
-        res = KEETO_NO_CERT;
-        goto cleanup_b;
-    }
-    key_provider->keys = keys;
-    keys = NULL;
+    values_string[count] = NULL;
+
+    *ret = values_string;
+    values_string = NULL;
     res = KEETO_OK;
 
 cleanup_b:
-    if (keys != NULL) {
-        free_keys(keys);
+    if (values_string != NULL) {
+        free_attr_values_as_string(values_string);
     }
 cleanup_a:
-    free_attr_values_as_binary(key_provider_certs);
+    ldap_value_free_len(values);
     return res;
 }
 
 static int
-add_key_provider(LDAP *ldap_handle, struct keeto_info *info,
-    struct keeto_access_profile *access_profile,
-    LDAPMessage *key_provider_entry, struct keeto_key_providers *key_providers)
+get_attr_values_as_binary(LDAP *ldap_handle, LDAPMessage *entry, char *attr,
+    struct berval ***ret)
 {
-    if (ldap_handle == NULL || info == NULL || access_profile == NULL ||
-        key_provider_entry == NULL || key_providers == NULL) {
-        fatal("ldap_handle, info, access_profile, key_provider_entry or "
-            "key_providers == NULL");
+    if (ldap_handle == NULL || entry == NULL || attr == NULL || ret == NULL) {
+        fatal("ldap_handle, entry, attr or ret == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
-
-    /* get key provider uids */
-    char *key_provider_uid_attr = cfg_getstr(info->cfg,
-        "ldap_key_provider_uid_attr");
-    char **key_provider_uids = NULL;
-    int rc = get_attr_values_as_string(ldap_handle, key_provider_entry,
-        key_provider_uid_attr, &key_provider_uids);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
+    /* get attribute values */
+    entry = ldap_first_entry(ldap_handle, entry);
+    if (entry == NULL) {
+        log_error("failed to parse ldap search result set");
+        return KEETO_LDAP_ERR;
+    }
+    check_attr_projection(entry, attr);
+    *ret = ldap_get_values_len(ldap_handle, entry, attr);
+    if (*ret == NULL) {
+        return KEETO_LDAP_NO_SUCH_ATTR;
+    }
+    return KEETO_OK;
+}
+
+static int
+compare_dns(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * normalizes the dns of a member attribute (e.g. the members of a
+ * group) and sorts them. the result is memoized per entry dn and
+ * attribute so that every member list is only normalized once per
+ * login. ret points to memory owned by the ldap memo.
+ */
+static int
+get_normalized_member_dns(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *entry, char *attr, char ***ret, size_t *ret_count)
+{
+    if (ldap_handle == NULL || info == NULL || entry == NULL || attr == NULL ||
+        ret == NULL || ret_count == NULL) {
+        fatal("ldap_handle, info, entry, attr, ret or ret_count == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    struct keeto_memo *memo = NULL;
+    int rc = get_ldap_memo(info, &memo);
+    if (rc != KEETO_OK) {
         return rc;
-    default:
-        log_error("failed to obtain key provider uids: attribute '%s' (%s)",
-            key_provider_uid_attr, keeto_strerror(rc));
-        return KEETO_LDAP_SCHEMA_ERR;
     }
-    /*
-     * for direct access profiles a key provider is only relevant if
-     * the uid of the key provider matches the uid of the user
-     * currently logging in.
-     */
-    if (access_profile->type == DIRECT_ACCESS_PROFILE) {
-        bool relevant = false;
-        for (int i = 0; key_provider_uids[i] != NULL; i++) {
-            if (strcmp(key_provider_uids[i], info->uid) == 0) {
-                relevant = true;
-                break;
-            }
-        }
-        if (!relevant) {
-            res = KEETO_NOT_RELEVANT;
-            goto cleanup_a;
-        }
+    LDAPMessage *first_entry = ldap_first_entry(ldap_handle, entry);
+    if (first_entry == NULL) {
+        log_error("failed to parse ldap search result set");
+        return KEETO_LDAP_ERR;
     }
-    /* create and populate keeto key provider struct */
-    struct keeto_key_provider *key_provider = new_key_provider();
-    if (key_provider == NULL) {
-        log_error("failed to allocate memory for key provider buffer");
-        res = KEETO_NO_MEMORY;
+    char *entry_dn = ldap_get_dn(ldap_handle, first_entry);
+    if (entry_dn == NULL) {
+        log_error("failed to obtain dn from entry");
+        return KEETO_LDAP_ERR;
+    }
+    size_t key_length = strlen("members\n\n") + strlen(attr) +
+        strlen(entry_dn) + 1;
+    char *key = malloc(key_length);
+    if (key == NULL) {
+        log_error("failed to allocate memory for ldap memo key buffer");
+        ldap_memfree(entry_dn);
+        return KEETO_NO_MEMORY;
+    }
+    snprintf(key, key_length, "members\n%s\n%s", attr, entry_dn);
+    ldap_memfree(entry_dn);
+
+    void *value = NULL;
+    rc = memo_get(memo, key, &value);
+    if (rc == KEETO_OK) {
+        struct keeto_ldap_memo_value *memo_value = value;
+        *ret = memo_value->member_dns;
+        *ret_count = memo_value->member_dn_count;
+        res = KEETO_OK;
         goto cleanup_a;
     }
-    key_provider->dn = ldap_get_dn(ldap_handle, key_provider_entry);
-    if (key_provider->dn == NULL) {
-        log_error("failed to obtain dn from key provider entry");
-        res = KEETO_LDAP_ERR;
-        goto cleanup_b;
+
+    char **member_dns = NULL;
+    rc = get_attr_values_as_string(ldap_handle, entry, attr, &member_dns);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup_a;
     }
-    key_provider->uid = strdup(key_provider_uids[0]);
-    if (key_provider->uid == NULL) {
-        log_error("failed to duplicate key provider uid");
+    struct keeto_ldap_memo_value *memo_value = calloc(1, sizeof *memo_value);
+    if (memo_value == NULL) {
+        log_error("failed to allocate memory for ldap memo value buffer");
         res = KEETO_NO_MEMORY;
         goto cleanup_b;
     }
+    memo_value->member_dns = calloc(count_values(member_dns) + 1,
+        sizeof *memo_value->member_dns);
+    if (memo_value->member_dns == NULL) {
+        log_error("failed to allocate memory for member dns buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_c;
+    }
+    for (int i = 0; member_dns[i] != NULL; i++) {
+        char **member_dn = &memo_value->member_dns[memo_value->member_dn_count];
+        rc = normalize_dn(member_dns[i], member_dn);
+        switch (rc) {
+        case KEETO_OK:
+            memo_value->member_dn_count++;
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_c;
+        default:
+            log_error("failed to normalize dn '%s' (%s)", member_dns[i],
+                keeto_strerror(rc));
+        }
+    }
+    qsort(memo_value->member_dns, memo_value->member_dn_count,
+        sizeof *memo_value->member_dns, &compare_dns);
 
-    /* add keys */
-    rc = add_keys(ldap_handle, info, key_provider_entry, key_provider);
+    rc = memo_put(memo, key, memo_value);
     if (rc != KEETO_OK) {
         res = rc;
-        goto cleanup_b;
+        goto cleanup_c;
     }
-
-    TAILQ_INSERT_TAIL(key_providers, key_provider, next);
-    key_provider = NULL;
+    *ret = memo_value->member_dns;
+    *ret_count = memo_value->member_dn_count;
+    memo_value = NULL;
     res = KEETO_OK;
 
+cleanup_c:
+    free_ldap_memo_value(memo_value);
 cleanup_b:
-    if (key_provider != NULL) {
-        free_key_provider(key_provider);
-    };
+    free_attr_values_as_string(member_dns);
 cleanup_a:
-    free_attr_values_as_string(key_provider_uids);
+    free(key);
     return res;
 }
 
-static int
-process_key_providers(LDAP *ldap_handle, struct keeto_info *info,
-    struct keeto_access_profile *access_profile,
-    LDAPMessage *key_provider_group_entry, char *key_provider_member_attr,
-    struct keeto_key_providers *key_providers)
+/* dn has to be normalized, member_dns sorted and normalized */
+static bool
+is_dn_member(char *dn, char **member_dns, size_t member_dn_count)
 {
-    if (ldap_handle == NULL || info == NULL || access_profile == NULL ||
-        key_provider_group_entry == NULL || key_provider_member_attr == NULL ||
-        key_providers == NULL) {
-        fatal("ldap_handle, info, access_profile, key_provider_group_entry, "
-            "key_provider_member_attr or key_providers == NULL");
+    if (dn == NULL || member_dns == NULL) {
+        fatal("dn or member_dns == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    return bsearch(&dn, member_dns, member_dn_count, sizeof *member_dns,
+        &compare_dns) != NULL;
+}
 
-    /* add key providers */
-    char **key_provider_dns = NULL;
-    int rc = get_attr_values_as_string(ldap_handle, key_provider_group_entry,
-        key_provider_member_attr, &key_provider_dns);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        return rc;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        return rc;
-    default:
-        log_error("failed to obtain key provider dns: attribute '%s' (%s)",
-            key_provider_member_attr, keeto_strerror(rc));
-        return rc;
+/* creates a filter matching attr against value, e.g. (uid=keeto) */
+static int
+create_equality_filter(const char *attr, const char *value, char *buffer,
+    size_t buffer_size)
+{
+    if (attr == NULL || value == NULL || buffer == NULL) {
+        fatal("attr, value or buffer == NULL");
     }
 
-    /* prepare ldap search */
-    char *key_provider_uid_attr = cfg_getstr(info->cfg,
-        "ldap_key_provider_uid_attr");
-    char *key_provider_cert_attr = cfg_getstr(info->cfg,
-        "ldap_key_provider_cert_attr");
-    char *attrs[] = {
-        key_provider_uid_attr,
-        key_provider_cert_attr,
-        NULL
+    struct berval value_raw = {
+        .bv_len = strlen(value),
+        .bv_val = (char *) value
+    };
+    struct berval value_escaped = {
+        .bv_len = 0,
+        .bv_val = NULL
     };
+    int rc = ldap_bv2escaped_filter_value(&value_raw, &value_escaped);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to escape value '%s' (%s)", value,
+            ldap_err2string(rc));
+        return KEETO_NO_MEMORY;
+    }
+    rc = snprintf(buffer, buffer_size, "(%s=%s)", attr, value_escaped.bv_val);
+    ber_memfree(value_escaped.bv_val);
+    if (rc < 0 || (size_t) rc >= buffer_size) {
+        log_error("failed to create ldap search filter");
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
 
-    for (int i = 0; key_provider_dns[i] != NULL; i++) {
-        char *key_provider_dn = key_provider_dns[i];
-        log_info("processing key provider '%s'", key_provider_dn);
+/*
+ * creates a filter matching the entries of all dns at once, e.g.
+ * (|(entryDN=dn1)(entryDN=dn2)). if filter is set the entries have to
+ * match it as well.
+ */
+static int
+create_dn_filter(const char *filter, char **dns, int count, char **ret)
+{
+    if (dns == NULL || ret == NULL) {
+        fatal("dns or ret == NULL");
+    }
+    if (count < 1) {
+        fatal("count < 1");
+    }
 
-        LDAPMessage *key_provider_entry = NULL;
-        rc = ldap_search_keeto(ldap_handle, info, key_provider_dn,
-            LDAP_SCOPE_BASE, NULL, attrs, &key_provider_entry);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_LDAP_CONNECTION_ERR:
-        case KEETO_NO_MEMORY:
-            res = rc;
-            goto cleanup;
-        default:
-            log_error("failed to obtain key provider entry (%s)",
-                keeto_strerror(rc));
-            continue;
-        }
+    int res = KEETO_UNKNOWN_ERR;
 
-        /* add key provider */
-        rc = add_key_provider(ldap_handle, info, access_profile,
-            key_provider_entry, key_providers);
-        switch (rc) {
-        case KEETO_OK:
-            log_info("added key provider");
-            break;
-        case KEETO_NO_MEMORY:
-            res = rc;
-            ldap_msgfree(key_provider_entry);
+    struct berval *escaped_dns = calloc(count, sizeof *escaped_dns);
+    if (escaped_dns == NULL) {
+        log_error("failed to allocate memory for escaped dns buffer");
+        return KEETO_NO_MEMORY;
+    }
+    size_t length = strlen("(&(|))") + 1;
+    if (filter != NULL) {
+        length += strlen(filter);
+    }
+    for (int i = 0; i < count; i++) {
+        struct berval dn_raw = {
+            .bv_len = strlen(dns[i]),
+            .bv_val = dns[i]
+        };
+        int rc = ldap_bv2escaped_filter_value(&dn_raw, &escaped_dns[i]);
+        if (rc != LDAP_SUCCESS) {
+            log_error("failed to escape dn '%s' (%s)", dns[i],
+                ldap_err2string(rc));
+            res = KEETO_NO_MEMORY;
             goto cleanup;
-        case KEETO_NOT_RELEVANT:
-            log_info("skipped key provider (%s)", keeto_strerror(rc));
-            goto cleanup_inner;
-        default:
-            log_error("failed to add key provider (%s)", keeto_strerror(rc));
-            goto cleanup_inner;
         }
-    cleanup_inner:
-        ldap_msgfree(key_provider_entry);
+        length += strlen("(=)") + strlen(LDAP_DN_ATTR) +
+            escaped_dns[i].bv_len;
+    }
+
+    char *dn_filter = malloc(length);
+    if (dn_filter == NULL) {
+        log_error("failed to allocate memory for ldap search filter buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup;
+    }
+    size_t offset = 0;
+    if (filter != NULL) {
+        offset += snprintf(dn_filter + offset, length - offset, "(&%s",
+            filter);
     }
+    offset += snprintf(dn_filter + offset, length - offset, "(|");
+    for (int i = 0; i < count; i++) {
+        offset += snprintf(dn_filter + offset, length - offset, "(%s=%s)",
+            LDAP_DN_ATTR, escaped_dns[i].bv_val);
+    }
+    snprintf(dn_filter + offset, length - offset, filter != NULL ? "))" :
+        ")");
+    *ret = dn_filter;
     res = KEETO_OK;
 
 cleanup:
-    free_attr_values_as_string(key_provider_dns);
+    for (int i = 0; i < count; i++) {
+        ber_memfree(escaped_dns[i].bv_val);
+    }
+    free(escaped_dns);
     return res;
 }
 
+/*
+ * equality filters on uid attributes are usually matched case
+ * insensitively by the directory. entries found by uid are therefore
+ * only used if one of their uids matches byte by byte.
+ */
 static int
-add_key_providers(LDAP *ldap_handle, struct keeto_info *info,
-    LDAPMessage *access_profile_entry,
-    struct keeto_access_profile *access_profile)
+check_entry_uid(LDAP *ldap_handle, LDAPMessage *entry, char *uid_attr,
+    char *uid, bool *ret)
 {
-    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
-        access_profile == NULL) {
-        fatal("ldap_handle, info, access_profile_entry or access_profile == NULL");
+    if (ldap_handle == NULL || entry == NULL || uid_attr == NULL ||
+        uid == NULL || ret == NULL) {
+        fatal("ldap_handle, entry, uid_attr, uid or ret == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
-    log_info("processing key providers");
-
-    /* create and populate keeto key providers struct */
-    struct keeto_key_providers *key_providers = new_key_providers();
-    if (key_providers == NULL) {
-        log_error("failed to allocate memory for key providers buffer");
-        return KEETO_NO_MEMORY;
+    char **uids = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, entry, uid_attr, &uids);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    bool match = false;
+    for (int i = 0; uids[i] != NULL && !match; i++) {
+        match = strcmp(uids[i], uid) == 0;
     }
+    free_attr_values_as_string(uids);
+    *ret = match;
+    return KEETO_OK;
+}
 
-    /* add direct key providers */
-    log_info("processing direct key providers");
-    int rc = process_key_providers(ldap_handle, info, access_profile,
-        access_profile_entry, KEETO_AP_KEY_PROVIDER_ATTR, key_providers);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_LDAP_CONNECTION_ERR:
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no direct key providers specified");
-        break;
-    default:
-        log_error("failed to add direct key providers (%s)", keeto_strerror(rc));
-        break;
+/*
+ * the target keystore entries of the uid are searched only once per
+ * login. their normalized dns are kept in info so that the target
+ * keystores of access on behalf profiles can be matched locally.
+ */
+static int
+get_target_keystore_dns_by_uid(LDAP *ldap_handle, struct keeto_info *info,
+    char ***ret)
+{
+    if (ldap_handle == NULL || info == NULL || ret == NULL) {
+        fatal("ldap_handle, info or ret == NULL");
     }
 
-    /* add key provider groups */
-    log_info("processing key provider groups");
-    char **key_provider_group_dns = NULL;
-    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
-        KEETO_AP_KEY_PROVIDER_GROUP_ATTR, &key_provider_group_dns);
-    switch (rc) {
-    case KEETO_OK:
-        ;
-        char *key_provider_group_member_attr = cfg_getstr(info->cfg,
-            "ldap_key_provider_group_member_attr");
+    if (info->target_keystore_dns != NULL) {
+        *ret = info->target_keystore_dns;
+        return KEETO_OK;
+    }
 
-        for (int i = 0; key_provider_group_dns[i] != NULL; i++) {
-            char *key_provider_group_dn = key_provider_group_dns[i];
-            log_info("processing key provider group '%s'", key_provider_group_dn);
+    int res = KEETO_UNKNOWN_ERR;
 
-            LDAPMessage *group_member_entry = NULL;
-            rc = get_group_member_entry(ldap_handle, info, key_provider_group_dn,
-                key_provider_group_member_attr, &group_member_entry);
-            switch (rc) {
-            case KEETO_OK:
-                break;
-            case KEETO_LDAP_CONNECTION_ERR:
-            case KEETO_NO_MEMORY:
-                res = rc;
-                free_attr_values_as_string(key_provider_group_dns);
-                goto cleanup;
-            default:
-                log_error("failed to process key provider group (%s)",
-                    keeto_strerror(rc));
-                continue;
-            }
-
-            rc = process_key_providers(ldap_handle, info, access_profile,
-                group_member_entry, key_provider_group_member_attr, key_providers);
-            switch (rc) {
-            case KEETO_OK:
-                break;
-            case KEETO_LDAP_CONNECTION_ERR:
-            case KEETO_NO_MEMORY:
-                res = rc;
-                ldap_msgfree(group_member_entry);
-                free_attr_values_as_string(key_provider_group_dns);
-                goto cleanup;
-            case KEETO_LDAP_NO_SUCH_ATTR:
-                log_error("failed to obtain key provider dns: attribute '%s' "
-                    "(%s)", key_provider_group_member_attr, keeto_strerror(rc));
-                goto cleanup_inner;
-            default:
-                log_error("failed to process key provider group (%s)",
-                    keeto_strerror(rc));
-                goto cleanup_inner;
-            }
-        cleanup_inner:
-            ldap_msgfree(group_member_entry);
-        }
-        free_attr_values_as_string(key_provider_group_dns);
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no key provider groups specified");
-        break;
-    default:
-        log_error("failed to obtain key provider group dns: attribute '%s' (%s)",
-            KEETO_AP_KEY_PROVIDER_GROUP_ATTR, keeto_strerror(rc));
-        break;
-    }
-
-    /* check if not empty */
-    if (TAILQ_EMPTY(key_providers)) {
-        res = KEETO_NO_KEY_PROVIDER;
-        goto cleanup;
-    }
-    access_profile->key_providers = key_providers;
-    key_providers = NULL;
-    res = KEETO_OK;
-
-cleanup:
-    if (key_providers != NULL) {
-        free_key_providers(key_providers);
-    }
-    return res;
-}
-
-static int
-add_access_profile(LDAP *ldap_handle, struct keeto_info *info,
-    LDAPMessage *access_profile_entry,
-    struct keeto_access_profiles *access_profiles)
-{
-    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
-        access_profiles == NULL) {
-        fatal("ldap_handle, info, access_profile_dn or access_profiles == NULL");
+    /* prepare ldap search */
+    char *target_keystore_search_base = cfg_getstr(info->cfg,
+        "ldap_target_keystore_search_base");
+    int target_keystore_search_scope = cfg_getint(info->cfg,
+        "ldap_target_keystore_search_scope");
+    char *target_keystore_uid_attr = cfg_getstr(info->cfg,
+        "ldap_target_keystore_uid_attr");
+    char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
+    int rc = create_equality_filter(target_keystore_uid_attr, info->uid, filter,
+        sizeof filter);
+    if (rc != KEETO_OK) {
+        return rc;
     }
+    char *attrs[] = {
+        target_keystore_uid_attr,
+        NULL
+    };
 
-    int res = KEETO_UNKNOWN_ERR;
-
-    /* create and populate keeto access profile struct */
-    struct keeto_access_profile *access_profile = new_access_profile();
-    if (access_profile == NULL) {
-        log_error("failed to allocate memory for access profile buffer");
-        return KEETO_NO_MEMORY;
-    }
-    access_profile->dn = ldap_get_dn(ldap_handle, access_profile_entry);
-    if (access_profile->dn == NULL) {
-        log_error("failed to obtain dn from access profile entry");
-        res = KEETO_LDAP_ERR;
-        goto cleanup_a;
-    }
-    int rc = get_rdn_from_dn(access_profile->dn, &access_profile->uid);
+    /* query ldap for target keystore entries with matching uid */
+    struct timeval ldap_timeout;
+    rc = get_ldap_remaining_time(info, &ldap_timeout);
     if (rc != KEETO_OK) {
-        log_error("failed to obtain rdn from dn '%s' (%s)", access_profile->dn,
-            keeto_strerror(rc));
-        res = KEETO_LDAP_ERR;
-        goto cleanup_a;
+        return rc;
     }
-
-    /* add access profile type */
-    rc = add_access_profile_type(ldap_handle, access_profile_entry,
-        access_profile);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_a;
-    default:
-        log_error("failed to determine access profile type (%s)",
-            keeto_strerror(rc));
-        res = rc;
+    LDAPMessage *target_keystore_entries = NULL;
+    rc = ldap_search_ext_s(ldap_handle, target_keystore_search_base,
+        target_keystore_search_scope, filter, attrs, 0, NULL, NULL,
+        &ldap_timeout, LDAP_NO_LIMIT, &target_keystore_entries);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to search ldap (%s)", ldap_err2string(rc));
+        res = get_keeto_error_from_ldap_error(rc);
         goto cleanup_a;
     }
+    register_attr_projection(ldap_handle, target_keystore_entries, attrs);
 
-    /* check access profile relevance */
-    bool relevant = false;
-    rc = check_access_profile_relevance(ldap_handle, info, access_profile,
-        access_profile_entry, &relevant);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_LDAP_CONNECTION_ERR:
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_a;
-    default:
-        log_error("failed to check access profile relevance (%s)",
-            keeto_strerror(rc));
-        res = rc;
-        goto cleanup_a;
-    }
-    if (!relevant) {
-        res = KEETO_NOT_RELEVANT;
+    int count = ldap_count_entries(ldap_handle, target_keystore_entries);
+    if (count < 0) {
+        log_error("failed to count target keystore entries");
+        res = KEETO_LDAP_ERR;
         goto cleanup_a;
     }
-
-    /* add key providers */
-    rc = add_key_providers(ldap_handle, info, access_profile_entry,
-        access_profile);
-    if (rc != KEETO_OK) {
-        res = rc;
+    char **target_keystore_dns = calloc(count + 1, sizeof *target_keystore_dns);
+    if (target_keystore_dns == NULL) {
+        log_error("failed to allocate memory for target keystore dns buffer");
+        res = KEETO_NO_MEMORY;
         goto cleanup_a;
     }
 
-    /* add keystore options */
-    log_info("processing keystore options");
-    char **keystore_options_dn = NULL;
-    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
-        KEETO_AP_KEYSTORE_OPTIONS_ATTR, &keystore_options_dn);
-    switch (rc) {
-    case KEETO_OK:
-        log_info("processing keystore options '%s'", keystore_options_dn[0]);
+    int i = 0;
+    for (LDAPMessage *target_keystore_entry = ldap_first_entry(ldap_handle,
+        target_keystore_entries); target_keystore_entry != NULL && i < count;
+        target_keystore_entry = ldap_next_entry(ldap_handle,
+        target_keystore_entry)) {
 
-        /* prepare ldap search */
-        char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
-        rc = snprintf(filter, sizeof filter, "(objectClass=%s)",
-            KEETO_KEYSTORE_OPTIONS_OBJCLASS);
-        if (rc < 0) {
-            log_error("failed to create ldap search filter");
-            res = KEETO_SYSTEM_ERR;
-            goto cleanup_b;
+        char *target_keystore_dn = ldap_get_dn(ldap_handle,
+            target_keystore_entry);
+        if (target_keystore_dn == NULL) {
+            log_error("failed to obtain dn from target keystore entry");
+            continue;
         }
-        char *attrs[] = {
-            KEETO_KEYSTORE_OPTIONS_FROM_ATTR,
-            KEETO_KEYSTORE_OPTIONS_CMD_ATTR,
-            NULL
-        };
-
-        LDAPMessage *keystore_options_entry = NULL;
-        rc = ldap_search_keeto(ldap_handle, info, keystore_options_dn[0],
-            LDAP_SCOPE_BASE, filter, attrs, &keystore_options_entry);
+        bool match = false;
+        rc = check_entry_uid(ldap_handle, target_keystore_entry,
+            target_keystore_uid_attr, info->uid, &match);
+        if (rc != KEETO_OK || !match) {
+            ldap_memfree(target_keystore_dn);
+            if (rc == KEETO_NO_MEMORY) {
+                res = rc;
+                goto cleanup_b;
+            }
+            log_info("skipped target keystore (uid does not match exactly)");
+            continue;
+        }
+        log_info("found target keystore '%s'", target_keystore_dn);
+        rc = normalize_dn(target_keystore_dn, &target_keystore_dns[i]);
+        ldap_memfree(target_keystore_dn);
         switch (rc) {
         case KEETO_OK:
+            i++;
             break;
-        case KEETO_LDAP_CONNECTION_ERR:
         case KEETO_NO_MEMORY:
             res = rc;
             goto cleanup_b;
         default:
-            log_error("failed to obtain keystore options entry (%s)",
+            log_error("failed to normalize target keystore dn (%s)",
                 keeto_strerror(rc));
-            /*
-             * keystore options attribute is set but not pointing
-             * to a valid keystore options entry. as keystore options
-             * are used to restrict access to an SSH server the whole
-             * access profile is skipped as adding keys without the
-             * keystore options (that someone was intended to set)
-             * would give someone higher privileges than he is supposed
-             * to have.
-             */
-             res = rc;
-             goto cleanup_b;
-        }
-
-        rc = add_keystore_options(ldap_handle, keystore_options_entry,
-            access_profile);
-        switch (rc) {
-        case KEETO_OK:
-            log_info("added keystore options");
-            break;
-        case KEETO_NO_MEMORY:
-            res = rc;
-            ldap_msgfree(keystore_options_entry);
-            goto cleanup_b;
-        case KEETO_NO_KEYSTORE_OPTION:
-            log_info("keystore options entry has no option set - remove "
-                "keystore options from access profile?!");
             break;
-        default:
-            log_error("failed to add keystore options (%s)", keeto_strerror(rc));
-            res = rc;
-            ldap_msgfree(keystore_options_entry);
-            goto cleanup_b;
         }
-        ldap_msgfree(keystore_options_entry);
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_a;
-    case KEETO_LDAP_NO_SUCH_ATTR:
-        log_info("no keystore options specified");
-        break;
-    default:
-        log_error("failed to obtain keystore options dn: attribute '%s' (%s)",
-            KEETO_AP_KEYSTORE_OPTIONS_ATTR, keeto_strerror(rc));
-        res = rc;
-        goto cleanup_a;
     }
-
-    TAILQ_INSERT_TAIL(access_profiles, access_profile, next);
-    access_profile = NULL;
+    info->target_keystore_dns = target_keystore_dns;
+    target_keystore_dns = NULL;
+    *ret = info->target_keystore_dns;
     res = KEETO_OK;
 
 cleanup_b:
-    free_attr_values_as_string(keystore_options_dn);
+    free_attr_values_as_string(target_keystore_dns);
 cleanup_a:
-    if (access_profile != NULL) {
-        free_access_profile(access_profile);
+    if (target_keystore_entries != NULL) {
+        ldap_msgfree(target_keystore_entries);
     }
     return res;
 }
 
 static int
-add_access_profiles(LDAP *ldap_handle, LDAPMessage *ssh_server_entry,
-    struct keeto_info *info)
+check_target_keystores(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *target_keystore_group_entry, char *target_keystore_member_attr,
+    bool *ret)
 {
-    if (ldap_handle == NULL || ssh_server_entry == NULL || info == NULL) {
-        fatal("ldap_handle, ssh_server_entry or info == NULL");
+    if (ldap_handle == NULL || info == NULL ||
+        target_keystore_group_entry == NULL ||
+        target_keystore_member_attr == NULL || ret == NULL) {
+        fatal("ldap_handle, info, target_keystore_group_entry, "
+            "target_keystore_member_attr or ret == NULL");
     }
 
     int res = KEETO_UNKNOWN_ERR;
-    log_info("processing access profiles");
+    bool relevant = false;
 
-    /* get access profile dns */
-    char **access_profile_dns = NULL;
-    int rc = get_attr_values_as_string(ldap_handle, ssh_server_entry,
-        KEETO_SSH_SERVER_AP_ATTR, &access_profile_dns);
+    /* match target keystore entries of uid locally */
+    if (cfg_getint(info->cfg, "ldap_target_keystore_reverse_lookup")) {
+        char **member_dns = NULL;
+        size_t member_dn_count = 0;
+        int rc = get_normalized_member_dns(ldap_handle, info,
+            target_keystore_group_entry, target_keystore_member_attr,
+            &member_dns, &member_dn_count);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+        case KEETO_LDAP_NO_SUCH_ATTR:
+            return rc;
+        default:
+            log_error("failed to obtain target keystore dns: attribute '%s' "
+                "(%s)", target_keystore_member_attr, keeto_strerror(rc));
+            return rc;
+        }
+        char **uid_target_keystore_dns = NULL;
+        rc = get_target_keystore_dns_by_uid(ldap_handle, info,
+            &uid_target_keystore_dns);
+        if (rc != KEETO_OK) {
+            log_error("failed to obtain target keystores of uid (%s)",
+                keeto_strerror(rc));
+            return rc;
+        }
+        for (int i = 0; uid_target_keystore_dns[i] != NULL && !relevant; i++) {
+            relevant = is_dn_member(uid_target_keystore_dns[i], member_dns,
+                member_dn_count);
+        }
+        *ret = relevant;
+        return KEETO_OK;
+    }
+
+    /* check target keystores */
+    char **target_keystore_dns = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, target_keystore_group_entry,
+        target_keystore_member_attr, &target_keystore_dns);
     switch (rc) {
     case KEETO_OK:
         break;
     case KEETO_NO_MEMORY:
         return rc;
     case KEETO_LDAP_NO_SUCH_ATTR:
-        return KEETO_NO_ACCESS_PROFILE_FOR_SSH_SERVER;
+        return rc;
     default:
-        log_error("failed to obtain access profile dns: attribute '%s' (%s)",
-            KEETO_SSH_SERVER_AP_ATTR, keeto_strerror(rc));
+        log_error("failed to obtain target keystore dns: attribute '%s' (%s)",
+            target_keystore_member_attr, keeto_strerror(rc));
         return rc;
     }
 
-    /* create and populate keeto access profiles struct */
-    struct keeto_access_profiles *access_profiles = new_access_profiles();
-    if (access_profiles == NULL) {
-        log_error("failed to allocate memory for access profiles buffer");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_a;
-    }
-
     /* prepare ldap search */
-    char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
-    rc = snprintf(filter, sizeof filter, "(objectClass=%s)", KEETO_AP_OBJCLASS);
-    if (rc < 0) {
-        log_error("failed to create ldap search filter");
-        res = KEETO_SYSTEM_ERR;
-        goto cleanup_b;
+    char *target_keystore_uid_attr = cfg_getstr(info->cfg,
+        "ldap_target_keystore_uid_attr");
+    char *attrs[] = {
+        target_keystore_uid_attr,
+        NULL
+    };
+
+    /* query ldap for all target keystore entries at once */
+    int target_keystore_count = count_values(target_keystore_dns);
+    LDAPMessage **target_keystore_entries = NULL;
+    rc = ldap_search_keeto_batch(ldap_handle, info, target_keystore_dns,
+        LDAP_SCOPE_BASE, NULL, attrs, &target_keystore_entries);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain target keystore entries (%s)",
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
     }
 
-    /* add access profiles */
-    for (int i = 0; access_profile_dns[i] != NULL; i++) {
-        char *access_profile_dn = access_profile_dns[i];
-        log_info("processing access profile '%s'", access_profile_dn);
-
-        LDAPMessage *access_profile_entry = NULL;
-        rc = ldap_search_keeto(ldap_handle, info, access_profile_dn,
-            LDAP_SCOPE_BASE, filter, NULL, &access_profile_entry);
-        switch(rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_LDAP_CONNECTION_ERR:
-        case KEETO_NO_MEMORY:
-            res = rc;
-            goto cleanup_b;
-        default:
-            log_error("failed to obtain access profile entry (%s)",
-                keeto_strerror(rc));
+    for (int i = 0; i < target_keystore_count && !relevant; i++) {
+        char *target_keystore_dn = target_keystore_dns[i];
+        log_info("checking target keystore '%s'", target_keystore_dn);
+
+        LDAPMessage *target_keystore_entry = target_keystore_entries[i];
+        if (target_keystore_entry == NULL) {
+            log_error("failed to obtain target keystore entry");
             continue;
         }
 
-        rc = add_access_profile(ldap_handle, info, access_profile_entry,
-            access_profiles);
+        /* get uids of target keystore */
+        char **target_keystore_uids = NULL;
+        rc = get_attr_values_as_string(ldap_handle, target_keystore_entry,
+            target_keystore_uid_attr, &target_keystore_uids);
         switch (rc) {
         case KEETO_OK:
-            log_info("added access profile");
             break;
-        case KEETO_LDAP_CONNECTION_ERR:
         case KEETO_NO_MEMORY:
-        case KEETO_SYSTEM_ERR:
             res = rc;
-            ldap_msgfree(access_profile_entry);
             goto cleanup_b;
-        case KEETO_NO_KEY_PROVIDER:
-        case KEETO_NOT_RELEVANT:
-            log_info("skipped access profile (%s)", keeto_strerror(rc));
-            goto cleanup_inner;
         default:
-            log_error("failed to add access profile (%s)", keeto_strerror(rc));
-            goto cleanup_inner;
+            log_error("failed to obtain target keystore uids: attribute '%s' (%s)",
+                target_keystore_uid_attr, keeto_strerror(rc));
+            continue;
         }
-    cleanup_inner:
-        ldap_msgfree(access_profile_entry);
-    }
 
-    /* check if not empty */
-    if (TAILQ_EMPTY(access_profiles)) {
-        res = KEETO_NO_ACCESS_PROFILE_FOR_UID;
-        goto cleanup_b;
+        /* check uids */
+        for (int j = 0; target_keystore_uids[j] != NULL; j++) {
+            if (strcmp(target_keystore_uids[j], info->uid) == 0) {
+                relevant = true;
+                break;
+            }
+        }
+        free_attr_values_as_string(target_keystore_uids);
     }
-    info->access_profiles = access_profiles;
-    access_profiles = NULL;
+
+    *ret = relevant;
     res = KEETO_OK;
 
 cleanup_b:
-    if (access_profiles != NULL) {
-        free_access_profiles(access_profiles);
-    }
+    free_search_results(target_keystore_entries);
 cleanup_a:
-    free_attr_values_as_string(access_profile_dns);
+    free_attr_values_as_string(target_keystore_dns);
     return res;
 }
 
 static int
-add_ssh_server_entry(LDAP *ldap_handle, struct keeto_info *info,
-    LDAPMessage **ret)
+check_access_profile_relevance_aobp(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *access_profile_entry, bool *ret)
 {
-    if (ldap_handle == NULL || info == NULL || ret == NULL) {
-        fatal("ldap_handle, info or ret == NULL");
+    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
+        ret == NULL) {
+        fatal("ldap_handle, info, access_profile_entry or ret == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    bool relevant = false;
+    log_info("checking target keystores");
 
-    /* prepare ldap search */
-    char *ssh_server_search_base = cfg_getstr(info->cfg,
-        "ldap_ssh_server_search_base");
-    int ssh_server_search_scope = cfg_getint(info->cfg,
-        "ldap_ssh_server_search_scope");
-    char *ssh_server_uid = cfg_getstr(info->cfg, "ldap_ssh_server_uid");
-    char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
-    int rc = snprintf(filter, sizeof filter, "(&(objectClass=%s)(%s=%s))",
-        KEETO_SSH_SERVER_OBJCLASS, KEETO_SSH_SERVER_UID_ATTR, ssh_server_uid);
-    if (rc < 0) {
-        log_error("failed to create ldap search filter");
-        return KEETO_SYSTEM_ERR;
+    /* no target keystore with the uid exists */
+    if (cfg_getint(info->cfg, "ldap_target_keystore_reverse_lookup")) {
+        char **uid_target_keystore_dns = NULL;
+        int rc = get_target_keystore_dns_by_uid(ldap_handle, info,
+            &uid_target_keystore_dns);
+        if (rc != KEETO_OK) {
+            log_error("failed to obtain target keystores of uid (%s)",
+                keeto_strerror(rc));
+            return rc;
+        }
+        if (uid_target_keystore_dns[0] == NULL) {
+            log_info("no target keystore with uid '%s' found", info->uid);
+            *ret = false;
+            return KEETO_OK;
+        }
     }
-    char *attrs[] = {
-        KEETO_SSH_SERVER_AP_ATTR,
-        NULL
-    };
 
-    /* query ldap for ssh server entry */
-    LDAPMessage *ssh_server_entry = NULL;
-    rc = ldap_search_keeto(ldap_handle, info, ssh_server_search_base,
-        ssh_server_search_scope, filter, attrs, &ssh_server_entry);
-    if (rc != KEETO_OK) {
-        log_error("failed to obtain ssh server entry (%s)", keeto_strerror(rc));
+    /* check direct target keystores */
+    log_info("checking direct target keystores");
+    int rc = check_target_keystores(ldap_handle, info, access_profile_entry,
+        KEETO_AOBP_TARGET_KEYSTORE_ATTR, &relevant);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_LDAP_CONNECTION_ERR:
+    case KEETO_NO_MEMORY:
         return rc;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no direct target keystores specified");
+        break;
+    default:
+        log_error("failed to check direct target keystores (%s)",
+            keeto_strerror(rc));
+        break;
     }
-
-    /* create and populate keeto ssh server struct */
-    struct keeto_ssh_server *ssh_server = new_ssh_server();
-    if (ssh_server == NULL) {
-        log_error("failed to allocate memory for ssh server buffer");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_a;
+    if (relevant) {
+        *ret = true;
+        return KEETO_OK;
     }
 
-    ssh_server->dn = ldap_get_dn(ldap_handle, ssh_server_entry);
-    if (ssh_server->dn == NULL) {
-        log_error("failed to obtain dn from ssh server entry");
-        res = KEETO_LDAP_ERR;
-        goto cleanup_b;
+    /* check target keystore groups */
+    log_info("checking target keystore groups");
+    char **target_keystore_group_dns = NULL;
+    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
+        KEETO_AOBP_TARGET_KEYSTORE_GROUP_ATTR, &target_keystore_group_dns);
+    switch (rc) {
+    case KEETO_OK:
+        ;
+        char *target_keystore_group_member_attr = cfg_getstr(info->cfg,
+            "ldap_target_keystore_group_member_attr");
+        char *attrs[] = {
+            target_keystore_group_member_attr,
+            NULL
+        };
+
+        /* query ldap for all target keystore group entries at once */
+        int group_count = count_values(target_keystore_group_dns);
+        LDAPMessage **group_member_entries = NULL;
+        rc = ldap_search_keeto_batch(ldap_handle, info,
+            target_keystore_group_dns, LDAP_SCOPE_BASE, NULL, attrs,
+            &group_member_entries);
+        if (rc != KEETO_OK) {
+            log_error("failed to obtain target keystore group entries (%s)",
+                keeto_strerror(rc));
+            free_attr_values_as_string(target_keystore_group_dns);
+            return rc;
+        }
+
+        for (int i = 0; i < group_count && !relevant; i++) {
+            char *target_keystore_group_dn = target_keystore_group_dns[i];
+            log_info("checking target keystore group '%s'",
+                target_keystore_group_dn);
+
+            LDAPMessage *group_member_entry = group_member_entries[i];
+            if (group_member_entry == NULL) {
+                log_error("failed to obtain group member entry");
+                continue;
+            }
+
+            rc = check_target_keystores(ldap_handle, info, group_member_entry,
+                target_keystore_group_member_attr, &relevant);
+            switch (rc) {
+            case KEETO_OK:
+                break;
+            case KEETO_LDAP_CONNECTION_ERR:
+            case KEETO_NO_MEMORY:
+                free_search_results(group_member_entries);
+                free_attr_values_as_string(target_keystore_group_dns);
+                return rc;
+            case KEETO_LDAP_NO_SUCH_ATTR:
+                log_error("failed to obtain target keystore dns: attribute '%s' "
+                    "(%s)", target_keystore_group_member_attr, keeto_strerror(rc));
+                break;
+            default:
+                log_error("failed to check target keystore group (%s)",
+                    keeto_strerror(rc));
+                break;
+            }
+        }
+        free_search_results(group_member_entries);
+        free_attr_values_as_string(target_keystore_group_dns);
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no target keystore groups specified");
+        break;
+    default:
+        log_error("failed to obtain target keystore group dns: attribute '%s' "
+            "(%s)", KEETO_AOBP_TARGET_KEYSTORE_GROUP_ATTR, keeto_strerror(rc));
+        break;
     }
-    ssh_server->uid = strdup(cfg_getstr(info->cfg, "ldap_ssh_server_uid"));
-    if (ssh_server->uid == NULL) {
-        log_error("failed to duplicate ssh server uid");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_b;
+    if (relevant) {
+        *ret = true;
+        return KEETO_OK;
     }
 
-    *ret = ssh_server_entry;
-    ssh_server_entry = NULL;
-    info->ssh_server = ssh_server;
-    ssh_server = NULL;
-    res = KEETO_OK;
+    *ret = false;
+    return KEETO_OK;
+}
 
-cleanup_b:
-    if (ssh_server != NULL) {
-        free_ssh_server(ssh_server);
+static int
+check_access_profile_enabled(LDAP *ldap_handle,
+    LDAPMessage *access_profile_entry, bool *ret)
+{
+    if (ldap_handle == NULL || access_profile_entry == NULL || ret == NULL) {
+        fatal("ldap_handle, access_profile_entry or ret == NULL");
     }
-cleanup_a:
-    if (ssh_server_entry != NULL) {
-        ldap_msgfree(ssh_server_entry);
+
+    /*
+     * determine state of access profile from KEETO_AP_ENABLED_ATTR
+     * attribute.
+     */
+    char **access_profile_state = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
+        KEETO_AP_ENABLED_ATTR, &access_profile_state);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    default:
+        log_error("failed to obtain access profile state: attribute '%s' (%s)",
+            KEETO_AP_ENABLED_ATTR, keeto_strerror(rc));
+        return KEETO_LDAP_SCHEMA_ERR;
     }
-    return res;
+    *ret = strcmp(access_profile_state[0], LDAP_BOOL_TRUE) == 0 ? true : false;
+    free_attr_values_as_string(access_profile_state);
+    return KEETO_OK;
 }
 
 static int
-init_starttls(LDAP *ldap_handle)
+check_access_profile_relevance_generic(LDAP *ldap_handle,
+    LDAPMessage *access_profile_entry, bool *ret)
 {
-    if (ldap_handle == NULL) {
-        fatal("ldap_handle == NULL");
+    if (ldap_handle == NULL || access_profile_entry == NULL || ret == NULL) {
+        fatal("ldap_handle, access_profile_entry or ret == NULL");
     }
 
-    /* initiate start tls session with server */
-    int rc = ldap_start_tls_s(ldap_handle, NULL, NULL);
-    if (rc != LDAP_SUCCESS) {
-        char *msg = NULL;
-        int old_rc = rc;
-        rc = ldap_get_option(ldap_handle, LDAP_OPT_DIAGNOSTIC_MESSAGE, &msg);
+    /* check if acccess profile entry is enabled */
+    bool profile_enabled = false;
+    int rc = check_access_profile_enabled(ldap_handle, access_profile_entry,
+        &profile_enabled);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    default:
+        log_error("failed to check if profile is enabled (%s)",
+            keeto_strerror(rc));
+        return rc;
+    }
+    if (!profile_enabled) {
+        log_info("access profile disabled");
+        *ret = false;
+        return KEETO_OK;
+    }
+    /* do further checks here in the future */
+    *ret = true;
+    return KEETO_OK;
+}
+
+static int
+check_access_profile_relevance(LDAP *ldap_handle, struct keeto_info *info,
+    struct keeto_access_profile *access_profile,
+    LDAPMessage *access_profile_entry, bool *ret)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile == NULL ||
+        access_profile_entry == NULL || ret == NULL) {
+        fatal("ldap_handle, info, access_profile, access_profile_entry or ret "
+            "== NULL");
+    }
+
+    bool relevant = false;
+    int rc = check_access_profile_relevance_generic(ldap_handle,
+        access_profile_entry, &relevant);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    default:
+        log_error("failed to check generic access profile relevance (%s)",
+            keeto_strerror(rc));
+        return rc;
+    }
+    if (!relevant) {
+        *ret = false;
+        return KEETO_OK;
+    }
+
+    /*
+     * an access on behalf profile is only relevant if there is a
+     * target keystore with a uid matching the uid of the user
+     * currently logging in.
+     */
+    if (access_profile->type == ACCESS_ON_BEHALF_PROFILE) {
+        bool relevant = false;
+        rc = check_access_profile_relevance_aobp(ldap_handle, info,
+            access_profile_entry, &relevant);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_LDAP_CONNECTION_ERR:
+        case KEETO_NO_MEMORY:
+            return rc;
+        default:
+            log_error("failed to check access on behalf profile relevance (%s)",
+                keeto_strerror(rc));
+            return rc;
+        }
+        if (!relevant) {
+            *ret = false;
+            return KEETO_OK;
+        }
+    }
+    *ret = true;
+    return KEETO_OK;
+}
+
+static int
+add_access_profile_type(LDAP *ldap_handle, LDAPMessage *access_profile_entry,
+    struct keeto_access_profile *access_profile)
+{
+    if (ldap_handle == NULL || access_profile_entry == NULL ||
+        access_profile == NULL) {
+        fatal("ldap_handle, access_profile_entry or access_profile == NULL");
+    }
+
+    /* determine access profile type from objectClass attribute */
+    char **objectclasses = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
+        "objectClass", &objectclasses);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    default:
+        log_error("failed to obtain access profile type: attribute '%s' (%s)",
+            "objectClass", keeto_strerror(rc));
+        return KEETO_LDAP_SCHEMA_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ACCESS_PROFILE_TYPE;
+    /* search for access profile type */
+    for (int i = 0; objectclasses[i] != NULL; i++) {
+        char *objectclass = objectclasses[i];
+        if (strcmp(objectclass, KEETO_DAP_OBJCLASS) == 0) {
+            access_profile->type = DIRECT_ACCESS_PROFILE;
+            res = KEETO_OK;
+            break;
+        } else if (strcmp(objectclass, KEETO_AOBP_OBJCLASS) == 0) {
+            access_profile->type = ACCESS_ON_BEHALF_PROFILE;
+            res = KEETO_OK;
+            break;
+        }
+    }
+    free_attr_values_as_string(objectclasses);
+    return res;
+}
+
+static int
+add_keystore_options(LDAP *ldap_handle, LDAPMessage *keystore_options_entry,
+    struct keeto_access_profile *access_profile)
+{
+    if (ldap_handle == NULL || keystore_options_entry == NULL ||
+        access_profile == NULL) {
+        fatal("ldap_handle, keystore_options_entry or access_profile == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* create and populate keeto keystore options struct */
+    struct keeto_keystore_options *keystore_options = new_keystore_options();
+    if (keystore_options == NULL) {
+        log_error("failed to allocate memory for keystore options buffer");
+        return KEETO_NO_MEMORY;
+    }
+    keystore_options->dn = ldap_get_dn(ldap_handle, keystore_options_entry);
+    if (keystore_options->dn == NULL) {
+        log_error("failed to obtain dn from keystore options entry");
+        res = KEETO_LDAP_ERR;
+        goto cleanup_a;
+    }
+    int rc = get_rdn_from_dn(keystore_options->dn, &keystore_options->uid);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain rdn from dn '%s' (%s)", keystore_options->dn,
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
+    }
+
+    /* get attribute values */
+    char **keystore_options_command = NULL;
+    rc = get_attr_values_as_string(ldap_handle, keystore_options_entry,
+        KEETO_KEYSTORE_OPTIONS_CMD_ATTR, &keystore_options_command);
+    switch (rc) {
+    case KEETO_OK:
+        keystore_options->command_option = strdup(keystore_options_command[0]);
+        if (keystore_options->command_option == NULL) {
+            log_error("failed to duplicate keystore option 'command'");
+            res = KEETO_NO_MEMORY;
+            goto cleanup_b;
+        }
+        log_info("added keystore option 'command'");
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup_a;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no keystore option 'command' specified");
+        break;
+    default:
+        log_error("failed to obtain keystore option 'command': attribute '%s' (%s)",
+            KEETO_KEYSTORE_OPTIONS_CMD_ATTR, keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
+    }
+
+    char **keystore_options_from = NULL;
+    rc = get_attr_values_as_string(ldap_handle, keystore_options_entry,
+        KEETO_KEYSTORE_OPTIONS_FROM_ATTR, &keystore_options_from);
+    switch (rc) {
+    case KEETO_OK:
+        keystore_options->from_option = strdup(keystore_options_from[0]);
+        if (keystore_options->from_option == NULL) {
+            log_error("failed to duplicate keystore option 'from'");
+            res = KEETO_NO_MEMORY;
+            goto cleanup_c;
+        }
+        log_info("added keystore option 'from'");
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup_b;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no keystore option 'from' specified");
+        break;
+    default:
+        log_error("failed to obtain keystore option 'from': attribute '%s' (%s)",
+            KEETO_KEYSTORE_OPTIONS_FROM_ATTR, keeto_strerror(rc));
+        res = rc;
+        goto cleanup_b;
+    }
+
+    /* only add keystore options if at least one options has been set */
+    if (keystore_options->from_option == NULL &&
+        keystore_options->command_option == NULL) {
+
+        res = KEETO_NO_KEYSTORE_OPTION;
+        goto cleanup_c;
+    }
+    access_profile->keystore_options = keystore_options;
+    keystore_options = NULL;
+    res = KEETO_OK;
+
+cleanup_c:
+    free_attr_values_as_string(keystore_options_from);
+cleanup_b:
+    free_attr_values_as_string(keystore_options_command);
+cleanup_a:
+    if (keystore_options != NULL) {
+        free_keystore_options(keystore_options);
+    }
+    return res;
+}
+
+static int
+add_key(struct berval *cert, struct keeto_keys *keys)
+{
+    if (cert == NULL || keys == NULL) {
+        fatal("cert or keys == NULL");
+    }
+
+    if (cert->bv_len == 0) {
+        return KEETO_NO_CERT;
+    }
+
+    /* create and populate keeto key struct */
+    struct keeto_key *key = new_key();
+    if (key == NULL) {
+        log_error("failed to allocate memory for key buffer");
+        return KEETO_NO_MEMORY;
+    }
+    /*
+     * the certificate is shared with the ldap memo. it is decoded only
+     * if the key is post processed.
+     */
+    key->der = (const unsigned char *) cert->bv_val;
+    key->der_length = cert->bv_len;
+    TAILQ_INSERT_TAIL(keys, key, next);
+    return KEETO_OK;
+}
+
+/*
+ * certificates of a key provider are obtained only once per login even
+ * if the key provider is part of several access profiles.
+ */
+static int
+get_key_provider_certs(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *key_provider_entry, struct berval ***ret)
+{
+    if (ldap_handle == NULL || info == NULL || key_provider_entry == NULL ||
+        ret == NULL) {
+        fatal("ldap_handle, info, key_provider_entry or ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    struct keeto_memo *memo = NULL;
+    int rc = get_ldap_memo(info, &memo);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    char *key_provider_cert_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_cert_attr");
+    char *key_provider_dn = ldap_get_dn(ldap_handle, key_provider_entry);
+    if (key_provider_dn == NULL) {
+        log_error("failed to obtain dn from key provider entry");
+        return KEETO_LDAP_ERR;
+    }
+    size_t key_length = strlen("x509\n\n") + strlen(key_provider_cert_attr) +
+        strlen(key_provider_dn) + 1;
+    char *key = malloc(key_length);
+    if (key == NULL) {
+        log_error("failed to allocate memory for ldap memo key buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    snprintf(key, key_length, "x509\n%s\n%s", key_provider_cert_attr,
+        key_provider_dn);
+
+    void *memo_value = NULL;
+    rc = memo_get(memo, key, &memo_value);
+    if (rc == KEETO_OK) {
+        log_debug("using memoized certificates of '%s'", key_provider_dn);
+        *ret = ((struct keeto_ldap_memo_value *) memo_value)->certs;
+        res = KEETO_OK;
+        goto cleanup_b;
+    }
+
+    /* get certificates */
+    struct berval **key_provider_certs = NULL;
+    rc = get_attr_values_as_binary(ldap_handle, key_provider_entry,
+        key_provider_cert_attr, &key_provider_certs);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain key provider certificates: attribute '%s' (%s)",
+            key_provider_cert_attr, keeto_strerror(rc));
+        res = KEETO_LDAP_SCHEMA_ERR;
+        goto cleanup_b;
+    }
+    rc = put_ldap_memo_value(memo, key, NULL, key_provider_certs);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup_b;
+    }
+    *ret = key_provider_certs;
+    res = KEETO_OK;
+
+cleanup_b:
+    free(key);
+cleanup_a:
+    ldap_memfree(key_provider_dn);
+    return res;
+}
+
+static int
+add_keys(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *key_provider_entry, struct keeto_key_provider *key_provider)
+{
+    if (ldap_handle == NULL || info == NULL || key_provider_entry == NULL ||
+        key_provider == NULL) {
+        fatal("ldap_handle, info, key_provider_entry or key_provider == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    log_info("processing keys");
+
+    /* get certificates */
+    struct berval **certs = NULL;
+    int rc = get_key_provider_certs(ldap_handle, info, key_provider_entry,
+        &certs);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    /* create and populate keeto keys struct */
+    struct keeto_keys *keys = new_keys();
+    if (keys == NULL) {
+        log_error("failed to allocate memory for keys buffer");
+        return KEETO_NO_MEMORY;
+    }
+
+    for (int i = 0; certs[i] != NULL; i++) {
+        rc = add_key(certs[i], keys);
+        switch (rc) {
+        case KEETO_OK:
+            log_info("added key");
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup;
+        default:
+            log_error("failed to add key (%s)", keeto_strerror(rc));
+        }
+    }
+    /* check if not empty */
+    if (TAILQ_EMPTY(keys)) {
+        res = KEETO_NO_CERT;
+        goto cleanup;
+    }
+    key_provider->keys = keys;
+    keys = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    if (keys != NULL) {
+        free_keys(keys);
+    }
+    return res;
+}
+
+static int
+add_key_provider(LDAP *ldap_handle, struct keeto_info *info,
+    struct keeto_access_profile *access_profile,
+    LDAPMessage *key_provider_entry, struct keeto_key_providers *key_providers)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile == NULL ||
+        key_provider_entry == NULL || key_providers == NULL) {
+        fatal("ldap_handle, info, access_profile, key_provider_entry or "
+            "key_providers == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* get key provider uids */
+    char *key_provider_uid_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_uid_attr");
+    char **key_provider_uids = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, key_provider_entry,
+        key_provider_uid_attr, &key_provider_uids);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    default:
+        log_error("failed to obtain key provider uids: attribute '%s' (%s)",
+            key_provider_uid_attr, keeto_strerror(rc));
+        return KEETO_LDAP_SCHEMA_ERR;
+    }
+    /*
+     * for direct access profiles a key provider is only relevant if
+     * the uid of the key provider matches the uid of the user
+     * currently logging in.
+     */
+    if (access_profile->type == DIRECT_ACCESS_PROFILE) {
+        bool relevant = false;
+        for (int i = 0; key_provider_uids[i] != NULL; i++) {
+            if (strcmp(key_provider_uids[i], info->uid) == 0) {
+                relevant = true;
+                break;
+            }
+        }
+        if (!relevant) {
+            res = KEETO_NOT_RELEVANT;
+            goto cleanup_a;
+        }
+    }
+    /* create and populate keeto key provider struct */
+    struct keeto_key_provider *key_provider = new_key_provider();
+    if (key_provider == NULL) {
+        log_error("failed to allocate memory for key provider buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    key_provider->dn = ldap_get_dn(ldap_handle, key_provider_entry);
+    if (key_provider->dn == NULL) {
+        log_error("failed to obtain dn from key provider entry");
+        res = KEETO_LDAP_ERR;
+        goto cleanup_b;
+    }
+    key_provider->uid = strdup(key_provider_uids[0]);
+    if (key_provider->uid == NULL) {
+        log_error("failed to duplicate key provider uid");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_b;
+    }
+
+    /* add keys */
+    rc = add_keys(ldap_handle, info, key_provider_entry, key_provider);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup_b;
+    }
+
+    TAILQ_INSERT_TAIL(key_providers, key_provider, next);
+    key_provider = NULL;
+    res = KEETO_OK;
+
+cleanup_b:
+    if (key_provider != NULL) {
+        free_key_provider(key_provider);
+    };
+cleanup_a:
+    free_attr_values_as_string(key_provider_uids);
+    return res;
+}
+
+static int
+process_key_providers(LDAP *ldap_handle, struct keeto_info *info,
+    struct keeto_access_profile *access_profile,
+    LDAPMessage *key_provider_group_entry, char *key_provider_member_attr,
+    struct keeto_key_providers *key_providers)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile == NULL ||
+        key_provider_group_entry == NULL || key_provider_member_attr == NULL ||
+        key_providers == NULL) {
+        fatal("ldap_handle, info, access_profile, key_provider_group_entry, "
+            "key_provider_member_attr or key_providers == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* add key providers */
+    char **key_provider_dns = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, key_provider_group_entry,
+        key_provider_member_attr, &key_provider_dns);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        return rc;
+    default:
+        log_error("failed to obtain key provider dns: attribute '%s' (%s)",
+            key_provider_member_attr, keeto_strerror(rc));
+        return rc;
+    }
+
+    /* prepare ldap search */
+    char *key_provider_uid_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_uid_attr");
+    char *key_provider_cert_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_cert_attr");
+    char *attrs[] = {
+        key_provider_uid_attr,
+        key_provider_cert_attr,
+        NULL
+    };
+
+    /* query ldap for all key provider entries at once */
+    int key_provider_count = count_values(key_provider_dns);
+    LDAPMessage **key_provider_entries = NULL;
+    rc = ldap_search_keeto_batch(ldap_handle, info, key_provider_dns,
+        LDAP_SCOPE_BASE, NULL, attrs, &key_provider_entries);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain key provider entries (%s)",
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
+    }
+
+    for (int i = 0; i < key_provider_count; i++) {
+        char *key_provider_dn = key_provider_dns[i];
+        log_info("processing key provider '%s'", key_provider_dn);
+
+        LDAPMessage *key_provider_entry = key_provider_entries[i];
+        if (key_provider_entry == NULL) {
+            log_error("failed to obtain key provider entry");
+            continue;
+        }
+
+        /* add key provider */
+        rc = add_key_provider(ldap_handle, info, access_profile,
+            key_provider_entry, key_providers);
+        switch (rc) {
+        case KEETO_OK:
+            log_info("added key provider");
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_b;
+        case KEETO_NOT_RELEVANT:
+            log_info("skipped key provider (%s)", keeto_strerror(rc));
+            break;
+        default:
+            log_error("failed to add key provider (%s)", keeto_strerror(rc));
+            break;
+        }
+    }
+    res = KEETO_OK;
+
+cleanup_b:
+    free_search_results(key_provider_entries);
+cleanup_a:
+    free_attr_values_as_string(key_provider_dns);
+    return res;
+}
+
+static int
+add_key_providers_by_dn(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *access_profile_entry,
+    struct keeto_access_profile *access_profile,
+    struct keeto_key_providers *key_providers)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
+        access_profile == NULL || key_providers == NULL) {
+        fatal("ldap_handle, info, access_profile_entry, access_profile or "
+            "key_providers == NULL");
+    }
+
+    /* add direct key providers */
+    log_info("processing direct key providers");
+    int rc = process_key_providers(ldap_handle, info, access_profile,
+        access_profile_entry, KEETO_AP_KEY_PROVIDER_ATTR, key_providers);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_LDAP_CONNECTION_ERR:
+    case KEETO_NO_MEMORY:
+        return rc;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no direct key providers specified");
+        break;
+    default:
+        log_error("failed to add direct key providers (%s)", keeto_strerror(rc));
+        break;
+    }
+
+    /* add key provider groups */
+    log_info("processing key provider groups");
+    char **key_provider_group_dns = NULL;
+    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
+        KEETO_AP_KEY_PROVIDER_GROUP_ATTR, &key_provider_group_dns);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no key provider groups specified");
+        return KEETO_OK;
+    default:
+        log_error("failed to obtain key provider group dns: attribute '%s' (%s)",
+            KEETO_AP_KEY_PROVIDER_GROUP_ATTR, keeto_strerror(rc));
+        return KEETO_OK;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    char *key_provider_group_member_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_group_member_attr");
+    char *attrs[] = {
+        key_provider_group_member_attr,
+        NULL
+    };
+
+    /* query ldap for all key provider group entries at once */
+    int group_count = count_values(key_provider_group_dns);
+    LDAPMessage **group_member_entries = NULL;
+    rc = ldap_search_keeto_batch(ldap_handle, info, key_provider_group_dns,
+        LDAP_SCOPE_BASE, NULL, attrs, &group_member_entries);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain key provider group entries (%s)",
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
+    }
+
+    for (int i = 0; i < group_count; i++) {
+        char *key_provider_group_dn = key_provider_group_dns[i];
+        log_info("processing key provider group '%s'", key_provider_group_dn);
+
+        LDAPMessage *group_member_entry = group_member_entries[i];
+        if (group_member_entry == NULL) {
+            log_error("failed to obtain group member entry");
+            continue;
+        }
+
+        rc = process_key_providers(ldap_handle, info, access_profile,
+            group_member_entry, key_provider_group_member_attr, key_providers);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_LDAP_CONNECTION_ERR:
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_b;
+        case KEETO_LDAP_NO_SUCH_ATTR:
+            log_error("failed to obtain key provider dns: attribute '%s' (%s)",
+                key_provider_group_member_attr, keeto_strerror(rc));
+            break;
+        default:
+            log_error("failed to process key provider group (%s)",
+                keeto_strerror(rc));
+            break;
+        }
+    }
+    res = KEETO_OK;
+
+cleanup_b:
+    free_search_results(group_member_entries);
+cleanup_a:
+    free_attr_values_as_string(key_provider_group_dns);
+    return res;
+}
+
+static int
+check_key_provider_membership(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *access_profile_entry, char *key_provider_dn, bool *ret)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
+        key_provider_dn == NULL || ret == NULL) {
+        fatal("ldap_handle, info, access_profile_entry, key_provider_dn or "
+            "ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    char *dn = NULL;
+    int rc = normalize_dn(key_provider_dn, &dn);
+    if (rc != KEETO_OK) {
+        log_error("failed to normalize dn '%s' (%s)", key_provider_dn,
+            keeto_strerror(rc));
+        return rc;
+    }
+
+    /* check direct key providers */
+    bool member = false;
+    char **key_provider_dns = NULL;
+    size_t key_provider_dn_count = 0;
+    rc = get_normalized_member_dns(ldap_handle, info, access_profile_entry,
+        KEETO_AP_KEY_PROVIDER_ATTR, &key_provider_dns, &key_provider_dn_count);
+    switch (rc) {
+    case KEETO_OK:
+        member = is_dn_member(dn, key_provider_dns, key_provider_dn_count);
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup_a;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        break;
+    default:
+        log_error("failed to obtain key provider dns: attribute '%s' (%s)",
+            KEETO_AP_KEY_PROVIDER_ATTR, keeto_strerror(rc));
+        break;
+    }
+    if (member) {
+        log_info("key provider is a direct key provider");
+        *ret = true;
+        res = KEETO_OK;
+        goto cleanup_a;
+    }
+
+    /* check key provider groups */
+    char **key_provider_group_dns = NULL;
+    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
+        KEETO_AP_KEY_PROVIDER_GROUP_ATTR, &key_provider_group_dns);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup_a;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        *ret = false;
+        res = KEETO_OK;
+        goto cleanup_a;
+    default:
+        log_error("failed to obtain key provider group dns: attribute '%s' (%s)",
+            KEETO_AP_KEY_PROVIDER_GROUP_ATTR, keeto_strerror(rc));
+        *ret = false;
+        res = KEETO_OK;
+        goto cleanup_a;
+    }
+
+    /*
+     * instead of fetching all members of the key provider groups the
+     * directory is asked which of the groups have the key provider as
+     * member. the dns are compared using the matching rule of the
+     * member attribute.
+     */
+    char *key_provider_search_base = cfg_getstr(info->cfg,
+        "ldap_key_provider_search_base");
+    char *key_provider_group_member_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_group_member_attr");
+    char member_filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
+    rc = create_equality_filter(key_provider_group_member_attr,
+        key_provider_dn, member_filter, sizeof member_filter);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup_b;
+    }
+    char *attrs[] = {
+        LDAP_NO_ATTRS,
+        NULL
+    };
+
+    int group_count = count_values(key_provider_group_dns);
+    for (int offset = 0; offset < group_count && !member;
+        offset += LDAP_PREFETCH_CHUNK_SIZE) {
+
+        int count = group_count - offset;
+        if (count > LDAP_PREFETCH_CHUNK_SIZE) {
+            count = LDAP_PREFETCH_CHUNK_SIZE;
+        }
+        char *filter = NULL;
+        rc = create_dn_filter(member_filter, key_provider_group_dns + offset,
+            count, &filter);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_b;
+        }
+        struct timeval ldap_timeout;
+        rc = get_ldap_remaining_time(info, &ldap_timeout);
+        if (rc != KEETO_OK) {
+            free(filter);
+            res = rc;
+            goto cleanup_b;
+        }
+        /* a single matching group is enough */
+        LDAPMessage *group_entries = NULL;
+        rc = ldap_search_ext_s(ldap_handle, key_provider_search_base,
+            LDAP_SCOPE_SUBTREE, filter, attrs, 0, NULL, NULL, &ldap_timeout, 1,
+            &group_entries);
+        free(filter);
+        if (rc != LDAP_SUCCESS && rc != LDAP_SIZELIMIT_EXCEEDED) {
+            log_error("failed to search ldap (%s)", ldap_err2string(rc));
+            if (group_entries != NULL) {
+                ldap_msgfree(group_entries);
+            }
+            res = get_keeto_error_from_ldap_error(rc);
+            goto cleanup_b;
+        }
+        LDAPMessage *group_entry = ldap_first_entry(ldap_handle,
+            group_entries);
+        if (group_entry != NULL) {
+            member = true;
+            char *group_dn = ldap_get_dn(ldap_handle, group_entry);
+            log_info("key provider is member of key provider group '%s'",
+                group_dn != NULL ? group_dn : "");
+            ldap_memfree(group_dn);
+        }
+        ldap_msgfree(group_entries);
+    }
+    *ret = member;
+    res = KEETO_OK;
+
+cleanup_b:
+    free_attr_values_as_string(key_provider_group_dns);
+cleanup_a:
+    free(dn);
+    return res;
+}
+
+/*
+ * for direct access profiles only the key provider with the uid of the
+ * user logging in is relevant. instead of querying every key provider
+ * of the access profile the key provider is searched by uid and it is
+ * checked locally whether it is a direct key provider or member of a
+ * key provider group of the access profile.
+ */
+static int
+add_key_providers_by_uid(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *access_profile_entry,
+    struct keeto_access_profile *access_profile,
+    struct keeto_key_providers *key_providers)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
+        access_profile == NULL || key_providers == NULL) {
+        fatal("ldap_handle, info, access_profile_entry, access_profile or "
+            "key_providers == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* prepare ldap search */
+    char *key_provider_search_base = cfg_getstr(info->cfg,
+        "ldap_key_provider_search_base");
+    int key_provider_search_scope = cfg_getint(info->cfg,
+        "ldap_key_provider_search_scope");
+    char *key_provider_uid_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_uid_attr");
+    char *key_provider_cert_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_cert_attr");
+    char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
+    int rc = create_equality_filter(key_provider_uid_attr, info->uid, filter,
+        sizeof filter);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    char *attrs[] = {
+        key_provider_uid_attr,
+        key_provider_cert_attr,
+        NULL
+    };
+
+    /*
+     * the search is the same for every direct access profile. the
+     * result is memoized and owned by the ldap memo.
+     */
+    struct keeto_memo *memo = NULL;
+    rc = get_ldap_memo(info, &memo);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    char *memo_key = NULL;
+    rc = create_search_memo_key(key_provider_search_base,
+        key_provider_search_scope, filter, attrs, &memo_key);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    LDAPMessage *key_provider_entries = NULL;
+    void *memo_value = NULL;
+    rc = memo_get(memo, memo_key, &memo_value);
+    if (rc == KEETO_OK) {
+        log_debug("using memoized ldap search result: base '%s'",
+            key_provider_search_base);
+        key_provider_entries =
+            ((struct keeto_ldap_memo_value *) memo_value)->result;
+        if (key_provider_entries == NULL) {
+            res = KEETO_LDAP_ERR;
+            goto cleanup;
+        }
+    } else {
+        /* query ldap for key provider entries with matching uid */
+        struct timeval ldap_timeout;
+        rc = get_ldap_remaining_time(info, &ldap_timeout);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+        rc = ldap_search_ext_s(ldap_handle, key_provider_search_base,
+            key_provider_search_scope, filter, attrs, 0, NULL, NULL,
+            &ldap_timeout, LDAP_NO_LIMIT, &key_provider_entries);
+        if (rc != LDAP_SUCCESS) {
+            log_error("failed to search ldap (%s)", ldap_err2string(rc));
+            if (key_provider_entries != NULL) {
+                ldap_msgfree(key_provider_entries);
+            }
+            res = get_keeto_error_from_ldap_error(rc);
+            goto cleanup;
+        }
+        rc = put_ldap_memo_value(memo, memo_key, key_provider_entries, NULL);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+    }
+    register_attr_projection(ldap_handle, key_provider_entries, attrs);
+
+    for (LDAPMessage *key_provider_entry = ldap_first_entry(ldap_handle,
+        key_provider_entries); key_provider_entry != NULL;
+        key_provider_entry = ldap_next_entry(ldap_handle, key_provider_entry)) {
+
+        char *key_provider_dn = ldap_get_dn(ldap_handle, key_provider_entry);
+        if (key_provider_dn == NULL) {
+            log_error("failed to obtain dn from key provider entry");
+            continue;
+        }
+        log_info("processing key provider '%s'", key_provider_dn);
+
+        bool match = false;
+        rc = check_entry_uid(ldap_handle, key_provider_entry,
+            key_provider_uid_attr, info->uid, &match);
+        if (rc != KEETO_OK || !match) {
+            ldap_memfree(key_provider_dn);
+            if (rc == KEETO_NO_MEMORY) {
+                res = rc;
+                goto cleanup;
+            }
+            log_info("skipped key provider (uid does not match exactly)");
+            continue;
+        }
+
+        bool member = false;
+        rc = check_key_provider_membership(ldap_handle, info,
+            access_profile_entry, key_provider_dn, &member);
+        ldap_memfree(key_provider_dn);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_LDAP_CONNECTION_ERR:
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup;
+        default:
+            log_error("failed to check key provider membership (%s)",
+                keeto_strerror(rc));
+            continue;
+        }
+        if (!member) {
+            log_info("skipped key provider (not part of access profile)");
+            continue;
+        }
+
+        /* add key provider */
+        rc = add_key_provider(ldap_handle, info, access_profile,
+            key_provider_entry, key_providers);
+        switch (rc) {
+        case KEETO_OK:
+            log_info("added key provider");
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup;
+        case KEETO_NOT_RELEVANT:
+            log_info("skipped key provider (%s)", keeto_strerror(rc));
+            break;
+        default:
+            log_error("failed to add key provider (%s)", keeto_strerror(rc));
+            break;
+        }
+    }
+    res = KEETO_OK;
+
+cleanup:
+    free(memo_key);
+    return res;
+}
+
+static int
+add_key_providers(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *access_profile_entry,
+    struct keeto_access_profile *access_profile)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
+        access_profile == NULL) {
+        fatal("ldap_handle, info, access_profile_entry or access_profile == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    log_info("processing key providers");
+
+    /* create and populate keeto key providers struct */
+    struct keeto_key_providers *key_providers = new_key_providers();
+    if (key_providers == NULL) {
+        log_error("failed to allocate memory for key providers buffer");
+        return KEETO_NO_MEMORY;
+    }
+
+    int rc;
+    bool reverse_lookup = cfg_getint(info->cfg,
+        "ldap_key_provider_reverse_lookup");
+    if (access_profile->type == DIRECT_ACCESS_PROFILE && reverse_lookup) {
+        log_info("searching key provider by uid '%s'", info->uid);
+        rc = add_key_providers_by_uid(ldap_handle, info, access_profile_entry,
+            access_profile, key_providers);
+    } else {
+        rc = add_key_providers_by_dn(ldap_handle, info, access_profile_entry,
+            access_profile, key_providers);
+    }
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_LDAP_CONNECTION_ERR:
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup;
+    default:
+        log_error("failed to add key providers (%s)", keeto_strerror(rc));
+        break;
+    }
+
+    /* check if not empty */
+    if (TAILQ_EMPTY(key_providers)) {
+        res = KEETO_NO_KEY_PROVIDER;
+        goto cleanup;
+    }
+    access_profile->key_providers = key_providers;
+    key_providers = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    if (key_providers != NULL) {
+        free_key_providers(key_providers);
+    }
+    return res;
+}
+
+/*
+ * kinds of entries below the access profiles. the order is the order
+ * in which the prefetch searches of a level are sent.
+ */
+enum keeto_ldap_entry_kind {
+    KEY_PROVIDER_GROUP_ENTRY,
+    KEY_PROVIDER_ENTRY,
+    TARGET_KEYSTORE_GROUP_ENTRY,
+    TARGET_KEYSTORE_ENTRY,
+    KEYSTORE_OPTIONS_ENTRY,
+    LDAP_ENTRY_KIND_COUNT
+};
+
+/*
+ * entries of one kind that are fetched together. they are memoized as
+ * if they had been fetched with a base search using filter and attrs,
+ * which is what the code processing them does.
+ */
+struct keeto_ldap_prefetch {
+    char *base;
+    char *filter;
+    char *attrs[3];
+    /* members of the entries are not prefetched if NULL */
+    char *member_attr;
+    char **dns;
+    int dn_count;
+    int dn_size;
+};
+
+/* the entries of one level of the access profile tree */
+struct keeto_ldap_level {
+    int depth;
+    struct keeto_ldap_prefetch prefetches[LDAP_ENTRY_KIND_COUNT];
+};
+
+/*
+ * members of a group are one level below the group. the tree is not
+ * followed beyond LDAP_TREE_MAX_DEPTH levels below the access profiles.
+ */
+static bool
+get_member_kind(enum keeto_ldap_entry_kind kind, int depth,
+    enum keeto_ldap_entry_kind *ret)
+{
+    if (ret == NULL) {
+        fatal("ret == NULL");
+    }
+
+    if (depth >= LDAP_TREE_MAX_DEPTH) {
+        return false;
+    }
+    switch (kind) {
+    case KEY_PROVIDER_GROUP_ENTRY:
+        *ret = KEY_PROVIDER_ENTRY;
+        return true;
+    case TARGET_KEYSTORE_GROUP_ENTRY:
+        *ret = TARGET_KEYSTORE_ENTRY;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void
+init_ldap_level(struct keeto_info *info, int depth,
+    struct keeto_ldap_level *level)
+{
+    if (info == NULL || level == NULL) {
+        fatal("info or level == NULL");
+    }
+
+    memset(level, 0, sizeof *level);
+    level->depth = depth;
+
+    char *key_provider_search_base = cfg_getstr(info->cfg,
+        "ldap_key_provider_search_base");
+    char *target_keystore_search_base = cfg_getstr(info->cfg,
+        "ldap_target_keystore_search_base");
+    struct keeto_ldap_prefetch *prefetch =
+        &level->prefetches[KEY_PROVIDER_GROUP_ENTRY];
+    prefetch->base = key_provider_search_base;
+    prefetch->member_attr = cfg_getstr(info->cfg,
+        "ldap_key_provider_group_member_attr");
+    prefetch->attrs[0] = prefetch->member_attr;
+
+    prefetch = &level->prefetches[KEY_PROVIDER_ENTRY];
+    prefetch->base = key_provider_search_base;
+    prefetch->attrs[0] = cfg_getstr(info->cfg, "ldap_key_provider_uid_attr");
+    prefetch->attrs[1] = cfg_getstr(info->cfg, "ldap_key_provider_cert_attr");
+
+    prefetch = &level->prefetches[TARGET_KEYSTORE_GROUP_ENTRY];
+    prefetch->base = target_keystore_search_base;
+    prefetch->member_attr = cfg_getstr(info->cfg,
+        "ldap_target_keystore_group_member_attr");
+    prefetch->attrs[0] = prefetch->member_attr;
+
+    prefetch = &level->prefetches[TARGET_KEYSTORE_ENTRY];
+    prefetch->base = target_keystore_search_base;
+    prefetch->attrs[0] = cfg_getstr(info->cfg,
+        "ldap_target_keystore_uid_attr");
+
+    prefetch = &level->prefetches[KEYSTORE_OPTIONS_ENTRY];
+    prefetch->base = key_provider_search_base;
+    prefetch->filter = "(objectClass=" KEETO_KEYSTORE_OPTIONS_OBJCLASS ")";
+    prefetch->attrs[0] = KEETO_KEYSTORE_OPTIONS_FROM_ATTR;
+    prefetch->attrs[1] = KEETO_KEYSTORE_OPTIONS_CMD_ATTR;
+}
+
+static void
+free_ldap_level_dns(struct keeto_ldap_level *level)
+{
+    if (level == NULL) {
+        fatal("level == NULL");
+    }
+
+    for (int i = 0; i < LDAP_ENTRY_KIND_COUNT; i++) {
+        struct keeto_ldap_prefetch *prefetch = &level->prefetches[i];
+        for (int j = 0; j < prefetch->dn_count; j++) {
+            free(prefetch->dns[j]);
+        }
+        free(prefetch->dns);
+        prefetch->dns = NULL;
+        prefetch->dn_count = 0;
+        prefetch->dn_size = 0;
+    }
+}
+
+static int
+add_prefetch_dn(struct keeto_ldap_prefetch *prefetch, const char *dn)
+{
+    if (prefetch == NULL || dn == NULL) {
+        fatal("prefetch or dn == NULL");
+    }
+
+    if (prefetch->dn_count == prefetch->dn_size) {
+        int dn_size = prefetch->dn_size == 0 ? 16 : prefetch->dn_size * 2;
+        char **dns = realloc(prefetch->dns, sizeof *dns * dn_size);
+        if (dns == NULL) {
+            log_error("failed to allocate memory for prefetch dns buffer");
+            return KEETO_NO_MEMORY;
+        }
+        prefetch->dns = dns;
+        prefetch->dn_size = dn_size;
+    }
+    prefetch->dns[prefetch->dn_count] = strdup(dn);
+    if (prefetch->dns[prefetch->dn_count] == NULL) {
+        log_error("failed to duplicate prefetch dn");
+        return KEETO_NO_MEMORY;
+    }
+    prefetch->dn_count++;
+    return KEETO_OK;
+}
+
+/* entries without attr do not reference anything */
+static int
+add_prefetch_dns(LDAP *ldap_handle, LDAPMessage *entry, char *attr,
+    bool first_only, struct keeto_ldap_prefetch *prefetch)
+{
+    if (ldap_handle == NULL || entry == NULL || attr == NULL ||
+        prefetch == NULL) {
+        fatal("ldap_handle, entry, attr or prefetch == NULL");
+    }
+
+    char **dns = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, entry, attr, &dns);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    default:
+        return KEETO_OK;
+    }
+    for (int i = 0; dns[i] != NULL && (i == 0 || !first_only); i++) {
+        rc = add_prefetch_dn(prefetch, dns[i]);
+        if (rc != KEETO_OK) {
+            break;
+        }
+    }
+    free_attr_values_as_string(dns);
+    return rc;
+}
+
+static int
+get_prefetch_memo_key(struct keeto_ldap_prefetch *prefetch, char *dn,
+    char **ret)
+{
+    if (prefetch == NULL || dn == NULL || ret == NULL) {
+        fatal("prefetch, dn or ret == NULL");
+    }
+
+    return create_search_memo_key(dn, LDAP_SCOPE_BASE, prefetch->filter,
+        prefetch->attrs, ret);
+}
+
+/*
+ * sorts the dns, drops duplicates and the dns that are memoized
+ * already.
+ */
+static int
+reduce_prefetch_dns(struct keeto_memo *memo,
+    struct keeto_ldap_prefetch *prefetch)
+{
+    if (memo == NULL || prefetch == NULL) {
+        fatal("memo or prefetch == NULL");
+    }
+
+    qsort(prefetch->dns, prefetch->dn_count, sizeof *prefetch->dns,
+        &compare_dns);
+    int count = 0;
+    for (int i = 0; i < prefetch->dn_count; i++) {
+        char *dn = prefetch->dns[i];
+        bool keep = count == 0 || strcmp(prefetch->dns[count - 1], dn) != 0;
+        if (keep) {
+            char *key = NULL;
+            int rc = get_prefetch_memo_key(prefetch, dn, &key);
+            if (rc != KEETO_OK) {
+                return rc;
+            }
+            void *memo_value = NULL;
+            keep = memo_get(memo, key, &memo_value) != KEETO_OK;
+            free(key);
+        }
+        if (keep) {
+            prefetch->dns[count++] = dn;
+        } else {
+            free(dn);
+        }
+    }
+    prefetch->dn_count = count;
+    return KEETO_OK;
+}
+
+/* one or-filter search for up to LDAP_PREFETCH_CHUNK_SIZE dns */
+struct keeto_ldap_prefetch_search {
+    struct keeto_ldap_prefetch *prefetch;
+    int offset;
+    int count;
+    char *filter;
+    int msgid;
+};
+
+/*
+ * memoizes the entries of a prefetch search under the dns they have
+ * been requested with. the entries are taken out of result so that
+ * each of them looks like the result of a base search. takes ownership
+ * of result in any case.
+ */
+static int
+add_prefetch_result(LDAP *ldap_handle, struct keeto_memo *memo,
+    struct keeto_ldap_prefetch_search *search, LDAPMessage *result,
+    int *ret_count)
+{
+    if (ldap_handle == NULL || memo == NULL || search == NULL ||
+        result == NULL || ret_count == NULL) {
+        fatal("ldap_handle, memo, search, result or ret_count == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    struct keeto_ldap_prefetch *prefetch = search->prefetch;
+
+    char **dns = calloc(search->count, sizeof *dns);
+    if (dns == NULL) {
+        log_error("failed to allocate memory for normalized dns buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    for (int i = 0; i < search->count; i++) {
+        int rc = normalize_dn(prefetch->dns[search->offset + i], &dns[i]);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_b;
+        default:
+            dns[i] = NULL;
+        }
+    }
+
+    LDAPMessage *entry = ldap_first_entry(ldap_handle, result);
+    while (entry != NULL) {
+        LDAPMessage *next_entry = ldap_next_entry(ldap_handle, entry);
+
+        char *entry_dn = ldap_get_dn(ldap_handle, entry);
+        if (entry_dn == NULL) {
+            log_error("failed to obtain dn from entry");
+            entry = next_entry;
+            continue;
+        }
+        char *dn = NULL;
+        int rc = normalize_dn(entry_dn, &dn);
+        ldap_memfree(entry_dn);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_b;
+        default:
+            entry = next_entry;
+            continue;
+        }
+        int index = -1;
+        for (int i = 0; i < search->count && index == -1; i++) {
+            if (dns[i] != NULL && strcmp(dns[i], dn) == 0) {
+                index = i;
+            }
+        }
+        free(dn);
+        if (index == -1) {
+            entry = next_entry;
+            continue;
+        }
+
+        char *key = NULL;
+        rc = get_prefetch_memo_key(prefetch,
+            prefetch->dns[search->offset + index], &key);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_b;
+        }
+        entry = ldap_delete_result_entry(&result, entry);
+        if (entry == NULL) {
+            fatal("entry not part of prefetch search result");
+        }
+        register_attr_projection(ldap_handle, entry, prefetch->attrs);
+        rc = put_ldap_memo_value(memo, key, entry, NULL);
+        free(key);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_b;
+        }
+        (*ret_count)++;
+        entry = next_entry;
+    }
+    res = KEETO_OK;
+
+cleanup_b:
+    for (int i = 0; i < search->count; i++) {
+        free(dns[i]);
+    }
+    free(dns);
+cleanup_a:
+    if (result != NULL) {
+        ldap_msgfree(result);
+    }
+    return res;
+}
+
+/*
+ * fetches all entries of a level with one or-filter search per kind
+ * (and chunk of dns). the searches are sent at once so the whole level
+ * costs about one round trip.
+ *
+ * the prefetch is an optimization only. entries that are not found,
+ * e.g. because they are not located below the search base or the
+ * directory does not provide entryDN, are left to the base searches
+ * of the code processing them.
+ */
+static int
+prefetch_ldap_level(LDAP *ldap_handle, struct keeto_info *info,
+    struct keeto_ldap_level *level)
+{
+    if (ldap_handle == NULL || info == NULL || level == NULL) {
+        fatal("ldap_handle, info or level == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    struct keeto_memo *memo = NULL;
+    int rc = get_ldap_memo(info, &memo);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    int search_count = 0;
+    int dn_count = 0;
+    for (int i = 0; i < LDAP_ENTRY_KIND_COUNT; i++) {
+        struct keeto_ldap_prefetch *prefetch = &level->prefetches[i];
+        rc = reduce_prefetch_dns(memo, prefetch);
+        if (rc != KEETO_OK) {
+            return rc;
+        }
+        search_count += (prefetch->dn_count + LDAP_PREFETCH_CHUNK_SIZE - 1) /
+            LDAP_PREFETCH_CHUNK_SIZE;
+        dn_count += prefetch->dn_count;
+    }
+    if (search_count == 0) {
+        return KEETO_OK;
+    }
+    struct keeto_ldap_prefetch_search *searches = calloc(search_count,
+        sizeof *searches);
+    if (searches == NULL) {
+        log_error("failed to allocate memory for prefetch search buffer");
+        return KEETO_NO_MEMORY;
+    }
+
+    /* send all searches of the level without waiting for responses */
+    int pending = 0;
+    int index = 0;
+    for (int i = 0; i < LDAP_ENTRY_KIND_COUNT; i++) {
+        struct keeto_ldap_prefetch *prefetch = &level->prefetches[i];
+        for (int offset = 0; offset < prefetch->dn_count;
+            offset += LDAP_PREFETCH_CHUNK_SIZE) {
+
+            struct keeto_ldap_prefetch_search *search = &searches[index++];
+            search->prefetch = prefetch;
+            search->offset = offset;
+            search->count = prefetch->dn_count - offset;
+            if (search->count > LDAP_PREFETCH_CHUNK_SIZE) {
+                search->count = LDAP_PREFETCH_CHUNK_SIZE;
+            }
+            search->msgid = -1;
+            rc = create_dn_filter(prefetch->filter, prefetch->dns + offset,
+                search->count, &search->filter);
+            if (rc != KEETO_OK) {
+                res = rc;
+                goto cleanup;
+            }
+            rc = ldap_search_ext(ldap_handle, prefetch->base,
+                LDAP_SCOPE_SUBTREE, search->filter, prefetch->attrs, 0, NULL,
+                NULL, NULL, LDAP_NO_LIMIT, &search->msgid);
+            if (rc != LDAP_SUCCESS) {
+                log_error("failed to send ldap prefetch search: base '%s' "
+                    "(%s)", prefetch->base, ldap_err2string(rc));
+                search->msgid = -1;
+                rc = get_keeto_error_from_ldap_error(rc);
+                switch (rc) {
+                case KEETO_LDAP_CONNECTION_ERR:
+                case KEETO_NO_MEMORY:
+                    res = rc;
+                    goto cleanup;
+                default:
+                    continue;
+                }
+            }
+            pending++;
+        }
+    }
+
+    /* collect responses in the order they arrive */
+    int found_count = 0;
+    while (pending > 0) {
+        struct timeval ldap_timeout;
+        rc = get_ldap_remaining_time(info, &ldap_timeout);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+        LDAPMessage *result = NULL;
+        rc = ldap_result(ldap_handle, LDAP_RES_ANY, LDAP_MSG_ALL,
+            &ldap_timeout, &result);
+        switch (rc) {
+        case -1:
+            ldap_get_option(ldap_handle, LDAP_OPT_RESULT_CODE, &rc);
+            log_error("failed to obtain ldap prefetch result (%s)",
+                ldap_err2string(rc));
+            res = get_keeto_error_from_ldap_error(rc);
+            if (res == KEETO_LDAP_ERR) {
+                res = KEETO_LDAP_CONNECTION_ERR;
+            }
+            goto cleanup;
+        case 0:
+            log_error("failed to obtain ldap prefetch result (%s)",
+                ldap_err2string(LDAP_TIMEOUT));
+            res = KEETO_LDAP_CONNECTION_ERR;
+            goto cleanup;
+        }
+
+        int msgid = ldap_msgid(result);
+        struct keeto_ldap_prefetch_search *search = NULL;
+        for (int i = 0; i < search_count; i++) {
+            if (searches[i].msgid == msgid) {
+                search = &searches[i];
+                break;
+            }
+        }
+        if (search == NULL) {
+            log_debug("discarding unexpected ldap message (%d)", msgid);
+            ldap_msgfree(result);
+            continue;
+        }
+        search->msgid = -1;
+        pending--;
+
+        /* partial results (e.g. size limit exceeded) are used as well */
+        int ldap_error = LDAP_SUCCESS;
+        rc = ldap_parse_result(ldap_handle, result, &ldap_error, NULL, NULL,
+            NULL, NULL, 0);
+        if (rc != LDAP_SUCCESS) {
+            ldap_error = rc;
+        }
+        if (ldap_error != LDAP_SUCCESS) {
+            log_debug("ldap prefetch search incomplete: base '%s' (%s)",
+                search->prefetch->base, ldap_err2string(ldap_error));
+            rc = get_keeto_error_from_ldap_error(ldap_error);
+            if (rc == KEETO_LDAP_CONNECTION_ERR || rc == KEETO_NO_MEMORY) {
+                ldap_msgfree(result);
+                res = rc;
+                goto cleanup;
+            }
+        }
+        rc = add_prefetch_result(ldap_handle, memo, search, result,
+            &found_count);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+    }
+    log_info("prefetched %d of %d entries at depth %d", found_count, dn_count,
+        level->depth);
+    res = KEETO_OK;
+
+cleanup:
+    for (int i = 0; i < search_count; i++) {
+        /* do not leave requests behind in case of an error */
+        if (searches[i].msgid != -1) {
+            ldap_abandon_ext(ldap_handle, searches[i].msgid, NULL, NULL);
+        }
+        free(searches[i].filter);
+    }
+    free(searches);
+    return res;
+}
+
+/* adds the members of the groups of level to next */
+static int
+add_member_dns(LDAP *ldap_handle, struct keeto_info *info,
+    struct keeto_ldap_level *level, struct keeto_ldap_level *next)
+{
+    if (ldap_handle == NULL || info == NULL || level == NULL ||
+        next == NULL) {
+        fatal("ldap_handle, info, level or next == NULL");
+    }
+
+    struct keeto_memo *memo = NULL;
+    int rc = get_ldap_memo(info, &memo);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    for (int i = 0; i < LDAP_ENTRY_KIND_COUNT; i++) {
+        struct keeto_ldap_prefetch *prefetch = &level->prefetches[i];
+        enum keeto_ldap_entry_kind member_kind;
+        if (prefetch->member_attr == NULL ||
+            !get_member_kind(i, level->depth, &member_kind)) {
+            continue;
+        }
+        for (int j = 0; j < prefetch->dn_count; j++) {
+            char *key = NULL;
+            rc = get_prefetch_memo_key(prefetch, prefetch->dns[j], &key);
+            if (rc != KEETO_OK) {
+                return rc;
+            }
+            void *memo_value = NULL;
+            rc = memo_get(memo, key, &memo_value);
+            free(key);
+            if (rc != KEETO_OK) {
+                continue;
+            }
+            LDAPMessage *group_entry =
+                ((struct keeto_ldap_memo_value *) memo_value)->result;
+            if (group_entry == NULL) {
+                continue;
+            }
+            rc = add_prefetch_dns(ldap_handle, group_entry,
+                prefetch->member_attr, false,
+                &next->prefetches[member_kind]);
+            if (rc != KEETO_OK) {
+                return rc;
+            }
+        }
+    }
+    return KEETO_OK;
+}
+
+/*
+ * prefetches level and all levels below. afterwards level does not hold
+ * any dns anymore.
+ */
+static int
+prefetch_ldap_tree(LDAP *ldap_handle, struct keeto_info *info,
+    struct keeto_ldap_level *level)
+{
+    if (ldap_handle == NULL || info == NULL || level == NULL) {
+        fatal("ldap_handle, info or level == NULL");
+    }
+
+    int rc = KEETO_OK;
+    struct keeto_ldap_level next;
+    while (rc == KEETO_OK) {
+        rc = prefetch_ldap_level(ldap_handle, info, level);
+        if (rc != KEETO_OK) {
+            break;
+        }
+        init_ldap_level(info, level->depth + 1, &next);
+        rc = add_member_dns(ldap_handle, info, level, &next);
+        free_ldap_level_dns(level);
+        *level = next;
+        if (rc != KEETO_OK) {
+            break;
+        }
+        bool empty = true;
+        for (int i = 0; i < LDAP_ENTRY_KIND_COUNT && empty; i++) {
+            empty = level->prefetches[i].dn_count == 0;
+        }
+        if (empty) {
+            break;
+        }
+    }
+    free_ldap_level_dns(level);
+    return rc;
+}
+
+/*
+ * the relevance of access on behalf profiles depends on their target
+ * keystores. these are prefetched for all profiles before the
+ * relevance of any of them is checked.
+ */
+static int
+prefetch_target_keystores(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage **access_profile_entries,
+    struct keeto_access_profile **access_profiles, int count)
+{
+    if (ldap_handle == NULL || info == NULL ||
+        access_profile_entries == NULL || access_profiles == NULL) {
+        fatal("ldap_handle, info, access_profile_entries or access_profiles "
+            "== NULL");
+    }
+
+    bool reverse_lookup = cfg_getint(info->cfg,
+        "ldap_target_keystore_reverse_lookup");
+    struct keeto_ldap_level level;
+    init_ldap_level(info, 1, &level);
+    /* target keystores of uid are matched against the members locally */
+    if (reverse_lookup) {
+        level.prefetches[TARGET_KEYSTORE_GROUP_ENTRY].member_attr = NULL;
+    }
+
+    int rc = KEETO_OK;
+    for (int i = 0; i < count && rc == KEETO_OK; i++) {
+        if (access_profiles[i] == NULL ||
+            access_profiles[i]->type != ACCESS_ON_BEHALF_PROFILE) {
+            continue;
+        }
+        rc = add_prefetch_dns(ldap_handle, access_profile_entries[i],
+            KEETO_AOBP_TARGET_KEYSTORE_GROUP_ATTR, false,
+            &level.prefetches[TARGET_KEYSTORE_GROUP_ENTRY]);
+        if (rc == KEETO_OK && !reverse_lookup) {
+            rc = add_prefetch_dns(ldap_handle, access_profile_entries[i],
+                KEETO_AOBP_TARGET_KEYSTORE_ATTR, false,
+                &level.prefetches[TARGET_KEYSTORE_ENTRY]);
+        }
+    }
+    if (rc != KEETO_OK) {
+        free_ldap_level_dns(&level);
+        return rc;
+    }
+    return prefetch_ldap_tree(ldap_handle, info, &level);
+}
+
+/*
+ * key providers and keystore options are prefetched for the relevant
+ * access profiles only.
+ */
+static int
+prefetch_key_providers(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage **access_profile_entries,
+    struct keeto_access_profile **access_profiles, int count)
+{
+    if (ldap_handle == NULL || info == NULL ||
+        access_profile_entries == NULL || access_profiles == NULL) {
+        fatal("ldap_handle, info, access_profile_entries or access_profiles "
+            "== NULL");
+    }
+
+    bool reverse_lookup = cfg_getint(info->cfg,
+        "ldap_key_provider_reverse_lookup");
+    struct keeto_ldap_level level;
+    init_ldap_level(info, 1, &level);
+
+    int rc = KEETO_OK;
+    for (int i = 0; i < count && rc == KEETO_OK; i++) {
+        if (access_profiles[i] == NULL) {
+            continue;
+        }
+        rc = add_prefetch_dns(ldap_handle, access_profile_entries[i],
+            KEETO_AP_KEYSTORE_OPTIONS_ATTR, true,
+            &level.prefetches[KEYSTORE_OPTIONS_ENTRY]);
+        /* the key provider is searched by uid instead */
+        if (access_profiles[i]->type == DIRECT_ACCESS_PROFILE &&
+            reverse_lookup) {
+            continue;
+        }
+        if (rc == KEETO_OK) {
+            rc = add_prefetch_dns(ldap_handle, access_profile_entries[i],
+                KEETO_AP_KEY_PROVIDER_GROUP_ATTR, false,
+                &level.prefetches[KEY_PROVIDER_GROUP_ENTRY]);
+        }
+        if (rc == KEETO_OK) {
+            rc = add_prefetch_dns(ldap_handle, access_profile_entries[i],
+                KEETO_AP_KEY_PROVIDER_ATTR, false,
+                &level.prefetches[KEY_PROVIDER_ENTRY]);
+        }
+    }
+    if (rc != KEETO_OK) {
+        free_ldap_level_dns(&level);
+        return rc;
+    }
+    return prefetch_ldap_tree(ldap_handle, info, &level);
+}
+
+static int
+create_access_profile(LDAP *ldap_handle, LDAPMessage *access_profile_entry,
+    struct keeto_access_profile **ret)
+{
+    if (ldap_handle == NULL || access_profile_entry == NULL || ret == NULL) {
+        fatal("ldap_handle, access_profile_entry or ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* create and populate keeto access profile struct */
+    struct keeto_access_profile *access_profile = new_access_profile();
+    if (access_profile == NULL) {
+        log_error("failed to allocate memory for access profile buffer");
+        return KEETO_NO_MEMORY;
+    }
+    access_profile->dn = ldap_get_dn(ldap_handle, access_profile_entry);
+    if (access_profile->dn == NULL) {
+        log_error("failed to obtain dn from access profile entry");
+        res = KEETO_LDAP_ERR;
+        goto cleanup;
+    }
+    int rc = get_rdn_from_dn(access_profile->dn, &access_profile->uid);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain rdn from dn '%s' (%s)", access_profile->dn,
+            keeto_strerror(rc));
+        res = KEETO_LDAP_ERR;
+        goto cleanup;
+    }
+
+    /* add access profile type */
+    rc = add_access_profile_type(ldap_handle, access_profile_entry,
+        access_profile);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup;
+    default:
+        log_error("failed to determine access profile type (%s)",
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup;
+    }
+    *ret = access_profile;
+    access_profile = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    if (access_profile != NULL) {
+        free_access_profile(access_profile);
+    }
+    return res;
+}
+
+/*
+ * takes ownership of access_profile in any case.
+ */
+static int
+add_access_profile(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage *access_profile_entry,
+    struct keeto_access_profile *access_profile,
+    struct keeto_access_profiles *access_profiles)
+{
+    if (ldap_handle == NULL || info == NULL || access_profile_entry == NULL ||
+        access_profile == NULL || access_profiles == NULL) {
+        fatal("ldap_handle, info, access_profile_entry, access_profile or "
+            "access_profiles == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* add key providers */
+    int rc = add_key_providers(ldap_handle, info, access_profile_entry,
+        access_profile);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup_a;
+    }
+
+    /* add keystore options */
+    log_info("processing keystore options");
+    char **keystore_options_dn = NULL;
+    rc = get_attr_values_as_string(ldap_handle, access_profile_entry,
+        KEETO_AP_KEYSTORE_OPTIONS_ATTR, &keystore_options_dn);
+    switch (rc) {
+    case KEETO_OK:
+        log_info("processing keystore options '%s'", keystore_options_dn[0]);
+
+        /* prepare ldap search */
+        char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
+        rc = snprintf(filter, sizeof filter, "(objectClass=%s)",
+            KEETO_KEYSTORE_OPTIONS_OBJCLASS);
+        if (rc < 0) {
+            log_error("failed to create ldap search filter");
+            res = KEETO_SYSTEM_ERR;
+            goto cleanup_b;
+        }
+        char *attrs[] = {
+            KEETO_KEYSTORE_OPTIONS_FROM_ATTR,
+            KEETO_KEYSTORE_OPTIONS_CMD_ATTR,
+            NULL
+        };
+
+        /* the entry might have been prefetched already */
+        char *keystore_options_bases[] = {
+            keystore_options_dn[0],
+            NULL
+        };
+        LDAPMessage **keystore_options_entries = NULL;
+        rc = ldap_search_keeto_batch(ldap_handle, info, keystore_options_bases,
+            LDAP_SCOPE_BASE, filter, attrs, &keystore_options_entries);
+        LDAPMessage *keystore_options_entry = NULL;
+        if (rc == KEETO_OK) {
+            keystore_options_entry = keystore_options_entries[0];
+            free_search_results(keystore_options_entries);
+            if (keystore_options_entry == NULL) {
+                rc = KEETO_LDAP_NO_SUCH_ENTRY;
+            }
+        }
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_LDAP_CONNECTION_ERR:
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_b;
+        default:
+            log_error("failed to obtain keystore options entry (%s)",
+                keeto_strerror(rc));
+            /*
+             * keystore options attribute is set but not pointing
+             * to a valid keystore options entry. as keystore options
+             * are used to restrict access to an SSH server the whole
+             * access profile is skipped as adding keys without the
+             * keystore options (that someone was intended to set)
+             * would give someone higher privileges than he is supposed
+             * to have.
+             */
+             res = rc;
+             goto cleanup_b;
+        }
+
+        rc = add_keystore_options(ldap_handle, keystore_options_entry,
+            access_profile);
+        switch (rc) {
+        case KEETO_OK:
+            log_info("added keystore options");
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_b;
+        case KEETO_NO_KEYSTORE_OPTION:
+            log_info("keystore options entry has no option set - remove "
+                "keystore options from access profile?!");
+            break;
+        default:
+            log_error("failed to add keystore options (%s)", keeto_strerror(rc));
+            res = rc;
+            goto cleanup_b;
+        }
+        break;
+    case KEETO_NO_MEMORY:
+        res = rc;
+        goto cleanup_a;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        log_info("no keystore options specified");
+        break;
+    default:
+        log_error("failed to obtain keystore options dn: attribute '%s' (%s)",
+            KEETO_AP_KEYSTORE_OPTIONS_ATTR, keeto_strerror(rc));
+        res = rc;
+        goto cleanup_a;
+    }
+
+    TAILQ_INSERT_TAIL(access_profiles, access_profile, next);
+    access_profile = NULL;
+    res = KEETO_OK;
+
+cleanup_b:
+    free_attr_values_as_string(keystore_options_dn);
+cleanup_a:
+    if (access_profile != NULL) {
+        free_access_profile(access_profile);
+    }
+    return res;
+}
+
+static int
+add_access_profiles(LDAP *ldap_handle, LDAPMessage *ssh_server_entry,
+    struct keeto_info *info)
+{
+    if (ldap_handle == NULL || ssh_server_entry == NULL || info == NULL) {
+        fatal("ldap_handle, ssh_server_entry or info == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    log_info("processing access profiles");
+
+    /* get access profile dns */
+    char **access_profile_dns = NULL;
+    int rc = get_attr_values_as_string(ldap_handle, ssh_server_entry,
+        KEETO_SSH_SERVER_AP_ATTR, &access_profile_dns);
+    switch (rc) {
+    case KEETO_OK:
+        break;
+    case KEETO_NO_MEMORY:
+        return rc;
+    case KEETO_LDAP_NO_SUCH_ATTR:
+        return KEETO_NO_ACCESS_PROFILE_FOR_SSH_SERVER;
+    default:
+        log_error("failed to obtain access profile dns: attribute '%s' (%s)",
+            KEETO_SSH_SERVER_AP_ATTR, keeto_strerror(rc));
+        return rc;
+    }
+
+    /* create and populate keeto access profiles struct */
+    struct keeto_access_profiles *access_profiles = new_access_profiles();
+    if (access_profiles == NULL) {
+        log_error("failed to allocate memory for access profiles buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+
+    /* prepare ldap search */
+    char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
+    rc = snprintf(filter, sizeof filter, "(objectClass=%s)", KEETO_AP_OBJCLASS);
+    if (rc < 0) {
+        log_error("failed to create ldap search filter");
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_b;
+    }
+
+    /* only request attributes that are actually processed */
+    char *attrs[] = {
+        "objectClass",
+        KEETO_AP_ENABLED_ATTR,
+        KEETO_AP_KEY_PROVIDER_ATTR,
+        KEETO_AP_KEY_PROVIDER_GROUP_ATTR,
+        KEETO_AP_KEYSTORE_OPTIONS_ATTR,
+        KEETO_AOBP_TARGET_KEYSTORE_ATTR,
+        KEETO_AOBP_TARGET_KEYSTORE_GROUP_ATTR,
+        NULL
+    };
+
+    /* query ldap for all access profile entries at once */
+    int access_profile_count = count_values(access_profile_dns);
+    LDAPMessage **access_profile_entries = NULL;
+    rc = ldap_search_keeto_batch(ldap_handle, info, access_profile_dns,
+        LDAP_SCOPE_BASE, filter, attrs, &access_profile_entries);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain access profile entries (%s)",
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup_b;
+    }
+
+    struct keeto_access_profile **candidates = calloc(access_profile_count + 1,
+        sizeof *candidates);
+    if (candidates == NULL) {
+        log_error("failed to allocate memory for access profile candidates "
+            "buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_c;
+    }
+
+    /*
+     * the access profiles are processed in phases so that the entries
+     * of each level of the tree below them are fetched for all access
+     * profiles at once.
+     */
+    for (int i = 0; i < access_profile_count; i++) {
+        if (access_profile_entries[i] == NULL) {
+            log_error("failed to obtain access profile entry '%s'",
+                access_profile_dns[i]);
+            continue;
+        }
+        rc = create_access_profile(ldap_handle, access_profile_entries[i],
+            &candidates[i]);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_d;
+        default:
+            log_error("failed to create access profile '%s' (%s)",
+                access_profile_dns[i], keeto_strerror(rc));
+            break;
+        }
+    }
+
+    /* check access profile relevance */
+    rc = prefetch_target_keystores(ldap_handle, info, access_profile_entries,
+        candidates, access_profile_count);
+    if (rc != KEETO_OK) {
+        log_error("failed to prefetch target keystores (%s)",
+            keeto_strerror(rc));
+        res = rc;
+        goto cleanup_d;
+    }
+    for (int i = 0; i < access_profile_count; i++) {
+        if (candidates[i] == NULL) {
+            continue;
+        }
+        log_info("checking relevance of access profile '%s'",
+            access_profile_dns[i]);
+        bool relevant = false;
+        rc = check_access_profile_relevance(ldap_handle, info, candidates[i],
+            access_profile_entries[i], &relevant);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_LDAP_CONNECTION_ERR:
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup_d;
+        default:
+            log_error("failed to check access profile relevance (%s)",
+                keeto_strerror(rc));
+            break;
+        }
+        if (!relevant) {
+            log_info("skipped access profile (%s)",
+                keeto_strerror(KEETO_NOT_RELEVANT));
+            free_access_profile(candidates[i]);
+            candidates[i] = NULL;
+        }
+    }
+
+    /* add access profiles */
+    rc = prefetch_key_providers(ldap_handle, info, access_profile_entries,
+        candidates, access_profile_count);
+    if (rc != KEETO_OK) {
+        log_error("failed to prefetch key providers (%s)", keeto_strerror(rc));
+        res = rc;
+        goto cleanup_d;
+    }
+    for (int i = 0; i < access_profile_count; i++) {
+        if (candidates[i] == NULL) {
+            continue;
+        }
+        log_info("processing access profile '%s'", access_profile_dns[i]);
+
+        struct keeto_access_profile *access_profile = candidates[i];
+        candidates[i] = NULL;
+        rc = add_access_profile(ldap_handle, info, access_profile_entries[i],
+            access_profile, access_profiles);
+        switch (rc) {
+        case KEETO_OK:
+            log_info("added access profile");
+            break;
+        case KEETO_LDAP_CONNECTION_ERR:
+        case KEETO_NO_MEMORY:
+        case KEETO_SYSTEM_ERR:
+            res = rc;
+            goto cleanup_d;
+        case KEETO_NO_KEY_PROVIDER:
+            log_info("skipped access profile (%s)", keeto_strerror(rc));
+            break;
+        default:
+            log_error("failed to add access profile (%s)", keeto_strerror(rc));
+            break;
+        }
+    }
+
+    /* check if not empty */
+    if (TAILQ_EMPTY(access_profiles)) {
+        res = KEETO_NO_ACCESS_PROFILE_FOR_UID;
+        goto cleanup_d;
+    }
+    info->access_profiles = access_profiles;
+    access_profiles = NULL;
+    res = KEETO_OK;
+
+cleanup_d:
+    for (int i = 0; i < access_profile_count; i++) {
+        if (candidates[i] != NULL) {
+            free_access_profile(candidates[i]);
+        }
+    }
+    free(candidates);
+cleanup_c:
+    free_search_results(access_profile_entries);
+cleanup_b:
+    if (access_profiles != NULL) {
+        free_access_profiles(access_profiles);
+    }
+cleanup_a:
+    free_attr_values_as_string(access_profile_dns);
+    return res;
+}
+
+static int
+add_ssh_server_entry(LDAP *ldap_handle, struct keeto_info *info,
+    LDAPMessage **ret)
+{
+    if (ldap_handle == NULL || info == NULL || ret == NULL) {
+        fatal("ldap_handle, info or ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* prepare ldap search */
+    char *ssh_server_search_base = cfg_getstr(info->cfg,
+        "ldap_ssh_server_search_base");
+    int ssh_server_search_scope = cfg_getint(info->cfg,
+        "ldap_ssh_server_search_scope");
+    char *ssh_server_uid = cfg_getstr(info->cfg, "ldap_ssh_server_uid");
+    char filter[LDAP_SEARCH_FILTER_BUFFER_SIZE];
+    int rc = snprintf(filter, sizeof filter, "(&(objectClass=%s)(%s=%s))",
+        KEETO_SSH_SERVER_OBJCLASS, KEETO_SSH_SERVER_UID_ATTR, ssh_server_uid);
+    if (rc < 0) {
+        log_error("failed to create ldap search filter");
+        return KEETO_SYSTEM_ERR;
+    }
+    char *attrs[] = {
+        KEETO_SSH_SERVER_AP_ATTR,
+        NULL
+    };
+
+    /* query ldap for ssh server entry */
+    LDAPMessage *ssh_server_entry = NULL;
+    rc = ldap_search_keeto(ldap_handle, info, ssh_server_search_base,
+        ssh_server_search_scope, filter, attrs, &ssh_server_entry);
+    if (rc != KEETO_OK) {
+        log_error("failed to obtain ssh server entry (%s)", keeto_strerror(rc));
+        return rc;
+    }
+
+    /* create and populate keeto ssh server struct */
+    struct keeto_ssh_server *ssh_server = new_ssh_server();
+    if (ssh_server == NULL) {
+        log_error("failed to allocate memory for ssh server buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+
+    ssh_server->dn = ldap_get_dn(ldap_handle, ssh_server_entry);
+    if (ssh_server->dn == NULL) {
+        log_error("failed to obtain dn from ssh server entry");
+        res = KEETO_LDAP_ERR;
+        goto cleanup_b;
+    }
+    ssh_server->uid = strdup(cfg_getstr(info->cfg, "ldap_ssh_server_uid"));
+    if (ssh_server->uid == NULL) {
+        log_error("failed to duplicate ssh server uid");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_b;
+    }
+
+    *ret = ssh_server_entry;
+    ssh_server_entry = NULL;
+    info->ssh_server = ssh_server;
+    ssh_server = NULL;
+    res = KEETO_OK;
+
+cleanup_b:
+    if (ssh_server != NULL) {
+        free_ssh_server(ssh_server);
+    }
+cleanup_a:
+    if (ssh_server_entry != NULL) {
+        ldap_msgfree(ssh_server_entry);
+    }
+    return res;
+}
+
+static int
+init_starttls(LDAP *ldap_handle)
+{
+    if (ldap_handle == NULL) {
+        fatal("ldap_handle == NULL");
+    }
+
+    /* initiate start tls session with server */
+    int rc = ldap_start_tls_s(ldap_handle, NULL, NULL);
+    if (rc != LDAP_SUCCESS) {
+        char *msg = NULL;
+        int old_rc = rc;
+        rc = ldap_get_option(ldap_handle, LDAP_OPT_DIAGNOSTIC_MESSAGE, &msg);
         if (rc == LDAP_OPT_SUCCESS) {
             log_error("failed to initialize starttls (%s)", msg);
         } else {
             log_error("failed to initialize starttls (%s)",
                 ldap_err2string(old_rc));
         }
-        if (msg != NULL) {
-            ldap_memfree(msg);
+        if (msg != NULL) {
+            ldap_memfree(msg);
+        }
+        return KEETO_LDAP_CONNECTION_ERR;
+    }
+    return KEETO_OK;
+}
+
+static int
+connect_to_ldap(LDAP *ldap_handle, struct keeto_info *info)
+{
+    if (ldap_handle == NULL || info == NULL) {
+        fatal("ldap_handle or info == NULL");
+    }
+
+    int rc;
+    bool ldap_starttls = cfg_getint(info->cfg, "ldap_starttls");
+    if (ldap_starttls) {
+        rc = init_starttls(ldap_handle);
+        if (rc != KEETO_OK) {
+            return rc;
+        }
+    }
+    char *ldap_bind_dn = cfg_getstr(info->cfg, "ldap_bind_dn");
+    char *ldap_bind_pwd = cfg_getstr(info->cfg, "ldap_bind_pwd");
+    size_t ldap_bind_pwd_length = strlen(ldap_bind_pwd);
+    struct berval cred = {
+        .bv_len = ldap_bind_pwd_length,
+        .bv_val = ldap_bind_pwd
+    };
+    rc = ldap_sasl_bind_s(ldap_handle, ldap_bind_dn, LDAP_SASL_SIMPLE, &cred,
+            NULL, NULL, NULL);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to bind to ldap (%s)", ldap_err2string(rc));
+        return KEETO_LDAP_CONNECTION_ERR;
+    }
+    return KEETO_OK;
+}
+
+static int
+set_ldap_options(LDAP *ldap_handle, struct keeto_info *info)
+{
+    if (ldap_handle == NULL || info == NULL) {
+        fatal("ldap_handle or info == NULL");
+    }
+
+    /* set protocol version */
+    const int ldap_version = LDAP_VERSION3;
+    int rc = ldap_set_option(ldap_handle, LDAP_OPT_PROTOCOL_VERSION,
+        &ldap_version);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_PROTOCOL_VERSION', "
+            "value '%d'", ldap_version);
+        return KEETO_LDAP_ERR;
+    }
+
+    /* set timeout(s) */
+    const int ldap_timeout_config = cfg_getint(info->cfg, "ldap_timeout");
+    const struct timeval ldap_timeout = get_ldap_timeout(info->cfg);
+
+    /*
+     * timeout for initial ldap connection establishment
+     * (bind/starttls).
+     */
+    rc = ldap_set_option(ldap_handle, LDAP_OPT_NETWORK_TIMEOUT, &ldap_timeout);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_NETWORK_TIMEOUT', "
+            "value '%d'", ldap_timeout_config);
+        return KEETO_LDAP_ERR;
+    }
+    /*
+     * timeout after connection establishment for every synchronous
+     * ldap call e.g. ldap_search_ext_s(). has precedence over
+     * LDAP_OPT_TIMELIMIT (tcp) but can be overridden by passing a
+     * timeout to the synchronous functions directly.
+     */
+    rc = ldap_set_option(ldap_handle, LDAP_OPT_TIMEOUT, &ldap_timeout);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_TIMEOUT', value "
+            "'%d'", ldap_timeout_config);
+        return KEETO_LDAP_ERR;
+    }
+    /*
+     * maximum time (in seconds) allowed for a ldap search operation
+     * (ldap). setting it globally only sets the timeout in the ldap
+     * search request. can also be overridden by passing a timeout to
+     * the ldap_search_ext_s() function directly.
+     */
+    rc = ldap_set_option(ldap_handle, LDAP_OPT_TIMELIMIT, &ldap_timeout_config);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_TIMELIMIT', value "
+            "'%d'", ldap_timeout_config);
+        return KEETO_LDAP_ERR;
+    }
+
+    /* set path to trusted ca's */
+    const char *cert_store_dir = cfg_getstr(info->cfg, "cert_store_dir");
+    rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_CACERTDIR, cert_store_dir);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_X_TLS_CACERTDIR', "
+            "value '%s'", cert_store_dir);
+        return KEETO_LDAP_ERR;
+    }
+
+    /* force validation of certificates when using starttls/ldaps */
+    const int req_cert = LDAP_OPT_X_TLS_DEMAND;
+    rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_REQUIRE_CERT, &req_cert);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_X_TLS_REQUIRE_CERT', "
+            "value '%d'", req_cert);
+        return KEETO_LDAP_ERR;
+    }
+
+    /*
+     * check ldap server certificate chain against CRL if specified in
+     * config.
+     *
+     * this option is only supported when libldap is linked against
+     * openssl! in case of failure a warning will be logged and
+     * execution flow continues. failing with an error would break
+     * support with major distros that haven't linked libldap against
+     * openssl.
+     */
+    bool check_crl = cfg_getint(info->cfg, "check_crl");
+    if (check_crl) {
+        const int crl_check = LDAP_OPT_X_TLS_CRL_ALL;
+        rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_CRLCHECK, &crl_check);
+        if (rc != LDAP_OPT_SUCCESS) {
+            log_warn("failed to set ldap option: key 'LDAP_OPT_X_TLS_CRLCHECK', "
+                "value '%d'", crl_check);
+        }
+    }
+
+    /*
+     * new context has to be set in order to apply options set above
+     * regarding tls.
+     */
+    const int is_server = 0;
+    rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_NEWCTX, &is_server);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_X_TLS_NEWCTX', "
+            "value '%d'", is_server);
+        return KEETO_LDAP_ERR;
+    }
+
+    return KEETO_OK;
+}
+
+static int
+init_ldap_handle(struct keeto_info *info, char *ldap_uri, LDAP **ret)
+{
+    if (info == NULL || ldap_uri == NULL || ret == NULL) {
+        fatal("info, ldap_uri or ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    LDAP *ldap_handle = NULL;
+    int rc = ldap_initialize(&ldap_handle, ldap_uri);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to initialize ldap handle (%s)", ldap_err2string(rc));
+        return KEETO_LDAP_ERR;
+    }
+    rc = set_ldap_options(ldap_handle, info);
+    if (rc != KEETO_OK) {
+        log_error("failed to set ldap options (%s)", keeto_strerror(rc));
+        res = rc;
+        goto cleanup;
+    }
+    *ret = ldap_handle;
+    ldap_handle = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    if (ldap_handle != NULL) {
+        rc = ldap_unbind_ext_s(ldap_handle, NULL, NULL);
+        if (rc != LDAP_SUCCESS) {
+            log_debug("ldap_unbind_ext_s(): '%s'", ldap_err2string(rc));
+        }
+    }
+    return res;
+}
+
+static long
+get_elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+        (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * state shared between race_ldap_uris() and the threads connecting to
+ * the candidates. candidates that are still connecting when the race
+ * is decided are aborted by shutting down their socket and all threads
+ * are joined before race_ldap_uris() returns. no thread of the module
+ * outlives the pam call that started it.
+ */
+struct keeto_ldap_race;
+
+struct keeto_ldap_candidate {
+    struct keeto_ldap_race *race;
+    int index;
+    LDAP *ldap_handle;
+    pthread_t thread;
+    bool started;
+    /* socket of the connection while the candidate is binding */
+    int fd;
+    int result;
+    long latency;
+    bool done;
+};
+
+struct keeto_ldap_race {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;
+    int winner;
+    /* set once race_ldap_uris() stopped waiting for candidates */
+    bool decided;
+    bool starttls;
+    char *bind_dn;
+    char *bind_pwd;
+    struct keeto_ldap_candidate candidates[KEETO_LDAP_MAX_URIS];
+};
+
+static void
+free_ldap_race(struct keeto_ldap_race *race)
+{
+    if (race == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&race->cond);
+    pthread_mutex_destroy(&race->lock);
+    free(race->bind_dn);
+    if (race->bind_pwd != NULL) {
+        memset(race->bind_pwd, 0, strlen(race->bind_pwd));
+        free(race->bind_pwd);
+    }
+    free(race);
+}
+
+static int
+create_ldap_race(struct keeto_info *info, struct keeto_ldap_race **ret)
+{
+    if (info == NULL || ret == NULL) {
+        fatal("info or ret == NULL");
+    }
+
+    struct keeto_ldap_race *race = calloc(1, sizeof *race);
+    if (race == NULL) {
+        log_error("failed to allocate memory for ldap race buffer");
+        return KEETO_NO_MEMORY;
+    }
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&race->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutex_init(&race->lock, NULL);
+    race->winner = -1;
+    race->starttls = cfg_getint(info->cfg, "ldap_starttls");
+    race->bind_dn = strdup(cfg_getstr(info->cfg, "ldap_bind_dn"));
+    race->bind_pwd = strdup(cfg_getstr(info->cfg, "ldap_bind_pwd"));
+    if (race->bind_dn == NULL || race->bind_pwd == NULL) {
+        log_error("failed to duplicate ldap bind credentials");
+        free_ldap_race(race);
+        return KEETO_NO_MEMORY;
+    }
+    *ret = race;
+    return KEETO_OK;
+}
+
+/*
+ * connects to the server and publishes the socket so that the
+ * candidate can be aborted once the race is decided.
+ */
+static int
+connect_ldap_race_candidate(struct keeto_ldap_race *race,
+    struct keeto_ldap_candidate *candidate)
+{
+    int rc = ldap_connect(candidate->ldap_handle);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to connect to ldap (%s)", ldap_err2string(rc));
+        return KEETO_LDAP_CONNECTION_ERR;
+    }
+    int fd = -1;
+    rc = ldap_get_option(candidate->ldap_handle, LDAP_OPT_DESC, &fd);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to get ldap option: key 'LDAP_OPT_DESC'");
+        return KEETO_LDAP_ERR;
+    }
+
+    pthread_mutex_lock(&race->lock);
+    bool decided = race->decided;
+    if (!decided) {
+        candidate->fd = fd;
+    }
+    pthread_mutex_unlock(&race->lock);
+    return decided ? KEETO_LDAP_CONNECTION_ERR : KEETO_OK;
+}
+
+static int
+bind_ldap_race_candidate(struct keeto_ldap_race *race, LDAP *ldap_handle)
+{
+    if (race->starttls) {
+        int rc = init_starttls(ldap_handle);
+        if (rc != KEETO_OK) {
+            return rc;
+        }
+    }
+    struct berval cred = {
+        .bv_len = strlen(race->bind_pwd),
+        .bv_val = race->bind_pwd
+    };
+    int rc = ldap_sasl_bind_s(ldap_handle, race->bind_dn, LDAP_SASL_SIMPLE,
+        &cred, NULL, NULL, NULL);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to bind to ldap (%s)", ldap_err2string(rc));
+        return KEETO_LDAP_CONNECTION_ERR;
+    }
+    return KEETO_OK;
+}
+
+static void *
+run_ldap_race_candidate(void *arg)
+{
+    struct keeto_ldap_candidate *candidate = arg;
+    struct keeto_ldap_race *race = candidate->race;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc = connect_ldap_race_candidate(race, candidate);
+    if (rc == KEETO_OK) {
+        rc = bind_ldap_race_candidate(race, candidate->ldap_handle);
+    }
+    long latency = get_elapsed_ms(&start);
+
+    pthread_mutex_lock(&race->lock);
+    candidate->result = rc;
+    candidate->latency = latency;
+    candidate->done = true;
+    candidate->fd = -1;
+    race->pending--;
+    LDAP *ldap_handle = NULL;
+    if (rc == KEETO_OK && race->winner == -1 && !race->decided) {
+        race->winner = candidate->index;
+    } else {
+        ldap_handle = candidate->ldap_handle;
+        candidate->ldap_handle = NULL;
+    }
+    pthread_cond_signal(&race->cond);
+    pthread_mutex_unlock(&race->lock);
+
+    close_ldap_connection(ldap_handle);
+    return NULL;
+}
+
+/* must be called with the race lock held */
+static void
+start_ldap_race_candidate(struct keeto_info *info, struct keeto_ldap_race *race,
+    char *ldap_uri, int index, const struct timespec *deadline)
+{
+    struct keeto_ldap_candidate *candidate = &race->candidates[index];
+    candidate->race = race;
+    candidate->index = index;
+    candidate->fd = -1;
+    candidate->done = true;
+
+    /*
+     * the socket is only known once the connection is established. the
+     * connect must therefore end by the deadline of the race on its own.
+     */
+    struct timeval remaining;
+    if (!get_remaining_time(deadline, &remaining)) {
+        candidate->result = KEETO_LDAP_CONNECTION_ERR;
+        return;
+    }
+    log_info("connecting to ldap server '%s'", ldap_uri);
+    int rc = init_ldap_handle(info, ldap_uri, &candidate->ldap_handle);
+    if (rc != KEETO_OK) {
+        candidate->result = rc;
+        return;
+    }
+    rc = ldap_set_option(candidate->ldap_handle, LDAP_OPT_NETWORK_TIMEOUT,
+        &remaining);
+    if (rc != LDAP_OPT_SUCCESS) {
+        log_error("failed to set ldap option: key 'LDAP_OPT_NETWORK_TIMEOUT'");
+        close_ldap_connection(candidate->ldap_handle);
+        candidate->ldap_handle = NULL;
+        candidate->result = KEETO_LDAP_ERR;
+        return;
+    }
+
+    rc = pthread_create(&candidate->thread, NULL, &run_ldap_race_candidate,
+        candidate);
+    if (rc != 0) {
+        log_error("failed to create ldap race thread (%s)", strerror(rc));
+        close_ldap_connection(candidate->ldap_handle);
+        candidate->ldap_handle = NULL;
+        candidate->result = KEETO_SYSTEM_ERR;
+        return;
+    }
+    candidate->started = true;
+    candidate->done = false;
+    race->pending++;
+}
+
+static bool
+is_time_reached(const struct timespec *time)
+{
+    struct timeval remaining;
+    return !get_remaining_time(time, &remaining);
+}
+
+static bool
+is_time_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec ||
+        (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * happy eyeballs for ldap servers: connecting and binding to the first
+ * uri is started. if the bind does not succeed within the hedge delay
+ * the next uri is tried in parallel and so on. the first uri that
+ * accepts the bind wins and its handle is returned. the bind latency of
+ * the winner is fed into the health table.
+ */
+static int
+race_ldap_uris(struct keeto_info *info, char **uris, int count,
+    struct keeto_health *health, LDAP **ret)
+{
+    if (info == NULL || uris == NULL || ret == NULL) {
+        fatal("info, uris or ret == NULL");
+    }
+
+    long hedge_delay = cfg_getint(info->cfg, "ldap_hedge_delay");
+    struct timeval hedge_timeout = {
+        .tv_sec = hedge_delay / 1000,
+        .tv_usec = (hedge_delay % 1000) * 1000
+    };
+    struct timespec deadline = get_deadline(get_ldap_timeout(info->cfg));
+
+    struct keeto_ldap_race *race = NULL;
+    int rc = create_ldap_race(info, &race);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    pthread_mutex_lock(&race->lock);
+    int next = 0;
+    struct timespec hedge = deadline;
+    while (race->winner == -1) {
+        if (next < count && (race->pending == 0 || is_time_reached(&hedge))) {
+            start_ldap_race_candidate(info, race, uris[next], next,
+                &deadline);
+            hedge = get_deadline(hedge_timeout);
+            next++;
+            continue;
+        }
+        if (race->pending == 0) {
+            break;
+        }
+        if (is_time_reached(&deadline)) {
+            log_error("failed to connect to any ldap server (timeout)");
+            break;
+        }
+        struct timespec *wait = &deadline;
+        if (next < count && is_time_before(&hedge, &deadline)) {
+            wait = &hedge;
+        }
+        pthread_cond_timedwait(&race->cond, &race->lock, wait);
+    }
+
+    /* collect the results of finished candidates */
+    race->decided = true;
+    int res = KEETO_LDAP_CONNECTION_ERR;
+    int winner = race->winner;
+    LDAP *ldap_handle = NULL;
+    long latencies[KEETO_LDAP_MAX_URIS];
+    int results[KEETO_LDAP_MAX_URIS];
+    bool done[KEETO_LDAP_MAX_URIS];
+    for (int i = 0; i < next; i++) {
+        struct keeto_ldap_candidate *candidate = &race->candidates[i];
+        latencies[i] = candidate->latency;
+        results[i] = candidate->result;
+        done[i] = candidate->done;
+        if (i == winner) {
+            ldap_handle = candidate->ldap_handle;
+            candidate->ldap_handle = NULL;
+        } else if (done[i] && results[i] != KEETO_LDAP_CONNECTION_ERR) {
+            res = results[i];
+        }
+    }
+    /* abort the candidates that are still binding */
+    for (int i = 0; i < next; i++) {
+        struct keeto_ldap_candidate *candidate = &race->candidates[i];
+        if (!candidate->done && candidate->fd != -1) {
+            log_debug("aborting ldap server '%s'", uris[i]);
+            shutdown(candidate->fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&race->lock);
+    for (int i = 0; i < next; i++) {
+        if (race->candidates[i].started) {
+            pthread_join(race->candidates[i].thread, NULL);
+        }
+    }
+    free_ldap_race(race);
+
+    if (health != NULL) {
+        for (int i = 0; i < next; i++) {
+            if (i == winner) {
+                record_health_success(health, uris[i], latencies[i]);
+            /* servers that did not answer at all count as failed */
+            } else if ((done[i] && results[i] == KEETO_LDAP_CONNECTION_ERR) ||
+                (!done[i] && winner == -1)) {
+                record_health_failure(health, uris[i]);
+            }
         }
-        return KEETO_LDAP_CONNECTION_ERR;
     }
+    if (winner == -1) {
+        return res;
+    }
+    log_info("ldap server '%s' won the race (%ldms)", uris[winner],
+        latencies[winner]);
+    *ret = ldap_handle;
     return KEETO_OK;
 }
 
-static int
-connect_to_ldap(LDAP *ldap_handle, struct keeto_info *info)
+/* sorts uris by their health score (stable) */
+static void
+sort_ldap_uris(struct keeto_health *health, char **uris, int count)
 {
-    if (ldap_handle == NULL || info == NULL) {
-        fatal("ldap_handle or info == NULL");
+    if (health == NULL || uris == NULL) {
+        fatal("health or uris == NULL");
     }
 
-    int rc;
-    bool ldap_starttls = cfg_getint(info->cfg, "ldap_starttls");
-    if (ldap_starttls) {
-        rc = init_starttls(ldap_handle);
-        if (rc != KEETO_OK) {
-            return rc;
-        }
+    unsigned long scores[KEETO_LDAP_MAX_URIS];
+    for (int i = 0; i < count; i++) {
+        scores[i] = get_health_score(health, uris[i]);
     }
-    char *ldap_bind_dn = cfg_getstr(info->cfg, "ldap_bind_dn");
-    char *ldap_bind_pwd = cfg_getstr(info->cfg, "ldap_bind_pwd");
-    size_t ldap_bind_pwd_length = strlen(ldap_bind_pwd);
-    struct berval cred = {
-        .bv_len = ldap_bind_pwd_length,
-        .bv_val = ldap_bind_pwd
-    };
-    rc = ldap_sasl_bind_s(ldap_handle, ldap_bind_dn, LDAP_SASL_SIMPLE, &cred,
-            NULL, NULL, NULL);
-    memset(ldap_bind_pwd, 0, ldap_bind_pwd_length);
-    if (rc != LDAP_SUCCESS) {
-        log_error("failed to bind to ldap (%s)", ldap_err2string(rc));
-        return KEETO_LDAP_CONNECTION_ERR;
+    for (int i = 1; i < count; i++) {
+        char *uri = uris[i];
+        unsigned long score = scores[i];
+        int j = i - 1;
+        for (; j >= 0 && scores[j] > score; j--) {
+            uris[j + 1] = uris[j];
+            scores[j + 1] = scores[j];
+        }
+        uris[j + 1] = uri;
+        scores[j + 1] = score;
     }
-    return KEETO_OK;
 }
 
 static int
-set_ldap_options(LDAP *ldap_handle, struct keeto_info *info)
+connect_to_ldap_uri(struct keeto_info *info, char *ldap_uri, LDAP **ret)
 {
-    if (ldap_handle == NULL || info == NULL) {
-        fatal("ldap_handle or info == NULL");
+    if (info == NULL || ldap_uri == NULL || ret == NULL) {
+        fatal("info, ldap_uri or ret == NULL");
     }
 
-    /* set protocol version */
-    const int ldap_version = LDAP_VERSION3;
-    int rc = ldap_set_option(ldap_handle, LDAP_OPT_PROTOCOL_VERSION,
-        &ldap_version);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_PROTOCOL_VERSION', "
-            "value '%d'", ldap_version);
-        return KEETO_LDAP_ERR;
+    /* init ldap handle */
+    LDAP *ldap_handle = NULL;
+    int rc = init_ldap_handle(info, ldap_uri, &ldap_handle);
+    if (rc != KEETO_OK) {
+        return rc;
     }
 
-    /* set timeout(s) */
-    const int ldap_timeout_config = cfg_getint(info->cfg, "ldap_timeout");
-    const struct timeval ldap_timeout = get_ldap_timeout(info->cfg);
+    /* connect to ldap server */
+    rc = connect_to_ldap(ldap_handle, info);
+    if (rc != KEETO_OK) {
+        close_ldap_connection(ldap_handle);
+        return rc;
+    }
+    *ret = ldap_handle;
+    return KEETO_OK;
+}
 
-    /*
-     * timeout for initial ldap connection establishment
-     * (bind/starttls).
-     */
-    rc = ldap_set_option(ldap_handle, LDAP_OPT_NETWORK_TIMEOUT, &ldap_timeout);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_NETWORK_TIMEOUT', "
-            "value '%d'", ldap_timeout_config);
-        return KEETO_LDAP_ERR;
+int
+open_ldap_connection(struct keeto_info *info, bool keep_bind_pwd, LDAP **ret)
+{
+    if (info == NULL || ret == NULL) {
+        fatal("info or ret == NULL");
     }
-    /*
-     * timeout after connection establishment for every synchronous
-     * ldap call e.g. ldap_search_ext_s(). has precedence over
-     * LDAP_OPT_TIMELIMIT (tcp) but can be overridden by passing a
-     * timeout to the synchronous functions directly.
-     */
-    rc = ldap_set_option(ldap_handle, LDAP_OPT_TIMEOUT, &ldap_timeout);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_TIMEOUT', value "
-            "'%d'", ldap_timeout_config);
-        return KEETO_LDAP_ERR;
+
+    int res = KEETO_LDAP_CONNECTION_ERR;
+
+    /* split list of ldap uris */
+    char *ldap_uri = cfg_getstr(info->cfg, "ldap_uri");
+    char ldap_uris[strlen(ldap_uri) + 1];
+    strcpy(ldap_uris, ldap_uri);
+    char *uris[KEETO_LDAP_MAX_URIS];
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *uri = strtok_r(ldap_uris, KEETO_LDAP_URI_SEPARATORS, &saveptr);
+        uri != NULL && count < KEETO_LDAP_MAX_URIS;
+        uri = strtok_r(NULL, KEETO_LDAP_URI_SEPARATORS, &saveptr)) {
+
+        uris[count++] = uri;
     }
-    /*
-     * maximum time (in seconds) allowed for a ldap search operation
-     * (ldap). setting it globally only sets the timeout in the ldap
-     * search request. can also be overridden by passing a timeout to
-     * the ldap_search_ext_s() function directly.
-     */
-    rc = ldap_set_option(ldap_handle, LDAP_OPT_TIMELIMIT, &ldap_timeout_config);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_TIMELIMIT', value "
-            "'%d'", ldap_timeout_config);
-        return KEETO_LDAP_ERR;
+
+    /* do not touch the network while the circuit breaker is open */
+    struct keeto_breaker *breaker = NULL;
+    char *ldap_breaker_file = cfg_getstr(info->cfg, "ldap_breaker_file");
+    if (ldap_breaker_file[0] != '\0') {
+        int rc = open_breaker(ldap_breaker_file, &breaker);
+        if (rc != KEETO_OK) {
+            log_error("failed to open ldap breaker file (%s)",
+                keeto_strerror(rc));
+        }
     }
+    if (breaker != NULL && !allow_breaker_request(breaker,
+        cfg_getint(info->cfg, "ldap_breaker_interval"))) {
 
-    /* set path to trusted ca's */
-    const char *cert_store_dir = cfg_getstr(info->cfg, "cert_store_dir");
-    rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_CACERTDIR, cert_store_dir);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_X_TLS_CACERTDIR', "
-            "value '%s'", cert_store_dir);
-        return KEETO_LDAP_ERR;
+        log_info("ldap circuit breaker open (skipping connection)");
+        close_breaker(breaker);
+        breaker = NULL;
+        count = 0;
     }
 
-    /* force validation of certificates when using starttls/ldaps */
-    const int req_cert = LDAP_OPT_X_TLS_DEMAND;
-    rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_REQUIRE_CERT, &req_cert);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_X_TLS_REQUIRE_CERT', "
-            "value '%d'", req_cert);
-        return KEETO_LDAP_ERR;
+    /* try healthiest ldap server first */
+    struct keeto_health *health = NULL;
+    char *ldap_health_file = cfg_getstr(info->cfg, "ldap_health_file");
+    if (count > 0 && ldap_health_file[0] != '\0') {
+        int rc = open_health(ldap_health_file, &health);
+        if (rc != KEETO_OK) {
+            log_error("failed to open ldap health file (%s)",
+                keeto_strerror(rc));
+        }
+    }
+    if (health != NULL) {
+        sort_ldap_uris(health, uris, count);
+    }
+
+    int hedge_delay = cfg_getint(info->cfg, "ldap_hedge_delay");
+    LDAP *ldap_handle = NULL;
+    if (count > 1 && hedge_delay > 0) {
+        res = race_ldap_uris(info, uris, count, health, &ldap_handle);
+        count = 0;
+    }
+    while (count > 0) {
+        log_info("connecting to ldap server '%s'", uris[0]);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int rc = connect_to_ldap_uri(info, uris[0], &ldap_handle);
+        if (rc == KEETO_OK) {
+            if (health != NULL) {
+                record_health_success(health, uris[0], get_elapsed_ms(&start));
+            }
+            res = KEETO_OK;
+            break;
+        }
+        res = rc;
+        if (rc != KEETO_LDAP_CONNECTION_ERR) {
+            break;
+        }
+        if (health != NULL) {
+            record_health_failure(health, uris[0]);
+        }
+        /* fail over to remaining ldap servers */
+        for (int i = 0; i < count - 1; i++) {
+            uris[i] = uris[i + 1];
+        }
+        count--;
     }
+    close_health(health);
 
     /*
-     * check ldap server certificate chain against CRL if specified in
-     * config.
-     *
-     * this option is only supported when libldap is linked against
-     * openssl! in case of failure a warning will be logged and
-     * execution flow continues. failing with an error would break
-     * support with major distros that haven't linked libldap against
-     * openssl.
+     * a server might accept the bind and still not answer searches. the
+     * success is therefore only recorded by the searches.
      */
-    bool check_crl = cfg_getint(info->cfg, "check_crl");
-    if (check_crl) {
-        const int crl_check = LDAP_OPT_X_TLS_CRL_ALL;
-        rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_CRLCHECK, &crl_check);
-        if (rc != LDAP_OPT_SUCCESS) {
-            log_warn("failed to set ldap option: key 'LDAP_OPT_X_TLS_CRLCHECK', "
-                "value '%d'", crl_check);
+    if (breaker != NULL) {
+        if (res == KEETO_LDAP_CONNECTION_ERR) {
+            record_breaker_failure(breaker,
+                cfg_getint(info->cfg, "ldap_breaker_threshold"));
         }
+        close_breaker(breaker);
     }
 
     /*
-     * new context has to be set in order to apply options set above
-     * regarding tls.
+     * long running processes (keetod) have to keep the password in
+     * order to be able to reconnect.
      */
-    const int is_server = 0;
-    rc = ldap_set_option(ldap_handle, LDAP_OPT_X_TLS_NEWCTX, &is_server);
-    if (rc != LDAP_OPT_SUCCESS) {
-        log_error("failed to set ldap option: key 'LDAP_OPT_X_TLS_NEWCTX', "
-            "value '%d'", is_server);
-        return KEETO_LDAP_ERR;
+    if (!keep_bind_pwd) {
+        char *ldap_bind_pwd = cfg_getstr(info->cfg, "ldap_bind_pwd");
+        memset(ldap_bind_pwd, 0, strlen(ldap_bind_pwd));
     }
-
+    if (res != KEETO_OK) {
+        return res;
+    }
+    log_info("connection to ldap established");
+    *ret = ldap_handle;
     return KEETO_OK;
 }
 
-static int
-init_ldap_handle(struct keeto_info *info, LDAP **ret)
+void
+close_ldap_connection(LDAP *ldap_handle)
 {
-    if (info == NULL || ret == NULL) {
-        fatal("info or ret == NULL");
+    if (ldap_handle == NULL) {
+        return;
     }
 
-    int res = KEETO_UNKNOWN_ERR;
-
-    LDAP *ldap_handle = NULL;
-    char *ldap_uri = cfg_getstr(info->cfg, "ldap_uri");
-    int rc = ldap_initialize(&ldap_handle, ldap_uri);
+    int rc = ldap_unbind_ext_s(ldap_handle, NULL, NULL);
     if (rc != LDAP_SUCCESS) {
-        log_error("failed to initialize ldap handle (%s)", ldap_err2string(rc));
-        return KEETO_LDAP_ERR;
-    }
-    rc = set_ldap_options(ldap_handle, info);
-    if (rc != KEETO_OK) {
-        log_error("failed to set ldap options (%s)", keeto_strerror(rc));
-        res = rc;
-        goto cleanup;
-    }
-    *ret = ldap_handle;
-    ldap_handle = NULL;
-    res = KEETO_OK;
-
-cleanup:
-    if (ldap_handle != NULL) {
-        rc = ldap_unbind_ext_s(ldap_handle, NULL, NULL);
-        if (rc != LDAP_SUCCESS) {
-            log_debug("ldap_unbind_ext_s(): '%s'", ldap_err2string(rc));
-        }
+        log_debug("ldap_unbind_ext_s(): '%s'", ldap_err2string(rc));
     }
-    return res;
 }
 
-int
-get_access_profiles_from_ldap(struct keeto_info *info)
+/*
+ * searches that time out or lose the connection count as failures of
+ * the circuit breaker. any other result shows that the servers answer.
+ */
+static void
+record_ldap_breaker_result(cfg_t *cfg, int res)
 {
-    if (info == NULL) {
-        fatal("info == NULL");
+    if (cfg == NULL) {
+        fatal("cfg == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
-
-    /* init ldap handle */
-    LDAP *ldap_handle = NULL;
-    int rc = init_ldap_handle(info, &ldap_handle);
+    char *ldap_breaker_file = cfg_getstr(cfg, "ldap_breaker_file");
+    if (ldap_breaker_file[0] == '\0') {
+        return;
+    }
+    struct keeto_breaker *breaker = NULL;
+    int rc = open_breaker(ldap_breaker_file, &breaker);
     if (rc != KEETO_OK) {
-        return rc;
+        log_error("failed to open ldap breaker file (%s)", keeto_strerror(rc));
+        return;
+    }
+    if (res == KEETO_LDAP_CONNECTION_ERR) {
+        record_breaker_failure(breaker,
+            cfg_getint(cfg, "ldap_breaker_threshold"));
+    } else {
+        record_breaker_success(breaker);
     }
+    close_breaker(breaker);
+}
 
-    /* connect to ldap server */
-    rc = connect_to_ldap(ldap_handle, info);
-    if (rc != KEETO_OK) {
-        res = rc;
-        goto cleanup_a;
+static int
+search_access_profiles(LDAP *ldap_handle, struct keeto_info *info)
+{
+    if (ldap_handle == NULL || info == NULL) {
+        fatal("ldap_handle or info == NULL");
     }
-    log_info("connection to ldap established");
+
     info->ldap_online = 1;
+    info->ldap_deadline = get_deadline(get_ldap_timeout(info->cfg));
 
     /* add ssh server entry */
     LDAPMessage *ssh_server_entry = NULL;
-    rc = add_ssh_server_entry(ldap_handle, info, &ssh_server_entry);
+    int rc = add_ssh_server_entry(ldap_handle, info, &ssh_server_entry);
     switch (rc) {
     case KEETO_OK:
         break;
     case KEETO_LDAP_CONNECTION_ERR:
     case KEETO_NO_MEMORY:
     case KEETO_SYSTEM_ERR:
-        res = rc;
-        goto cleanup_a;
+        free_attr_projections();
+        return rc;
     case KEETO_LDAP_NO_SUCH_ENTRY:
     case KEETO_LDAP_SCHEMA_ERR:
         log_error("failed to add ssh server (%s)", keeto_strerror(rc));
-        res = KEETO_NO_SSH_SERVER;
-        goto cleanup_a;
+        free_attr_projections();
+        return KEETO_NO_SSH_SERVER;
     default:
         log_error("failed to add ssh server (%s)", keeto_strerror(rc));
-        res = rc;
-        goto cleanup_a;
+        free_attr_projections();
+        return rc;
     }
     log_info("added ssh server '%s' (%s)", info->ssh_server->uid,
         info->ssh_server->dn);
 
     /* add access profiles */
     rc = add_access_profiles(ldap_handle, ssh_server_entry, info);
-    if (rc != KEETO_OK) {
-        res = rc;
-        goto cleanup_b;
-    }
-    res = KEETO_OK;
-
-cleanup_b:
     ldap_msgfree(ssh_server_entry);
-cleanup_a:
-    rc = ldap_unbind_ext_s(ldap_handle, NULL, NULL);
-    if (rc != LDAP_SUCCESS) {
-        log_debug("ldap_unbind_ext_s(): '%s'", ldap_err2string(rc));
+    free_attr_projections();
+    return rc;
+}
+
+int
+get_access_profiles_from_ldap_handle(LDAP *ldap_handle,
+    struct keeto_info *info)
+{
+    if (ldap_handle == NULL || info == NULL) {
+        fatal("ldap_handle or info == NULL");
     }
-    return res;
+
+    int rc = search_access_profiles(ldap_handle, info);
+    record_ldap_breaker_result(info->cfg, rc);
+    return rc;
 }
 
+int
+get_access_profiles_from_ldap(struct keeto_info *info)
+{
+    if (info == NULL) {
+        fatal("info == NULL");
+    }
+
+    LDAP *ldap_handle = NULL;
+    int rc = open_ldap_connection(info, false, &ldap_handle);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    rc = get_access_profiles_from_ldap_handle(ldap_handle, info);
+    close_ldap_connection(ldap_handle);
+    return rc;
+}
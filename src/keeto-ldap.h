@@ -20,6 +20,10 @@
 #ifndef KEETO_LDAP_H
 #define KEETO_LDAP_H
 
+#include <stdbool.h>
+
+#include <ldap.h>
+
 #include "keeto-util.h"
 
 #define LDAP_BOOL_TRUE "TRUE"
@@ -41,6 +45,11 @@
 #define KEETO_KEYSTORE_OPTIONS_FROM_ATTR "keetoKeystoreOptionFrom"
 #define KEETO_KEYSTORE_OPTIONS_CMD_ATTR "keetoKeystoreOptionCommand"
 
+int open_ldap_connection(struct keeto_info *info, bool keep_bind_pwd,
+    LDAP **ret);
+void close_ldap_connection(LDAP *ldap_handle);
+int get_access_profiles_from_ldap_handle(LDAP *ldap_handle,
+    struct keeto_info *info);
 int get_access_profiles_from_ldap(struct keeto_info *info);
 
 #endif /* KEETO_LDAP_H */
@@ -33,6 +33,7 @@
 #define LOG_PREFIX_BUFFER_SIZE 1024
 
 static int keeto_syslog_facility = LOG_LOCAL1;
+static bool initialized = false;
 
 static void
 keeto_log(int level, char *prefix, const char *fmt, va_list ap)
@@ -41,7 +42,6 @@ keeto_log(int level, char *prefix, const char *fmt, va_list ap)
         fatal("fmt == NULL");
     }
 
-    static bool initialized = false;
     if (!initialized) {
         openlog(KEETO_SYSLOG_IDENTIFIER, LOG_PID, keeto_syslog_facility);
         initialized = true;
@@ -157,3 +157,13 @@ set_syslog_facility(const char *syslog_facility)
     return KEETO_OK;
 }
 
+/*
+ * closes the connection to syslog. the connection is reopened on the
+ * next log call.
+ */
+void
+close_log()
+{
+    closelog();
+    initialized = false;
+}
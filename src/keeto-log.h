@@ -40,6 +40,7 @@ void keeto_fatal(const char *filename, const char *function, int line,
     const char *fmt, ...) __attribute__((noreturn))
     __attribute__((format(printf, 4, 5)));
 int set_syslog_facility(const char *syslog_facility);
+void close_log();
 
 #endif /* KEETO_LOG_H */
 
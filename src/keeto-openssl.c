@@ -24,8 +24,10 @@
 #include <stddef.h>
 
 #include <openssl/bn.h>
+#include <openssl/crypto.h>
 #include <openssl/ossl_typ.h>
 #include <openssl/rsa.h>
+#include <openssl/x509.h>
 
 void
 RSA_get0_key(const RSA *r, const BIGNUM **n, const BIGNUM **e, const BIGNUM **d)
@@ -41,6 +43,40 @@ RSA_get0_key(const RSA *r, const BIGNUM **n, const BIGNUM **e, const BIGNUM **d)
     }
 }
 
+int
+X509_up_ref(X509 *x)
+{
+    int references = CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509);
+    return references > 1 ? 1 : 0;
+}
+
+const ASN1_INTEGER *
+X509_REVOKED_get0_serialNumber(const X509_REVOKED *x)
+{
+    return x->serialNumber;
+}
+
+STACK_OF(X509_OBJECT) *
+X509_STORE_get0_objects(X509_STORE *v)
+{
+    return v->objs;
+}
+
+int
+X509_OBJECT_get_type(const X509_OBJECT *a)
+{
+    return a->type;
+}
+
+X509 *
+X509_OBJECT_get0_X509(const X509_OBJECT *a)
+{
+    if (a == NULL || a->type != X509_LU_X509) {
+        return NULL;
+    }
+    return a->data.x509;
+}
+
 #else /* openssl 1.1 functions */
 
 extern int remove_me_if_code_is_added_here;
@@ -33,6 +33,7 @@
 #include <openssl/ossl_typ.h>
 #include <openssl/rsa.h>
 #include <openssl/ssl.h>
+#include <openssl/x509.h>
 
 #define init_openssl() do { \
     SSL_load_error_strings(); \
@@ -46,14 +47,28 @@
     ERR_remove_thread_state(NULL); \
 } while (0)
 
+/* openssl 1.0 needs locking callbacks to be used by multiple threads */
+#define OPENSSL_THREAD_SAFE 0
+
 void RSA_get0_key(const RSA *r, const BIGNUM **n, const BIGNUM **e,
     const BIGNUM **d);
+int X509_up_ref(X509 *x);
+const ASN1_INTEGER *X509_REVOKED_get0_serialNumber(const X509_REVOKED *x);
+STACK_OF(X509_OBJECT) *X509_STORE_get0_objects(X509_STORE *v);
+int X509_OBJECT_get_type(const X509_OBJECT *a);
+X509 *X509_OBJECT_get0_X509(const X509_OBJECT *a);
+
+#define X509_STORE_CTX_get1_crls X509_STORE_get1_crls
+#define X509_CRL_get0_lastUpdate X509_CRL_get_lastUpdate
+#define X509_CRL_get0_nextUpdate X509_CRL_get_nextUpdate
 
 #else /* openssl 1.1 functions */
 
 #define init_openssl() do {} while (0)
 #define cleanup_openssl() do {} while (0)
 
+#define OPENSSL_THREAD_SAFE 1
+
 #endif /* OPENSSL_VERSION_NUMBER */
 
 #endif /* KEETO_OPENSSL_H */
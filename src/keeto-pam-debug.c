@@ -99,6 +99,8 @@ log_keystore_record(struct keeto_keystore_record *keystore_record)
     log_string("keystore_record->command_option",
         keystore_record->command_option);
     log_string("keystore_record->from_option", keystore_record->from_option);
+    log_string("keystore_record->expiry_time_option",
+        keystore_record->expiry_time_option);
 }
 
 static void
@@ -192,6 +194,19 @@ log_key(struct keeto_key *key)
     log_ssh_key(key->ssh_key);
     log_string("key->ssh_key_fp_md5", key->ssh_key_fp_md5);
     log_string("key->ssh_key_fp_sha256", key->ssh_key_fp_sha256);
+    log_string("key->expiry_time_option", key->expiry_time_option);
+    log_int("key->der_length", (int) key->der_length);
+    /* the certificate is released after post processing */
+    if (key->x509 == NULL && key->der != NULL) {
+        int rc = decode_key_x509(key, NULL, NULL);
+        if (rc != KEETO_OK) {
+            log_info("x509 undecodable");
+            return;
+        }
+        log_x509(key->x509);
+        release_key_x509(key);
+        return;
+    }
     log_x509(key->x509);
 }
 
@@ -294,6 +309,13 @@ log_config(cfg_t *cfg)
     log_string("cfg->ldap_bind_pwd", "********");
     log_int("cfg->ldap_timeout", cfg_getint(cfg, "ldap_timeout"));
     log_bool("cfg->ldap_strict", cfg_getint(cfg, "ldap_strict"));
+    log_int("cfg->ldap_hedge_delay", cfg_getint(cfg, "ldap_hedge_delay"));
+    log_string("cfg->ldap_health_file", cfg_getstr(cfg, "ldap_health_file"));
+    log_string("cfg->ldap_breaker_file", cfg_getstr(cfg, "ldap_breaker_file"));
+    log_int("cfg->ldap_breaker_threshold",
+        cfg_getint(cfg, "ldap_breaker_threshold"));
+    log_int("cfg->ldap_breaker_interval",
+        cfg_getint(cfg, "ldap_breaker_interval"));
 
     log_string("cfg->ldap_ssh_server_search_base", cfg_getstr(cfg,
         "ldap_ssh_server_search_base"));
@@ -308,18 +330,56 @@ log_config(cfg_t *cfg)
         "ldap_key_provider_uid_attr"));
     log_string("cfg->ldap_key_provider_cert_attr", cfg_getstr(cfg,
         "ldap_key_provider_cert_attr"));
+    log_bool("cfg->ldap_key_provider_reverse_lookup", cfg_getint(cfg,
+        "ldap_key_provider_reverse_lookup"));
+    log_string("cfg->ldap_key_provider_search_base", cfg_getstr(cfg,
+        "ldap_key_provider_search_base"));
+    log_int("cfg->ldap_key_provider_search_scope", cfg_getint(cfg,
+        "ldap_key_provider_search_scope"));
 
     log_string("cfg->ldap_target_keystore_group_member_attr", cfg_getstr(cfg,
         "ldap_target_keystore_group_member_attr"));
     log_string("cfg->ldap_target_keystore_uid_attr", cfg_getstr(cfg,
         "ldap_target_keystore_uid_attr"));
+    log_bool("cfg->ldap_target_keystore_reverse_lookup", cfg_getint(cfg,
+        "ldap_target_keystore_reverse_lookup"));
+    log_string("cfg->ldap_target_keystore_search_base", cfg_getstr(cfg,
+        "ldap_target_keystore_search_base"));
+    log_int("cfg->ldap_target_keystore_search_scope", cfg_getint(cfg,
+        "ldap_target_keystore_search_scope"));
 
     log_string("cfg->ssh_keystore_location", cfg_getstr(cfg,
         "ssh_keystore_location"));
+    log_string("cfg->ssh_keystore_db", cfg_getstr(cfg, "ssh_keystore_db"));
+    log_bool("cfg->ssh_keystore_expiry_time", cfg_getint(cfg,
+        "ssh_keystore_expiry_time"));
+    log_int("cfg->ssh_keystore_max_lifetime", cfg_getint(cfg,
+        "ssh_keystore_max_lifetime"));
+    log_string("cfg->ssh_keystore_cache_location", cfg_getstr(cfg,
+        "ssh_keystore_cache_location"));
+    log_int("cfg->ssh_keystore_cache_fresh_ttl", cfg_getint(cfg,
+        "ssh_keystore_cache_fresh_ttl"));
+    log_int("cfg->ssh_keystore_cache_stale_ttl", cfg_getint(cfg,
+        "ssh_keystore_cache_stale_ttl"));
     log_string("cfg->cert_store_dir", cfg_getstr(cfg, "cert_store_dir"));
     log_bool("cfg->check_crl", cfg_getint(cfg, "check_crl"));
+    log_string("cfg->cert_store_snapshot",
+        cfg_getstr(cfg, "cert_store_snapshot"));
+    log_string("cfg->crl_index", cfg_getstr(cfg, "crl_index"));
+    log_string("cfg->cert_validation_cache_file",
+        cfg_getstr(cfg, "cert_validation_cache_file"));
+    log_int("cfg->cert_validation_cache_max_age",
+        cfg_getint(cfg, "cert_validation_cache_max_age"));
+    log_int("cfg->cert_validation_threads",
+        cfg_getint(cfg, "cert_validation_threads"));
+    log_bool("cfg->cert_issuer_check", cfg_getint(cfg, "cert_issuer_check"));
+    log_string("cfg->ssh_key_cache_file", cfg_getstr(cfg, "ssh_key_cache_file"));
 
     log_string("cfg->uid_regex", cfg_getstr(cfg, "uid_regex"));
+
+    log_string("cfg->keetod_socket", cfg_getstr(cfg, "keetod_socket"));
+    log_int("cfg->keetod_timeout", cfg_getint(cfg, "keetod_timeout"));
+    log_int("cfg->keetod_workers", cfg_getint(cfg, "keetod_workers"));
 }
 
 static void
@@ -335,11 +395,17 @@ log_keeto_info(struct keeto_info *info)
     log_info(" ");
     log_string("info->uid", info->uid);
     log_string("info->ssh_keystore_location", info->ssh_keystore_location);
+    log_string("info->ssh_keystore_cache_location",
+        info->ssh_keystore_cache_location);
     log_info(" ");
     log_ssh_server(info->ssh_server);
     log_info(" ");
     log_access_profiles(info->access_profiles);
     log_bool("info->ldap_online", info->ldap_online);
+    if (info->ldap_memo != NULL) {
+        log_int("info->ldap_memo->hits", info->ldap_memo->hits);
+        log_int("info->ldap_memo->misses", info->ldap_memo->misses);
+    }
     log_info(" ");
     log_keystore_records(info->keystore_records);
 }
@@ -18,21 +18,28 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include <confuse.h>
 
 #define PAM_SM_AUTH
 #include <security/pam_modules.h>
 
+#include "keeto-cache.h"
 #include "keeto-config.h"
 #include "keeto-error.h"
+#include "keeto-ipc.h"
+#include "keeto-keystore.h"
 #include "keeto-ldap.h"
 #include "keeto-log.h"
 #include "keeto-openssl.h"
@@ -41,6 +48,8 @@
 
 #define MAX_UID_LENGTH 32
 #define SSH_KEYSTORE_LOCATION_BUFFER_SIZE 1024
+#define MAX_FD_FALLBACK 1024
+#define CONFIG_SNAPSHOT_ARG "config_snapshot="
 
 static void
 cleanup(pam_handle_t *pamh, void *data, int error_status)
@@ -75,340 +84,391 @@ cleanup(pam_handle_t *pamh, void *data, int error_status)
     struct keeto_info *info = data;
     log_info("cleaning up");
     free_info(info);
+    free_uid_validator();
     cleanup_openssl();
     closelog();
 }
 
-static void
-remove_keystore(char *keystore)
-{
-    if (keystore == NULL) {
-        fatal("keystore == NULL");
-    }
-
-    int rc = unlink(keystore);
-    if (rc == -1) {
-        switch (errno) {
-        case ENOENT:
-            break;
-        default:
-            log_error("failed to remove keystore file '%s' (%s)", keystore,
-                strerror(errno));
-        }
-        return;
-    }
-    log_info("removed keystore file '%s'", keystore);
-}
-
 static int
-write_keystore(char *keystore, struct keeto_keystore_records *keystore_records)
+get_keystore_records_from_ldap(struct keeto_info *info)
 {
-    if (keystore == NULL || keystore_records == NULL) {
-        fatal("keystore or keystore_records == NULL");
+    if (info == NULL) {
+        fatal("info == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    /* get access profiles from ldap */
+    int rc = get_access_profiles_from_ldap(info);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
 
-    /* create temporary file */
-    char *template_suffix = "-XXXXXXX";
-    size_t tmp_keystore_size = strlen(keystore) + strlen(template_suffix) + 1;
-    char tmp_keystore[tmp_keystore_size];
-    strcpy(tmp_keystore, keystore);
-    strcat(tmp_keystore, template_suffix);
     /*
-     * in older versions of glibc mkstemp sets permission of temp file
-     * to 0666. being on the safe side...
+     * init cert store for subsequent x509 validation. a single login
+     * only needs the chains of its key providers - certs/crl's are
+     * looked up on demand.
      */
-    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
-    int tmp_keystore_fd = mkstemp(tmp_keystore);
-    umask(mask);
-    if (tmp_keystore_fd == -1) {
-        log_error("failed to create temporary keystore file '%s' (%s)",
-            tmp_keystore, strerror(errno));
-        return KEETO_SYSTEM_ERR;
-    }
-
-    FILE *tmp_keystore_file = fdopen(tmp_keystore_fd, "w");
-    if (tmp_keystore_file == NULL) {
-        log_error("failed to open temporary keystore file '%s' for writing (%s)",
-            tmp_keystore, strerror(errno));
-        int rc = close(tmp_keystore_fd);
-        if (rc == -1) {
-            log_error("failed to close file descriptor of temporary keystore "
-                "file '%s' (%s)", tmp_keystore, strerror(errno));
+    char *cert_store_dir = cfg_getstr(info->cfg, "cert_store_dir");
+    bool check_crl = cfg_getint(info->cfg, "check_crl");
+    /* crl's are checked against the crl indexes if available */
+    char *crl_index = cfg_getstr(info->cfg, "crl_index");
+    bool use_crl_index = check_crl && crl_index[0] != '\0';
+    rc = init_cert_store(cert_store_dir, check_crl && !use_crl_index, false,
+        NULL);
+    if (rc != KEETO_OK) {
+        log_error("failed to initialize cert store (%s)", keeto_strerror(rc));
+        return rc;
+    }
+    if (use_crl_index) {
+        rc = init_crl_index(crl_index);
+        if (rc != KEETO_OK) {
+            log_error("failed to initialize crl index (%s)",
+                keeto_strerror(rc));
+            free_cert_store();
+            return rc;
         }
-        return KEETO_SYSTEM_ERR;
-    }
-
-    struct keeto_keystore_record *keystore_record = NULL;
-    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
-        fprintf(tmp_keystore_file, "environment=\"KEETOREALUSER=%s\"",
-            keystore_record->uid);
-        bool command_option_set = keystore_record->command_option != NULL ?
-            true : false;
-        if (command_option_set) {
-            fprintf(tmp_keystore_file, ",command=\"%s\"",
-                keystore_record->command_option);
+    }
+    char *cert_validation_cache_file = cfg_getstr(info->cfg,
+        "cert_validation_cache_file");
+    if (cert_validation_cache_file[0] != '\0') {
+        rc = init_validation_cache(cert_validation_cache_file,
+            cfg_getint(info->cfg, "cert_validation_cache_max_age"));
+        if (rc != KEETO_OK) {
+            log_error("failed to initialize validation cache (%s)",
+                keeto_strerror(rc));
         }
-        bool from_option_set = keystore_record->from_option != NULL ?
-            true : false;
-        if (from_option_set) {
-            fprintf(tmp_keystore_file, ",from=\"%s\"",
-                keystore_record->from_option);
+    }
+    char *ssh_key_cache_file = cfg_getstr(info->cfg, "ssh_key_cache_file");
+    if (ssh_key_cache_file[0] != '\0') {
+        rc = init_key_cache(ssh_key_cache_file);
+        if (rc != KEETO_OK) {
+            log_error("failed to initialize key cache (%s)",
+                keeto_strerror(rc));
         }
-        fprintf(tmp_keystore_file, " %s %s\n\n", keystore_record->ssh_keytype,
-            keystore_record->ssh_key);
     }
 
-    int rc = fchmod(tmp_keystore_fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (rc == -1) {
-        log_error("failed to set permissions for temp keystore file '%s' (%s)",
-            tmp_keystore, strerror(errno));
-        res = KEETO_SYSTEM_ERR;
-        goto cleanup;
+    /*
+     * validate certificates, convert public key to OpenSSH
+     * authorized_keys format and create keystore records.
+     */
+    log_info("post processing access profiles");
+    rc = post_process_access_profiles(info);
+    free_key_cache();
+    free_validation_cache();
+    free_crl_index();
+    free_cert_store();
+    return rc;
+}
+
+static int
+get_keystore_records_from_keetod(struct keeto_info *info, char *socket_path,
+    int *result)
+{
+    if (info == NULL || socket_path == NULL || result == NULL) {
+        fatal("info, socket_path or result == NULL");
     }
-    rc = rename(tmp_keystore, keystore);
-    if (rc == -1) {
-        log_error("failed to move temp keystore file from '%s' to '%s' (%s)",
-            tmp_keystore, keystore, strerror(errno));
-        res = KEETO_SYSTEM_ERR;
+
+    int keetod_timeout = cfg_getint(info->cfg, "keetod_timeout");
+    int fd = -1;
+    int rc = connect_to_keetod(socket_path, keetod_timeout, &fd);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    rc = send_keetod_request(fd, info->uid);
+    if (rc != KEETO_OK) {
         goto cleanup;
     }
-    res = KEETO_OK;
+    rc = receive_keetod_response(fd, info, result);
 
 cleanup:
-    rc = fclose(tmp_keystore_file);
-    if (rc != 0) {
-        log_error("failed to flush stream and close file descriptor of "
-            "temporary keystore file '%s' (%s)", tmp_keystore, strerror(errno));
-        return KEETO_SYSTEM_ERR;
+    close(fd);
+    return rc;
+}
+
+/*
+ * get keystore records either from keetod or by querying ldap
+ * directly. in case keetod is not reachable fall back to ldap.
+ */
+static int
+resolve_keystore_records(struct keeto_info *info)
+{
+    if (info == NULL) {
+        fatal("info == NULL");
     }
-    return res;
+
+    char *keetod_socket = cfg_getstr(info->cfg, "keetod_socket");
+    bool keetod_enabled = strlen(keetod_socket) > 0 ? true : false;
+    if (keetod_enabled) {
+        log_info("obtaining keystore records from keetod '%s'", keetod_socket);
+        int keetod_result = KEETO_UNKNOWN_ERR;
+        int rc = get_keystore_records_from_keetod(info, keetod_socket,
+            &keetod_result);
+        switch (rc) {
+        case KEETO_OK:
+            return keetod_result;
+        case KEETO_NO_MEMORY:
+            return rc;
+        default:
+            log_warn("failed to obtain keystore records from keetod (%s) - "
+                "falling back to ldap", keeto_strerror(rc));
+        }
+    }
+    return get_keystore_records_from_ldap(info);
 }
 
+/*
+ * the keystore is either written to the keystore file of the user or,
+ * if configured, to the keystore db served by keeto-authorized-keys.
+ */
 static int
-add_keystore_record(struct keeto_key_provider *key_provider,
-    struct keeto_keystore_options *keystore_options, struct keeto_key *key,
-    struct keeto_keystore_records *keystore_records)
+store_keystore(struct keeto_info *info)
 {
-    if (key_provider == NULL || key == NULL || keystore_records == NULL) {
-        fatal("key_provider, key or keystore_records == NULL");
+    if (info == NULL) {
+        fatal("info == NULL");
     }
 
-    struct keeto_keystore_record *keystore_record = new_keystore_record();
-    if (keystore_record == NULL) {
-        log_error("failed to allocate memory for keystore record buffer");
-        return KEETO_NO_MEMORY;
+    char *ssh_keystore_db = cfg_getstr(info->cfg, "ssh_keystore_db");
+    if (strlen(ssh_keystore_db) > 0) {
+        log_info("writing keystore of uid '%s' to keystore db '%s'",
+            info->uid, ssh_keystore_db);
+        return write_keystore_db(ssh_keystore_db, info->uid,
+            info->keystore_records);
     }
+    log_info("writing keystore file '%s'", info->ssh_keystore_location);
+    return write_keystore(info->ssh_keystore_location, info->keystore_records);
+}
 
-    keystore_record->uid = key_provider->uid;
-    keystore_record->ssh_keytype = key->ssh_key->keytype;
-    keystore_record->ssh_key = key->ssh_key->key;
-    keystore_record->ssh_key_fp_md5 = key->ssh_key_fp_md5;
-    keystore_record->ssh_key_fp_sha256 = key->ssh_key_fp_sha256;
-    if (keystore_options != NULL) {
-        keystore_record->command_option = keystore_options->command_option;
-        keystore_record->from_option = keystore_options->from_option;
+static void
+discard_keystore(struct keeto_info *info)
+{
+    if (info == NULL) {
+        fatal("info == NULL");
     }
-    SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
 
-    return KEETO_OK;
+    char *ssh_keystore_db = cfg_getstr(info->cfg, "ssh_keystore_db");
+    if (strlen(ssh_keystore_db) > 0) {
+        remove_keystore_db(ssh_keystore_db, info->uid);
+        return;
+    }
+    remove_keystore(info->ssh_keystore_location);
 }
 
-static int
-post_process_key(struct keeto_key *key)
+static void
+run_keystore_cache_refresh(struct keeto_info *info, int lock_fd)
 {
-    if (key == NULL) {
-        fatal("key == NULL");
+    if (info == NULL) {
+        fatal("info == NULL");
     }
 
-    /* check certificate */
-    bool valid = false;
-    int rc = validate_x509(key->x509, &valid);
-    if (rc != KEETO_OK) {
-        log_error("failed to validate certificate (%s)", keeto_strerror(rc));
-        return KEETO_CERT_VALIDATION_ERR;
+    /* detach from the ssh session */
+    close_log();
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd == -1) {
+        max_fd = MAX_FD_FALLBACK;
+    }
+    for (int fd = 0; fd < max_fd; fd++) {
+        if (fd != lock_fd) {
+            close(fd);
+        }
     }
-    if (!valid) {
-        return KEETO_INVALID_CERT;
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd == STDIN_FILENO) {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
     }
 
-    /* add ssh key data */
-    rc = add_key_data_from_x509(key->x509, key);
+    struct keeto_info *refresh_info = new_info();
+    if (refresh_info == NULL) {
+        log_error("failed to allocate memory for info buffer");
+        return;
+    }
+    /* borrow everything needed from the original info object */
+    refresh_info->cfg = info->cfg;
+    refresh_info->uid = info->uid;
+    refresh_info->ssh_keystore_location = info->ssh_keystore_location;
+    refresh_info->ssh_keystore_cache_location =
+        info->ssh_keystore_cache_location;
+
+    log_info("refreshing keystore cache of uid '%s'", refresh_info->uid);
+    int rc = resolve_keystore_records(refresh_info);
     switch (rc) {
     case KEETO_OK:
+        rc = store_keystore(refresh_info);
+        if (rc != KEETO_OK) {
+            log_error("failed to write keystore file (%s)", keeto_strerror(rc));
+            break;
+        }
+        rc = store_keystore_cache(refresh_info->ssh_keystore_cache_location,
+            refresh_info);
+        if (rc != KEETO_OK) {
+            log_error("failed to store keystore cache (%s)", keeto_strerror(rc));
+        }
+        break;
+    case KEETO_NO_ACCESS_PROFILE_FOR_SSH_SERVER:
+    case KEETO_NO_ACCESS_PROFILE_FOR_UID:
+        log_info("access revoked for uid '%s' (%s)", refresh_info->uid,
+            keeto_strerror(rc));
+        discard_keystore(refresh_info);
+        remove_keystore_cache(refresh_info->ssh_keystore_cache_location);
         break;
-    case KEETO_NO_MEMORY:
-        return rc;
     default:
-        log_error("failed to add key data (%s)", keeto_strerror(rc));
-        return KEETO_KEY_TRANSFORM_ERR;
+        log_error("failed to refresh keystore cache (%s)", keeto_strerror(rc));
     }
-    return KEETO_OK;
+
+    refresh_info->cfg = NULL;
+    refresh_info->uid = NULL;
+    refresh_info->ssh_keystore_location = NULL;
+    refresh_info->ssh_keystore_cache_location = NULL;
+    free_info(refresh_info);
 }
 
-static int
-post_process_key_provider(struct keeto_key_provider *key_provider,
-    struct keeto_keystore_options *keystore_options,
-    struct keeto_keystore_records *keystore_records)
+/*
+ * refreshes the keystore cache in a detached process so that the
+ * login does not have to wait for ldap. the cache lock makes sure
+ * that only one refresh per uid is running at a time. the refresh
+ * process runs ldap and openssl code after fork(). this is safe as the
+ * module joins all threads it starts before the pam call returns.
+ */
+static void
+refresh_keystore_cache(struct keeto_info *info)
 {
-    if (key_provider == NULL || keystore_records == NULL) {
-        fatal("key_provider or keystore_records == NULL");
+    if (info == NULL) {
+        fatal("info == NULL");
     }
 
-    if (key_provider->keys == NULL) {
-        fatal("key_provider->keys == NULL");
+    int lock_fd = -1;
+    int rc = try_lock_keystore_cache(info->ssh_keystore_cache_location,
+        &lock_fd);
+    if (rc != KEETO_OK) {
+        log_error("failed to lock keystore cache (%s)", keeto_strerror(rc));
+        return;
+    }
+    if (lock_fd == -1) {
+        log_info("keystore cache refresh already in progress");
+        return;
     }
 
-    struct keeto_key *key = NULL;
-    struct keeto_key *key_tmp = NULL;
-    TAILQ_FOREACH_SAFE(key, key_provider->keys, next, key_tmp) {
-        char *subject = NULL;
-        int rc = get_subject_from_x509(key->x509, &subject);
-        switch (rc) {
-        case KEETO_OK:
-            log_info("processing key '%s'", subject);
-            free(subject);
-            break;
-        case KEETO_NO_MEMORY:
-            return rc;
-        default:
-            log_error("failed to obtain subject from certificate (%s)",
-                keeto_strerror(rc));
+    pid_t pid = fork();
+    switch (pid) {
+    case -1:
+        log_error("failed to fork keystore cache refresh process (%s)",
+            strerror(errno));
+        close(lock_fd);
+        return;
+    case 0:
+        break;
+    default:
+        /*
+         * the lock is released once the refresh process closes its
+         * copy of the file descriptor.
+         */
+        close(lock_fd);
+        /* reap intermediate process. refresh process is adopted by init */
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+            ;
         }
+        return;
+    }
 
-        rc = post_process_key(key);
-        switch (rc) {
-        case KEETO_OK:
-            /* add key to keystore records */
-            log_info("adding keystore record");
-            rc = add_keystore_record(key_provider, keystore_options, key,
-                keystore_records);
-            switch (rc) {
-            case KEETO_OK:
-                break;
-            case KEETO_NO_MEMORY:
-                return rc;
-            default:
-                log_error("failed to add keystore record");
-            }
-            break;
-        case KEETO_NO_MEMORY:
-            return rc;
-        default:
-            log_info("removing key (%s)", keeto_strerror(rc));
-            TAILQ_REMOVE(key_provider->keys, key, next);
-            free_key(key);
-        }
+    /* intermediate process */
+    if (setsid() == -1) {
+        _exit(EXIT_FAILURE);
     }
-    if (TAILQ_EMPTY(key_provider->keys)) {
-        return KEETO_NO_KEY;
+    pid = fork();
+    if (pid != 0) {
+        _exit(pid == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
     }
-    return KEETO_OK;
+
+    /* refresh process */
+    run_keystore_cache_refresh(info, lock_fd);
+    _exit(EXIT_SUCCESS);
 }
 
-static int
-post_process_access_profile(struct keeto_access_profile *access_profile,
-    struct keeto_keystore_records *keystore_records)
+/* drops keystore records that have not been written yet */
+static void
+release_keystore_records(struct keeto_info *info)
 {
-    if (access_profile == NULL || keystore_records == NULL) {
-        fatal("access_profile or keystore_records == NULL");
-    }
-
-    if (access_profile->key_providers == NULL) {
-        fatal("access_profile->key_providers == NULL");
+    if (info == NULL) {
+        fatal("info == NULL");
     }
 
-    struct keeto_key_provider *key_provider = NULL;
-    struct keeto_key_provider *key_provider_tmp = NULL;
-    TAILQ_FOREACH_SAFE(key_provider, access_profile->key_providers, next,
-        key_provider_tmp) {
-
-        log_info("processing key provider '%s'", key_provider->uid);
-        int rc = post_process_key_provider(key_provider,
-            access_profile->keystore_options, keystore_records);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_NO_MEMORY:
-            return rc;
-        default:
-            log_info("removing key provider (%s)", keeto_strerror(rc));
-            TAILQ_REMOVE(access_profile->key_providers, key_provider, next);
-            free_key_provider(key_provider);
-        }
-    }
-    if (TAILQ_EMPTY(access_profile->key_providers)) {
-        return KEETO_NO_KEY_PROVIDER;
-    }
-    return KEETO_OK;
+    free_keystore_records(info->keystore_records);
+    info->keystore_records = NULL;
+    free(info->keystore_records_buffer);
+    info->keystore_records_buffer = NULL;
 }
 
-int
-post_process_access_profiles(struct keeto_info *info)
+static int
+get_keystore_records_from_cache(struct keeto_info *info)
 {
     if (info == NULL) {
         fatal("info == NULL");
     }
 
-    if (info->access_profiles == NULL) {
-        fatal("info->access_profiles == NULL");
+    time_t fresh_ttl = cfg_getint(info->cfg, "ssh_keystore_cache_fresh_ttl");
+    time_t stale_ttl = cfg_getint(info->cfg, "ssh_keystore_cache_stale_ttl");
+    time_t max_age = get_keystore_cache_max_age(fresh_ttl, stale_ttl);
+    if (max_age == 0) {
+        return KEETO_NO_CACHE_ENTRY;
     }
 
-    int res = KEETO_UNKNOWN_ERR;
-
-    /* init cert store for subsequent x509 validation */
-    char *cert_store_dir = cfg_getstr(info->cfg, "cert_store_dir");
-    bool check_crl = cfg_getint(info->cfg, "check_crl");
-    int rc = init_cert_store(cert_store_dir, check_crl);
+    time_t age = 0;
+    int rc = load_keystore_cache(info->ssh_keystore_cache_location, info,
+        max_age, &age);
     if (rc != KEETO_OK) {
-        log_error("failed to initialize cert store (%s)", keeto_strerror(rc));
         return rc;
     }
-
-    struct keeto_keystore_records *keystore_records = new_keystore_records();
-    if (keystore_records == NULL) {
-        log_error("failed to allocate memory for keystore records buffer");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_a;
+    /* sshd ignores records past their expiry time. obtain them anew */
+    time_t expiry = 0;
+    if (get_keystore_records_expiry(info->keystore_records, &expiry) &&
+        expiry <= time(NULL)) {
+        log_info("ignoring keystore cache (expired records, age %llds)",
+            (long long) age);
+        release_keystore_records(info);
+        return KEETO_NO_CACHE_ENTRY;
+    }
+    switch (get_keystore_cache_state(age, fresh_ttl, stale_ttl)) {
+    case KEETO_CACHE_FRESH:
+        log_info("using keystore cache (fresh, age %llds)", (long long) age);
+        return KEETO_OK;
+    case KEETO_CACHE_STALE:
+        log_info("using keystore cache (stale, age %llds)", (long long) age);
+        refresh_keystore_cache(info);
+        return KEETO_OK;
+    default:
+        release_keystore_records(info);
+        return KEETO_NO_CACHE_ENTRY;
     }
+}
 
-    struct keeto_access_profile *access_profile = NULL;
-    struct keeto_access_profile *access_profile_tmp = NULL;
-    TAILQ_FOREACH_SAFE(access_profile, info->access_profiles, next,
-        access_profile_tmp) {
-
-        log_info("processing access profile '%s'", access_profile->uid);
-        int rc = post_process_access_profile(access_profile, keystore_records);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_NO_MEMORY:
-            res = rc;
-            goto cleanup_b;
-        default:
-            log_info("removing access profile (%s)", keeto_strerror(rc));
-            TAILQ_REMOVE(info->access_profiles, access_profile, next);
-            free_access_profile(access_profile);
-        }
-    }
-    if (TAILQ_EMPTY(info->access_profiles)) {
-        free_access_profiles(info->access_profiles);
-        info->access_profiles = NULL;
-        res = KEETO_NO_ACCESS_PROFILE_FOR_UID;
-        goto cleanup_b;
+/*
+ * while ldap is offline a keystore cache of any age is used as long as
+ * its records carry expiry times that have not passed yet.
+ */
+static int
+get_keystore_records_from_offline_cache(struct keeto_info *info)
+{
+    if (info == NULL) {
+        fatal("info == NULL");
     }
-    info->keystore_records = keystore_records;
-    keystore_records = NULL;
-    res = KEETO_OK;
 
-cleanup_b:
-    if (keystore_records != NULL) {
-        free_keystore_records(keystore_records);
+    release_keystore_records(info);
+    time_t age = 0;
+    int rc = load_keystore_cache(info->ssh_keystore_cache_location, info, 0,
+        &age);
+    if (rc != KEETO_OK) {
+        return rc;
     }
-cleanup_a:
-    free_cert_store();
-    return res;
+    time_t expiry = 0;
+    if (!get_keystore_records_expiry(info->keystore_records, &expiry) ||
+        expiry <= time(NULL)) {
+        log_info("ignoring keystore cache (records without expiry time or "
+            "expired, age %llds)", (long long) age);
+        release_keystore_records(info);
+        return KEETO_NO_CACHE_ENTRY;
+    }
+    log_info("using keystore cache (ldap offline, age %llds)",
+        (long long) age);
+    return KEETO_OK;
 }
 
 PAM_EXTERN int
@@ -418,12 +478,26 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv)
         fatal("pamh or argv == NULL");
     }
 
-    /* check pam module arguments */
-    if (argc != 1) {
-        log_error("arg count != 1");
+    /*
+     * check pam module arguments. the config file can be followed by
+     * config_snapshot=<file> to load the config from a snapshot.
+     */
+    if (argc != 1 && argc != 2) {
+        log_error("arg count != 1 and != 2");
         return PAM_SERVICE_ERR;
     }
     const char *cfg_file = argv[0];
+    const char *cfg_snapshot_file = NULL;
+    if (argc == 2) {
+        size_t prefix_length = strlen(CONFIG_SNAPSHOT_ARG);
+        if (strncmp(argv[1], CONFIG_SNAPSHOT_ARG, prefix_length) != 0 ||
+            argv[1][prefix_length] != '/') {
+            log_error("invalid argument '%s' (expected %s<absolute path>)",
+                argv[1], CONFIG_SNAPSHOT_ARG);
+            return PAM_SERVICE_ERR;
+        }
+        cfg_snapshot_file = argv[1] + prefix_length;
+    }
     if (!file_readable(cfg_file)) {
         log_error("failed to open config file '%s' for reading", cfg_file);
         return PAM_SERVICE_ERR;
@@ -447,7 +521,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv)
     init_openssl();
 
     /* parse config */
-    info->cfg = parse_config(cfg_file);
+    info->cfg = parse_config_with_snapshot(cfg_file, cfg_snapshot_file);
     if (info->cfg == NULL) {
         log_error("failed to parse config file '%s'", cfg_file);
         return PAM_SERVICE_ERR;
@@ -509,75 +583,99 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv)
     substitute_token('u', info->uid, ssh_keystore_location,
         info->ssh_keystore_location, SSH_KEYSTORE_LOCATION_BUFFER_SIZE);
 
+    /* expand keystore cache path and add to info */
+    char *ssh_keystore_cache_location = cfg_getstr(info->cfg,
+        "ssh_keystore_cache_location");
+    bool cache_enabled = strlen(ssh_keystore_cache_location) > 0 ? true : false;
+    if (cache_enabled) {
+        info->ssh_keystore_cache_location =
+            malloc(SSH_KEYSTORE_LOCATION_BUFFER_SIZE);
+        if (info->ssh_keystore_cache_location == NULL) {
+            log_error("failed to allocate memory for ssh keystore cache "
+                "location buffer");
+            return PAM_BUF_ERR;
+        }
+        substitute_token('u', info->uid, ssh_keystore_cache_location,
+            info->ssh_keystore_cache_location,
+            SSH_KEYSTORE_LOCATION_BUFFER_SIZE);
+    }
+
     int res = PAM_ABORT;
 
-    /*
-     * get access profiles from ldap.
-     *
-     * only remove keystore when access permissions explicitly say so.
-     */
-    rc = get_access_profiles_from_ldap(info);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        log_error("failed to obtain access profiles from ldap (%s)",
-            keeto_strerror(rc));
-        return PAM_BUF_ERR;
-    case KEETO_LDAP_CONNECTION_ERR:
-        log_error("failed to obtain access profiles from ldap (%s)",
-            keeto_strerror(rc));
-        info->ldap_online = 0;
-        bool ldap_strict = cfg_getint(info->cfg, "ldap_strict");
-        if (ldap_strict) {
-            log_info("ldap strict mode active - refusing access");
-            return PAM_AUTHINFO_UNAVAIL;
+    /* users whose access did not change recently are served from cache */
+    rc = KEETO_NO_CACHE_ENTRY;
+    if (cache_enabled) {
+        rc = get_keystore_records_from_cache(info);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            log_error("failed to obtain keystore records from cache (%s)",
+                keeto_strerror(rc));
+            return PAM_BUF_ERR;
+        default:
+            log_info("no usable keystore cache entry (%s)", keeto_strerror(rc));
         }
-        return PAM_SUCCESS;
-    case KEETO_NO_SSH_SERVER:
-        log_error("failed to obtain access profiles from ldap (%s)",
-            keeto_strerror(rc));
-        return PAM_AUTHINFO_UNAVAIL;
-    case KEETO_NO_ACCESS_PROFILE_FOR_SSH_SERVER:
-        log_info("no access profiles specified for ssh server");
-        res = PAM_AUTH_ERR;
-        goto cleanup_keystore;
-    case KEETO_NO_ACCESS_PROFILE_FOR_UID:
-        log_info("no valid access profile specified for uid '%s'", info->uid);
-        res = PAM_AUTH_ERR;
-        goto cleanup_keystore;
-    default:
-        log_error("failed to obtain access profiles from ldap (%s)",
-            keeto_strerror(rc));
-        return PAM_SERVICE_ERR;
     }
 
-    /*
-     * validate certificates, convert public key to OpenSSH
-     * authorized_keys format and create keystore records.
-     */
-    log_info("post processing access profiles");
-    rc = post_process_access_profiles(info);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        log_error("failed to post process access profiles (%s)",
-            keeto_strerror(rc));
-        return PAM_BUF_ERR;
-    case KEETO_NO_ACCESS_PROFILE_FOR_UID:
-        log_info("no valid access profile specified for uid '%s'", info->uid);
-        res = PAM_AUTH_ERR;
-        goto cleanup_keystore;
-    default:
-        log_error("failed to post process access profiles (%s)",
-            keeto_strerror(rc));
-        return PAM_SERVICE_ERR;
+    /* only remove keystore when access permissions explicitly say so. */
+    bool cache_fallback = false;
+    if (rc != KEETO_OK) {
+        rc = resolve_keystore_records(info);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            log_error("failed to obtain keystore records (%s)",
+                keeto_strerror(rc));
+            return PAM_BUF_ERR;
+        case KEETO_LDAP_CONNECTION_ERR:
+            log_error("failed to obtain keystore records (%s)",
+                keeto_strerror(rc));
+            info->ldap_online = 0;
+            bool ldap_strict = cfg_getint(info->cfg, "ldap_strict");
+            if (ldap_strict) {
+                log_info("ldap strict mode active - refusing access");
+                return PAM_AUTHINFO_UNAVAIL;
+            }
+            if (!cache_enabled ||
+                get_keystore_records_from_offline_cache(info) != KEETO_OK) {
+                return PAM_SUCCESS;
+            }
+            cache_fallback = true;
+            break;
+        case KEETO_NO_SSH_SERVER:
+            log_error("failed to obtain keystore records (%s)",
+                keeto_strerror(rc));
+            return PAM_AUTHINFO_UNAVAIL;
+        case KEETO_NO_ACCESS_PROFILE_FOR_SSH_SERVER:
+            log_info("no access profiles specified for ssh server");
+            res = PAM_AUTH_ERR;
+            goto cleanup_keystore;
+        case KEETO_NO_ACCESS_PROFILE_FOR_UID:
+            log_info("no valid access profile specified for uid '%s'",
+                info->uid);
+            res = PAM_AUTH_ERR;
+            goto cleanup_keystore;
+        default:
+            log_error("failed to obtain keystore records (%s)",
+                keeto_strerror(rc));
+            return PAM_SERVICE_ERR;
+        }
+
+        if (cache_enabled && !cache_fallback) {
+            log_info("storing keystore cache file '%s'",
+                info->ssh_keystore_cache_location);
+            rc = store_keystore_cache(info->ssh_keystore_cache_location, info);
+            if (rc != KEETO_OK) {
+                log_error("failed to store keystore cache (%s)",
+                    keeto_strerror(rc));
+            }
+        }
     }
 
-    /* write keystore records to keystore file */
-    log_info("writing keystore file '%s'", info->ssh_keystore_location);
-    rc = write_keystore(info->ssh_keystore_location, info->keystore_records);
+    /* write keystore records to keystore file or keystore db */
+    rc = store_keystore(info);
     switch (rc) {
     case KEETO_OK:
         break;
@@ -589,7 +687,10 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv)
     return PAM_SUCCESS;
 
 cleanup_keystore:
-    remove_keystore(info->ssh_keystore_location);
+    discard_keystore(info);
+    if (info->ssh_keystore_cache_location != NULL) {
+        remove_keystore_cache(info->ssh_keystore_cache_location);
+    }
     return res;
 }
 
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * encoders of a fixed simd level. encode_hex() and encode_base64() pick
+ * the level at runtime - this header is only meant for the tests and the
+ * benchmark.
+ */
+
+#ifndef KEETO_UTIL_ENCODE_H
+#define KEETO_UTIL_ENCODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum keeto_simd_level {
+    KEETO_SIMD_NONE,
+    KEETO_SIMD_SSSE3,
+    KEETO_SIMD_AVX2
+};
+
+/* highest level supported by the cpu */
+enum keeto_simd_level get_simd_level();
+/* level must not exceed get_simd_level() */
+size_t encode_hex_with_level(const unsigned char *src, size_t src_length,
+    char delimiter, enum keeto_simd_level level, char *dst);
+size_t encode_base64_with_level(const unsigned char *src, size_t src_length,
+    bool pad, enum keeto_simd_level level, char *dst);
+
+#endif /* KEETO_UTIL_ENCODE_H */
+
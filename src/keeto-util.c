@@ -19,31 +19,64 @@
 
 #include "keeto-util.h"
 
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <ldap.h>
 #include <regex.h>
 #include <syslog.h>
+#if KEETO_SIMD_X86
+#include <immintrin.h>
+#endif
 
 #include "keeto-config.h"
 #include "keeto-error.h"
 #include "keeto-log.h"
+#include "keeto-util-encode.h"
 #include "keeto-x509.h"
 
 #define GROUP_DN_BUFFER_SIZE 1024
+#define UID_MAX_ATOMS 8
+#define UID_MAX_LENGTH 256
 
 struct keeto_str_to_enum_entry {
     char *key;
     int value;
 };
 
+/* character class matched between min and max times */
+struct keeto_uid_atom {
+    unsigned char charset[32];
+    size_t min;
+    size_t max;
+};
+
+/*
+ * compiled uid_regex. simple patterns (like the default) are matched by
+ * the atoms instead of regexec().
+ */
+struct keeto_uid_validator {
+    char *pattern;
+    bool fast_path;
+    struct keeto_uid_atom atoms[UID_MAX_ATOMS];
+    size_t atom_count;
+    regex_t regex;
+};
+
+static struct keeto_uid_validator *uid_validator;
+
 static struct keeto_str_to_enum_entry syslog_facility_lt[] = {
     { "LOG_KERN", LOG_KERN },
     { "LOG_USER", LOG_USER },
@@ -136,6 +169,402 @@ file_readable(const char *file)
     return true;
 }
 
+/*
+ * maps a file shared between processes into memory. only regular files
+ * owned by the effective user without any of the insecure mode bits
+ * set are trusted. the file is resized if needed and init is called
+ * while holding the file lock so that concurrent processes do not see
+ * a half initialized file. name is the kind of file used in messages.
+ */
+int
+map_shared_file(const char *file, const char *name, size_t size,
+    mode_t insecure_mode, int (*init)(int fd, void *map, bool resized),
+    int *ret_fd, void **ret_map)
+{
+    if (file == NULL || name == NULL || init == NULL || ret_fd == NULL ||
+        ret_map == NULL) {
+        fatal("file, name, init, ret_fd or ret_map == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    int fd = open(file, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+        S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        log_error("failed to open %s file '%s' (%s)", name, file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat %s file '%s' (%s)", name, file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    if (!S_ISREG(stat_buffer.st_mode) || stat_buffer.st_uid != geteuid() ||
+        (stat_buffer.st_mode & insecure_mode) != 0) {
+        log_error("refusing to use %s file '%s' (insecure file)", name, file);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+
+    rc = flock(fd, LOCK_EX);
+    if (rc == -1) {
+        log_error("failed to lock %s file '%s' (%s)", name, file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    bool resized = false;
+    if ((size_t) stat_buffer.st_size != size) {
+        rc = ftruncate(fd, size);
+        if (rc == -1) {
+            log_error("failed to resize %s file '%s' (%s)", name, file,
+                strerror(errno));
+            res = KEETO_SYSTEM_ERR;
+            goto cleanup_b;
+        }
+        resized = true;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_error("failed to map %s file '%s' (%s)", name, file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_b;
+    }
+    rc = init(fd, map, resized);
+    if (rc != KEETO_OK) {
+        log_error("failed to initialize %s file '%s' (%s)", name, file,
+            strerror(errno));
+        munmap(map, size);
+        res = rc;
+        goto cleanup_b;
+    }
+    flock(fd, LOCK_UN);
+
+    *ret_fd = fd;
+    *ret_map = map;
+    return KEETO_OK;
+
+cleanup_b:
+    flock(fd, LOCK_UN);
+cleanup_a:
+    close(fd);
+    return res;
+}
+
+static void
+set_uid_charset(unsigned char charset[32], unsigned char c)
+{
+    charset[c >> 3] |= 1 << (c & 7);
+}
+
+static bool
+is_uid_charset_member(const unsigned char charset[32], unsigned char c)
+{
+    return charset[c >> 3] & (1 << (c & 7));
+}
+
+static bool
+is_uid_literal(char c)
+{
+    return isalnum((unsigned char) c) || c == '_' || c == '-';
+}
+
+/*
+ * parses a single character or a bracket expression consisting of
+ * literals and ranges. everything else is left to regcomp().
+ */
+static bool
+parse_uid_charset(const char **pattern, unsigned char charset[32])
+{
+    const char *p = *pattern;
+    memset(charset, 0, 32);
+
+    if (*p != '[') {
+        if (!is_uid_literal(*p)) {
+            return false;
+        }
+        set_uid_charset(charset, *p);
+        *pattern = p + 1;
+        return true;
+    }
+    p++;
+    if (*p == ']' || *p == '^') {
+        return false;
+    }
+    while (*p != ']') {
+        if (!is_uid_literal(*p) && *p != '.') {
+            return false;
+        }
+        /* a '-' at the start or the end of the expression is a literal */
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            if (!isalnum((unsigned char) p[0]) ||
+                !isalnum((unsigned char) p[2]) || p[0] > p[2]) {
+                return false;
+            }
+            for (int c = p[0]; c <= p[2]; c++) {
+                set_uid_charset(charset, c);
+            }
+            p += 3;
+            continue;
+        }
+        set_uid_charset(charset, *p);
+        p++;
+    }
+    *pattern = p + 1;
+    return true;
+}
+
+static bool
+parse_uid_bound(const char **pattern, size_t *ret)
+{
+    const char *p = *pattern;
+    size_t bound = 0;
+    if (!isdigit((unsigned char) *p)) {
+        return false;
+    }
+    while (isdigit((unsigned char) *p)) {
+        bound = bound * 10 + (*p - '0');
+        if (bound > RE_DUP_MAX) {
+            return false;
+        }
+        p++;
+    }
+    *pattern = p;
+    *ret = bound;
+    return true;
+}
+
+static bool
+parse_uid_quantifier(const char **pattern, size_t *min, size_t *max)
+{
+    const char *p = *pattern;
+    switch (*p) {
+    case '?':
+        *min = 0;
+        *max = 1;
+        break;
+    case '*':
+        *min = 0;
+        *max = SIZE_MAX;
+        break;
+    case '+':
+        *min = 1;
+        *max = SIZE_MAX;
+        break;
+    case '{':
+        p++;
+        if (!parse_uid_bound(&p, min)) {
+            return false;
+        }
+        *max = *min;
+        if (*p == ',') {
+            p++;
+            *max = SIZE_MAX;
+            if (*p != '}' && !parse_uid_bound(&p, max)) {
+                return false;
+            }
+        }
+        if (*p != '}' || *min > *max) {
+            return false;
+        }
+        break;
+    default:
+        *min = 1;
+        *max = 1;
+        *pattern = p;
+        return true;
+    }
+    *pattern = p + 1;
+    return true;
+}
+
+/*
+ * recognizes anchored patterns of character classes. only the last
+ * class may be matched a variable number of times so that a uid can be
+ * matched without backtracking.
+ */
+static bool
+compile_uid_fast_path(const char *pattern, struct keeto_uid_validator *validator)
+{
+    const char *p = pattern;
+    if (*p != '^') {
+        return false;
+    }
+    p++;
+    size_t count = 0;
+    while (*p != '$') {
+        if (count == UID_MAX_ATOMS) {
+            return false;
+        }
+        /* a variable class must be the last one */
+        if (count > 0 && validator->atoms[count - 1].min !=
+            validator->atoms[count - 1].max) {
+            return false;
+        }
+        struct keeto_uid_atom *atom = &validator->atoms[count];
+        if (!parse_uid_charset(&p, atom->charset) ||
+            !parse_uid_quantifier(&p, &atom->min, &atom->max)) {
+            return false;
+        }
+        count++;
+    }
+    if (p[1] != '\0') {
+        return false;
+    }
+    validator->atom_count = count;
+    return true;
+}
+
+static bool
+match_uid_fast_path(struct keeto_uid_validator *validator, const char *uid)
+{
+    const unsigned char *c = (const unsigned char *) uid;
+    for (size_t i = 0; i < validator->atom_count; i++) {
+        struct keeto_uid_atom *atom = &validator->atoms[i];
+        size_t matched = 0;
+        while (matched < atom->max && *c != '\0' &&
+            is_uid_charset_member(atom->charset, *c)) {
+            matched++;
+            c++;
+        }
+        if (matched < atom->min) {
+            return false;
+        }
+    }
+    return *c == '\0';
+}
+
+static void
+release_uid_validator(struct keeto_uid_validator *validator)
+{
+    if (validator == NULL) {
+        return;
+    }
+    if (!validator->fast_path) {
+        regfree(&validator->regex);
+    }
+    free(validator->pattern);
+    free(validator);
+}
+
+static bool
+match_uid_validator(struct keeto_uid_validator *validator, const char *uid)
+{
+    if (validator->fast_path) {
+        return match_uid_fast_path(validator, uid);
+    }
+    return regexec(&validator->regex, uid, 0, NULL, 0) == 0;
+}
+
+static int
+new_uid_validator(const char *regex, struct keeto_uid_validator **ret)
+{
+    struct keeto_uid_validator *validator = malloc(sizeof *validator);
+    if (validator == NULL) {
+        log_error("failed to allocate memory for uid validator buffer");
+        return KEETO_NO_MEMORY;
+    }
+    memset(validator, 0, sizeof *validator);
+    validator->pattern = strdup(regex);
+    if (validator->pattern == NULL) {
+        log_error("failed to duplicate uid regex");
+        free(validator);
+        return KEETO_NO_MEMORY;
+    }
+    validator->fast_path = compile_uid_fast_path(regex, validator);
+    if (!validator->fast_path) {
+        int rc = regcomp(&validator->regex, regex, REG_EXTENDED | REG_NOSUB);
+        if (rc != 0) {
+            log_error("failed to compile regex (%d)", rc);
+            free(validator->pattern);
+            free(validator);
+            return KEETO_REGEX_ERR;
+        }
+    }
+    *ret = validator;
+    return KEETO_OK;
+}
+
+void
+free_uid_validator()
+{
+    release_uid_validator(uid_validator);
+    uid_validator = NULL;
+}
+
+/*
+ * the uid regex of a config is compiled once when the config is put
+ * into use. check_uid() only reads the compiled regex so that
+ * init_uid_validator() and free_uid_validator() must not run
+ * concurrently with it.
+ */
+int
+init_uid_validator(const char *regex)
+{
+    if (regex == NULL) {
+        fatal("regex == NULL");
+    }
+
+    if (uid_validator != NULL && strcmp(uid_validator->pattern, regex) == 0) {
+        return KEETO_OK;
+    }
+
+    struct keeto_uid_validator *validator = NULL;
+    int rc = new_uid_validator(regex, &validator);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    free_uid_validator();
+    uid_validator = validator;
+    return KEETO_OK;
+}
+
+/* checks if regex compiles without touching the compiled uid regex */
+int
+validate_uid_regex(const char *regex)
+{
+    if (regex == NULL) {
+        fatal("regex == NULL");
+    }
+
+    struct keeto_uid_validator *validator = NULL;
+    int rc = new_uid_validator(regex, &validator);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    release_uid_validator(validator);
+    return KEETO_OK;
+}
+
+/*
+ * uids that cannot be valid for any sensible uid regex (e.g. sent by
+ * brute force scans) are rejected without further work.
+ */
+static bool
+is_bogus_uid(const char *uid)
+{
+    size_t length = strnlen(uid, UID_MAX_LENGTH + 1);
+    if (length == 0 || length > UID_MAX_LENGTH) {
+        return true;
+    }
+    if (strcmp(uid, ".") == 0 || strcmp(uid, "..") == 0) {
+        return true;
+    }
+    for (const unsigned char *c = (const unsigned char *) uid; *c != '\0';
+        c++) {
+        if (*c < 0x20 || *c == 0x7f || *c == '/') {
+            return true;
+        }
+    }
+    return false;
+}
+
 int
 check_uid(char *regex, const char *uid, bool *uid_valid)
 {
@@ -143,19 +572,23 @@ check_uid(char *regex, const char *uid, bool *uid_valid)
         fatal("regex, uid or uid_valid == NULL");
     }
 
-    regex_t regex_uid;
-    int rc = regcomp(&regex_uid, regex, REG_EXTENDED | REG_NOSUB);
-    if (rc != 0) {
-        log_error("failed to compile regex (%d)", rc);
-        return KEETO_REGEX_ERR;
-    }
-    rc = regexec(&regex_uid, uid, 0, NULL, 0);
-    regfree(&regex_uid);
-    if (rc == 0) {
-        *uid_valid = true;
-    } else {
+    if (is_bogus_uid(uid)) {
         *uid_valid = false;
+        return KEETO_OK;
+    }
+    if (uid_validator != NULL && strcmp(uid_validator->pattern, regex) == 0) {
+        *uid_valid = match_uid_validator(uid_validator, uid);
+        return KEETO_OK;
+    }
+
+    /* not the regex of the config in use - compiled for this check only */
+    struct keeto_uid_validator *validator = NULL;
+    int rc = new_uid_validator(regex, &validator);
+    if (rc != KEETO_OK) {
+        return rc;
     }
+    *uid_valid = match_uid_validator(validator, uid);
+    release_uid_validator(validator);
     return KEETO_OK;
 }
 
@@ -232,6 +665,54 @@ cleanup:
     return res;
 }
 
+/*
+ * brings a dn into a canonical string representation so that dns can
+ * be compared with strcmp(). as the attributes used in dns are usually
+ * case insensitive the result is lowercased. the result has to be freed
+ * with free().
+ */
+int
+normalize_dn(const char *dn, char **ret)
+{
+    if (dn == NULL || ret == NULL) {
+        fatal("dn or ret == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    LDAPDN ldap_dn = NULL;
+    int rc = ldap_str2dn(dn, &ldap_dn, LDAP_DN_FORMAT_LDAPV3);
+    if (rc != LDAP_SUCCESS) {
+        log_error("failed to parse dn '%s' (%s)", dn, ldap_err2string(rc));
+        return KEETO_LDAP_ERR;
+    }
+    char *ldap_normalized_dn = NULL;
+    rc = ldap_dn2str(ldap_dn, &ldap_normalized_dn, LDAP_DN_FORMAT_LDAPV3);
+    if (rc != LDAP_SUCCESS || ldap_normalized_dn == NULL) {
+        log_error("failed to convert dn '%s' (%s)", dn, ldap_err2string(rc));
+        res = rc == LDAP_NO_MEMORY ? KEETO_NO_MEMORY : KEETO_LDAP_ERR;
+        goto cleanup_a;
+    }
+    /* memory of libldap must not be released with free() */
+    char *normalized_dn = strdup(ldap_normalized_dn);
+    if (normalized_dn == NULL) {
+        log_error("failed to duplicate normalized dn");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_b;
+    }
+    for (char *c = normalized_dn; *c != '\0'; c++) {
+        *c = tolower((unsigned char) *c);
+    }
+    *ret = normalized_dn;
+    res = KEETO_OK;
+
+cleanup_b:
+    ldap_memfree(ldap_normalized_dn);
+cleanup_a:
+    ldap_dnfree(ldap_dn);
+    return res;
+}
+
 struct timeval
 get_ldap_timeout(cfg_t *cfg)
 {
@@ -247,6 +728,394 @@ get_ldap_timeout(cfg_t *cfg)
     return ldap_timeout;
 }
 
+/* deadlines are based on the monotonic clock */
+struct timespec
+get_deadline(struct timeval timeout)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout.tv_sec;
+    deadline.tv_nsec += timeout.tv_usec * 1000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+/*
+ * obtains the time left until deadline. returns false if the deadline
+ * has passed.
+ */
+bool
+get_remaining_time(const struct timespec *deadline, struct timeval *ret)
+{
+    if (deadline == NULL || ret == NULL) {
+        fatal("deadline or ret == NULL");
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long remaining = (long long) (deadline->tv_sec - now.tv_sec) *
+        1000000 + (deadline->tv_nsec - now.tv_nsec) / 1000;
+    if (remaining <= 0) {
+        return false;
+    }
+    ret->tv_sec = remaining / 1000000;
+    ret->tv_usec = remaining % 1000000;
+    return true;
+}
+
+/*
+ * the encoders process large blocks with ssse3 / avx2 if the cpu
+ * supports it. the remainder is encoded with lookup tables.
+ */
+static const char hex_digits[] = "0123456789abcdef";
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+enum keeto_simd_level
+get_simd_level()
+{
+#if KEETO_SIMD_X86
+    static int simd_level = -1;
+    int level = __atomic_load_n(&simd_level, __ATOMIC_RELAXED);
+    if (level == -1) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            level = KEETO_SIMD_AVX2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            level = KEETO_SIMD_SSSE3;
+        } else {
+            level = KEETO_SIMD_NONE;
+        }
+        __atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
+    }
+    return level;
+#else
+    return KEETO_SIMD_NONE;
+#endif
+}
+
+#if KEETO_SIMD_X86
+/*
+ * 16 bytes are encoded per iteration. with a delimiter each byte is
+ * followed by the delimiter. returns the number of bytes encoded.
+ */
+__attribute__((target("ssse3")))
+static size_t
+encode_hex_ssse3(const unsigned char *src, size_t src_length, char delimiter,
+    char *dst)
+{
+    const __m128i digits = _mm_loadu_si128((const __m128i *) hex_digits);
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    size_t i = 0;
+    for (; i + 16 <= src_length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_shuffle_epi8(digits,
+            _mm_and_si128(_mm_srli_epi16(in, 4), nibble_mask));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble_mask));
+        /* digits of byte 0-7 and 8-15 */
+        __m128i a = _mm_unpacklo_epi8(hi, lo);
+        __m128i b = _mm_unpackhi_epi8(hi, lo);
+        if (delimiter == '\0') {
+            _mm_storeu_si128((__m128i *) dst, a);
+            _mm_storeu_si128((__m128i *) (dst + 16), b);
+            dst += 32;
+            continue;
+        }
+        /* spread the digits to 3 characters per byte */
+        __m128i out0 = _mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1,
+            6, 7, -1, 8, 9, -1, 10)),
+            _mm_and_si128(delimiters, _mm_setr_epi8(0, 0, -1, 0, 0, -1, 0,
+            0, -1, 0, 0, -1, 0, 0, -1, 0)));
+        __m128i out1 = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1,
+            -1, 0, 1, -1, 2, 3, -1, 4, 5))),
+            _mm_and_si128(delimiters, _mm_setr_epi8(0, -1, 0, 0, -1, 0, 0,
+            -1, 0, 0, -1, 0, 0, -1, 0, 0)));
+        __m128i out2 = _mm_or_si128(
+            _mm_shuffle_epi8(b, _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10,
+            11, -1, 12, 13, -1, 14, 15, -1)),
+            _mm_and_si128(delimiters, _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1,
+            0, 0, -1, 0, 0, -1, 0, 0, -1)));
+        _mm_storeu_si128((__m128i *) dst, out0);
+        _mm_storeu_si128((__m128i *) (dst + 16), out1);
+        _mm_storeu_si128((__m128i *) (dst + 32), out2);
+        dst += 48;
+    }
+    return i;
+}
+
+/* 32 bytes are encoded per iteration (no delimiter) */
+__attribute__((target("avx2")))
+static size_t
+encode_hex_avx2(const unsigned char *src, size_t src_length, char *dst)
+{
+    const __m256i digits = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) hex_digits));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= src_length; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i hi = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble_mask));
+        __m256i lo = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(in, nibble_mask));
+        /* unpacking works per 128 bit lane */
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *) dst,
+            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + 32),
+            _mm256_permute2x128_si256(a, b, 0x31));
+        dst += 64;
+    }
+    return i;
+}
+
+/*
+ * maps 6 bit values to base64 characters by adding the offset of the
+ * range the value belongs to (wojciech mula's sse base64 encoding).
+ */
+__attribute__((target("ssse3")))
+static __m128i
+lookup_base64_ssse3(__m128i indices)
+{
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+/* split 12 bytes into 16 6 bit values, one per byte */
+__attribute__((target("ssse3")))
+static __m128i
+unpack_base64_ssse3(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5,
+        3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+        _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+        _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t0, t1);
+}
+
+/*
+ * 12 bytes are encoded per iteration. 16 bytes are loaded, so the
+ * last 4 bytes of src are left to the caller.
+ */
+__attribute__((target("ssse3")))
+static size_t
+encode_base64_ssse3(const unsigned char *src, size_t src_length, char *dst)
+{
+    size_t i = 0;
+    for (; i + 16 <= src_length; i += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) dst,
+            lookup_base64_ssse3(unpack_base64_ssse3(in)));
+        dst += 16;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static __m256i
+lookup_base64_avx2(__m256i indices)
+{
+    const __m256i offsets = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0,
+        0));
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range, _mm256_and_si256(less,
+        _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+}
+
+/* 24 bytes (12 per 128 bit lane) are encoded per iteration */
+__attribute__((target("avx2")))
+static size_t
+encode_base64_avx2(const unsigned char *src, size_t src_length, char *dst)
+{
+    const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_set_epi8(10, 11,
+        9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    size_t i = 0;
+    for (; i + 28 <= src_length; i += 24) {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *) (src + i))),
+            _mm_loadu_si128((const __m128i *) (src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+        __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in,
+            _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in,
+            _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        _mm256_storeu_si256((__m256i *) dst,
+            lookup_base64_avx2(_mm256_or_si256(t0, t1)));
+        dst += 32;
+    }
+    return i;
+}
+#endif /* KEETO_SIMD_X86 */
+
+/*
+ * encode src from offset start on. if bytes before start have been
+ * encoded with a delimiter, each of them is followed by the delimiter.
+ */
+static size_t
+encode_hex_scalar(const unsigned char *src, size_t src_length, size_t start,
+    char delimiter, char *dst, char *dst_ptr)
+{
+    if (start > 0 && start == src_length && delimiter != '\0') {
+        /* drop the delimiter following the last byte */
+        dst_ptr--;
+    }
+    for (size_t i = start; i < src_length; i++) {
+        if (i > start && delimiter != '\0') {
+            *dst_ptr++ = delimiter;
+        }
+        *dst_ptr++ = hex_digits[src[i] >> 4];
+        *dst_ptr++ = hex_digits[src[i] & 0x0f];
+    }
+    *dst_ptr = '\0';
+    return dst_ptr - dst;
+}
+
+static size_t
+encode_base64_scalar(const unsigned char *src, size_t src_length,
+    size_t start, bool pad, char *dst, char *dst_ptr)
+{
+    size_t i = start;
+    for (; i + 3 <= src_length; i += 3) {
+        uint32_t triple = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *dst_ptr++ = base64_digits[(triple >> 18) & 0x3f];
+        *dst_ptr++ = base64_digits[(triple >> 12) & 0x3f];
+        *dst_ptr++ = base64_digits[(triple >> 6) & 0x3f];
+        *dst_ptr++ = base64_digits[triple & 0x3f];
+    }
+    if (i < src_length) {
+        uint32_t triple = src[i] << 16;
+        if (i + 1 < src_length) {
+            triple |= src[i + 1] << 8;
+        }
+        *dst_ptr++ = base64_digits[(triple >> 18) & 0x3f];
+        *dst_ptr++ = base64_digits[(triple >> 12) & 0x3f];
+        if (i + 1 < src_length) {
+            *dst_ptr++ = base64_digits[(triple >> 6) & 0x3f];
+        } else if (pad) {
+            *dst_ptr++ = '=';
+        }
+        if (pad) {
+            *dst_ptr++ = '=';
+        }
+    }
+    *dst_ptr = '\0';
+    return dst_ptr - dst;
+}
+
+size_t
+encode_hex_with_level(const unsigned char *src, size_t src_length,
+    char delimiter, enum keeto_simd_level level, char *dst)
+{
+    if (src == NULL || dst == NULL) {
+        fatal("src or dst == NULL");
+    }
+
+    size_t start = 0;
+    char *dst_ptr = dst;
+#if KEETO_SIMD_X86
+    size_t width = delimiter != '\0' ? 3 : 2;
+    switch (level) {
+    case KEETO_SIMD_AVX2:
+        if (delimiter == '\0') {
+            start = encode_hex_avx2(src, src_length, dst_ptr);
+            dst_ptr += start * width;
+        }
+        /* remaining blocks of 16 bytes */
+        size_t encoded = encode_hex_ssse3(src + start, src_length - start,
+            delimiter, dst_ptr);
+        start += encoded;
+        dst_ptr += encoded * width;
+        break;
+    case KEETO_SIMD_SSSE3:
+        start = encode_hex_ssse3(src, src_length, delimiter, dst_ptr);
+        dst_ptr += start * width;
+        break;
+    case KEETO_SIMD_NONE:
+        break;
+    }
+#endif
+    return encode_hex_scalar(src, src_length, start, delimiter, dst, dst_ptr);
+}
+
+/*
+ * encode src as lowercase hex into dst which has to hold at least
+ * HEX_LENGTH(src_length, delimiter) + 1 bytes. a delimiter of '\0'
+ * omits the delimiter. returns the length of the null terminated result.
+ */
+size_t
+encode_hex(const unsigned char *src, size_t src_length, char delimiter,
+    char *dst)
+{
+    return encode_hex_with_level(src, src_length, delimiter,
+        get_simd_level(), dst);
+}
+
+size_t
+encode_base64_with_level(const unsigned char *src, size_t src_length,
+    bool pad, enum keeto_simd_level level, char *dst)
+{
+    if (src == NULL || dst == NULL) {
+        fatal("src or dst == NULL");
+    }
+
+    size_t start = 0;
+    char *dst_ptr = dst;
+#if KEETO_SIMD_X86
+    switch (level) {
+    case KEETO_SIMD_AVX2:
+        start = encode_base64_avx2(src, src_length, dst_ptr);
+        dst_ptr += start / 3 * 4;
+        /* remaining blocks of 12 bytes */
+        size_t encoded = encode_base64_ssse3(src + start, src_length - start,
+            dst_ptr);
+        start += encoded;
+        dst_ptr += encoded / 3 * 4;
+        break;
+    case KEETO_SIMD_SSSE3:
+        start = encode_base64_ssse3(src, src_length, dst_ptr);
+        dst_ptr += start / 3 * 4;
+        break;
+    case KEETO_SIMD_NONE:
+        break;
+    }
+#endif
+    return encode_base64_scalar(src, src_length, start, pad, dst, dst_ptr);
+}
+
+/*
+ * encode src as base64 into dst which has to hold at least
+ * BASE64_LENGTH(src_length) + 1 bytes. without pad the trailing '='
+ * characters are omitted. returns the length of the null terminated
+ * result.
+ */
+size_t
+encode_base64(const unsigned char *src, size_t src_length, bool pad,
+    char *dst)
+{
+    return encode_base64_with_level(src, src_length, pad, get_simd_level(),
+        dst);
+}
+
 int
 blob_to_hex(unsigned char *src, size_t src_len, char *delimiter, char **ret)
 {
@@ -256,20 +1125,16 @@ blob_to_hex(unsigned char *src, size_t src_len, char *delimiter, char **ret)
     if (src_len == 0) {
         return KEETO_OK;
     }
+    if (strlen(delimiter) > 1) {
+        fatal("delimiter must not be longer than one character");
+    }
 
-    size_t delimiter_len = strlen(delimiter);
-    size_t dst_len = ((src_len - 1) * (2 + delimiter_len)) + 3;
-    char *dst = malloc(dst_len);
+    char *dst = malloc(HEX_LENGTH(src_len, delimiter[0]) + 1);
     if (dst == NULL) {
         log_error("failed to allocate memory for hex buffer");
         return KEETO_NO_MEMORY;
     }
-
-    char *dst_ptr = dst;
-    for (int i = 0; i < src_len; i++) {
-        dst_ptr += sprintf(dst_ptr, "%02x%s", src[i], i < (src_len - 1) ?
-            delimiter : "");
-    }
+    encode_hex(src, src_len, delimiter[0], dst);
     *ret = dst;
 
     return KEETO_OK;
@@ -285,58 +1150,443 @@ blob_to_base64(unsigned char *src, size_t src_length, char **ret)
         return KEETO_OK;
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    char *result = malloc(BASE64_LENGTH(src_length) + 1);
+    if (result == NULL) {
+        log_error("failed to allocate memory for base64 buffer");
+        return KEETO_NO_MEMORY;
+    }
+    encode_base64(src, src_length, true, result);
+    *ret = result;
 
-    /* base64 encode blob */
+    return KEETO_OK;
+}
 
-    /* create base64 bio */
-    BIO *bio_base64 = BIO_new(BIO_f_base64());
-    if (bio_base64 == NULL) {
-        log_error("failed to create base64 bio");
-        return KEETO_OPENSSL_ERR;
+static size_t
+memo_hash(const char *key)
+{
+    /* fnv-1a */
+    size_t hash = 2166136261u;
+    for (const char *c = key; *c != '\0'; c++) {
+        hash ^= (unsigned char) tolower((unsigned char) *c);
+        hash *= 16777619u;
     }
-    BIO_set_flags(bio_base64, BIO_FLAGS_BASE64_NO_NL);
+    return hash;
+}
 
-    /* create memory bio */
-    BIO *bio_mem = BIO_new(BIO_s_mem());
-    if (bio_mem == NULL) {
-        log_error("failed to create mem bio");
-        res = KEETO_OPENSSL_ERR;
-        goto cleanup_a;
+int
+memo_get(struct keeto_memo *memo, const char *key, void **ret)
+{
+    if (memo == NULL || key == NULL || ret == NULL) {
+        fatal("memo, key or ret == NULL");
     }
-    /* create bio chain base64->mem */
-    BIO *bio_base64_mem = BIO_push(bio_base64, bio_mem);
 
-    /* write */
-    BIO_write(bio_base64_mem, src, src_length);
-    int rc = BIO_flush(bio_base64_mem);
-    if (rc != 1) {
-        log_error("failed to flush bio");
-        res = KEETO_OPENSSL_ERR;
-        goto cleanup_b;
+    size_t bucket = memo_hash(key) % memo->bucket_count;
+    for (struct keeto_memo_entry *entry = memo->buckets[bucket]; entry != NULL;
+        entry = entry->next) {
+
+        if (strcasecmp(entry->key, key) == 0) {
+            memo->hits++;
+            *ret = entry->value;
+            return KEETO_OK;
+        }
+    }
+    memo->misses++;
+    return KEETO_NO_CACHE_ENTRY;
+}
+
+/*
+ * the memo takes ownership of value on success only. an existing value
+ * with the same key is replaced.
+ */
+int
+memo_put(struct keeto_memo *memo, const char *key, void *value)
+{
+    if (memo == NULL || key == NULL) {
+        fatal("memo or key == NULL");
     }
 
-    /* store base64 encoded string in var and put null terminator */
-    unsigned char *bio_buffer = NULL;
-    long data_out = BIO_get_mem_data(bio_mem, &bio_buffer);
+    size_t bucket = memo_hash(key) % memo->bucket_count;
+    for (struct keeto_memo_entry *entry = memo->buckets[bucket]; entry != NULL;
+        entry = entry->next) {
 
-    char *result = malloc(data_out + 1);
-    if (result == NULL) {
-        log_error("failed to allocate memory for base64 buffer");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_b;
+        if (strcasecmp(entry->key, key) == 0) {
+            if (memo->free_value != NULL && entry->value != value) {
+                memo->free_value(entry->value);
+            }
+            entry->value = value;
+            return KEETO_OK;
+        }
     }
-    memcpy(result, bio_buffer, data_out);
-    result[data_out] = '\0';
 
-    *ret = result;
-    res = KEETO_OK;
+    struct keeto_memo_entry *entry = malloc(sizeof *entry);
+    if (entry == NULL) {
+        log_error("failed to allocate memory for memo entry buffer");
+        return KEETO_NO_MEMORY;
+    }
+    entry->key = strdup(key);
+    if (entry->key == NULL) {
+        log_error("failed to duplicate memo key");
+        free(entry);
+        return KEETO_NO_MEMORY;
+    }
+    entry->value = value;
+    entry->next = memo->buckets[bucket];
+    memo->buckets[bucket] = entry;
+    return KEETO_OK;
+}
 
-cleanup_b:
-    BIO_vfree(bio_mem);
-cleanup_a:
-    BIO_vfree(bio_base64);
-    return res;
+/* keystore record with its position during deduplication */
+struct keeto_dedupe_entry {
+    struct keeto_keystore_record *keystore_record;
+    size_t position;
+    bool removed;
+};
+
+static bool
+is_same_keystore_option(const char *option_a, const char *option_b)
+{
+    if (option_a == NULL || option_b == NULL) {
+        return option_a == option_b;
+    }
+    return strcmp(option_a, option_b) == 0;
+}
+
+static bool
+is_same_ssh_key(struct keeto_keystore_record *keystore_record_a,
+    struct keeto_keystore_record *keystore_record_b)
+{
+    return strcmp(keystore_record_a->ssh_keytype,
+        keystore_record_b->ssh_keytype) == 0 &&
+        strcmp(keystore_record_a->ssh_key, keystore_record_b->ssh_key) == 0;
+}
+
+/*
+ * expiry times are fixed width digit strings and compare like numbers.
+ * a record without expiry time never expires.
+ */
+static bool
+is_same_or_later_expiry(const char *expiry_time_a, const char *expiry_time_b)
+{
+    if (expiry_time_a == NULL || expiry_time_b == NULL) {
+        return expiry_time_a == NULL;
+    }
+    return strcmp(expiry_time_a, expiry_time_b) >= 0;
+}
+
+/* records granting the same uid with the same forced command */
+static bool
+is_same_grant(struct keeto_keystore_record *keystore_record_a,
+    struct keeto_keystore_record *keystore_record_b)
+{
+    return strcmp(keystore_record_a->uid, keystore_record_b->uid) == 0 &&
+        is_same_keystore_option(keystore_record_a->command_option,
+        keystore_record_b->command_option);
+}
+
+/* orders by ssh key and keeps the keystore order otherwise */
+static int
+compare_dedupe_entries(const void *a, const void *b)
+{
+    const struct keeto_dedupe_entry *entry_a =
+        *(const struct keeto_dedupe_entry * const *) a;
+    const struct keeto_dedupe_entry *entry_b =
+        *(const struct keeto_dedupe_entry * const *) b;
+
+    int rc = strcmp(entry_a->keystore_record->ssh_keytype,
+        entry_b->keystore_record->ssh_keytype);
+    if (rc == 0) {
+        rc = strcmp(entry_a->keystore_record->ssh_key,
+            entry_b->keystore_record->ssh_key);
+    }
+    if (rc != 0) {
+        return rc;
+    }
+    return entry_a->position < entry_b->position ? -1 : 1;
+}
+
+/*
+ * dedupes the records of one ssh key given in keystore order. sshd uses
+ * the first record of a key whose from option matches the client, so
+ * a record is only removed if that cannot change the outcome:
+ *
+ * - a record is removed if an earlier record grants the same uid with
+ *   the same command option, the same or no from option and expires at
+ *   the same time or later.
+ * - a record without from option is merged into the previous record of
+ *   the same key if that grants the same uid with the same command
+ *   option and does not expire later. the previous record takes over
+ *   the missing from option and the expiry time of the record.
+ *
+ * records that differ in uid or command option and records with
+ * different from options or expiry times are kept otherwise.
+ */
+static void
+dedupe_ssh_key_records(struct keeto_dedupe_entry **entries, size_t count)
+{
+    for (size_t i = 1; i < count; i++) {
+        struct keeto_keystore_record *keystore_record =
+            entries[i]->keystore_record;
+        struct keeto_dedupe_entry *previous = NULL;
+        for (size_t j = 0; j < i && !entries[i]->removed; j++) {
+            if (entries[j]->removed) {
+                continue;
+            }
+            previous = entries[j];
+            struct keeto_keystore_record *earlier = entries[j]->keystore_record;
+            if (is_same_grant(earlier, keystore_record) &&
+                (earlier->from_option == NULL ||
+                is_same_keystore_option(earlier->from_option,
+                keystore_record->from_option)) &&
+                is_same_or_later_expiry(earlier->expiry_time_option,
+                keystore_record->expiry_time_option)) {
+
+                entries[i]->removed = true;
+            }
+        }
+        if (entries[i]->removed || previous == NULL ||
+            keystore_record->from_option != NULL ||
+            !is_same_grant(previous->keystore_record, keystore_record) ||
+            !is_same_or_later_expiry(keystore_record->expiry_time_option,
+            previous->keystore_record->expiry_time_option)) {
+            continue;
+        }
+        previous->keystore_record->from_option = NULL;
+        previous->keystore_record->expiry_time_option =
+            keystore_record->expiry_time_option;
+        entries[i]->removed = true;
+    }
+}
+
+/*
+ * removes duplicate keystore records (same ssh key, uid, command option
+ * and from option) and merges records whose options allow it (see
+ * dedupe_ssh_key_records()). the order of the remaining records is
+ * kept. ret_removed is set to the number of removed records.
+ */
+int
+dedupe_keystore_records(struct keeto_keystore_records *keystore_records,
+    size_t *ret_removed)
+{
+    if (keystore_records == NULL || ret_removed == NULL) {
+        fatal("keystore_records or ret_removed == NULL");
+    }
+
+    size_t count = 0;
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        count++;
+    }
+    *ret_removed = 0;
+    if (count < 2) {
+        return KEETO_OK;
+    }
+
+    struct keeto_dedupe_entry *entries = calloc(count, sizeof *entries);
+    struct keeto_dedupe_entry **sorted = calloc(count, sizeof *sorted);
+    if (entries == NULL || sorted == NULL) {
+        log_error("failed to allocate memory for dedupe buffer");
+        free(sorted);
+        free(entries);
+        return KEETO_NO_MEMORY;
+    }
+    size_t position = 0;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        entries[position].keystore_record = keystore_record;
+        entries[position].position = position;
+        sorted[position] = &entries[position];
+        position++;
+    }
+    qsort(sorted, count, sizeof *sorted, &compare_dedupe_entries);
+    for (size_t start = 0, end = 1; start < count; start = end++) {
+        while (end < count && is_same_ssh_key(sorted[start]->keystore_record,
+            sorted[end]->keystore_record)) {
+            end++;
+        }
+        dedupe_ssh_key_records(&sorted[start], end - start);
+    }
+
+    /* rebuild the records in keystore order */
+    SIMPLEQ_INIT(keystore_records);
+    size_t removed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].removed) {
+            free_keystore_record(entries[i].keystore_record);
+            removed++;
+            continue;
+        }
+        SIMPLEQ_INSERT_TAIL(keystore_records, entries[i].keystore_record, next);
+    }
+    free(sorted);
+    free(entries);
+    *ret_removed = removed;
+    return KEETO_OK;
+}
+
+static size_t
+get_keystore_record_field_size(const char *field)
+{
+    return field == NULL ? 1 : strlen(field) + 2;
+}
+
+/*
+ * every field of a keystore record is encoded as a presence byte
+ * optionally followed by a NUL terminated string.
+ */
+size_t
+get_keystore_record_size(struct keeto_keystore_record *keystore_record)
+{
+    if (keystore_record == NULL) {
+        fatal("keystore_record == NULL");
+    }
+
+    return get_keystore_record_field_size(keystore_record->uid) +
+        get_keystore_record_field_size(keystore_record->ssh_keytype) +
+        get_keystore_record_field_size(keystore_record->ssh_key) +
+        get_keystore_record_field_size(keystore_record->ssh_key_fp_md5) +
+        get_keystore_record_field_size(keystore_record->ssh_key_fp_sha256) +
+        get_keystore_record_field_size(keystore_record->command_option) +
+        get_keystore_record_field_size(keystore_record->from_option) +
+        get_keystore_record_field_size(keystore_record->expiry_time_option);
+}
+
+/*
+ * removes records larger than KEETO_KEYSTORE_MAX_RECORD_SIZE and all
+ * records beyond KEETO_KEYSTORE_MAX_RECORDS so that the keystore records
+ * of a uid always fit into a keetod response and a keystore cache file.
+ * ret_removed is set to the number of removed records.
+ */
+void
+limit_keystore_records(struct keeto_keystore_records *keystore_records,
+    size_t *ret_removed)
+{
+    if (keystore_records == NULL || ret_removed == NULL) {
+        fatal("keystore_records or ret_removed == NULL");
+    }
+
+    size_t count = 0;
+    size_t removed = 0;
+    struct keeto_keystore_record *keystore_record =
+        SIMPLEQ_FIRST(keystore_records);
+    SIMPLEQ_INIT(keystore_records);
+    while (keystore_record != NULL) {
+        struct keeto_keystore_record *next = SIMPLEQ_NEXT(keystore_record,
+            next);
+        if (count == KEETO_KEYSTORE_MAX_RECORDS || get_keystore_record_size(
+            keystore_record) > KEETO_KEYSTORE_MAX_RECORD_SIZE) {
+            free_keystore_record(keystore_record);
+            removed++;
+        } else {
+            SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+            count++;
+        }
+        keystore_record = next;
+    }
+    *ret_removed = removed;
+}
+
+/*
+ * sshd reads expiry-time options without time zone in local time. the
+ * utc suffix is not understood by older openssh versions.
+ */
+int
+format_expiry_time(time_t expiry, char **ret)
+{
+    if (ret == NULL) {
+        fatal("ret == NULL");
+    }
+
+    struct tm tm;
+    if (localtime_r(&expiry, &tm) == NULL) {
+        log_error("failed to convert expiry time to local time");
+        return KEETO_SYSTEM_ERR;
+    }
+    char *buffer = malloc(EXPIRY_TIME_LENGTH + 1);
+    if (buffer == NULL) {
+        log_error("failed to allocate memory for expiry time buffer");
+        return KEETO_NO_MEMORY;
+    }
+    size_t length = strftime(buffer, EXPIRY_TIME_LENGTH + 1, "%Y%m%d%H%M%S",
+        &tm);
+    if (length != EXPIRY_TIME_LENGTH) {
+        log_error("failed to format expiry time");
+        free(buffer);
+        return KEETO_SYSTEM_ERR;
+    }
+    *ret = buffer;
+    return KEETO_OK;
+}
+
+/* returns false if expiry_time is malformed */
+bool
+parse_expiry_time(const char *expiry_time, time_t *ret)
+{
+    if (expiry_time == NULL || ret == NULL) {
+        fatal("expiry_time or ret == NULL");
+    }
+
+    if (strlen(expiry_time) != EXPIRY_TIME_LENGTH) {
+        return false;
+    }
+    int values[6];
+    int digits[6] = { 4, 2, 2, 2, 2, 2 };
+    const char *ptr = expiry_time;
+    for (int i = 0; i < 6; i++) {
+        values[i] = 0;
+        for (int j = 0; j < digits[i]; j++, ptr++) {
+            if (!isdigit((unsigned char) *ptr)) {
+                return false;
+            }
+            values[i] = values[i] * 10 + (*ptr - '0');
+        }
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+    tm.tm_year = values[0] - 1900;
+    tm.tm_mon = values[1] - 1;
+    tm.tm_mday = values[2];
+    tm.tm_hour = values[3];
+    tm.tm_min = values[4];
+    tm.tm_sec = values[5];
+    tm.tm_isdst = -1;
+    time_t expiry = mktime(&tm);
+    if (expiry == (time_t) -1) {
+        return false;
+    }
+    *ret = expiry;
+    return true;
+}
+
+/*
+ * obtains the earliest expiry time of all keystore records. returns
+ * false if no record expires. malformed expiry times count as expired.
+ */
+bool
+get_keystore_records_expiry(struct keeto_keystore_records *keystore_records,
+    time_t *ret)
+{
+    if (keystore_records == NULL || ret == NULL) {
+        fatal("keystore_records or ret == NULL");
+    }
+
+    bool found = false;
+    time_t earliest = 0;
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        if (keystore_record->expiry_time_option == NULL) {
+            continue;
+        }
+        time_t expiry = 0;
+        if (!parse_expiry_time(keystore_record->expiry_time_option,
+            &expiry)) {
+            expiry = 0;
+        }
+        if (!found || expiry < earliest) {
+            earliest = expiry;
+            found = true;
+        }
+    }
+    *ret = earliest;
+    return found;
 }
 
 /* constructors */
@@ -479,6 +1729,28 @@ new_keystore_record()
     return keystore_record;
 }
 
+struct keeto_memo *
+new_memo(size_t bucket_count, void (*free_value)(void *))
+{
+    if (bucket_count == 0) {
+        fatal("bucket_count == 0");
+    }
+
+    struct keeto_memo *memo = malloc(sizeof *memo);
+    if (memo == NULL) {
+        return NULL;
+    }
+    memset(memo, 0, sizeof *memo);
+    memo->buckets = calloc(bucket_count, sizeof *memo->buckets);
+    if (memo->buckets == NULL) {
+        free(memo);
+        return NULL;
+    }
+    memo->bucket_count = bucket_count;
+    memo->free_value = free_value;
+    return memo;
+}
+
 /* destructors */
 void
 free_info(struct keeto_info *info)
@@ -489,9 +1761,18 @@ free_info(struct keeto_info *info)
     free_config(info->cfg);
     free(info->uid);
     free(info->ssh_keystore_location);
+    free(info->ssh_keystore_cache_location);
     free_ssh_server(info->ssh_server);
     free_access_profiles(info->access_profiles);
     free_keystore_records(info->keystore_records);
+    free(info->keystore_records_buffer);
+    free_memo(info->ldap_memo);
+    if (info->target_keystore_dns != NULL) {
+        for (int i = 0; info->target_keystore_dns[i] != NULL; i++) {
+            free(info->target_keystore_dns[i]);
+        }
+        free(info->target_keystore_dns);
+    }
     free(info);
 }
 
@@ -594,6 +1875,7 @@ free_key(struct keeto_key *key)
     free_ssh_key(key->ssh_key);
     free(key->ssh_key_fp_md5);
     free(key->ssh_key_fp_sha256);
+    free(key->expiry_time_option);
     free(key);
 }
 
@@ -637,3 +1919,24 @@ free_keystore_record(struct keeto_keystore_record *keystore_record)
     free(keystore_record);
 }
 
+void
+free_memo(struct keeto_memo *memo)
+{
+    if (memo == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < memo->bucket_count; i++) {
+        struct keeto_memo_entry *entry = memo->buckets[i];
+        while (entry != NULL) {
+            struct keeto_memo_entry *next = entry->next;
+            if (memo->free_value != NULL) {
+                memo->free_value(entry->value);
+            }
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(memo->buckets);
+    free(memo);
+}
@@ -23,7 +23,9 @@
 #include "queue.h"
 
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/types.h>
 
 #include <confuse.h>
 #include <openssl/x509.h>
@@ -35,6 +37,26 @@
     } \
 } while (0)
 
+/* simd encoders are picked at runtime on x86 (gcc / clang only) */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEETO_SIMD_X86 1
+#else
+#define KEETO_SIMD_X86 0
+#endif
+
+/* length of encoded data of n bytes (without terminating null byte) */
+#define BASE64_LENGTH(n) (((n) + 2) / 3 * 4)
+#define HEX_LENGTH(n, delimiter) \
+    ((n) == 0 ? 0 : (n) * 2 + ((delimiter) != '\0' ? (n) - 1 : 0))
+/* length of an expiry-time option value (YYYYMMDDHHMMSS) */
+#define EXPIRY_TIME_LENGTH 14
+/*
+ * upper bounds of the keystore records of a uid. the size of a record
+ * is its size in the keetod protocol (see get_keystore_record_size()).
+ */
+#define KEETO_KEYSTORE_MAX_RECORDS 8192
+#define KEETO_KEYSTORE_MAX_RECORD_SIZE (8 * 1024)
+
 enum {
     KEETO_UNDEF = 0x56
 };
@@ -57,6 +79,7 @@ struct keeto_keystore_record {
     char *ssh_key_fp_sha256;
     char *command_option;
     char *from_option;
+    char *expiry_time_option;
     SIMPLEQ_ENTRY(keeto_keystore_record) next;
 };
 
@@ -72,11 +95,18 @@ struct keeto_ssh_key {
     char *key;
 };
 
+/*
+ * der references the certificate held by the ldap memo. x509 is only
+ * decoded while the key is post processed - see decode_key_x509().
+ */
 struct keeto_key {
+    const unsigned char *der;
+    size_t der_length;
     X509 *x509;
     struct keeto_ssh_key *ssh_key;
     char *ssh_key_fp_md5;
     char *ssh_key_fp_sha256;
+    char *expiry_time_option;
     TAILQ_ENTRY(keeto_key) next;
 };
 
@@ -101,28 +131,76 @@ struct keeto_ssh_server {
     char *uid;
 };
 
+/* request scoped lookup table, keys are compared case insensitive */
+struct keeto_memo_entry {
+    char *key;
+    void *value;
+    struct keeto_memo_entry *next;
+};
+
+struct keeto_memo {
+    struct keeto_memo_entry **buckets;
+    size_t bucket_count;
+    void (*free_value)(void *value);
+    unsigned int hits;
+    unsigned int misses;
+};
+
 struct keeto_info {
     cfg_t *cfg;
     char *uid;
     char *ssh_keystore_location;
+    char *ssh_keystore_cache_location;
     struct keeto_ssh_server *ssh_server;
     TAILQ_HEAD(keeto_access_profiles, keeto_access_profile)
         *access_profiles;
     char ldap_online;
     SIMPLEQ_HEAD(keeto_keystore_records, keeto_keystore_record)
         *keystore_records;
+    /* backing storage of keystore records received from keetod */
+    char *keystore_records_buffer;
+    /* normalized dns of target keystores of uid (reverse lookup) */
+    char **target_keystore_dns;
+    /* ldap entries and certificates fetched during this login */
+    struct keeto_memo *ldap_memo;
+    /* all ldap searches of this login have to finish before (monotonic) */
+    struct timespec ldap_deadline;
 };
 
 int str_to_enum(enum keeto_section section, const char *key);
 bool file_readable(const char *file);
+int map_shared_file(const char *file, const char *name, size_t size,
+    mode_t insecure_mode, int (*init)(int fd, void *map, bool resized),
+    int *ret_fd, void **ret_map);
+int init_uid_validator(const char *regex);
+void free_uid_validator();
+int validate_uid_regex(const char *regex);
 int check_uid(char *regex, const char *uid, bool *uid_valid);
 void substitute_token(char token, const char *subst, const char *src, char *dst,
     size_t dst_length);
 int get_rdn_from_dn(const char *dn, char **buffer);
+int normalize_dn(const char *dn, char **ret);
 struct timeval get_ldap_timeout(cfg_t *cfg);
+struct timespec get_deadline(struct timeval timeout);
+bool get_remaining_time(const struct timespec *deadline, struct timeval *ret);
 int blob_to_hex(unsigned char *src, size_t src_length, char *delimiter,
     char **ret);
 int blob_to_base64(unsigned char *src, size_t src_length, char **ret);
+size_t encode_hex(const unsigned char *src, size_t src_length, char delimiter,
+    char *dst);
+size_t encode_base64(const unsigned char *src, size_t src_length, bool pad,
+    char *dst);
+int memo_get(struct keeto_memo *memo, const char *key, void **ret);
+int memo_put(struct keeto_memo *memo, const char *key, void *value);
+int dedupe_keystore_records(struct keeto_keystore_records *keystore_records,
+    size_t *ret_removed);
+size_t get_keystore_record_size(struct keeto_keystore_record *keystore_record);
+void limit_keystore_records(struct keeto_keystore_records *keystore_records,
+    size_t *ret_removed);
+int format_expiry_time(time_t expiry, char **ret);
+bool parse_expiry_time(const char *expiry_time, time_t *ret);
+bool get_keystore_records_expiry(
+    struct keeto_keystore_records *keystore_records, time_t *ret);
 /* constructors */
 struct keeto_info *new_info();
 struct keeto_ssh_server *new_ssh_server();
@@ -136,6 +214,7 @@ struct keeto_key *new_key();
 struct keeto_keystore_options *new_keystore_options();
 struct keeto_keystore_records *new_keystore_records();
 struct keeto_keystore_record *new_keystore_record();
+struct keeto_memo *new_memo(size_t bucket_count, void (*free_value)(void *));
 /* destructors */
 void free_info(struct keeto_info *info);
 void free_ssh_server(struct keeto_ssh_server *ssh_server);
@@ -149,6 +228,7 @@ void free_key(struct keeto_key *key);
 void free_keystore_options(struct keeto_keystore_options *keystore_options);
 void free_keystore_records(struct keeto_keystore_records *keystore_records);
 void free_keystore_record(struct keeto_keystore_record *keystore_record);
+void free_memo(struct keeto_memo *memo);
 
 #endif /* KEETO_UTIL_H */
 
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-vcache.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keeto-error.h"
+#include "keeto-log.h"
+#include "keeto-util.h"
+
+static int
+init_vcache_file(int fd, void *map, bool resized)
+{
+    struct keeto_vcache_table *table = map;
+    if (resized || table->magic != KEETO_VCACHE_MAGIC ||
+        table->version != KEETO_VCACHE_VERSION) {
+
+        memset(table, 0, sizeof *table);
+        table->magic = KEETO_VCACHE_MAGIC;
+        table->version = KEETO_VCACHE_VERSION;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * the validation cache file is shared between processes by mapping it
+ * into memory. entries are protected by a sequence counter each.
+ */
+int
+open_vcache(const char *vcache_file, struct keeto_vcache **ret)
+{
+    if (vcache_file == NULL || ret == NULL) {
+        fatal("vcache_file or ret == NULL");
+    }
+
+    /*
+     * only trust files that cannot be altered by others. entries of the
+     * file allow to skip certificate validation.
+     */
+    int fd = -1;
+    void *map = NULL;
+    int rc = map_shared_file(vcache_file, "validation cache",
+        sizeof (struct keeto_vcache_table), S_IRWXG | S_IRWXO,
+        &init_vcache_file, &fd, &map);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    struct keeto_vcache *vcache = malloc(sizeof *vcache);
+    if (vcache == NULL) {
+        log_error("failed to allocate memory for validation cache buffer");
+        munmap(map, sizeof (struct keeto_vcache_table));
+        close(fd);
+        return KEETO_NO_MEMORY;
+    }
+    vcache->fd = fd;
+    vcache->table = map;
+    *ret = vcache;
+    return KEETO_OK;
+}
+
+void
+close_vcache(struct keeto_vcache *vcache)
+{
+    if (vcache == NULL) {
+        return;
+    }
+    munmap(vcache->table, sizeof (struct keeto_vcache_table));
+    close(vcache->fd);
+    free(vcache);
+}
+
+/* the digest is uniformly distributed - use its prefix as hash */
+static unsigned int
+get_vcache_slot(const unsigned char *digest)
+{
+    uint32_t hash;
+    memcpy(&hash, digest, sizeof hash);
+    return hash % KEETO_VCACHE_ENTRIES;
+}
+
+/* copy an entry consistently. fails if the entry is being written. */
+static bool
+read_vcache_entry(struct keeto_vcache_entry *entry,
+    struct keeto_vcache_entry *ret)
+{
+    uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return false;
+    }
+    ret->generation = __atomic_load_n(&entry->generation, __ATOMIC_RELAXED);
+    ret->expires = __atomic_load_n(&entry->expires, __ATOMIC_RELAXED);
+    for (int i = 0; i < KEETO_VCACHE_DIGEST_SIZE; i++) {
+        ret->digest[i] = __atomic_load_n(&entry->digest[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq;
+}
+
+bool
+lookup_vcache(struct keeto_vcache *vcache, const unsigned char *digest,
+    uint64_t generation, int64_t now)
+{
+    if (vcache == NULL || digest == NULL) {
+        fatal("vcache or digest == NULL");
+    }
+
+    unsigned int slot = get_vcache_slot(digest);
+    for (int i = 0; i < KEETO_VCACHE_PROBES; i++) {
+        struct keeto_vcache_entry *entry =
+            &vcache->table->entries[(slot + i) % KEETO_VCACHE_ENTRIES];
+        struct keeto_vcache_entry copy;
+        if (!read_vcache_entry(entry, &copy)) {
+            continue;
+        }
+        if (memcmp(copy.digest, digest, KEETO_VCACHE_DIGEST_SIZE) == 0) {
+            return copy.generation == generation && copy.expires > now;
+        }
+    }
+    return false;
+}
+
+/*
+ * the entry is stored in the first probed slot that either holds the
+ * same digest or is outdated. otherwise the entry expiring first is
+ * replaced. the store is skipped if another process is writing to the
+ * chosen slot.
+ */
+void
+store_vcache(struct keeto_vcache *vcache, const unsigned char *digest,
+    uint64_t generation, int64_t now, int64_t expires)
+{
+    if (vcache == NULL || digest == NULL) {
+        fatal("vcache or digest == NULL");
+    }
+
+    unsigned int slot = get_vcache_slot(digest);
+    struct keeto_vcache_entry *victim = NULL;
+    int64_t victim_expires = INT64_MAX;
+    for (int i = 0; i < KEETO_VCACHE_PROBES; i++) {
+        struct keeto_vcache_entry *entry =
+            &vcache->table->entries[(slot + i) % KEETO_VCACHE_ENTRIES];
+        struct keeto_vcache_entry copy;
+        if (!read_vcache_entry(entry, &copy)) {
+            continue;
+        }
+        if (memcmp(copy.digest, digest, KEETO_VCACHE_DIGEST_SIZE) == 0 ||
+            copy.generation != generation || copy.expires <= now) {
+            victim = entry;
+            break;
+        }
+        if (copy.expires < victim_expires) {
+            victim = entry;
+            victim_expires = copy.expires;
+        }
+    }
+    if (victim == NULL) {
+        return;
+    }
+
+    uint32_t seq = __atomic_load_n(&victim->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&victim->seq, &seq,
+        seq + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_store_n(&victim->generation, generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->expires, expires, __ATOMIC_RELAXED);
+    for (int i = 0; i < KEETO_VCACHE_DIGEST_SIZE; i++) {
+        __atomic_store_n(&victim->digest[i], digest[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_VCACHE_H
+#define KEETO_VCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEETO_VCACHE_MAGIC 0x4b544f56 /* KTOV */
+#define KEETO_VCACHE_VERSION 1
+#define KEETO_VCACHE_ENTRIES 8192
+#define KEETO_VCACHE_PROBES 8
+#define KEETO_VCACHE_DIGEST_SIZE 32
+
+/*
+ * cached result of a successful certificate validation. seq is odd
+ * while the entry is being written.
+ */
+struct keeto_vcache_entry {
+    uint32_t seq;
+    uint32_t reserved;
+    uint64_t generation;
+    int64_t expires;
+    unsigned char digest[KEETO_VCACHE_DIGEST_SIZE];
+};
+
+/* layout of the validation cache file shared by all processes */
+struct keeto_vcache_table {
+    uint32_t magic;
+    uint32_t version;
+    struct keeto_vcache_entry entries[KEETO_VCACHE_ENTRIES];
+};
+
+struct keeto_vcache {
+    int fd;
+    struct keeto_vcache_table *table;
+};
+
+int open_vcache(const char *vcache_file, struct keeto_vcache **ret);
+void close_vcache(struct keeto_vcache *vcache);
+bool lookup_vcache(struct keeto_vcache *vcache, const unsigned char *digest,
+    uint64_t generation, int64_t now);
+void store_vcache(struct keeto_vcache *vcache, const unsigned char *digest,
+    uint64_t generation, int64_t now, int64_t expires);
+
+#endif /* KEETO_VCACHE_H */
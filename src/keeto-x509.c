@@ -19,421 +19,1718 @@
 
 #include "keeto-x509.h"
 
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <openssl/bio.h>
 #include <openssl/bn.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <openssl/md5.h>
 #include <openssl/ossl_typ.h>
+#include <openssl/pem.h>
 #include <openssl/rsa.h>
+#include <openssl/sha.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 #include <openssl/x509_vfy.h>
 
+#include "keeto-crl.h"
 #include "keeto-error.h"
+#include "keeto-kcache.h"
 #include "keeto-log.h"
 #include "keeto-openssl.h"
 #include "keeto-util.h"
+#include "keeto-vcache.h"
+
+#define SNAPSHOT_MAGIC 0x4b544f53 /* KTOS */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_RECORD_X509 1
+#define SNAPSHOT_RECORD_CRL 2
+
+/* state of the cert store directory */
+struct keeto_cert_store_stamp {
+    int64_t dir_mtime;
+    int64_t dir_mtime_nsec;
+    int64_t newest_mtime;
+    int64_t newest_mtime_nsec;
+    uint64_t size;
+    uint64_t entries;
+    /* sum of the hashes of name, inode, mtime and size of all entries */
+    uint64_t entries_hash;
+};
+
+struct keeto_cert_store_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t check_crl;
+    uint32_t dir_length;
+    uint32_t count;
+    uint32_t reserved;
+    struct keeto_cert_store_stamp stamp;
+};
+
+/* opened crl indexes - index is NULL if the file does not exist */
+struct keeto_crl_index_entry {
+    char *file;
+    struct keeto_crl_index *index;
+    struct keeto_crl_index_entry *next;
+};
+
+struct keeto_cert_store_snapshot_buffer {
+    unsigned char *data;
+    size_t length;
+    size_t size;
+    uint32_t count;
+};
 
 static X509_STORE *cert_store;
+static char *cert_store_source;
+static unsigned long *cert_store_subject_hashes;
+static size_t cert_store_subject_hash_count;
+static bool cert_store_check_crl;
+static bool cert_store_preloaded;
+static struct keeto_cert_store_stamp cert_store_stamp;
+static uint64_t cert_store_generation;
+static int64_t cert_store_crl_expiry;
+static char *crl_index_source;
+static struct keeto_cert_store_stamp crl_index_stamp;
+static uint64_t crl_index_generation;
+static struct keeto_crl_index_entry *crl_indexes;
+/* crl indexes are opened lazily by concurrent validations */
+static pthread_mutex_t crl_indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct keeto_vcache *validation_cache;
+static long validation_cache_max_age;
+static struct keeto_kcache *key_cache;
 
-static bool
-msb_set(unsigned char byte)
+/*
+ * the most significant bit of an ssh mpint is the sign. a value with
+ * its most significant bit set is prefixed with a zero byte to avoid
+ * misinterpreting it as a negative number.
+ */
+static size_t
+get_ssh_mpint_length(const BIGNUM *bn)
 {
-    if (byte & 0x80) {
-        return true;
-    } else {
-        return false;
+    size_t length = BN_num_bytes(bn);
+    if (length > 0 && BN_num_bits(bn) % 8 == 0) {
+        length++;
+    }
+    return length;
+}
+
+static unsigned char *
+put_ssh_mpint(unsigned char *dst, const BIGNUM *bn)
+{
+    size_t length = get_ssh_mpint_length(bn);
+    PUT_32BIT(dst, length);
+    dst += 4;
+    if (length > (size_t) BN_num_bytes(bn)) {
+        *dst++ = 0;
     }
+    return dst + BN_bn2bin(bn, dst);
+}
+
+static size_t
+get_ssh_key_blob_length_from_rsa(const char *ssh_keytype, RSA *rsa)
+{
+    const BIGNUM *modulus = NULL;
+    const BIGNUM *exponent = NULL;
+    RSA_get0_key(rsa, &modulus, &exponent, NULL);
+
+    /* every value is prefixed with its length in 4 bytes */
+    return 4 + strlen(ssh_keytype) + 4 + get_ssh_mpint_length(exponent) +
+        4 + get_ssh_mpint_length(modulus);
+}
+
+/*
+ * size of the arena needed by encode_ssh_key_from_rsa(): the ssh key
+ * blob, its base64 representation and the md5 and sha256 fingerprints
+ * (each null terminated).
+ */
+static size_t
+get_ssh_key_encoding_size(const char *ssh_keytype, RSA *rsa)
+{
+    size_t blob_length = get_ssh_key_blob_length_from_rsa(ssh_keytype, rsa);
+    return blob_length + BASE64_LENGTH(blob_length) + 1 +
+        HEX_LENGTH(MD5_DIGEST_LENGTH, ':') + 1 +
+        BASE64_LENGTH(SHA256_DIGEST_LENGTH) + 1;
 }
 
+/*
+ * the ssh key blob, its base64 representation and both fingerprints in
+ * openssh format are written into the arena in a single pass. the
+ * pointers of ret point into the arena.
+ */
 static int
-get_ssh_key_blob_from_rsa(char *ssh_keytype, RSA *rsa, unsigned char **ret,
-    size_t *ret_length)
+encode_ssh_key_from_rsa(const char *ssh_keytype, RSA *rsa,
+    unsigned char *arena, size_t arena_size,
+    struct keeto_ssh_key_encoding *ret)
 {
-    if (ssh_keytype == NULL || rsa == NULL || ret == NULL ||
-        ret_length == NULL) {
+    if (ssh_keytype == NULL || rsa == NULL || arena == NULL || ret == NULL) {
+        fatal("ssh_keytype, rsa, arena or ret == NULL");
+    }
 
-        fatal("ssh_keytype, rsa, ret or ret_length == NULL");
+    if (arena_size < get_ssh_key_encoding_size(ssh_keytype, rsa)) {
+        fatal("arena_size too small");
     }
 
-    /* get modulus and exponent */
     const BIGNUM *modulus = NULL;
     const BIGNUM *exponent = NULL;
     RSA_get0_key(rsa, &modulus, &exponent, NULL);
 
-    /* length of keytype WITHOUT terminating null byte */
+    /* ssh key blob */
+    unsigned char *arena_p = arena;
     size_t length_keytype = strlen(ssh_keytype);
-    size_t length_modulus = BN_num_bytes(modulus);
-    size_t length_exponent = BN_num_bytes(exponent);
-    /*
-     * the 4 bytes hold the length of the following value and the 2
-     * extra bytes before the exponent and modulus are possibly
-     * needed to prefix the values with leading zeroes if the most
-     * significant bit of them is set. this is to avoid
-     * misinterpreting the value as a negative number later.
-     */
-    size_t pre_length_blob = 4 + length_keytype + 4 + 1 + length_exponent +
-        4 + 1 + length_modulus;
-    size_t length_tmp_buffer = length_modulus > length_exponent ?
-        length_modulus : length_exponent;
-
-    unsigned char *blob = malloc(pre_length_blob);
-    if (blob == NULL) {
-        log_error("failed to allocate memory for ssh key blob buffer");
-        return KEETO_NO_MEMORY;
+    PUT_32BIT(arena_p, length_keytype);
+    arena_p += 4;
+    memcpy(arena_p, ssh_keytype, length_keytype);
+    arena_p += length_keytype;
+    arena_p = put_ssh_mpint(arena_p, exponent);
+    arena_p = put_ssh_mpint(arena_p, modulus);
+    ret->blob = arena;
+    ret->blob_length = arena_p - arena;
+
+    /* base64 encoded ssh key */
+    ret->key = (char *) arena_p;
+    arena_p += encode_base64(ret->blob, ret->blob_length, true, ret->key) + 1;
+
+    /* md5 fingerprint in hex separated by ':' */
+    unsigned char digest_buffer[EVP_MAX_MD_SIZE];
+    int rc = EVP_Digest(ret->blob, ret->blob_length, digest_buffer, NULL,
+        EVP_md5(), NULL);
+    if (rc == 0) {
+        log_error("failed to apply digest to ssh key blob");
+        return KEETO_OPENSSL_ERR;
+    }
+    ret->fp_md5 = (char *) arena_p;
+    arena_p += encode_hex(digest_buffer, MD5_DIGEST_LENGTH, ':',
+        ret->fp_md5) + 1;
+
+    /* sha256 fingerprint in base64 without padding */
+    rc = EVP_Digest(ret->blob, ret->blob_length, digest_buffer, NULL,
+        EVP_sha256(), NULL);
+    if (rc == 0) {
+        log_error("failed to apply digest to ssh key blob");
+        return KEETO_OPENSSL_ERR;
     }
-    unsigned char tmp_buffer[length_tmp_buffer];
-    unsigned char *blob_p = blob;
-
-    /* put length of keytype */
-    PUT_32BIT(blob_p, length_keytype);
-    blob_p += 4;
-    /* put keytype */
-    memcpy(blob_p, ssh_keytype, length_keytype);
-    blob_p += length_keytype;
-
-    /* put length of exponent */
-    BN_bn2bin(exponent, tmp_buffer);
-    if (msb_set(tmp_buffer[0])) {
-        PUT_32BIT(blob_p, length_exponent + 1);
-        blob_p += 4;
-        memset(blob_p, 0, 1);
-        blob_p++;
-    } else {
-        PUT_32BIT(blob_p, length_exponent);
-        blob_p += 4;
-    }
-    /* put exponent */
-    memcpy(blob_p, tmp_buffer, length_exponent);
-    blob_p += length_exponent;
-
-    /* put length of modulus */
-    BN_bn2bin(modulus, tmp_buffer);
-    if (msb_set(tmp_buffer[0])) {
-        PUT_32BIT(blob_p, length_modulus + 1);
-        blob_p += 4;
-        memset(blob_p, 0, 1);
-        blob_p++;
-    } else {
-        PUT_32BIT(blob_p, length_modulus);
-        blob_p += 4;
-    }
-    /* put modulus */
-    memcpy(blob_p, tmp_buffer, length_modulus);
-    blob_p += length_modulus;
-
-    *ret = blob;
-    *ret_length = blob_p - blob;
+    ret->fp_sha256 = (char *) arena_p;
+    encode_base64(digest_buffer, SHA256_DIGEST_LENGTH, false, ret->fp_sha256);
 
     return KEETO_OK;
 }
 
 static int
-get_ssh_key_fingerprint_from_blob(unsigned char *blob, size_t blob_length,
-    enum keeto_digests algo, char **ret)
+add_key_data_from_rsa(RSA *rsa, struct keeto_ssh_key *ssh_key,
+    struct keeto_key *key)
 {
-    if (blob == NULL || ret == NULL) {
-        fatal("blob or ret == NULL");
+    if (rsa == NULL || ssh_key == NULL || key == NULL) {
+        fatal("rsa, ssh_key or key == NULL");
     }
 
-    const EVP_MD *digest = NULL;
-    switch (algo) {
-    case KEETO_DIGEST_MD5:
-        digest = EVP_md5();
-        break;
-    case KEETO_DIGEST_SHA256:
-        digest = EVP_sha256();
-        break;
-    default:
-        return KEETO_UNKNOWN_DIGEST_ALGO;
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* the arena only has to be allocated for very large keys */
+    unsigned char arena_buffer[KEETO_SSH_KEY_ARENA_SIZE];
+    unsigned char *arena = arena_buffer;
+    size_t arena_size = get_ssh_key_encoding_size(ssh_key->keytype, rsa);
+    if (arena_size > sizeof arena_buffer) {
+        arena = malloc(arena_size);
+        if (arena == NULL) {
+            log_error("failed to allocate memory for ssh key arena");
+            return KEETO_NO_MEMORY;
+        }
     }
 
-    unsigned char digest_buffer[EVP_MD_size(digest)];
+    struct keeto_ssh_key_encoding encoding;
+    int rc = encode_ssh_key_from_rsa(ssh_key->keytype, rsa, arena, arena_size,
+        &encoding);
+    if (rc != KEETO_OK) {
+        log_error("failed to encode ssh key (%s)", keeto_strerror(rc));
+        res = rc;
+        goto cleanup;
+    }
 
-    /* hash */
-    int rc = EVP_Digest(blob, blob_length, digest_buffer, NULL, digest, NULL);
-    if (rc == 0) {
-        log_error("failed to apply digest to ssh key blob");
-        return KEETO_OPENSSL_ERR;
+    char *tmp_ssh_key = strdup(encoding.key);
+    char *ssh_key_fp_md5 = strdup(encoding.fp_md5);
+    char *ssh_key_fp_sha256 = strdup(encoding.fp_sha256);
+    if (tmp_ssh_key == NULL || ssh_key_fp_md5 == NULL ||
+        ssh_key_fp_sha256 == NULL) {
+
+        log_error("failed to duplicate ssh key data");
+        free(tmp_ssh_key);
+        free(ssh_key_fp_md5);
+        free(ssh_key_fp_sha256);
+        res = KEETO_NO_MEMORY;
+        goto cleanup;
+    }
+    key->ssh_key_fp_sha256 = ssh_key_fp_sha256;
+    key->ssh_key_fp_md5 = ssh_key_fp_md5;
+    ssh_key->key = tmp_ssh_key;
+    res = KEETO_OK;
+
+cleanup:
+    if (arena != arena_buffer) {
+        free(arena);
     }
+    return res;
+}
 
-    /* get openssh fingerprint representation */
-    char *fp = NULL;
-    switch (algo) {
-    case KEETO_DIGEST_MD5:
-        rc = blob_to_hex(digest_buffer, sizeof digest_buffer, ":", &fp);
-        switch (rc) {
-        case KEETO_OK:
-            break;
-        case KEETO_NO_MEMORY:
-            return rc;
-        default:
-            log_error("failed to obtain hex encoded ssh key fingerprint (%s)",
-                keeto_strerror(rc));
-            return rc;
+static int
+derive_key_data_from_x509(X509 *x509, struct keeto_key *key)
+{
+    if (x509 == NULL || key == NULL) {
+        fatal("x509 or key == NULL");
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    EVP_PKEY *pkey = X509_get_pubkey(x509);
+    if (pkey == NULL) {
+        log_error("failed to extract public key from certificate");
+        return KEETO_X509_ERR;
+    }
+
+    struct keeto_ssh_key *ssh_key = new_ssh_key();
+    if (ssh_key == NULL) {
+        log_error("failed to allocate memory for ssh key buffer");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    int pkey_type = EVP_PKEY_base_id(pkey);
+    switch (pkey_type) {
+    case EVP_PKEY_RSA:
+        ssh_key->keytype = strdup("ssh-rsa");
+        if (ssh_key->keytype == NULL) {
+            log_error("failed to duplicate ssh keytype");
+            res = KEETO_NO_MEMORY;
+            goto cleanup_b;
         }
-        break;
-    case KEETO_DIGEST_SHA256:
-        rc = blob_to_base64(digest_buffer, sizeof digest_buffer, &fp);
+        /* get rsa key */
+        RSA *rsa = EVP_PKEY_get1_RSA(pkey);
+        if (rsa == NULL) {
+            log_error("failed to obtain rsa key");
+            res = KEETO_OPENSSL_ERR;
+            goto cleanup_b;
+        }
+        /* add key data */
+        int rc = add_key_data_from_rsa(rsa, ssh_key, key);
         switch (rc) {
         case KEETO_OK:
             break;
         case KEETO_NO_MEMORY:
-            return rc;
+            res = rc;
+            RSA_free(rsa);
+            goto cleanup_b;
         default:
-            log_error("failed to obtain base64 encoded ssh key fingerprint (%s)",
+            log_error("failed to obtain ssh key data from rsa (%s)",
                 keeto_strerror(rc));
-            return rc;
+            res = rc;
+            RSA_free(rsa);
+            goto cleanup_b;
         }
-        /* remove '=' at the end */
-        size_t end_of_fp = strcspn(fp, "=");
-        fp[end_of_fp] = '\0';
+        RSA_free(rsa);
         break;
+    default:
+        log_error("unsupported key type (%d)", pkey_type);
+        res = KEETO_UNSUPPORTED_KEY_TYPE;
+        goto cleanup_a;
+    }
+    key->ssh_key = ssh_key;
+    ssh_key = NULL;
+    res = KEETO_OK;
+
+cleanup_b:
+    if (ssh_key != NULL) {
+        free_ssh_key(ssh_key);
+    }
+cleanup_a:
+    EVP_PKEY_free(pkey);
+    return res;
+}
+
+int
+init_key_cache(char *key_cache_file)
+{
+    if (key_cache_file == NULL) {
+        fatal("key_cache_file == NULL");
     }
 
-    *ret = fp;
-    return KEETO_OK;
+    if (key_cache != NULL) {
+        return KEETO_OK;
+    }
+    return open_kcache(key_cache_file, &key_cache);
 }
 
-static int
-add_key_data_from_rsa(RSA *rsa, struct keeto_ssh_key *ssh_key,
-    struct keeto_key *key)
+void
+free_key_cache()
 {
-    if (rsa == NULL || ssh_key == NULL || key == NULL) {
-        fatal("rsa, ssh_key or key == NULL");
+    close_kcache(key_cache);
+    key_cache = NULL;
+}
+
+/*
+ * the digest of keys obtained from ldap is taken from their der
+ * encoding directly - this equals X509_digest() without encoding the
+ * certificate again.
+ */
+void
+get_key_digest(struct keeto_key *key, struct keeto_x509_digest *ret)
+{
+    if (key == NULL || ret == NULL) {
+        fatal("key or ret == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    ret->valid = false;
+    if (key->der != NULL) {
+        SHA256(key->der, key->der_length, ret->data);
+        ret->valid = true;
+        return;
+    }
+    if (key->x509 == NULL) {
+        fatal("key->x509 == NULL");
+    }
+    unsigned int digest_length = 0;
+    int rc = X509_digest(key->x509, EVP_sha256(), ret->data, &digest_length);
+    if (rc == 0 || digest_length != sizeof ret->data) {
+        log_error("failed to obtain certificate digest");
+        return;
+    }
+    ret->valid = true;
+}
+
+/*
+ * the ssh key material only depends on the certificate. certificates
+ * seen before are looked up in the key cache by their digest instead of
+ * deriving the key material again.
+ */
+int
+add_key_data_from_x509(X509 *x509, const struct keeto_x509_digest *digest,
+    struct keeto_key *key)
+{
+    if (x509 == NULL || digest == NULL || key == NULL) {
+        fatal("x509, digest or key == NULL");
+    }
 
-    /* get ssh key blob needed by all upcoming operations */
-    unsigned char *blob = NULL;
-    size_t blob_length;
+    if (key_cache == NULL || !digest->valid) {
+        return derive_key_data_from_x509(x509, key);
+    }
 
-    int rc = get_ssh_key_blob_from_rsa(ssh_key->keytype, rsa, &blob, &blob_length);
+    struct keeto_kcache_value value = { NULL, NULL, NULL, NULL };
+    int rc = lookup_kcache(key_cache, digest->data, &value);
     switch (rc) {
     case KEETO_OK:
-        break;
+        key->ssh_key = new_ssh_key();
+        if (key->ssh_key == NULL) {
+            log_error("failed to allocate memory for ssh key buffer");
+            free_kcache_value(&value);
+            return KEETO_NO_MEMORY;
+        }
+        log_debug("ssh key data found in key cache");
+        key->ssh_key->keytype = value.keytype;
+        key->ssh_key->key = value.key;
+        key->ssh_key_fp_md5 = value.fp_md5;
+        key->ssh_key_fp_sha256 = value.fp_sha256;
+        return KEETO_OK;
     case KEETO_NO_MEMORY:
         return rc;
+    case KEETO_NO_CACHE_ENTRY:
+        break;
     default:
-        log_error("failed to obtain ssh key blob from rsa (%s)",
-            keeto_strerror(rc));
+        log_error("failed to look up key cache (%s)", keeto_strerror(rc));
+    }
+
+    rc = derive_key_data_from_x509(x509, key);
+    if (rc != KEETO_OK) {
         return rc;
     }
+    value.keytype = key->ssh_key->keytype;
+    value.key = key->ssh_key->key;
+    value.fp_md5 = key->ssh_key_fp_md5;
+    value.fp_sha256 = key->ssh_key_fp_sha256;
+    rc = store_kcache(key_cache, digest->data, &value);
+    if (rc != KEETO_OK) {
+        log_error("failed to store ssh key data in key cache (%s)",
+            keeto_strerror(rc));
+    }
+    return KEETO_OK;
+}
 
-    /* get ssh key */
-    char *tmp_ssh_key = NULL;
-    rc = blob_to_base64(blob, blob_length, &tmp_ssh_key);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_a;
-    default:
-        log_error("failed to base64 encode ssh key (%s)", keeto_strerror(rc));
-        res = rc;
-        goto cleanup_a;
+/*
+ * long running processes (keetod) load the cert store completely into
+ * memory (including crl's) instead of looking up certificates and
+ * crl's on demand. a stamp of the cert store directory allows to
+ * detect changes so that the cert store only has to be reloaded if the
+ * directory has been altered.
+ */
+static bool
+is_hashed_cert_store_entry(const char *name, char *type)
+{
+    for (int i = 0; i < 8; i++) {
+        if (!isxdigit((unsigned char) name[i])) {
+            return false;
+        }
+    }
+    if (name[8] != '.') {
+        return false;
+    }
+    const char *suffix = &name[9];
+    *type = '\0';
+    if (*suffix == 'r' || *suffix == 'i') {
+        *type = *suffix;
+        suffix++;
     }
+    if (*suffix == '\0') {
+        return false;
+    }
+    for (; *suffix != '\0'; suffix++) {
+        if (!isdigit((unsigned char) *suffix)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    /* get fingerprints */
-    char *ssh_key_fp_md5 = NULL;
-    rc = get_ssh_key_fingerprint_from_blob(blob, blob_length, KEETO_DIGEST_MD5,
-        &ssh_key_fp_md5);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_b;
-    default:
-        log_error("failed to obtain ssh key md5 fingerprint (%s)",
-            keeto_strerror(rc));
-        res = rc;
-        goto cleanup_b;
+static uint64_t
+get_fnv1a_hash(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
     }
+    return hash;
+}
 
-    char *ssh_key_fp_sha256 = NULL;
-    rc = get_ssh_key_fingerprint_from_blob(blob, blob_length, KEETO_DIGEST_SHA256,
-        &ssh_key_fp_sha256);
-    switch (rc) {
-    case KEETO_OK:
-        break;
-    case KEETO_NO_MEMORY:
-        res = rc;
-        goto cleanup_c;
-    default:
-        log_error("failed to obtain ssh key sha256 fingerprint (%s)",
-            keeto_strerror(rc));
-        res = rc;
-        goto cleanup_c;
+/*
+ * files overwritten in place and repointed symlinks do not change the
+ * mtime of the directory - every entry is part of the stamp. the
+ * hashes of the entries are summed up as the order of readdir() is
+ * arbitrary.
+ */
+static void
+add_cert_store_stamp_entry(struct keeto_cert_store_stamp *stamp,
+    const char *name, const struct stat *stat_buffer)
+{
+    if (stat_buffer->st_mtim.tv_sec > stamp->newest_mtime ||
+        (stat_buffer->st_mtim.tv_sec == stamp->newest_mtime &&
+        stat_buffer->st_mtim.tv_nsec > stamp->newest_mtime_nsec)) {
+
+        stamp->newest_mtime = stat_buffer->st_mtim.tv_sec;
+        stamp->newest_mtime_nsec = stat_buffer->st_mtim.tv_nsec;
+    }
+    stamp->size += stat_buffer->st_size;
+    stamp->entries++;
+
+    uint64_t fields[] = {
+        stat_buffer->st_dev,
+        stat_buffer->st_ino,
+        stat_buffer->st_mtim.tv_sec,
+        stat_buffer->st_mtim.tv_nsec,
+        stat_buffer->st_size
+    };
+    uint64_t hash = get_fnv1a_hash(14695981039346656037ULL, name,
+        strlen(name));
+    stamp->entries_hash += get_fnv1a_hash(hash, fields, sizeof fields);
+}
+
+static int
+get_cert_store_stamp(const char *cert_store_dir,
+    struct keeto_cert_store_stamp *ret)
+{
+    DIR *dir = opendir(cert_store_dir);
+    if (dir == NULL) {
+        log_error("failed to open cert store dir '%s' (%s)", cert_store_dir,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    struct keeto_cert_store_stamp stamp;
+    memset(&stamp, 0, sizeof stamp);
+
+    struct stat stat_buffer;
+    int rc = fstat(dirfd(dir), &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat cert store dir '%s' (%s)", cert_store_dir,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup;
+    }
+    stamp.dir_mtime = stat_buffer.st_mtim.tv_sec;
+    stamp.dir_mtime_nsec = stat_buffer.st_mtim.tv_nsec;
+
+    /* symlinks are followed as they usually point to the actual files */
+    for (struct dirent *entry = readdir(dir); entry != NULL;
+        entry = readdir(dir)) {
+
+        char type = '\0';
+        if (!is_hashed_cert_store_entry(entry->d_name, &type)) {
+            continue;
+        }
+        rc = fstatat(dirfd(dir), entry->d_name, &stat_buffer, 0);
+        if (rc == -1) {
+            continue;
+        }
+        add_cert_store_stamp_entry(&stamp, entry->d_name, &stat_buffer);
+    }
+    *ret = stamp;
+    res = KEETO_OK;
+
+cleanup:
+    closedir(dir);
+    return res;
+}
+
+static int
+new_cert_store(bool check_crl, X509_STORE **ret)
+{
+    X509_STORE *store = X509_STORE_new();
+    if (store == NULL) {
+        log_error("failed to create cert store");
+        return KEETO_OPENSSL_ERR;
+    }
+    if (check_crl) {
+        int rc = X509_STORE_set_flags(store, X509_V_FLAG_CRL_CHECK |
+            X509_V_FLAG_CRL_CHECK_ALL);
+        if (rc == 0) {
+            log_error("failed to set cert store flags");
+            X509_STORE_free(store);
+            return KEETO_OPENSSL_ERR;
+        }
+    }
+    *ret = store;
+    return KEETO_OK;
+}
+
+/* the same object might be reachable through several hashed names */
+static bool
+is_duplicate_cert_store_object()
+{
+    unsigned long err = ERR_peek_last_error();
+    if (ERR_GET_LIB(err) == ERR_LIB_X509 &&
+        ERR_GET_REASON(err) == X509_R_CERT_ALREADY_IN_HASH_TABLE) {
+        ERR_clear_error();
+        return true;
+    }
+    return false;
+}
+
+static int
+add_x509_to_cert_store(X509_STORE *store, X509 *x509)
+{
+    int rc = X509_STORE_add_cert(store, x509);
+    if (rc == 0 && !is_duplicate_cert_store_object()) {
+        log_error("failed to add certificate to cert store");
+        return KEETO_OPENSSL_ERR;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * crl_expiry keeps track of the earliest next update of all crl's in
+ * the cert store. validation results must not be cached beyond.
+ */
+static int
+add_crl_to_cert_store(X509_STORE *store, X509_CRL *crl, int64_t *crl_expiry)
+{
+    int rc = X509_STORE_add_crl(store, crl);
+    if (rc == 0 && !is_duplicate_cert_store_object()) {
+        log_error("failed to add crl to cert store");
+        return KEETO_OPENSSL_ERR;
+    }
+    const ASN1_TIME *next_update = X509_CRL_get0_nextUpdate(crl);
+    if (next_update != NULL) {
+        int64_t expiry = get_time_from_asn1_time(next_update, time(NULL));
+        if (expiry < *crl_expiry) {
+            *crl_expiry = expiry;
+        }
+    }
+    return KEETO_OK;
+}
+
+/*
+ * records of a snapshot consist of a type byte, the length of the der
+ * encoded object and the object itself.
+ */
+static unsigned char *
+add_snapshot_record(struct keeto_cert_store_snapshot_buffer *buffer,
+    unsigned char type, int length)
+{
+    size_t needed = buffer->length + 1 + sizeof (uint32_t) + length;
+    if (needed > buffer->size) {
+        size_t size = buffer->size == 0 ? 65536 : buffer->size;
+        while (size < needed) {
+            size *= 2;
+        }
+        unsigned char *data = realloc(buffer->data, size);
+        if (data == NULL) {
+            log_error("failed to allocate memory for snapshot buffer");
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->size = size;
+    }
+    unsigned char *record = buffer->data + buffer->length;
+    uint32_t record_length = length;
+    record[0] = type;
+    memcpy(&record[1], &record_length, sizeof record_length);
+    buffer->length = needed;
+    buffer->count++;
+    return record + 1 + sizeof record_length;
+}
+
+static int
+add_x509_to_snapshot(struct keeto_cert_store_snapshot_buffer *buffer,
+    X509 *x509)
+{
+    int length = i2d_X509(x509, NULL);
+    if (length <= 0) {
+        log_error("failed to der encode certificate");
+        return KEETO_OPENSSL_ERR;
+    }
+    unsigned char *der = add_snapshot_record(buffer, SNAPSHOT_RECORD_X509,
+        length);
+    if (der == NULL) {
+        return KEETO_NO_MEMORY;
+    }
+    i2d_X509(x509, &der);
+    return KEETO_OK;
+}
+
+static int
+add_crl_to_snapshot(struct keeto_cert_store_snapshot_buffer *buffer,
+    X509_CRL *crl)
+{
+    int length = i2d_X509_CRL(crl, NULL);
+    if (length <= 0) {
+        log_error("failed to der encode crl");
+        return KEETO_OPENSSL_ERR;
+    }
+    unsigned char *der = add_snapshot_record(buffer, SNAPSHOT_RECORD_CRL,
+        length);
+    if (der == NULL) {
+        return KEETO_NO_MEMORY;
+    }
+    i2d_X509_CRL(crl, &der);
+    return KEETO_OK;
+}
+
+/*
+ * like X509_LOOKUP_hash_dir() only certificates are taken from files
+ * with a '.<n>' suffix and crl's from files with a '.r<n>' suffix.
+ */
+static int
+load_cert_store_file(X509_STORE *store, const char *file, bool crl,
+    int64_t *crl_expiry, struct keeto_cert_store_snapshot_buffer *snapshot)
+{
+    BIO *bio = BIO_new_file(file, "r");
+    if (bio == NULL) {
+        log_error("failed to open '%s'", file);
+        return KEETO_OPENSSL_ERR;
+    }
+    STACK_OF(X509_INFO) *infos = PEM_X509_INFO_read_bio(bio, NULL, NULL,
+        NULL);
+    BIO_free(bio);
+    if (infos == NULL) {
+        log_error("failed to read certs/crl's from '%s'", file);
+        return KEETO_OPENSSL_ERR;
+    }
+
+    int res = KEETO_OK;
+    for (int i = 0; i < sk_X509_INFO_num(infos) && res == KEETO_OK; i++) {
+        X509_INFO *info = sk_X509_INFO_value(infos, i);
+        if (!crl && info->x509 != NULL) {
+            res = add_x509_to_cert_store(store, info->x509);
+            if (res == KEETO_OK && snapshot != NULL) {
+                res = add_x509_to_snapshot(snapshot, info->x509);
+            }
+        } else if (crl && info->crl != NULL) {
+            res = add_crl_to_cert_store(store, info->crl, crl_expiry);
+            if (res == KEETO_OK && snapshot != NULL) {
+                res = add_crl_to_snapshot(snapshot, info->crl);
+            }
+        }
+    }
+    sk_X509_INFO_pop_free(infos, X509_INFO_free);
+    return res;
+}
+
+static int
+load_cert_store_dir(X509_STORE *store, const char *cert_store_dir,
+    bool check_crl, int64_t *crl_expiry,
+    struct keeto_cert_store_snapshot_buffer *snapshot)
+{
+    DIR *dir = opendir(cert_store_dir);
+    if (dir == NULL) {
+        log_error("failed to open cert store dir '%s' (%s)", cert_store_dir,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_OK;
+    for (struct dirent *entry = readdir(dir); entry != NULL;
+        entry = readdir(dir)) {
+
+        char type = '\0';
+        if (!is_hashed_cert_store_entry(entry->d_name, &type)) {
+            continue;
+        }
+        /* crl's are not needed if they are not checked */
+        if (type == 'i' || (type == 'r' && !check_crl)) {
+            continue;
+        }
+        bool crl = type == 'r';
+        char file[strlen(cert_store_dir) + strlen(entry->d_name) + 2];
+        snprintf(file, sizeof file, "%s/%s", cert_store_dir, entry->d_name);
+        int rc = load_cert_store_file(store, file, crl, crl_expiry,
+            snapshot);
+        switch (rc) {
+        case KEETO_OK:
+            break;
+        case KEETO_NO_MEMORY:
+            res = rc;
+            goto cleanup;
+        default:
+            /*
+             * skip broken files. certificates depending on them will
+             * fail validation.
+             */
+            log_error("failed to load '%s' into cert store (%s)", file,
+                keeto_strerror(rc));
+        }
+    }
+
+cleanup:
+    closedir(dir);
+    return res;
+}
+
+static int
+write_cert_store_snapshot(const char *snapshot_file, const char *cert_store_dir,
+    bool check_crl, struct keeto_cert_store_stamp *stamp,
+    struct keeto_cert_store_snapshot_buffer *snapshot)
+{
+    struct keeto_cert_store_snapshot_header header;
+    memset(&header, 0, sizeof header);
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.check_crl = check_crl;
+    header.dir_length = strlen(cert_store_dir);
+    header.count = snapshot->count;
+    header.stamp = *stamp;
+
+    /* write to temporary file and rename to replace the snapshot atomically */
+    char tmp_file[strlen(snapshot_file) + 8];
+    snprintf(tmp_file, sizeof tmp_file, "%s.XXXXXX", snapshot_file);
+    int fd = mkstemp(tmp_file);
+    if (fd == -1) {
+        log_error("failed to create snapshot file '%s' (%s)", tmp_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    FILE *file = fdopen(fd, "w");
+    if (file == NULL) {
+        log_error("failed to open snapshot file '%s' (%s)", tmp_file,
+            strerror(errno));
+        close(fd);
+        unlink(tmp_file);
+        return KEETO_SYSTEM_ERR;
+    }
+    bool written = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 &&
+        fwrite(&header, sizeof header, 1, file) == 1 &&
+        fwrite(cert_store_dir, header.dir_length, 1, file) == 1 &&
+        (snapshot->length == 0 ||
+        fwrite(snapshot->data, snapshot->length, 1, file) == 1);
+    if (fclose(file) != 0) {
+        written = false;
+    }
+    if (!written || rename(tmp_file, snapshot_file) == -1) {
+        log_error("failed to write snapshot file '%s' (%s)", snapshot_file,
+            strerror(errno));
+        unlink(tmp_file);
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * returns KEETO_NO_CACHE_ENTRY if the snapshot does not exist or does
+ * not match the current state of the cert store directory.
+ */
+static int
+load_cert_store_snapshot(X509_STORE *store, const char *snapshot_file,
+    const char *cert_store_dir, bool check_crl,
+    struct keeto_cert_store_stamp *stamp, int64_t *crl_expiry)
+{
+    int fd = open(snapshot_file, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return KEETO_NO_CACHE_ENTRY;
+        }
+        log_error("failed to open snapshot file '%s' (%s)", snapshot_file,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    /* the snapshot determines the trusted ca's - only trust our own files */
+    struct stat stat_buffer;
+    int rc = fstat(fd, &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat snapshot file '%s' (%s)", snapshot_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    if (!S_ISREG(stat_buffer.st_mode) || stat_buffer.st_uid != geteuid() ||
+        (stat_buffer.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        log_error("refusing to use snapshot file '%s' (insecure file)",
+            snapshot_file);
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    size_t size = stat_buffer.st_size;
+    struct keeto_cert_store_snapshot_header header;
+    if (size < sizeof header) {
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_a;
+    }
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("failed to map snapshot file '%s' (%s)", snapshot_file,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    memcpy(&header, data, sizeof header);
+    size_t dir_length = strlen(cert_store_dir);
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.check_crl != check_crl || header.dir_length != dir_length ||
+        size - sizeof header < dir_length ||
+        memcmp(data + sizeof header, cert_store_dir, dir_length) != 0 ||
+        memcmp(&header.stamp, stamp, sizeof header.stamp) != 0) {
+
+        res = KEETO_NO_CACHE_ENTRY;
+        goto cleanup_b;
+    }
+
+    size_t offset = sizeof header + dir_length;
+    for (uint32_t i = 0; i < header.count; i++) {
+        uint32_t length;
+        if (size - offset < 1 + sizeof length) {
+            log_error("snapshot file '%s' truncated", snapshot_file);
+            res = KEETO_X509_ERR;
+            goto cleanup_b;
+        }
+        unsigned char type = data[offset];
+        memcpy(&length, data + offset + 1, sizeof length);
+        offset += 1 + sizeof length;
+        if (size - offset < length) {
+            log_error("snapshot file '%s' truncated", snapshot_file);
+            res = KEETO_X509_ERR;
+            goto cleanup_b;
+        }
+        const unsigned char *der = data + offset;
+        offset += length;
+
+        if (type == SNAPSHOT_RECORD_X509) {
+            X509 *x509 = d2i_X509(NULL, &der, length);
+            if (x509 == NULL) {
+                log_error("failed to decode certificate from snapshot");
+                res = KEETO_X509_ERR;
+                goto cleanup_b;
+            }
+            rc = add_x509_to_cert_store(store, x509);
+            X509_free(x509);
+        } else if (type == SNAPSHOT_RECORD_CRL) {
+            X509_CRL *crl = d2i_X509_CRL(NULL, &der, length);
+            if (crl == NULL) {
+                log_error("failed to decode crl from snapshot");
+                res = KEETO_X509_ERR;
+                goto cleanup_b;
+            }
+            rc = add_crl_to_cert_store(store, crl, crl_expiry);
+            X509_CRL_free(crl);
+        } else {
+            log_error("unknown record type in snapshot file '%s'",
+                snapshot_file);
+            res = KEETO_X509_ERR;
+            goto cleanup_b;
+        }
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup_b;
+        }
+    }
+    res = KEETO_OK;
+
+cleanup_b:
+    munmap(data, size);
+cleanup_a:
+    close(fd);
+    return res;
+}
+
+/*
+ * validation results are bound to the generation of the cert store
+ * they have been obtained with.
+ */
+static uint64_t
+get_cert_store_generation(const char *cert_store_dir, bool check_crl,
+    struct keeto_cert_store_stamp *stamp)
+{
+    if (cert_store_dir == NULL || stamp == NULL) {
+        fatal("cert_store_dir or stamp == NULL");
+    }
+
+    uint64_t hash = get_fnv1a_hash(14695981039346656037ULL, cert_store_dir,
+        strlen(cert_store_dir));
+    hash = (hash ^ (check_crl ? 1 : 0)) * 1099511628211ULL;
+    return get_fnv1a_hash(hash, stamp, sizeof *stamp);
+}
+
+static int
+compare_subject_hashes(const void *a, const void *b)
+{
+    unsigned long hash_a = *(const unsigned long *) a;
+    unsigned long hash_b = *(const unsigned long *) b;
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+/*
+ * sorted subject name hashes of all certs in the cert store. a
+ * certificate whose issuer name hash is not part of them cannot be
+ * validated against the cert store.
+ */
+static int
+get_cert_store_subject_hashes(X509_STORE *store, unsigned long **ret,
+    size_t *count)
+{
+    if (store == NULL || ret == NULL || count == NULL) {
+        fatal("store, ret or count == NULL");
+    }
+
+    STACK_OF(X509_OBJECT) *objects = X509_STORE_get0_objects(store);
+    int object_count = sk_X509_OBJECT_num(objects);
+    unsigned long *hashes = malloc(sizeof(unsigned long) *
+        (object_count > 0 ? object_count : 1));
+    if (hashes == NULL) {
+        log_error("failed to allocate memory for subject hash buffer");
+        return KEETO_NO_MEMORY;
+    }
+    size_t hash_count = 0;
+    for (int i = 0; i < object_count; i++) {
+        X509_OBJECT *object = sk_X509_OBJECT_value(objects, i);
+        if (X509_OBJECT_get_type(object) != X509_LU_X509) {
+            continue;
+        }
+        X509 *x509 = X509_OBJECT_get0_X509(object);
+        hashes[hash_count++] = X509_NAME_hash(X509_get_subject_name(x509));
+    }
+    qsort(hashes, hash_count, sizeof *hashes, &compare_subject_hashes);
+    *ret = hashes;
+    *count = hash_count;
+    return KEETO_OK;
+}
+
+/*
+ * sorted subject name hashes taken from the hashed names of the cert
+ * store directory. the stamp is the same as get_cert_store_stamp()
+ * would return.
+ */
+static int
+get_cert_store_dir_hashes(const char *cert_store_dir,
+    struct keeto_cert_store_stamp *stamp, unsigned long **ret, size_t *count)
+{
+    if (cert_store_dir == NULL || stamp == NULL || ret == NULL ||
+        count == NULL) {
+        fatal("cert_store_dir, stamp, ret or count == NULL");
+    }
+
+    DIR *dir = opendir(cert_store_dir);
+    if (dir == NULL) {
+        log_error("failed to open cert store dir '%s' (%s)", cert_store_dir,
+            strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+    struct stat stat_buffer;
+    int rc = fstat(dirfd(dir), &stat_buffer);
+    if (rc == -1) {
+        log_error("failed to stat cert store dir '%s' (%s)", cert_store_dir,
+            strerror(errno));
+        res = KEETO_SYSTEM_ERR;
+        goto cleanup_a;
+    }
+    memset(stamp, 0, sizeof *stamp);
+    stamp->dir_mtime = stat_buffer.st_mtim.tv_sec;
+    stamp->dir_mtime_nsec = stat_buffer.st_mtim.tv_nsec;
+
+    unsigned long *hashes = NULL;
+    size_t hash_count = 0;
+    size_t hash_size = 0;
+    for (struct dirent *entry = readdir(dir); entry != NULL;
+        entry = readdir(dir)) {
+
+        char type = '\0';
+        if (!is_hashed_cert_store_entry(entry->d_name, &type)) {
+            continue;
+        }
+        rc = fstatat(dirfd(dir), entry->d_name, &stat_buffer, 0);
+        if (rc == -1) {
+            continue;
+        }
+        add_cert_store_stamp_entry(stamp, entry->d_name, &stat_buffer);
+        if (type != '\0') {
+            continue;
+        }
+        if (hash_count == hash_size) {
+            size_t size = hash_size == 0 ? 64 : hash_size * 2;
+            unsigned long *tmp = realloc(hashes, size * sizeof *hashes);
+            if (tmp == NULL) {
+                log_error("failed to allocate memory for subject hash "
+                    "buffer");
+                res = KEETO_NO_MEMORY;
+                goto cleanup_b;
+            }
+            hashes = tmp;
+            hash_size = size;
+        }
+        hashes[hash_count++] = strtoul(entry->d_name, NULL, 16);
+    }
+    if (hashes != NULL) {
+        qsort(hashes, hash_count, sizeof *hashes, &compare_subject_hashes);
+    }
+    *ret = hashes;
+    *count = hash_count;
+    hashes = NULL;
+    res = KEETO_OK;
+
+cleanup_b:
+    free(hashes);
+cleanup_a:
+    closedir(dir);
+    return res;
+}
+
+static void
+set_cert_store(X509_STORE *store, char *source, bool check_crl,
+    bool preloaded, struct keeto_cert_store_stamp *stamp,
+    unsigned long *subject_hashes, size_t subject_hash_count,
+    int64_t crl_expiry)
+{
+    free_cert_store();
+    cert_store = store;
+    cert_store_subject_hashes = subject_hashes;
+    cert_store_subject_hash_count = subject_hash_count;
+    cert_store_source = source;
+    cert_store_check_crl = check_crl;
+    cert_store_preloaded = preloaded;
+    cert_store_stamp = *stamp;
+    cert_store_generation = get_cert_store_generation(source, check_crl,
+        stamp);
+    cert_store_crl_expiry = crl_expiry;
+}
+
+/*
+ * certificates and crl's are looked up on demand by their hashed names
+ * so that a single login only decodes the chain it validates. crl's
+ * are not known in advance - validation results are bound to the crl's
+ * actually used instead (see get_chain_crl_expiry()).
+ */
+static int
+init_lazy_cert_store(char *cert_store_dir, bool check_crl)
+{
+    struct keeto_cert_store_stamp stamp;
+    unsigned long *subject_hashes = NULL;
+    size_t subject_hash_count = 0;
+    int rc = get_cert_store_dir_hashes(cert_store_dir, &stamp,
+        &subject_hashes, &subject_hash_count);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    if (cert_store != NULL && !cert_store_preloaded &&
+        cert_store_check_crl == check_crl &&
+        strcmp(cert_store_source, cert_store_dir) == 0 &&
+        memcmp(&cert_store_stamp, &stamp, sizeof stamp) == 0) {
+
+        free(subject_hashes);
+        return KEETO_OK;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    char *source = strdup(cert_store_dir);
+    if (source == NULL) {
+        log_error("failed to duplicate cert store dir");
+        res = KEETO_NO_MEMORY;
+        goto cleanup_a;
+    }
+    X509_STORE *cert_store_tmp = NULL;
+    rc = new_cert_store(check_crl, &cert_store_tmp);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup_b;
+    }
+    X509_LOOKUP *cert_store_lookup = X509_STORE_add_lookup(cert_store_tmp,
+        X509_LOOKUP_hash_dir());
+    if (cert_store_lookup == NULL) {
+        log_error("failed to create cert store lookup object");
+        res = KEETO_X509_ERR;
+        goto cleanup_c;
+    }
+    rc = X509_LOOKUP_add_dir(cert_store_lookup, cert_store_dir,
+        X509_FILETYPE_PEM);
+    if (rc == 0) {
+        log_error("failed to read certs from '%s'", cert_store_dir);
+        res = KEETO_OPENSSL_ERR;
+        goto cleanup_c;
+    }
+    set_cert_store(cert_store_tmp, source, check_crl, false, &stamp,
+        subject_hashes, subject_hash_count, INT64_MAX);
+    return KEETO_OK;
+
+cleanup_c:
+    X509_STORE_free(cert_store_tmp);
+cleanup_b:
+    free(source);
+cleanup_a:
+    free(subject_hashes);
+    return res;
+}
+
+/*
+ * the cert store is only reloaded if the cert store directory (or the
+ * settings) changed since the last call. unless preload is set
+ * certificates and crl's are looked up on demand. otherwise all of
+ * them are loaded - if snapshot_file is given from the precompiled
+ * snapshot instead of parsing all certs/crl's. the snapshot is
+ * (re)written whenever it is outdated.
+ */
+int
+init_cert_store(char *cert_store_dir, bool check_crl, bool preload,
+    char *snapshot_file)
+{
+    if (cert_store_dir == NULL) {
+        fatal("cert_store_dir == NULL");
+    }
+
+    if (!preload) {
+        return init_lazy_cert_store(cert_store_dir, check_crl);
+    }
+
+    struct keeto_cert_store_stamp stamp;
+    int rc = get_cert_store_stamp(cert_store_dir, &stamp);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    if (cert_store != NULL && cert_store_preloaded &&
+        cert_store_check_crl == check_crl &&
+        strcmp(cert_store_source, cert_store_dir) == 0 &&
+        memcmp(&cert_store_stamp, &stamp, sizeof stamp) == 0) {
+
+        return KEETO_OK;
+    }
+
+    int res = KEETO_UNKNOWN_ERR;
+
+    char *source = strdup(cert_store_dir);
+    if (source == NULL) {
+        log_error("failed to duplicate cert store dir");
+        return KEETO_NO_MEMORY;
+    }
+
+    X509_STORE *cert_store_tmp = NULL;
+    int64_t crl_expiry = INT64_MAX;
+    if (snapshot_file != NULL) {
+        rc = new_cert_store(check_crl, &cert_store_tmp);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+        rc = load_cert_store_snapshot(cert_store_tmp, snapshot_file,
+            cert_store_dir, check_crl, &stamp, &crl_expiry);
+        if (rc != KEETO_OK) {
+            if (rc != KEETO_NO_CACHE_ENTRY) {
+                log_error("failed to load cert store snapshot (%s)",
+                    keeto_strerror(rc));
+            }
+            X509_STORE_free(cert_store_tmp);
+            cert_store_tmp = NULL;
+            crl_expiry = INT64_MAX;
+        }
+    }
+
+    if (cert_store_tmp == NULL) {
+        /* create a new x509 store with trusted ca certs/crl's */
+        rc = new_cert_store(check_crl, &cert_store_tmp);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+        struct keeto_cert_store_snapshot_buffer snapshot = { NULL, 0, 0, 0 };
+        rc = load_cert_store_dir(cert_store_tmp, cert_store_dir, check_crl,
+            &crl_expiry, snapshot_file != NULL ? &snapshot : NULL);
+        if (rc == KEETO_OK && snapshot_file != NULL) {
+            rc = write_cert_store_snapshot(snapshot_file, cert_store_dir,
+                check_crl, &stamp, &snapshot);
+            if (rc != KEETO_OK) {
+                log_error("failed to write cert store snapshot (%s)",
+                    keeto_strerror(rc));
+            }
+            rc = KEETO_OK;
+        }
+        free(snapshot.data);
+        if (rc != KEETO_OK) {
+            log_error("failed to read certs from '%s'", cert_store_dir);
+            res = rc;
+            goto cleanup;
+        }
+    }
+
+    unsigned long *subject_hashes = NULL;
+    size_t subject_hash_count = 0;
+    rc = get_cert_store_subject_hashes(cert_store_tmp, &subject_hashes,
+        &subject_hash_count);
+    if (rc != KEETO_OK) {
+        res = rc;
+        goto cleanup;
+    }
+
+    set_cert_store(cert_store_tmp, source, check_crl, true, &stamp,
+        subject_hashes, subject_hash_count, crl_expiry);
+    cert_store_tmp = NULL;
+    source = NULL;
+    res = KEETO_OK;
+
+cleanup:
+    if (cert_store_tmp != NULL) {
+        X509_STORE_free(cert_store_tmp);
+    }
+    free(source);
+    return res;
+}
+
+/*
+ * tells whether the cert store has to be reinitialized because the
+ * cert store directory or the settings changed. allows long running
+ * processes to check for changes without serializing the users of the
+ * cert store. the current cert store is kept if the directory cannot
+ * be read.
+ */
+bool
+is_cert_store_outdated(char *cert_store_dir, bool check_crl)
+{
+    if (cert_store_dir == NULL) {
+        fatal("cert_store_dir == NULL");
+    }
+
+    if (cert_store == NULL || cert_store_check_crl != check_crl ||
+        strcmp(cert_store_source, cert_store_dir) != 0) {
+        return true;
+    }
+    struct keeto_cert_store_stamp stamp;
+    int rc = get_cert_store_stamp(cert_store_dir, &stamp);
+    if (rc != KEETO_OK) {
+        return false;
     }
-    key->ssh_key_fp_sha256 = ssh_key_fp_sha256;
-    ssh_key_fp_sha256 = NULL;
-    key->ssh_key_fp_md5 = ssh_key_fp_md5;
-    ssh_key_fp_md5 = NULL;
-    ssh_key->key = tmp_ssh_key;
-    tmp_ssh_key = NULL;
-    res = KEETO_OK;
+    return memcmp(&cert_store_stamp, &stamp, sizeof stamp) != 0;
+}
 
-cleanup_c:
-    if (ssh_key_fp_md5 != NULL) {
-        free(ssh_key_fp_md5);
+void
+free_cert_store()
+{
+    if (cert_store == NULL) {
+        return;
     }
-cleanup_b:
-    if (tmp_ssh_key != NULL) {
-        free(tmp_ssh_key);
+    X509_STORE_free(cert_store);
+    cert_store = NULL;
+    free(cert_store_source);
+    cert_store_source = NULL;
+    free(cert_store_subject_hashes);
+    cert_store_subject_hashes = NULL;
+    cert_store_subject_hash_count = 0;
+}
+
+static void
+free_crl_indexes()
+{
+    struct keeto_crl_index_entry *entry = crl_indexes;
+    while (entry != NULL) {
+        struct keeto_crl_index_entry *next = entry->next;
+        close_crl_index(entry->index);
+        free(entry->file);
+        free(entry);
+        entry = next;
     }
-cleanup_a:
-    free(blob);
-    return res;
+    crl_indexes = NULL;
 }
 
+/*
+ * revocation is checked against the crl indexes of crl_index_dir
+ * (written by keeto-crl-compile) instead of crl's in the cert store.
+ * opened indexes are kept until the directory changes.
+ */
 int
-add_key_data_from_x509(X509 *x509, struct keeto_key *key)
+init_crl_index(char *crl_index_dir)
 {
-    if (x509 == NULL || key == NULL) {
-        fatal("x509 or key == NULL");
+    if (crl_index_dir == NULL) {
+        fatal("crl_index_dir == NULL");
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    struct keeto_cert_store_stamp stamp;
+    int rc = get_cert_store_stamp(crl_index_dir, &stamp);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    if (crl_index_source != NULL &&
+        strcmp(crl_index_source, crl_index_dir) == 0 &&
+        memcmp(&crl_index_stamp, &stamp, sizeof stamp) == 0) {
 
-    EVP_PKEY *pkey = X509_get_pubkey(x509);
-    if (pkey == NULL) {
-        log_error("failed to extract public key from certificate");
-        return KEETO_X509_ERR;
+        return KEETO_OK;
     }
 
-    struct keeto_ssh_key *ssh_key = new_ssh_key();
-    if (ssh_key == NULL) {
-        log_error("failed to allocate memory for ssh key buffer");
-        res = KEETO_NO_MEMORY;
-        goto cleanup_a;
+    char *source = strdup(crl_index_dir);
+    if (source == NULL) {
+        log_error("failed to duplicate crl index dir");
+        return KEETO_NO_MEMORY;
     }
-    int pkey_type = EVP_PKEY_base_id(pkey);
-    switch (pkey_type) {
-    case EVP_PKEY_RSA:
-        ssh_key->keytype = strdup("ssh-rsa");
-        if (ssh_key->keytype == NULL) {
-            log_error("failed to duplicate ssh keytype");
-            res = KEETO_NO_MEMORY;
-            goto cleanup_b;
+    free_crl_index();
+    crl_index_source = source;
+    crl_index_stamp = stamp;
+    crl_index_generation = get_cert_store_generation(crl_index_dir, true,
+        &stamp);
+    return KEETO_OK;
+}
+
+/*
+ * returns true if crl_index_dir is not the directory of the opened
+ * indexes or if it has been changed (e.g. by keeto-crl-compile) since
+ * the indexes were opened.
+ */
+bool
+is_crl_index_outdated(char *crl_index_dir)
+{
+    if (crl_index_dir == NULL) {
+        fatal("crl_index_dir == NULL");
+    }
+
+    if (crl_index_source == NULL ||
+        strcmp(crl_index_source, crl_index_dir) != 0) {
+        return true;
+    }
+    struct keeto_cert_store_stamp stamp;
+    int rc = get_cert_store_stamp(crl_index_dir, &stamp);
+    if (rc != KEETO_OK) {
+        return false;
+    }
+    return memcmp(&crl_index_stamp, &stamp, sizeof stamp) != 0;
+}
+
+void
+free_crl_index()
+{
+    free_crl_indexes();
+    free(crl_index_source);
+    crl_index_source = NULL;
+    crl_index_generation = 0;
+}
+
+/* like crl's the indexes are looked up by the hash of the issuer name */
+static int
+get_crl_index(X509 *x509, struct keeto_crl_index **ret)
+{
+    unsigned long hash = X509_issuer_name_hash(x509);
+    for (int n = 0; ; n++) {
+        char file[strlen(crl_index_source) + 24];
+        snprintf(file, sizeof file, "%s/%08lx.i%d", crl_index_source, hash, n);
+
+        struct keeto_crl_index_entry *entry = NULL;
+        for (entry = crl_indexes; entry != NULL; entry = entry->next) {
+            if (strcmp(entry->file, file) == 0) {
+                break;
+            }
         }
-        /* get rsa key */
-        RSA *rsa = EVP_PKEY_get1_RSA(pkey);
-        if (rsa == NULL) {
-            log_error("failed to obtain rsa key");
-            res = KEETO_OPENSSL_ERR;
-            goto cleanup_b;
+        if (entry == NULL) {
+            entry = malloc(sizeof *entry);
+            if (entry == NULL) {
+                log_error("failed to allocate memory for crl index entry");
+                return KEETO_NO_MEMORY;
+            }
+            entry->file = strdup(file);
+            if (entry->file == NULL) {
+                log_error("failed to duplicate crl index file");
+                free(entry);
+                return KEETO_NO_MEMORY;
+            }
+            entry->index = NULL;
+            int rc = open_crl_index(file, &entry->index);
+            if (rc != KEETO_OK && rc != KEETO_NO_SUCH_VALUE) {
+                free(entry->file);
+                free(entry);
+                return rc;
+            }
+            entry->next = crl_indexes;
+            crl_indexes = entry;
         }
-        /* add key data */
-        int rc = add_key_data_from_rsa(rsa, ssh_key, key);
+        if (entry->index == NULL) {
+            return KEETO_NO_SUCH_VALUE;
+        }
+        if (crl_index_matches_issuer(entry->index,
+            X509_get_issuer_name(x509))) {
+
+            *ret = entry->index;
+            return KEETO_OK;
+        }
+    }
+}
+
+/*
+ * every certificate of the verified chain is checked against the crl
+ * index of its issuer, like X509_V_FLAG_CRL_CHECK_ALL does.
+ */
+static int
+check_chain_revocation(X509_STORE_CTX *ctx_store, int64_t now, bool *valid,
+    int64_t *crl_expiry)
+{
+    STACK_OF(X509) *chain = X509_STORE_CTX_get1_chain(ctx_store);
+    if (chain == NULL) {
+        log_error("failed to obtain certificate chain");
+        return KEETO_OPENSSL_ERR;
+    }
+
+    int res = KEETO_OK;
+    *valid = true;
+    for (int i = 0; i < sk_X509_num(chain) && *valid; i++) {
+        X509 *x509 = sk_X509_value(chain, i);
+        struct keeto_crl_index *index = NULL;
+        pthread_mutex_lock(&crl_indexes_lock);
+        int rc = get_crl_index(x509, &index);
+        pthread_mutex_unlock(&crl_indexes_lock);
         switch (rc) {
         case KEETO_OK:
             break;
-        case KEETO_NO_MEMORY:
-            res = rc;
-            RSA_free(rsa);
-            goto cleanup_b;
+        case KEETO_NO_SUCH_VALUE:
+            log_error("certificate not valid (unable to get crl index)");
+            *valid = false;
+            continue;
         default:
-            log_error("failed to obtain ssh key data from rsa (%s)",
-                keeto_strerror(rc));
             res = rc;
-            RSA_free(rsa);
-            goto cleanup_b;
+            goto cleanup;
+        }
+        if (index->header->this_update > now) {
+            log_error("certificate not valid (crl index not yet valid)");
+            *valid = false;
+            continue;
+        }
+        if (index->header->next_update < now) {
+            log_error("certificate not valid (crl index has expired)");
+            *valid = false;
+            continue;
+        }
+        bool revoked = false;
+        rc = lookup_crl_index(index, X509_get_serialNumber(x509), &revoked);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+        if (revoked) {
+            log_error("certificate not valid (certificate revoked)");
+            *valid = false;
+            continue;
+        }
+        if (index->header->next_update < *crl_expiry) {
+            *crl_expiry = index->header->next_update;
         }
-        RSA_free(rsa);
-        break;
-    default:
-        log_error("unsupported key type (%d)", pkey_type);
-        res = KEETO_UNSUPPORTED_KEY_TYPE;
-        goto cleanup_a;
     }
-    key->ssh_key = ssh_key;
-    ssh_key = NULL;
-    res = KEETO_OK;
 
-cleanup_b:
-    if (ssh_key != NULL) {
-        free_ssh_key(ssh_key);
-    }
-cleanup_a:
-    EVP_PKEY_free(pkey);
+cleanup:
+    sk_X509_pop_free(chain, X509_free);
     return res;
 }
 
 int
-init_cert_store(char *cert_store_dir, bool check_crl)
+init_validation_cache(char *validation_cache_file, long max_age)
 {
-    if (cert_store_dir == NULL) {
-        fatal("cert_store_dir == NULL");
+    if (validation_cache_file == NULL) {
+        fatal("validation_cache_file == NULL");
     }
 
-    if (cert_store != NULL) {
+    if (validation_cache != NULL) {
         return KEETO_OK;
     }
 
-    int res = KEETO_UNKNOWN_ERR;
+    int rc = open_vcache(validation_cache_file, &validation_cache);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    validation_cache_max_age = max_age;
+    return KEETO_OK;
+}
 
-    /* create a new x509 store with trusted ca certs/crl's */
-    X509_STORE *cert_store_tmp = X509_STORE_new();
-    if (cert_store_tmp == NULL) {
-        log_error("failed to create cert store");
-        return KEETO_OPENSSL_ERR;
+void
+free_validation_cache()
+{
+    close_vcache(validation_cache);
+    validation_cache = NULL;
+}
+
+/*
+ * a validation result stays valid until a certificate of the chain
+ * expires, one of the crl's has to be updated or the maximum age is
+ * reached. changes to the cert store or the crl indexes change the
+ * generation.
+ */
+static int64_t
+get_validation_expiry(X509_STORE_CTX *ctx_store, int64_t now,
+    int64_t crl_expiry)
+{
+    STACK_OF(X509) *chain = X509_STORE_CTX_get1_chain(ctx_store);
+    if (chain == NULL) {
+        /* do not cache what cannot be bound to the chain */
+        return now;
     }
-    X509_LOOKUP *cert_store_lookup = X509_STORE_add_lookup(cert_store_tmp,
-        X509_LOOKUP_hash_dir());
-    if (cert_store_lookup == NULL) {
-        log_error("failed to create cert store lookup object");
-        res = KEETO_X509_ERR;
-        goto cleanup;
+    int64_t expires = now + validation_cache_max_age;
+    for (int i = 0; i < sk_X509_num(chain); i++) {
+        int64_t not_after = get_time_from_asn1_time(
+            X509_get_notAfter(sk_X509_value(chain, i)), now);
+        if (not_after < expires) {
+            expires = not_after;
+        }
     }
-    int rc = X509_LOOKUP_add_dir(cert_store_lookup, cert_store_dir,
-        X509_FILETYPE_PEM);
-    if (rc == 0) {
-        log_error("failed to read certs from '%s'", cert_store_dir);
-        res = KEETO_OPENSSL_ERR;
-        goto cleanup;
+    sk_X509_pop_free(chain, X509_free);
+    if (crl_expiry < expires) {
+        expires = crl_expiry;
     }
-    if (check_crl) {
-        rc = X509_STORE_set_flags(cert_store_tmp, X509_V_FLAG_CRL_CHECK |
-            X509_V_FLAG_CRL_CHECK_ALL);
-        if (rc == 0) {
-            log_error("failed to set cert store flags");
-            res = KEETO_OPENSSL_ERR;
-            goto cleanup;
+    return expires;
+}
+
+/*
+ * earliest next update of the crl's that have been used to validate
+ * the chain of ctx_store. crl's without next update do not expire.
+ */
+static int64_t
+get_chain_crl_expiry(X509_STORE_CTX *ctx_store)
+{
+    int64_t crl_expiry = INT64_MAX;
+    STACK_OF(X509) *chain = X509_STORE_CTX_get1_chain(ctx_store);
+    if (chain == NULL) {
+        /* do not cache what cannot be bound to the crl's */
+        return 0;
+    }
+    int64_t now = time(NULL);
+    for (int i = 0; i < sk_X509_num(chain); i++) {
+        X509_NAME *issuer = X509_get_issuer_name(sk_X509_value(chain, i));
+        STACK_OF(X509_CRL) *crls = X509_STORE_CTX_get1_crls(ctx_store, issuer);
+        for (int j = 0; j < sk_X509_CRL_num(crls); j++) {
+            const ASN1_TIME *next_update =
+                X509_CRL_get0_nextUpdate(sk_X509_CRL_value(crls, j));
+            if (next_update == NULL) {
+                continue;
+            }
+            int64_t expiry = get_time_from_asn1_time(next_update, now);
+            if (expiry < crl_expiry) {
+                crl_expiry = expiry;
+            }
         }
+        sk_X509_CRL_pop_free(crls, X509_CRL_free);
     }
-    cert_store = cert_store_tmp;
-    cert_store_tmp = NULL;
-    res = KEETO_OK;
+    sk_X509_pop_free(chain, X509_free);
+    return crl_expiry;
+}
 
-cleanup:
-    if (cert_store_tmp != NULL) {
-        X509_STORE_free(cert_store_tmp);
+static uint64_t
+get_validation_generation()
+{
+    return (cert_store_generation ^ crl_index_generation) * 1099511628211ULL;
+}
+
+const char *
+get_x509_reject_string(enum keeto_x509_reject reject)
+{
+    switch (reject) {
+    case KEETO_X509_ACCEPTED:
+        return "accepted";
+    case KEETO_X509_NOT_YET_VALID:
+        return "not yet valid";
+    case KEETO_X509_EXPIRED:
+        return "expired";
+    case KEETO_X509_UNSUPPORTED_KEY_TYPE:
+        return "unsupported key type";
+    case KEETO_X509_WRONG_KEY_USAGE:
+        return "wrong key usage";
+    case KEETO_X509_UNKNOWN_ISSUER:
+        return "unknown issuer";
+    default:
+        return "unknown reject reason";
     }
-    return res;
 }
 
-void
-free_cert_store()
+/*
+ * cheap checks that only look at the certificate itself. certificates
+ * rejected here would fail validate_x509() or add_key_data_from_x509()
+ * anyway - but only after building the whole chain.
+ */
+enum keeto_x509_reject
+prevalidate_x509(X509 *x509, bool check_issuer)
 {
-    if (cert_store == NULL) {
-        return;
+    if (x509 == NULL) {
+        fatal("x509 == NULL");
     }
-    X509_STORE_free(cert_store);
+
+    if (X509_cmp_current_time(X509_get_notBefore(x509)) > 0) {
+        return KEETO_X509_NOT_YET_VALID;
+    }
+    if (X509_cmp_current_time(X509_get_notAfter(x509)) < 0) {
+        return KEETO_X509_EXPIRED;
+    }
+
+    /* add_key_data_from_x509() only supports rsa keys */
+    ASN1_OBJECT *algorithm = NULL;
+    int rc = X509_PUBKEY_get0_param(&algorithm, NULL, NULL, NULL,
+        X509_get_X509_PUBKEY(x509));
+    if (rc == 0 || OBJ_obj2nid(algorithm) != NID_rsaEncryption) {
+        return KEETO_X509_UNSUPPORTED_KEY_TYPE;
+    }
+
+    /* same purpose as used for validation */
+    rc = X509_check_purpose(x509, X509_PURPOSE_SSL_CLIENT, 0);
+    if (rc != 1) {
+        return KEETO_X509_WRONG_KEY_USAGE;
+    }
+
+    if (check_issuer && cert_store_subject_hashes != NULL) {
+        unsigned long issuer_hash =
+            X509_NAME_hash(X509_get_issuer_name(x509));
+        if (bsearch(&issuer_hash, cert_store_subject_hashes,
+            cert_store_subject_hash_count, sizeof issuer_hash,
+            &compare_subject_hashes) == NULL) {
+
+            return KEETO_X509_UNKNOWN_ISSUER;
+        }
+    }
+    return KEETO_X509_ACCEPTED;
 }
 
 int
-validate_x509(X509 *x509, bool *ret)
+validate_x509(X509 *x509, const struct keeto_x509_digest *digest, bool *ret)
 {
-    if (x509 == NULL || ret == NULL) {
-        fatal("x509 or ret == NULL");
+    if (x509 == NULL || digest == NULL || ret == NULL) {
+        fatal("x509, digest or ret == NULL");
     }
 
     if (cert_store == NULL) {
@@ -442,6 +1739,20 @@ validate_x509(X509 *x509, bool *ret)
 
     int res = KEETO_UNKNOWN_ERR;
 
+    /* certificates validated recently do not have to be validated again */
+    bool cacheable = false;
+    int64_t now = time(NULL);
+    if (validation_cache != NULL && digest->valid) {
+        if (lookup_vcache(validation_cache, digest->data,
+            get_validation_generation(), now)) {
+
+            log_debug("certificate valid (cached)");
+            *ret = true;
+            return KEETO_OK;
+        }
+        cacheable = true;
+    }
+
     /* validate the user certificate against the cert store */
     X509_STORE_CTX *ctx_store = X509_STORE_CTX_new();
     if (ctx_store == NULL) {
@@ -466,8 +1777,28 @@ validate_x509(X509 *x509, bool *ret)
         int cert_err = X509_STORE_CTX_get_error(ctx_store);
         log_error("certificate not valid (%s)",
             X509_verify_cert_error_string(cert_err));
-    } else {
-        *ret = true;
+        res = KEETO_OK;
+        goto cleanup;
+    }
+
+    int64_t crl_expiry = cert_store_crl_expiry;
+    if (!cert_store_preloaded && cert_store_check_crl) {
+        crl_expiry = get_chain_crl_expiry(ctx_store);
+    }
+    *ret = true;
+    if (crl_index_source != NULL) {
+        rc = check_chain_revocation(ctx_store, now, ret, &crl_expiry);
+        if (rc != KEETO_OK) {
+            res = rc;
+            goto cleanup;
+        }
+    }
+    if (*ret && cacheable) {
+        int64_t expires = get_validation_expiry(ctx_store, now, crl_expiry);
+        if (expires > now) {
+            store_vcache(validation_cache, digest->data,
+                get_validation_generation(), now, expires);
+        }
     }
     res = KEETO_OK;
 
@@ -579,6 +1910,85 @@ get_subject_from_x509(X509 *x509, char **ret)
     return get_x509_name_as_string(subject, ret);
 }
 
+/*
+ * with x509_memo the certificate is decoded only once per authentication
+ * and shared by all keys with the same digest. the memo holds a reference
+ * of its own so release_key_x509() can be used either way.
+ */
+int
+decode_key_x509(struct keeto_key *key,
+    const struct keeto_x509_digest *digest, struct keeto_x509_memo *x509_memo)
+{
+    if (key == NULL) {
+        fatal("key == NULL");
+    }
+
+    if (key->x509 != NULL) {
+        return KEETO_OK;
+    }
+    if (key->der == NULL) {
+        fatal("key->der == NULL");
+    }
+
+    bool memoize = x509_memo != NULL && digest != NULL && digest->valid;
+    char memo_key[2 * KEETO_X509_DIGEST_SIZE + 1];
+    void *memo_value = NULL;
+    if (memoize) {
+        encode_hex(digest->data, sizeof digest->data, '\0', memo_key);
+        pthread_mutex_lock(&x509_memo->lock);
+        if (memo_get(x509_memo->memo, memo_key, &memo_value) == KEETO_OK) {
+            X509_up_ref(memo_value);
+            key->x509 = memo_value;
+        }
+        pthread_mutex_unlock(&x509_memo->lock);
+        if (key->x509 != NULL) {
+            return KEETO_OK;
+        }
+    }
+
+    const unsigned char *der = key->der;
+    key->x509 = d2i_X509(NULL, &der, (long) key->der_length);
+    if (key->x509 == NULL) {
+        log_error("failed to decode certificate");
+        return KEETO_X509_ERR;
+    }
+
+    if (memoize) {
+        pthread_mutex_lock(&x509_memo->lock);
+        /* another thread might have decoded the certificate meanwhile */
+        if (memo_get(x509_memo->memo, memo_key, &memo_value) == KEETO_OK) {
+            X509_up_ref(memo_value);
+            free_x509(key->x509);
+            key->x509 = memo_value;
+        } else {
+            X509_up_ref(key->x509);
+            if (memo_put(x509_memo->memo, memo_key, key->x509) != KEETO_OK) {
+                free_x509(key->x509);
+            }
+        }
+        pthread_mutex_unlock(&x509_memo->lock);
+    }
+    return KEETO_OK;
+}
+
+/*
+ * the certificate is not needed anymore as soon as the ssh key data is
+ * derived. keys without der (e.g. created from a pem file) keep it.
+ */
+void
+release_key_x509(struct keeto_key *key)
+{
+    if (key == NULL) {
+        fatal("key == NULL");
+    }
+
+    if (key->der == NULL) {
+        return;
+    }
+    free_x509(key->x509);
+    key->x509 = NULL;
+}
+
 void
 free_x509(X509 *x509)
 {
@@ -588,3 +1998,37 @@ free_x509(X509 *x509)
     X509_free(x509);
 }
 
+static void
+free_x509_memo_value(void *value)
+{
+    free_x509(value);
+}
+
+struct keeto_x509_memo *
+new_x509_memo()
+{
+    struct keeto_x509_memo *x509_memo = malloc(sizeof *x509_memo);
+    if (x509_memo == NULL) {
+        return NULL;
+    }
+    x509_memo->memo = new_memo(KEETO_X509_MEMO_BUCKETS,
+        &free_x509_memo_value);
+    if (x509_memo->memo == NULL) {
+        free(x509_memo);
+        return NULL;
+    }
+    pthread_mutex_init(&x509_memo->lock, NULL);
+    return x509_memo;
+}
+
+void
+free_x509_memo(struct keeto_x509_memo *x509_memo)
+{
+    if (x509_memo == NULL) {
+        return;
+    }
+    free_memo(x509_memo->memo);
+    pthread_mutex_destroy(&x509_memo->lock);
+    free(x509_memo);
+}
+
@@ -20,6 +20,7 @@
 #ifndef KEETO_X509_H
 #define KEETO_X509_H
 
+#include <pthread.h>
 #include <stdbool.h>
 
 #include <openssl/x509.h>
@@ -31,6 +32,51 @@ enum keeto_digests {
     KEETO_DIGEST_SHA256
 };
 
+/* reasons for rejecting a certificate in prevalidate_x509() */
+enum keeto_x509_reject {
+    KEETO_X509_ACCEPTED,
+    KEETO_X509_NOT_YET_VALID,
+    KEETO_X509_EXPIRED,
+    KEETO_X509_UNSUPPORTED_KEY_TYPE,
+    KEETO_X509_WRONG_KEY_USAGE,
+    KEETO_X509_UNKNOWN_ISSUER,
+    KEETO_X509_REJECTS
+};
+
+#define KEETO_X509_DIGEST_SIZE 32
+
+/*
+ * sha256 digest of a certificate. it is computed once per certificate
+ * and used as key of the validation cache and the key cache.
+ */
+struct keeto_x509_digest {
+    bool valid;
+    unsigned char data[KEETO_X509_DIGEST_SIZE];
+};
+
+/*
+ * certificates decoded during one authentication by digest. the same
+ * certificate is often referenced by several access profiles.
+ */
+#define KEETO_X509_MEMO_BUCKETS 64
+
+struct keeto_x509_memo {
+    pthread_mutex_t lock;
+    struct keeto_memo *memo;
+};
+
+/* covers the encoding of rsa keys up to 8192 bit */
+#define KEETO_SSH_KEY_ARENA_SIZE 4096
+
+/* ssh key data encoded into an arena - see encode_ssh_key_from_rsa() */
+struct keeto_ssh_key_encoding {
+    unsigned char *blob;
+    size_t blob_length;
+    char *key;
+    char *fp_md5;
+    char *fp_sha256;
+};
+
 #define PUT_32BIT(cp, value) do { \
     (cp)[0] = (unsigned char) ((value) >> 24); \
     (cp)[1] = (unsigned char) ((value) >> 16); \
@@ -38,14 +84,33 @@ enum keeto_digests {
     (cp)[3] = (unsigned char) (value); \
 } while (0)
 
-int init_cert_store(char *cert_store_dir, bool check_crl);
+int init_cert_store(char *cert_store_dir, bool check_crl, bool preload,
+    char *snapshot_file);
+bool is_cert_store_outdated(char *cert_store_dir, bool check_crl);
 void free_cert_store();
-int add_key_data_from_x509(X509 *x509, struct keeto_key *key);
-int validate_x509(X509 *x509, bool *valid);
+int init_crl_index(char *crl_index_dir);
+bool is_crl_index_outdated(char *crl_index_dir);
+void free_crl_index();
+int init_validation_cache(char *validation_cache_file, long max_age);
+void free_validation_cache();
+int init_key_cache(char *key_cache_file);
+void free_key_cache();
+int decode_key_x509(struct keeto_key *key,
+    const struct keeto_x509_digest *digest, struct keeto_x509_memo *x509_memo);
+void release_key_x509(struct keeto_key *key);
+void get_key_digest(struct keeto_key *key, struct keeto_x509_digest *ret);
+int add_key_data_from_x509(X509 *x509, const struct keeto_x509_digest *digest,
+    struct keeto_key *key);
+const char *get_x509_reject_string(enum keeto_x509_reject reject);
+enum keeto_x509_reject prevalidate_x509(X509 *x509, bool check_issuer);
+int validate_x509(X509 *x509, const struct keeto_x509_digest *digest,
+    bool *valid);
 char *get_serial_from_x509(X509 *x509);
 int get_issuer_from_x509(X509 *x509, char **ret);
 int get_subject_from_x509(X509 *x509, char **ret);
 void free_x509(X509 *x509);
+struct keeto_x509_memo *new_x509_memo();
+void free_x509_memo(struct keeto_x509_memo *x509_memo);
 
 #endif /* KEETO_X509_H */
 
@@ -0,0 +1,700 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * keetod keeps the parsed config, the ldap connections and the cert
+ * store in memory and answers keystore requests from the pam module
+ * over a unix domain socket. this avoids the costly setup (ldap
+ * connection establishment, starttls, bind, cert store creation) for
+ * every single login.
+ *
+ * requests are handled by a fixed number of worker threads, each with
+ * its own ldap connection, so that a slow ldap search does not block
+ * other logins. the cert store is built once per config generation
+ * and reloaded whenever the cert store directory changes.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <confuse.h>
+#include <ldap.h>
+
+#include "keeto-config.h"
+#include "keeto-error.h"
+#include "keeto-ipc.h"
+#include "keeto-keystore.h"
+#include "keeto-ldap.h"
+#include "keeto-log.h"
+#include "keeto-openssl.h"
+#include "keeto-util.h"
+#include "keeto-x509.h"
+
+#define KEETOD_LISTEN_BACKLOG 64
+#define KEETOD_QUEUE_SIZE 256
+
+/* accepted connections waiting for a worker */
+struct keetod_queue {
+    int fds[KEETOD_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+};
+
+static volatile sig_atomic_t terminate = 0;
+static volatile sig_atomic_t reload = 0;
+
+/*
+ * the config and everything derived from it (cert store, caches) is
+ * read locked by the workers while they handle a request. a reload
+ * takes the write lock and starts a new generation - workers drop
+ * their ldap connection when they notice it.
+ */
+static cfg_t *cfg = NULL;
+static unsigned long cfg_generation = 0;
+static pthread_rwlock_t cfg_lock;
+
+static struct keetod_queue queue = {
+    .head = 0,
+    .count = 0,
+    .closed = false,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER
+};
+
+static void
+handle_signal(int signal)
+{
+    switch (signal) {
+    case SIGHUP:
+        reload = 1;
+        break;
+    case SIGINT:
+    case SIGTERM:
+        terminate = 1;
+        break;
+    }
+}
+
+static int
+setup_signal_handlers()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sigemptyset(&sa.sa_mask);
+    /*
+     * do not set SA_RESTART so that a blocking accept() returns on
+     * signal arrival.
+     */
+    sa.sa_handler = &handle_signal;
+    if (sigaction(SIGHUP, &sa, NULL) == -1 ||
+        sigaction(SIGINT, &sa, NULL) == -1 ||
+        sigaction(SIGTERM, &sa, NULL) == -1) {
+        log_error("failed to install signal handler (%s)", strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    /* clients that went away must not kill the daemon */
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+        log_error("failed to ignore SIGPIPE (%s)", strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
+
+/*
+ * if crl indexes are used, crl's are not loaded into the cert store but
+ * checked against the indexes instead.
+ */
+static int
+init_cert_store_from_config(cfg_t *config)
+{
+    if (config == NULL) {
+        fatal("config == NULL");
+    }
+
+    char *cert_store_dir = cfg_getstr(config, "cert_store_dir");
+    bool check_crl = cfg_getint(config, "check_crl");
+    char *cert_store_snapshot = cfg_getstr(config, "cert_store_snapshot");
+    char *crl_index = cfg_getstr(config, "crl_index");
+    bool use_crl_index = check_crl && crl_index[0] != '\0';
+    int rc = init_cert_store(cert_store_dir, check_crl && !use_crl_index, true,
+        cert_store_snapshot[0] != '\0' ? cert_store_snapshot : NULL);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+    if (!use_crl_index) {
+        free_crl_index();
+        return KEETO_OK;
+    }
+    return init_crl_index(crl_index);
+}
+
+static bool
+is_cert_store_from_config_outdated(cfg_t *config)
+{
+    if (config == NULL) {
+        fatal("config == NULL");
+    }
+
+    char *cert_store_dir = cfg_getstr(config, "cert_store_dir");
+    bool check_crl = cfg_getint(config, "check_crl");
+    char *crl_index = cfg_getstr(config, "crl_index");
+    bool use_crl_index = check_crl && crl_index[0] != '\0';
+    if (is_cert_store_outdated(cert_store_dir, check_crl && !use_crl_index)) {
+        return true;
+    }
+    return use_crl_index && is_crl_index_outdated(crl_index);
+}
+
+static int
+load_config(const char *cfg_file)
+{
+    if (cfg_file == NULL) {
+        fatal("cfg_file == NULL");
+    }
+
+    cfg_t *cfg_tmp = parse_config(cfg_file);
+    if (cfg_tmp == NULL) {
+        log_error("failed to parse config file '%s'", cfg_file);
+        return KEETO_SYSTEM_ERR;
+    }
+
+    char *syslog_facility = cfg_getstr(cfg_tmp, "syslog_facility");
+    int rc = set_syslog_facility(syslog_facility);
+    if (rc != KEETO_OK) {
+        log_error("failed to set syslog facility '%s' (%s)", syslog_facility,
+            keeto_strerror(rc));
+        free_config(cfg_tmp);
+        return rc;
+    }
+
+    /* (re)initialize cert store with the new settings */
+    free_cert_store();
+    free_crl_index();
+    rc = init_cert_store_from_config(cfg_tmp);
+    if (rc != KEETO_OK) {
+        log_error("failed to initialize cert store (%s)", keeto_strerror(rc));
+        free_config(cfg_tmp);
+        /* restore cert store of the old config */
+        if (cfg != NULL) {
+            int rc_restore = init_cert_store_from_config(cfg);
+            if (rc_restore != KEETO_OK) {
+                log_error("failed to restore cert store (%s)",
+                    keeto_strerror(rc_restore));
+            }
+        }
+        return rc;
+    }
+
+    /* (re)open validation cache */
+    free_validation_cache();
+    char *cert_validation_cache_file = cfg_getstr(cfg_tmp,
+        "cert_validation_cache_file");
+    if (cert_validation_cache_file[0] != '\0') {
+        rc = init_validation_cache(cert_validation_cache_file,
+            cfg_getint(cfg_tmp, "cert_validation_cache_max_age"));
+        if (rc != KEETO_OK) {
+            log_error("failed to initialize validation cache (%s)",
+                keeto_strerror(rc));
+        }
+    }
+
+    /* (re)open key cache */
+    free_key_cache();
+    char *ssh_key_cache_file = cfg_getstr(cfg_tmp, "ssh_key_cache_file");
+    if (ssh_key_cache_file[0] != '\0') {
+        rc = init_key_cache(ssh_key_cache_file);
+        if (rc != KEETO_OK) {
+            log_error("failed to initialize key cache (%s)",
+                keeto_strerror(rc));
+        }
+    }
+
+    /* the compiled uid regex belongs to the config in use */
+    rc = init_uid_validator(cfg_getstr(cfg_tmp, "uid_regex"));
+    if (rc != KEETO_OK) {
+        log_error("failed to compile uid regex (%s)", keeto_strerror(rc));
+    }
+
+    /* ldap settings might have changed */
+    free_config(cfg);
+    cfg = cfg_tmp;
+    cfg_generation++;
+    return KEETO_OK;
+}
+
+static int
+init_cfg_lock()
+{
+    /* pending reloads must not be starved by a steady stream of requests */
+    pthread_rwlockattr_t attr;
+    int rc = pthread_rwlockattr_init(&attr);
+    if (rc == 0) {
+        rc = pthread_rwlockattr_setkind_np(&attr,
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        if (rc == 0) {
+            rc = pthread_rwlock_init(&cfg_lock, &attr);
+        }
+        pthread_rwlockattr_destroy(&attr);
+    }
+    if (rc != 0) {
+        log_error("failed to initialize config lock (%s)", strerror(rc));
+        return KEETO_SYSTEM_ERR;
+    }
+    return KEETO_OK;
+}
+
+static int
+reload_config(const char *cfg_file)
+{
+    if (cfg_file == NULL) {
+        fatal("cfg_file == NULL");
+    }
+
+    pthread_rwlock_wrlock(&cfg_lock);
+    int rc = load_config(cfg_file);
+    pthread_rwlock_unlock(&cfg_lock);
+    return rc;
+}
+
+/*
+ * the cert store directory (e.g. by c_rehash) and the crl index
+ * directory (by keeto-crl-compile) might be changed at any time. both
+ * are checked before a request is handed to a worker. the write lock
+ * is only taken if the cert store has to be reloaded.
+ */
+static void
+refresh_cert_store()
+{
+    pthread_rwlock_rdlock(&cfg_lock);
+    bool outdated = is_cert_store_from_config_outdated(cfg);
+    pthread_rwlock_unlock(&cfg_lock);
+    if (!outdated) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&cfg_lock);
+    log_info("reloading cert store");
+    int rc = init_cert_store_from_config(cfg);
+    if (rc != KEETO_OK) {
+        log_error("failed to reload cert store (%s) - keeping old cert store",
+            keeto_strerror(rc));
+    }
+    pthread_rwlock_unlock(&cfg_lock);
+}
+
+/* returns false if the queue is full */
+static bool
+push_connection(int fd)
+{
+    pthread_mutex_lock(&queue.lock);
+    if (queue.count == KEETOD_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue.lock);
+        return false;
+    }
+    queue.fds[(queue.head + queue.count) % KEETOD_QUEUE_SIZE] = fd;
+    queue.count++;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    return true;
+}
+
+/* returns false if the queue has been closed and is drained */
+static bool
+pop_connection(int *ret)
+{
+    if (ret == NULL) {
+        fatal("ret == NULL");
+    }
+
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0 && !queue.closed) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    if (queue.count == 0) {
+        pthread_mutex_unlock(&queue.lock);
+        return false;
+    }
+    *ret = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % KEETOD_QUEUE_SIZE;
+    queue.count--;
+    pthread_mutex_unlock(&queue.lock);
+    return true;
+}
+
+static void
+close_queue()
+{
+    pthread_mutex_lock(&queue.lock);
+    queue.closed = true;
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+static int
+create_socket(const char *socket_path, int *ret)
+{
+    if (socket_path == NULL || ret == NULL) {
+        fatal("socket_path or ret == NULL");
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof addr.sun_path) {
+        log_error("failed to create socket '%s' (path too long)", socket_path);
+        return KEETO_SYSTEM_ERR;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        log_error("failed to create socket (%s)", strerror(errno));
+        return KEETO_SYSTEM_ERR;
+    }
+
+    /* remove stale socket of a previous run */
+    int rc = unlink(socket_path);
+    if (rc == -1 && errno != ENOENT) {
+        log_error("failed to remove socket '%s' (%s)", socket_path,
+            strerror(errno));
+        goto cleanup;
+    }
+    /* only root is allowed to talk to keetod */
+    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    rc = bind(fd, (struct sockaddr *) &addr, sizeof addr);
+    umask(mask);
+    if (rc == -1) {
+        log_error("failed to bind socket '%s' (%s)", socket_path,
+            strerror(errno));
+        goto cleanup;
+    }
+    rc = listen(fd, KEETOD_LISTEN_BACKLOG);
+    if (rc == -1) {
+        log_error("failed to listen on socket '%s' (%s)", socket_path,
+            strerror(errno));
+        goto cleanup;
+    }
+    *ret = fd;
+    return KEETO_OK;
+
+cleanup:
+    close(fd);
+    return KEETO_SYSTEM_ERR;
+}
+
+static bool
+peer_is_root(int fd)
+{
+    struct ucred peer_cred;
+    socklen_t peer_cred_length = sizeof peer_cred;
+    int rc = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer_cred,
+        &peer_cred_length);
+    if (rc == -1) {
+        log_error("failed to obtain peer credentials (%s)", strerror(errno));
+        return false;
+    }
+    if (peer_cred.uid != 0) {
+        log_error("refusing request from uid '%u' pid '%d'", peer_cred.uid,
+            peer_cred.pid);
+        return false;
+    }
+    return true;
+}
+
+static int
+resolve_keystore_records(struct keeto_info *info, LDAP **ldap_handle)
+{
+    if (info == NULL || ldap_handle == NULL) {
+        fatal("info or ldap_handle == NULL");
+    }
+
+    bool reconnected = false;
+    int rc;
+    do {
+        if (*ldap_handle == NULL) {
+            rc = open_ldap_connection(info, true, ldap_handle);
+            if (rc != KEETO_OK) {
+                return rc;
+            }
+            reconnected = true;
+        }
+        rc = get_access_profiles_from_ldap_handle(*ldap_handle, info);
+        if (rc == KEETO_LDAP_CONNECTION_ERR) {
+            /*
+             * the warm connection might have been closed by the server
+             * in the meantime. reconnect once.
+             */
+            log_info("dropping ldap connection");
+            close_ldap_connection(*ldap_handle);
+            *ldap_handle = NULL;
+            free_ssh_server(info->ssh_server);
+            info->ssh_server = NULL;
+        }
+    } while (rc == KEETO_LDAP_CONNECTION_ERR && !reconnected);
+    if (rc != KEETO_OK) {
+        return rc;
+    }
+
+    log_info("post processing access profiles");
+    return post_process_access_profiles(info);
+}
+
+/* the caller has to hold the read lock of the config */
+static void
+handle_request(int fd, LDAP **ldap_handle)
+{
+    if (ldap_handle == NULL) {
+        fatal("ldap_handle == NULL");
+    }
+
+    if (!peer_is_root(fd)) {
+        return;
+    }
+
+    /* do not let a stuck client block the daemon */
+    struct timeval tv = {
+        .tv_sec = cfg_getint(cfg, "keetod_timeout"),
+        .tv_usec = 0
+    };
+    int rc = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    if (rc == 0) {
+        rc = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+    }
+    if (rc == -1) {
+        log_error("failed to set socket timeout (%s)", strerror(errno));
+        return;
+    }
+
+    char *uid = NULL;
+    rc = receive_keetod_request(fd, &uid);
+    if (rc != KEETO_OK) {
+        log_error("failed to receive request (%s)", keeto_strerror(rc));
+        return;
+    }
+
+    struct keeto_info *info = new_info();
+    if (info == NULL) {
+        log_error("failed to allocate memory for info buffer");
+        free(uid);
+        return;
+    }
+    /* config is owned by the daemon */
+    info->cfg = cfg;
+    info->uid = uid;
+    log_info("processing request for uid '%s'", uid);
+
+    /* the pam module checks the uid as well. being on the safe side... */
+    int result = KEETO_UNKNOWN_ERR;
+    bool uid_valid = false;
+    char *uid_regex = cfg_getstr(cfg, "uid_regex");
+    rc = check_uid(uid_regex, uid, &uid_valid);
+    if (rc != KEETO_OK) {
+        log_error("failed to check uid (%s)", keeto_strerror(rc));
+        result = rc;
+    } else if (!uid_valid) {
+        log_error("invalid uid '%s'", uid);
+        result = KEETO_NO_ACCESS_PROFILE_FOR_UID;
+    } else {
+        result = resolve_keystore_records(info, ldap_handle);
+    }
+    log_info("sending response (%s)", keeto_strerror(result));
+
+    rc = send_keetod_response(fd, result, info->ldap_online,
+        result == KEETO_OK ? info->keystore_records : NULL);
+    if (rc != KEETO_OK) {
+        log_error("failed to send response (%s)", keeto_strerror(rc));
+    }
+    info->cfg = NULL;
+    free_info(info);
+}
+
+static void *
+run_worker(void *arg)
+{
+    (void) arg;
+
+    LDAP *ldap_handle = NULL;
+    unsigned long generation = 0;
+    int fd = -1;
+    while (pop_connection(&fd)) {
+        pthread_rwlock_rdlock(&cfg_lock);
+        if (generation != cfg_generation) {
+            close_ldap_connection(ldap_handle);
+            ldap_handle = NULL;
+            generation = cfg_generation;
+        }
+        handle_request(fd, &ldap_handle);
+        pthread_rwlock_unlock(&cfg_lock);
+        close(fd);
+    }
+    close_ldap_connection(ldap_handle);
+    return NULL;
+}
+
+/*
+ * signals are handled by the main thread only. this way a signal
+ * always interrupts accept().
+ */
+static long
+start_workers(long count, pthread_t *workers)
+{
+    if (workers == NULL) {
+        fatal("workers == NULL");
+    }
+
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    long started = 0;
+    for (; started < count; started++) {
+        int rc = pthread_create(&workers[started], NULL, &run_worker, NULL);
+        if (rc != 0) {
+            log_error("failed to create worker thread (%s)", strerror(rc));
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return started;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <config file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *cfg_file = argv[1];
+
+    int res = EXIT_FAILURE;
+
+    init_openssl();
+    int rc = setup_signal_handlers();
+    if (rc != KEETO_OK) {
+        goto cleanup_a;
+    }
+    rc = init_cfg_lock();
+    if (rc != KEETO_OK) {
+        goto cleanup_a;
+    }
+    rc = load_config(cfg_file);
+    if (rc != KEETO_OK) {
+        goto cleanup_a;
+    }
+    char *socket_path = strdup(cfg_getstr(cfg, "keetod_socket"));
+    if (socket_path == NULL) {
+        log_error("failed to duplicate socket path");
+        goto cleanup_a;
+    }
+    if (strlen(socket_path) == 0) {
+        log_error("failed to start keetod (keetod_socket not set)");
+        goto cleanup_b;
+    }
+    int socket_fd = -1;
+    rc = create_socket(socket_path, &socket_fd);
+    if (rc != KEETO_OK) {
+        goto cleanup_b;
+    }
+
+    /* the openssl 1.0 cert store must not be used by several threads */
+    long worker_count = OPENSSL_THREAD_SAFE ?
+        cfg_getint(cfg, "keetod_workers") : 1;
+    pthread_t *workers = malloc(sizeof(pthread_t) * worker_count);
+    if (workers == NULL) {
+        log_error("failed to allocate memory for worker buffer");
+        goto cleanup_c;
+    }
+    long started = start_workers(worker_count, workers);
+    if (started == 0) {
+        goto cleanup_d;
+    }
+    log_info("keetod listening on '%s' (%ld workers)", socket_path, started);
+
+    while (!terminate) {
+        if (reload) {
+            reload = 0;
+            log_info("reloading config file '%s'", cfg_file);
+            rc = reload_config(cfg_file);
+            if (rc != KEETO_OK) {
+                log_error("failed to reload config - keeping old config");
+            }
+        }
+
+        int client_fd = accept4(socket_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            switch (errno) {
+            case EINTR:
+            case ECONNABORTED:
+                continue;
+            default:
+                log_error("failed to accept connection (%s)", strerror(errno));
+                goto cleanup_d;
+            }
+        }
+        refresh_cert_store();
+        /* the client falls back to querying ldap directly */
+        if (!push_connection(client_fd)) {
+            log_error("dropping connection (all workers busy)");
+            close(client_fd);
+        }
+    }
+    log_info("keetod terminating");
+    res = EXIT_SUCCESS;
+
+cleanup_d:
+    close_queue();
+    for (long i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+cleanup_c:
+    close(socket_fd);
+    unlink(socket_path);
+cleanup_b:
+    free(socket_path);
+cleanup_a:
+    free_key_cache();
+    free_validation_cache();
+    free_crl_index();
+    free_cert_store();
+    free_uid_validator();
+    free_config(cfg);
+    cleanup_openssl();
+    closelog();
+    return res;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2014-2018 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * micro benchmark of the base64 / hex encoders against the former bio
+ * and sprintf based implementations. input sizes correspond to the ssh
+ * key blobs of rsa keys and the digests of their fingerprints.
+ *
+ * usage: keeto-bench-encode [iterations]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+
+#include "../src/keeto-log.h"
+#include "../src/keeto-util.h"
+#include "../src/keeto-util-encode.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+struct keeto_bench_input {
+    char *name;
+    size_t length;
+    char delimiter;
+    bool pad;
+};
+
+static struct keeto_bench_input bench_input_lt[] = {
+    { "md5 fingerprint (hex)", 16, ':', false },
+    { "sha256 fingerprint (base64)", 32, '\0', false },
+    { "rsa-1024 key blob (base64)", 151, '\0', true },
+    { "rsa-2048 key blob (base64)", 279, '\0', true },
+    { "rsa-4096 key blob (base64)", 535, '\0', true },
+    { "rsa-8192 key blob (base64)", 1047, '\0', true }
+};
+
+/* former blob_to_hex() */
+static char *
+legacy_encode_hex(unsigned char *src, size_t src_len, char *delimiter)
+{
+    size_t delimiter_len = strlen(delimiter);
+    size_t dst_len = ((src_len - 1) * (2 + delimiter_len)) + 3;
+    char *dst = malloc(dst_len);
+    if (dst == NULL) {
+        return NULL;
+    }
+    char *dst_ptr = dst;
+    for (size_t i = 0; i < src_len; i++) {
+        dst_ptr += sprintf(dst_ptr, "%02x%s", src[i], i < (src_len - 1) ?
+            delimiter : "");
+    }
+    return dst;
+}
+
+/* former blob_to_base64() */
+static char *
+legacy_encode_base64(unsigned char *src, size_t src_length, bool pad)
+{
+    BIO *bio_base64 = BIO_new(BIO_f_base64());
+    BIO *bio_mem = BIO_new(BIO_s_mem());
+    if (bio_base64 == NULL || bio_mem == NULL) {
+        BIO_free(bio_base64);
+        BIO_free(bio_mem);
+        return NULL;
+    }
+    BIO_set_flags(bio_base64, BIO_FLAGS_BASE64_NO_NL);
+    BIO *bio_base64_mem = BIO_push(bio_base64, bio_mem);
+    BIO_write(bio_base64_mem, src, src_length);
+    char *result = NULL;
+    if (BIO_flush(bio_base64_mem) == 1) {
+        unsigned char *bio_buffer = NULL;
+        long data_out = BIO_get_mem_data(bio_mem, &bio_buffer);
+        result = malloc(data_out + 1);
+        if (result != NULL) {
+            memcpy(result, bio_buffer, data_out);
+            result[data_out] = '\0';
+            if (!pad) {
+                result[strcspn(result, "=")] = '\0';
+            }
+        }
+    }
+    BIO_free_all(bio_base64_mem);
+    return result;
+}
+
+static double
+get_elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 +
+        (end->tv_nsec - start->tv_nsec);
+}
+
+/* encodes the input with the given simd level; -1 is the legacy code */
+static size_t
+encode_input(struct keeto_bench_input *input, unsigned char *src, int level,
+    char *dst)
+{
+    bool hex = input->delimiter != '\0';
+
+    if (level == -1) {
+        char *result = hex ?
+            legacy_encode_hex(src, input->length, (char []) {
+            input->delimiter, '\0' }) :
+            legacy_encode_base64(src, input->length, input->pad);
+        if (result == NULL) {
+            fatal("failed to encode input");
+        }
+        size_t length = strlen(result);
+        memcpy(dst, result, length + 1);
+        free(result);
+        return length;
+    }
+    return hex ?
+        encode_hex_with_level(src, input->length, input->delimiter, level,
+        dst) :
+        encode_base64_with_level(src, input->length, input->pad, level, dst);
+}
+
+int
+main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *level_names[] = { "legacy", "table", "ssse3", "avx2" };
+    int max_level = get_simd_level();
+
+    printf("%-30s %10s %10s\n", "input", "encoder", "ns/op");
+    for (size_t i = 0; i < sizeof bench_input_lt / sizeof bench_input_lt[0];
+        i++) {
+
+        struct keeto_bench_input *input = &bench_input_lt[i];
+        unsigned char src[input->length];
+        for (size_t j = 0; j < input->length; j++) {
+            src[j] = rand();
+        }
+        char expected[input->length * 3 + 1];
+        encode_input(input, src, -1, expected);
+
+        for (int level = -1; level <= max_level; level++) {
+            char dst[input->length * 3 + 1];
+            encode_input(input, src, level, dst);
+            if (strcmp(expected, dst) != 0) {
+                fprintf(stderr, "%s: %s encoder differs from legacy\n",
+                    input->name, level_names[level + 1]);
+                return EXIT_FAILURE;
+            }
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (long n = 0; n < iterations; n++) {
+                encode_input(input, src, level, dst);
+                /* keep the compiler from dropping the loop */
+                __asm__ __volatile__("" : : "r" (dst) : "memory");
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            printf("%-30s %10s %10.1f\n", input->name, level_names[level + 1],
+                get_elapsed_ns(&start, &end) / iterations);
+        }
+    }
+    return EXIT_SUCCESS;
+}
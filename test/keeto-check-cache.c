@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-check-cache.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <check.h>
+#include <confuse.h>
+
+#include "../src/keeto-config.h"
+#include "../src/keeto-error.h"
+#include "../src/keeto-cache.c"
+
+static struct keeto_cache_age_entry cache_age_lt[] = {
+    { 0, 0, KEETO_OK },
+    { 3600, 0, KEETO_OK },
+    { 0, 60, KEETO_OK },
+    { 50, 60, KEETO_OK },
+    { 70, 60, KEETO_NO_CACHE_ENTRY },
+    /* entries from the future are never used */
+    { -3600, 0, KEETO_NO_CACHE_ENTRY },
+    { -3600, 60, KEETO_NO_CACHE_ENTRY }
+};
+
+static struct keeto_cache_state_entry cache_state_lt[] = {
+    { 0, 0, 0, KEETO_CACHE_EXPIRED },
+    { 0, 60, 0, KEETO_CACHE_FRESH },
+    { 59, 60, 0, KEETO_CACHE_FRESH },
+    { 60, 60, 0, KEETO_CACHE_EXPIRED },
+    { 0, 60, 600, KEETO_CACHE_FRESH },
+    { 60, 60, 600, KEETO_CACHE_STALE },
+    { 599, 60, 600, KEETO_CACHE_STALE },
+    { 600, 60, 600, KEETO_CACHE_EXPIRED },
+    { 0, 0, 600, KEETO_CACHE_STALE },
+    { 599, 0, 600, KEETO_CACHE_STALE },
+    /* a stale ttl below the fresh ttl has no effect */
+    { 30, 60, 10, KEETO_CACHE_FRESH },
+    { 60, 60, 10, KEETO_CACHE_EXPIRED },
+    { -1, 60, 600, KEETO_CACHE_EXPIRED }
+};
+
+/* the entry starts with the header followed by the uid field "alice" */
+static struct keeto_cache_format_entry cache_format_lt[] = {
+    { 0, 0x00, KEETO_NO_CACHE_ENTRY },
+    { 3, 0x00, KEETO_NO_CACHE_ENTRY },
+    { 7, KEETO_CACHE_VERSION + 1, KEETO_NO_CACHE_ENTRY },
+    /* no uid */
+    { 16, 0x00, KEETO_NO_CACHE_ENTRY },
+    /* different uid */
+    { 17, 'b', KEETO_NO_CACHE_ENTRY },
+    /* unterminated uid */
+    { 22, 'x', KEETO_NO_CACHE_ENTRY }
+};
+
+static struct keeto_cache_mode_entry cache_mode_lt[] = {
+    { S_IRUSR | S_IWUSR, KEETO_OK },
+    { S_IRUSR, KEETO_OK },
+    { S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, KEETO_OK },
+    { S_IRUSR | S_IWUSR | S_IWGRP, KEETO_NO_CACHE_ENTRY },
+    { S_IRUSR | S_IWUSR | S_IWOTH, KEETO_NO_CACHE_ENTRY }
+};
+
+static void
+add_keystore_record_entry(struct keeto_keystore_records *keystore_records,
+    char *uid, char *ssh_key, char *command_option, char *expiry_time_option)
+{
+    struct keeto_keystore_record *keystore_record = new_keystore_record();
+    ck_assert(NULL != keystore_record);
+    keystore_record->uid = uid;
+    keystore_record->ssh_keytype = "ssh-rsa";
+    keystore_record->ssh_key = ssh_key;
+    keystore_record->ssh_key_fp_md5 = "md5";
+    keystore_record->ssh_key_fp_sha256 = "sha256";
+    keystore_record->command_option = command_option;
+    keystore_record->expiry_time_option = expiry_time_option;
+    SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+}
+
+static void
+check_field(char *exp_field, char *field)
+{
+    if (exp_field == NULL) {
+        ck_assert(NULL == field);
+    } else {
+        ck_assert(NULL != field);
+        ck_assert_str_eq(exp_field, field);
+    }
+}
+
+static void
+init_cache_info(struct keeto_info *info)
+{
+    memset(info, 0, sizeof *info);
+    char *config_file = CONFIGSDIR "/valid.conf";
+    info->cfg = parse_config(config_file);
+    ck_assert(NULL != info->cfg);
+    info->uid = "alice";
+}
+
+/* stores an entry for alice holding two keystore records */
+static void
+store_cache_entry(size_t *ret_length)
+{
+    struct keeto_info info;
+    init_cache_info(&info);
+    info.keystore_records = new_keystore_records();
+    ck_assert(NULL != info.keystore_records);
+    add_keystore_record_entry(info.keystore_records, "alice", "AAAA", NULL,
+        NULL);
+    add_keystore_record_entry(info.keystore_records, "bob", "BBBB",
+        "/bin/true", "21170226113844");
+
+    unlink(KEYSTORECACHE);
+    int rc = store_keystore_cache(KEYSTORECACHE, &info);
+    ck_assert_int_eq(KEETO_OK, rc);
+    if (ret_length != NULL) {
+        *ret_length = KEETO_CACHE_HEADER_SIZE + get_field_size(info.uid) +
+            get_field_size(cfg_getstr(info.cfg, "ldap_ssh_server_uid")) +
+            get_keystore_records_size(info.keystore_records);
+    }
+    free_keystore_records(info.keystore_records);
+    free_config(info.cfg);
+}
+
+static int
+load_cache_entry(time_t max_age, time_t *ret_age)
+{
+    struct keeto_info info;
+    init_cache_info(&info);
+    time_t age = -1;
+    int rc = load_keystore_cache(KEYSTORECACHE, &info, max_age, &age);
+    if (rc == KEETO_OK) {
+        ck_assert(NULL != info.keystore_records);
+        ck_assert(NULL != info.keystore_records_buffer);
+        ck_assert(age >= 0);
+    } else {
+        ck_assert(NULL == info.keystore_records);
+        ck_assert(NULL == info.keystore_records_buffer);
+    }
+    if (ret_age != NULL) {
+        *ret_age = age;
+    }
+    free_keystore_records(info.keystore_records);
+    free(info.keystore_records_buffer);
+    free_config(info.cfg);
+    return rc;
+}
+
+static void
+write_cache_bytes(off_t offset, const unsigned char *bytes, size_t length)
+{
+    int fd = open(KEYSTORECACHE, O_WRONLY);
+    ck_assert(-1 != fd);
+    ck_assert_int_eq(length, pwrite(fd, bytes, length, offset));
+    close(fd);
+}
+
+static void
+set_cache_created(time_t created)
+{
+    unsigned char bytes[2 * sizeof (uint32_t)];
+    put_uint32(bytes, (uint64_t) created >> 32);
+    put_uint32(bytes + sizeof (uint32_t), (uint64_t) created & 0xffffffff);
+    write_cache_bytes(2 * sizeof (uint32_t), bytes, sizeof bytes);
+}
+
+/*
+ * store_keystore_cache() / load_keystore_cache()
+ */
+START_TEST
+(t_store_load_keystore_cache)
+{
+    size_t exp_length = 0;
+    store_cache_entry(&exp_length);
+
+    /* the entry is only accessible by its owner */
+    struct stat stat_buffer;
+    ck_assert_int_eq(0, stat(KEYSTORECACHE, &stat_buffer));
+    ck_assert(S_ISREG(stat_buffer.st_mode));
+    ck_assert_int_eq(geteuid(), stat_buffer.st_uid);
+    ck_assert_int_eq(0, stat_buffer.st_mode & (S_IRWXG | S_IRWXO));
+    ck_assert_int_eq(exp_length, stat_buffer.st_size);
+
+    /* header */
+    unsigned char header[KEETO_CACHE_HEADER_SIZE];
+    int fd = open(KEYSTORECACHE, O_RDONLY);
+    ck_assert(-1 != fd);
+    ck_assert_int_eq(sizeof header, read(fd, header, sizeof header));
+    close(fd);
+    ck_assert(KEETO_CACHE_MAGIC == get_uint32(header));
+    ck_assert(KEETO_CACHE_VERSION == get_uint32(header + sizeof (uint32_t)));
+    uint64_t created = (uint64_t) get_uint32(header + 2 * sizeof (uint32_t))
+        << 32 | get_uint32(header + 3 * sizeof (uint32_t));
+    ck_assert((time_t) created <= time(NULL));
+    ck_assert((time_t) created > time(NULL) - 60);
+
+    /* records */
+    struct keeto_info info;
+    init_cache_info(&info);
+    time_t age = -1;
+    int rc = load_keystore_cache(KEYSTORECACHE, &info, 60, &age);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert(age >= 0 && age < 60);
+    struct keeto_keystore_record *record = SIMPLEQ_FIRST(info.keystore_records);
+    ck_assert(NULL != record);
+    check_field("alice", record->uid);
+    check_field("ssh-rsa", record->ssh_keytype);
+    check_field("AAAA", record->ssh_key);
+    check_field("md5", record->ssh_key_fp_md5);
+    check_field("sha256", record->ssh_key_fp_sha256);
+    check_field(NULL, record->command_option);
+    check_field(NULL, record->from_option);
+    check_field(NULL, record->expiry_time_option);
+    record = SIMPLEQ_NEXT(record, next);
+    ck_assert(NULL != record);
+    check_field("bob", record->uid);
+    check_field("BBBB", record->ssh_key);
+    check_field("/bin/true", record->command_option);
+    check_field("21170226113844", record->expiry_time_option);
+    ck_assert(NULL == SIMPLEQ_NEXT(record, next));
+    free_keystore_records(info.keystore_records);
+    free(info.keystore_records_buffer);
+    free_config(info.cfg);
+}
+END_TEST
+
+START_TEST
+(t_load_keystore_cache_not_found)
+{
+    unlink(KEYSTORECACHE);
+    int rc = load_cache_entry(0, NULL);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+}
+END_TEST
+
+START_TEST
+(t_load_keystore_cache_age)
+{
+    time_t age = cache_age_lt[_i].age;
+    time_t max_age = cache_age_lt[_i].max_age;
+    int exp_res = cache_age_lt[_i].exp_res;
+
+    store_cache_entry(NULL);
+    set_cache_created(time(NULL) - age);
+    time_t ret_age = -1;
+    int rc = load_cache_entry(max_age, &ret_age);
+    ck_assert_int_eq(exp_res, rc);
+    if (rc == KEETO_OK) {
+        /* allow for the clock ticking during the test */
+        ck_assert(ret_age >= age && ret_age <= age + 2);
+    }
+}
+END_TEST
+
+START_TEST
+(t_load_keystore_cache_format)
+{
+    size_t offset = cache_format_lt[_i].offset;
+    unsigned char value = cache_format_lt[_i].value;
+    int exp_res = cache_format_lt[_i].exp_res;
+
+    store_cache_entry(NULL);
+    write_cache_bytes(offset, &value, 1);
+    int rc = load_cache_entry(0, NULL);
+    ck_assert_int_eq(exp_res, rc);
+}
+END_TEST
+
+START_TEST
+(t_load_keystore_cache_size)
+{
+    size_t length = 0;
+    store_cache_entry(&length);
+    off_t sizes[] = {
+        0,
+        KEETO_CACHE_HEADER_SIZE - 1,
+        KEETO_CACHE_HEADER_SIZE,
+        length - 1,
+        /* trailing garbage */
+        length + 1,
+        KEETO_CACHE_MAX_SIZE + 1
+    };
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        store_cache_entry(NULL);
+        ck_assert_int_eq(0, truncate(KEYSTORECACHE, sizes[i]));
+        int rc = load_cache_entry(0, NULL);
+        ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    }
+}
+END_TEST
+
+START_TEST
+(t_load_keystore_cache_mode)
+{
+    mode_t mode = cache_mode_lt[_i].mode;
+    int exp_res = cache_mode_lt[_i].exp_res;
+
+    store_cache_entry(NULL);
+    ck_assert_int_eq(0, chmod(KEYSTORECACHE, mode));
+    int rc = load_cache_entry(0, NULL);
+    ck_assert_int_eq(exp_res, rc);
+}
+END_TEST
+
+START_TEST
+(t_load_keystore_cache_insecure)
+{
+    /* not a regular file */
+    unlink(KEYSTORECACHE);
+    ck_assert_int_eq(0, mkdir(KEYSTORECACHE, S_IRWXU));
+    int rc = load_cache_entry(0, NULL);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    ck_assert_int_eq(0, rmdir(KEYSTORECACHE));
+
+    /* owned by someone else. changing the owner requires root */
+    if (geteuid() != 0) {
+        return;
+    }
+    store_cache_entry(NULL);
+    ck_assert_int_eq(0, chown(KEYSTORECACHE, 65534, -1));
+    rc = load_cache_entry(0, NULL);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    unlink(KEYSTORECACHE);
+}
+END_TEST
+
+START_TEST
+(t_max_cache_size)
+{
+    /* every keystore that fits into a keetod response can be cached */
+    size_t max_entry_size = KEETO_CACHE_HEADER_SIZE +
+        2 * (KEETOD_MAX_REQUEST_SIZE - 1 + 2) + sizeof (uint32_t) +
+        (size_t) KEETO_KEYSTORE_MAX_RECORDS * KEETO_KEYSTORE_MAX_RECORD_SIZE;
+    ck_assert(max_entry_size <= KEETO_CACHE_MAX_SIZE);
+}
+END_TEST
+
+/*
+ * get_keystore_cache_state()
+ */
+START_TEST
+(t_get_keystore_cache_state)
+{
+    time_t age = cache_state_lt[_i].age;
+    time_t fresh_ttl = cache_state_lt[_i].fresh_ttl;
+    time_t stale_ttl = cache_state_lt[_i].stale_ttl;
+    int exp_state = cache_state_lt[_i].exp_state;
+
+    int state = get_keystore_cache_state(age, fresh_ttl, stale_ttl);
+    ck_assert_int_eq(exp_state, state);
+    /* entries that are not expired are never refused by their age */
+    if (state != KEETO_CACHE_EXPIRED) {
+        ck_assert(age < get_keystore_cache_max_age(fresh_ttl, stale_ttl));
+    }
+}
+END_TEST
+
+Suite *
+make_cache_suite(void)
+{
+    Suite *s = suite_create("cache");
+    TCase *tc_main = tcase_create("main");
+
+    /* add test cases to suite */
+    suite_add_tcase(s, tc_main);
+
+    /*
+     * main test cases
+     */
+
+    /* store_keystore_cache() / load_keystore_cache() */
+    tcase_add_test(tc_main, t_store_load_keystore_cache);
+    tcase_add_test(tc_main, t_load_keystore_cache_not_found);
+    int cache_age_lt_items = sizeof cache_age_lt / sizeof cache_age_lt[0];
+    tcase_add_loop_test(tc_main, t_load_keystore_cache_age, 0,
+        cache_age_lt_items);
+    int cache_format_lt_items = sizeof cache_format_lt /
+        sizeof cache_format_lt[0];
+    tcase_add_loop_test(tc_main, t_load_keystore_cache_format, 0,
+        cache_format_lt_items);
+    tcase_add_test(tc_main, t_load_keystore_cache_size);
+    int cache_mode_lt_items = sizeof cache_mode_lt / sizeof cache_mode_lt[0];
+    tcase_add_loop_test(tc_main, t_load_keystore_cache_mode, 0,
+        cache_mode_lt_items);
+    tcase_add_test(tc_main, t_load_keystore_cache_insecure);
+    tcase_add_test(tc_main, t_max_cache_size);
+
+    /* get_keystore_cache_state() */
+    int cache_state_lt_items = sizeof cache_state_lt /
+        sizeof cache_state_lt[0];
+    tcase_add_loop_test(tc_main, t_get_keystore_cache_state, 0,
+        cache_state_lt_items);
+
+    return s;
+}
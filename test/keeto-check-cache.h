@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_CHECK_CACHE_H
+#define KEETO_CHECK_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <check.h>
+
+/* creation time of the entry is set to now - age */
+struct keeto_cache_age_entry {
+    time_t age;
+    time_t max_age;
+    int exp_res;
+};
+
+struct keeto_cache_state_entry {
+    time_t age;
+    time_t fresh_ttl;
+    time_t stale_ttl;
+    int exp_state;
+};
+
+/* byte at offset of a stored entry is replaced by value */
+struct keeto_cache_format_entry {
+    size_t offset;
+    unsigned char value;
+    int exp_res;
+};
+
+struct keeto_cache_mode_entry {
+    mode_t mode;
+    int exp_res;
+};
+
+Suite *make_cache_suite(void);
+
+#endif /* KEETO_CHECK_CACHE_H */
@@ -19,6 +19,9 @@
 
 #include "keeto-check-config.h"
 
+#include <string.h>
+#include <unistd.h>
+
 #include <check.h>
 #include <confuse.h>
 
@@ -32,11 +35,37 @@ static char *config_neg_lt[] = {
     CONFIGSDIR "/ldap_bind_dn_neg.conf",
     CONFIGSDIR "/ldap_timeout_neg.conf",
     CONFIGSDIR "/ldap_strict_neg.conf",
+    CONFIGSDIR "/ldap_hedge_delay_neg.conf",
+    CONFIGSDIR "/ldap_health_file_neg.conf",
+    CONFIGSDIR "/ldap_breaker_file_neg.conf",
+    CONFIGSDIR "/ldap_breaker_threshold_neg.conf",
+    CONFIGSDIR "/ldap_breaker_interval_neg.conf",
     CONFIGSDIR "/ldap_ssh_server_search_base_neg.conf",
     CONFIGSDIR "/ldap_ssh_server_search_scope_neg.conf",
+    CONFIGSDIR "/ldap_key_provider_reverse_lookup_neg.conf",
+    CONFIGSDIR "/ldap_key_provider_search_base_neg.conf",
+    CONFIGSDIR "/ldap_key_provider_search_scope_neg.conf",
+    CONFIGSDIR "/ldap_target_keystore_reverse_lookup_neg.conf",
+    CONFIGSDIR "/ldap_target_keystore_search_base_neg.conf",
+    CONFIGSDIR "/ldap_target_keystore_search_scope_neg.conf",
+    CONFIGSDIR "/ssh_keystore_db_neg.conf",
+    CONFIGSDIR "/ssh_keystore_expiry_time_neg.conf",
+    CONFIGSDIR "/ssh_keystore_max_lifetime_neg.conf",
+    CONFIGSDIR "/ssh_keystore_cache_fresh_ttl_neg.conf",
+    CONFIGSDIR "/ssh_keystore_cache_stale_ttl_neg.conf",
     CONFIGSDIR "/cert_store_dir_neg.conf",
     CONFIGSDIR "/check_crl_neg.conf",
-    CONFIGSDIR "/uid_regex_neg.conf"
+    CONFIGSDIR "/cert_store_snapshot_neg.conf",
+    CONFIGSDIR "/crl_index_neg.conf",
+    CONFIGSDIR "/cert_validation_cache_file_neg.conf",
+    CONFIGSDIR "/cert_validation_cache_max_age_neg.conf",
+    CONFIGSDIR "/cert_validation_threads_neg.conf",
+    CONFIGSDIR "/cert_issuer_check_neg.conf",
+    CONFIGSDIR "/ssh_key_cache_file_neg.conf",
+    CONFIGSDIR "/uid_regex_neg.conf",
+    CONFIGSDIR "/keetod_socket_neg.conf",
+    CONFIGSDIR "/keetod_timeout_neg.conf",
+    CONFIGSDIR "/keetod_workers_neg.conf"
 };
 
 /*
@@ -75,6 +104,50 @@ START_TEST
 }
 END_TEST
 
+/*
+ * parse_config_with_snapshot()
+ */
+START_TEST
+(t_parse_config_with_snapshot)
+{
+    char *config_file = CONFIGSDIR "/valid.conf";
+    unlink(CONFIGSNAPSHOT);
+    cfg_t *exp_cfg = parse_config(config_file);
+    if (exp_cfg == NULL) {
+        ck_abort_msg("failed to parse config (%s)", config_file);
+    }
+
+    /* the first run writes the snapshot, the second one loads it */
+    for (int i = 0; i < 2; i++) {
+        cfg_t *cfg = parse_config_with_snapshot(config_file,
+            CONFIGSNAPSHOT);
+        ck_assert(cfg != NULL);
+        ck_assert_int_eq(0, access(CONFIGSNAPSHOT, R_OK));
+        for (int j = 0; exp_cfg->opts[j].name != NULL; j++) {
+            char *name = (char *) exp_cfg->opts[j].name;
+            if (exp_cfg->opts[j].type == CFGT_INT) {
+                ck_assert_int_eq(cfg_getint(exp_cfg, name),
+                    cfg_getint(cfg, name));
+            } else {
+                ck_assert_str_eq(cfg_getstr(exp_cfg, name),
+                    cfg_getstr(cfg, name));
+            }
+        }
+        free_config(cfg);
+    }
+    free_config(exp_cfg);
+}
+END_TEST
+
+START_TEST
+(t_parse_config_with_snapshot_neg)
+{
+    char *config_file = config_neg_lt[_i];
+    cfg_t *cfg = parse_config_with_snapshot(config_file, CONFIGSNAPSHOT);
+    ck_assert(cfg == NULL);
+}
+END_TEST
+
 Suite *
 make_config_suite(void)
 {
@@ -94,6 +167,11 @@ make_config_suite(void)
     int config_neg_lt_items = sizeof config_neg_lt / sizeof config_neg_lt[0];
     tcase_add_loop_test(tc_main, t_parse_config_neg, 0, config_neg_lt_items);
 
+    /* parse_config_with_snapshot() */
+    tcase_add_test(tc_main, t_parse_config_with_snapshot);
+    tcase_add_loop_test(tc_main, t_parse_config_with_snapshot_neg, 0,
+        config_neg_lt_items);
+
     return s;
 }
 
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-check-ipc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <check.h>
+
+#include "../src/keeto-error.h"
+#include "../src/keeto-ipc.c"
+
+/*
+ * payloads of responses start with the result, the ldap online flag
+ * and the number of keystore records.
+ */
+static struct keeto_receive_frame_entry receive_frame_lt[] = {
+    /* requests */
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 4, "foo", 4,
+        KEETO_OK },
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 0, "", 0,
+        KEETO_IPC_ERR },
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION,
+        KEETOD_MAX_REQUEST_SIZE, NULL, KEETOD_MAX_REQUEST_SIZE, KEETO_OK },
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION,
+        KEETOD_MAX_REQUEST_SIZE + 1, NULL, KEETOD_MAX_REQUEST_SIZE + 1,
+        KEETO_IPC_ERR },
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 8, "foo", 4,
+        KEETO_IPC_ERR },
+    { false, KEETOD_HEADER_SIZE - 1, KEETOD_PROTOCOL_VERSION, 4, "foo", 0,
+        KEETO_IPC_ERR },
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION + 1, 4, "foo", 4,
+        KEETO_IPC_ERR },
+    { false, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 4, "fo\0o", 4,
+        KEETO_IPC_ERR },
+    /* responses */
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 12,
+        "\0\0\0\0\0\0\0\1\0\0\0\0", 12, KEETO_OK },
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 0, "", 0,
+        KEETO_IPC_ERR },
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION,
+        KEETOD_MAX_MESSAGE_SIZE + 1, "", 0, KEETO_IPC_ERR },
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 12,
+        "\0\0\0\0\0\0\0\1", 8, KEETO_IPC_ERR },
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 8,
+        "\0\0\0\0\0\0\0\1", 8, KEETO_IPC_ERR },
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 13,
+        "\0\0\0\0\0\0\0\1\0\0\0\0\0", 13, KEETO_IPC_ERR },
+    /* record count exceeds the records sent */
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 15,
+        "\0\0\0\0\0\0\0\1\0\0\0\1\1a\0", 15, KEETO_IPC_ERR },
+    /* record without ssh key */
+    { true, KEETOD_HEADER_SIZE, KEETOD_PROTOCOL_VERSION, 24,
+        "\0\0\0\0\0\0\0\1\0\0\0\1\1a\0\1b\0\0\0\0\0\0\0\0", 24,
+        KEETO_IPC_ERR }
+};
+
+static void
+create_socket_pair(int *ret_sender, int *ret_receiver)
+{
+    int fds[2];
+    int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    ck_assert_int_eq(0, rc);
+    *ret_sender = fds[0];
+    *ret_receiver = fds[1];
+}
+
+static void
+add_keystore_record_entry(struct keeto_keystore_records *keystore_records,
+    char *uid, char *ssh_key, char *command_option, char *expiry_time_option)
+{
+    struct keeto_keystore_record *keystore_record = new_keystore_record();
+    ck_assert(NULL != keystore_record);
+    keystore_record->uid = uid;
+    keystore_record->ssh_keytype = "ssh-rsa";
+    keystore_record->ssh_key = ssh_key;
+    keystore_record->ssh_key_fp_md5 = "md5";
+    keystore_record->ssh_key_fp_sha256 = "sha256";
+    keystore_record->command_option = command_option;
+    keystore_record->expiry_time_option = expiry_time_option;
+    SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+}
+
+static void
+check_field(char *exp_field, char *field)
+{
+    if (exp_field == NULL) {
+        ck_assert(NULL == field);
+    } else {
+        ck_assert(NULL != field);
+        ck_assert_str_eq(exp_field, field);
+    }
+}
+
+/*
+ * send_keetod_request() / receive_keetod_request()
+ */
+START_TEST
+(t_keetod_request)
+{
+    int sender = -1;
+    int receiver = -1;
+    create_socket_pair(&sender, &receiver);
+
+    int rc = send_keetod_request(sender, "keeto");
+    ck_assert_int_eq(KEETO_OK, rc);
+    char *uid = NULL;
+    rc = receive_keetod_request(receiver, &uid);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq("keeto", uid);
+    free(uid);
+
+    /* a uid that does not fit into a request is not sent at all */
+    char long_uid[KEETOD_MAX_REQUEST_SIZE + 1];
+    memset(long_uid, 'a', sizeof long_uid - 1);
+    long_uid[sizeof long_uid - 1] = '\0';
+    rc = send_keetod_request(sender, long_uid);
+    ck_assert_int_eq(KEETO_IPC_ERR, rc);
+    close(sender);
+    uid = NULL;
+    rc = receive_keetod_request(receiver, &uid);
+    ck_assert_int_eq(KEETO_IPC_ERR, rc);
+    ck_assert(NULL == uid);
+    close(receiver);
+}
+END_TEST
+
+/*
+ * send_keetod_response() / receive_keetod_response()
+ */
+START_TEST
+(t_keetod_response)
+{
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    ck_assert(NULL != keystore_records);
+    add_keystore_record_entry(keystore_records, "alice", "AAAA", NULL, NULL);
+    add_keystore_record_entry(keystore_records, "bob", "BBBB", "/bin/true",
+        "21170226113844");
+
+    int sender = -1;
+    int receiver = -1;
+    create_socket_pair(&sender, &receiver);
+    int rc = send_keetod_response(sender, KEETO_NO_ACCESS_PROFILE_FOR_UID, 1,
+        keystore_records);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    struct keeto_info info;
+    memset(&info, 0, sizeof info);
+    int result = KEETO_OK;
+    rc = receive_keetod_response(receiver, &info, &result);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(KEETO_NO_ACCESS_PROFILE_FOR_UID, result);
+    ck_assert_int_eq(1, info.ldap_online);
+    ck_assert(NULL != info.keystore_records);
+
+    struct keeto_keystore_record *exp_record =
+        SIMPLEQ_FIRST(keystore_records);
+    struct keeto_keystore_record *record = NULL;
+    SIMPLEQ_FOREACH(record, info.keystore_records, next) {
+        ck_assert(NULL != exp_record);
+        check_field(exp_record->uid, record->uid);
+        check_field(exp_record->ssh_keytype, record->ssh_keytype);
+        check_field(exp_record->ssh_key, record->ssh_key);
+        check_field(exp_record->ssh_key_fp_md5, record->ssh_key_fp_md5);
+        check_field(exp_record->ssh_key_fp_sha256, record->ssh_key_fp_sha256);
+        check_field(exp_record->command_option, record->command_option);
+        check_field(exp_record->from_option, record->from_option);
+        check_field(exp_record->expiry_time_option,
+            record->expiry_time_option);
+        exp_record = SIMPLEQ_NEXT(exp_record, next);
+    }
+    ck_assert(NULL == exp_record);
+
+    free_keystore_records(info.keystore_records);
+    free(info.keystore_records_buffer);
+    free_keystore_records(keystore_records);
+    close(sender);
+    close(receiver);
+}
+END_TEST
+
+START_TEST
+(t_keetod_response_empty)
+{
+    int sender = -1;
+    int receiver = -1;
+    create_socket_pair(&sender, &receiver);
+    int rc = send_keetod_response(sender, KEETO_OK, 0, NULL);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    struct keeto_info info;
+    memset(&info, 0, sizeof info);
+    int result = KEETO_UNKNOWN_ERR;
+    rc = receive_keetod_response(receiver, &info, &result);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(KEETO_OK, result);
+    ck_assert_int_eq(0, info.ldap_online);
+    ck_assert(NULL == info.keystore_records);
+    free(info.keystore_records_buffer);
+    close(sender);
+    close(receiver);
+}
+END_TEST
+
+/*
+ * receive_message()
+ */
+START_TEST
+(t_receive_frame)
+{
+    bool response = receive_frame_lt[_i].response;
+    size_t header_size = receive_frame_lt[_i].header_size;
+    uint32_t version = receive_frame_lt[_i].version;
+    uint32_t length = receive_frame_lt[_i].length;
+    char *payload = receive_frame_lt[_i].payload;
+    size_t payload_size = receive_frame_lt[_i].payload_size;
+    int exp_res = receive_frame_lt[_i].exp_res;
+
+    unsigned char *frame = malloc(KEETOD_HEADER_SIZE + payload_size);
+    ck_assert(NULL != frame);
+    put_uint32(frame, version);
+    put_uint32(frame + sizeof (uint32_t), length);
+    if (payload != NULL) {
+        memcpy(frame + header_size, payload, payload_size);
+    } else {
+        /* a uid of payload_size bytes */
+        memset(frame + header_size, 'a', payload_size - 1);
+        frame[header_size + payload_size - 1] = '\0';
+    }
+
+    int sender = -1;
+    int receiver = -1;
+    create_socket_pair(&sender, &receiver);
+    int rc = write_all(sender, frame, header_size + payload_size);
+    ck_assert_int_eq(KEETO_OK, rc);
+    close(sender);
+
+    if (response) {
+        struct keeto_info info;
+        memset(&info, 0, sizeof info);
+        int result = KEETO_UNKNOWN_ERR;
+        rc = receive_keetod_response(receiver, &info, &result);
+        ck_assert_int_eq(exp_res, rc);
+        if (rc == KEETO_OK) {
+            free_keystore_records(info.keystore_records);
+            free(info.keystore_records_buffer);
+        } else {
+            ck_assert(NULL == info.keystore_records);
+            ck_assert(NULL == info.keystore_records_buffer);
+        }
+    } else {
+        char *uid = NULL;
+        rc = receive_keetod_request(receiver, &uid);
+        ck_assert_int_eq(exp_res, rc);
+        if (rc == KEETO_OK) {
+            ck_assert_int_eq(payload_size - 1, strlen(uid));
+        } else {
+            ck_assert(NULL == uid);
+        }
+        free(uid);
+    }
+    free(frame);
+    close(receiver);
+}
+END_TEST
+
+/*
+ * send_message()
+ */
+START_TEST
+(t_send_message_oversized)
+{
+    int sender = -1;
+    int receiver = -1;
+    create_socket_pair(&sender, &receiver);
+
+    /* the payload is rejected before anything is sent */
+    unsigned char payload[1] = { 0 };
+    int rc = send_message(sender, payload, KEETOD_MAX_MESSAGE_SIZE + 1);
+    ck_assert_int_eq(KEETO_IPC_ERR, rc);
+    close(sender);
+    unsigned char buffer[1];
+    ck_assert_int_eq(0, read(receiver, buffer, sizeof buffer));
+    close(receiver);
+}
+END_TEST
+
+START_TEST
+(t_max_message_size)
+{
+    /* the largest possible keystore of a uid fits into a response */
+    size_t max_response_size = 2 * sizeof (uint32_t) + sizeof (uint32_t) +
+        (size_t) KEETO_KEYSTORE_MAX_RECORDS * KEETO_KEYSTORE_MAX_RECORD_SIZE;
+    ck_assert(max_response_size <= KEETOD_MAX_MESSAGE_SIZE);
+    ck_assert(KEETOD_MAX_MESSAGE_SIZE <= UINT32_MAX);
+}
+END_TEST
+
+Suite *
+make_ipc_suite(void)
+{
+    Suite *s = suite_create("ipc");
+    TCase *tc_main = tcase_create("main");
+
+    /* add test cases to suite */
+    suite_add_tcase(s, tc_main);
+
+    /*
+     * main test cases
+     */
+
+    /* send_keetod_request() / receive_keetod_request() */
+    tcase_add_test(tc_main, t_keetod_request);
+
+    /* send_keetod_response() / receive_keetod_response() */
+    tcase_add_test(tc_main, t_keetod_response);
+    tcase_add_test(tc_main, t_keetod_response_empty);
+
+    /* receive_message() */
+    int receive_frame_lt_items = sizeof receive_frame_lt /
+        sizeof receive_frame_lt[0];
+    tcase_add_loop_test(tc_main, t_receive_frame, 0, receive_frame_lt_items);
+
+    /* send_message() */
+    tcase_add_test(tc_main, t_send_message_oversized);
+    tcase_add_test(tc_main, t_max_message_size);
+
+    return s;
+}
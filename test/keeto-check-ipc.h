@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_CHECK_IPC_H
+#define KEETO_CHECK_IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <check.h>
+
+/*
+ * a frame as sent by a peer. only header_size bytes of the header and
+ * payload_size bytes of the payload are sent before the connection is
+ * closed. a NULL payload is sent as uid of payload_size bytes.
+ */
+struct keeto_receive_frame_entry {
+    bool response;
+    size_t header_size;
+    uint32_t version;
+    uint32_t length;
+    char *payload;
+    size_t payload_size;
+    int exp_res;
+};
+
+Suite *make_ipc_suite(void);
+
+#endif /* KEETO_CHECK_IPC_H */
@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-check-keystore.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <check.h>
+#include <openssl/crypto.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "../src/keeto-openssl.h"
+#include "../src/keeto-keystore.c"
+
+#define BUFFER_SIZE 4096
+#define POST_PROCESS_RUNS 4
+
+/*
+ * keys in the order they are visited. a new access profile or key provider
+ * starts whenever the name changes.
+ */
+static struct keeto_post_process_key_entry post_process_key_lt[] = {
+    { "profile1", "provider1", "valid1.pem", false },
+    { "profile1", "provider1", "valid2.pem", true },
+    { "profile1", "provider1", "untrusted-ca.pem", false },
+    { "profile1", "provider2", "not-yet-valid.pem", false },
+    { "profile1", "provider2", "valid2.pem", false },
+    { "profile2", "provider3", "valid3.pem", false },
+    { "profile2", "provider3", "unknown-issuer.pem", false },
+    { "profile2", "provider4", "trusted-ca-expired.pem", false },
+    { "profile2", "provider4", "valid4.pem", false },
+    { "profile2", "provider4", "valid1.pem", true }
+};
+
+static long post_process_threads_lt[] = { 2, 3, 4, 8 };
+
+static struct keeto_write_keystore_entry write_keystore_lt[] = {
+    { KEYSTORE_CHANGE_NONE, false },
+    { KEYSTORE_CHANGE_RECORDS, true },
+    { KEYSTORE_CHANGE_DATA, true },
+    { KEYSTORE_CHANGE_MODE, true },
+    { KEYSTORE_CHANGE_OWNER, true }
+};
+
+static struct keeto_add_expiry_time_entry add_expiry_time_lt[] = {
+    { "valid1.pem", 0, 4643782724 },
+    /* issued years ago but still valid */
+    { "valid1.pem", 3600, 4643782724 },
+    { "valid1.pem", 4000000000, 4643782724 },
+    { "trusted-ca-expired.pem", 3600, 1490122390 },
+    { "not-yet-valid.pem", 86400, 7258118400 }
+};
+
+static unsigned char *post_process_der[sizeof post_process_key_lt /
+    sizeof post_process_key_lt[0]];
+static size_t post_process_der_length[sizeof post_process_key_lt /
+    sizeof post_process_key_lt[0]];
+
+void
+setup_post_process_keys()
+{
+    init_openssl();
+    int rc = init_cert_store(CERTSTOREDIR, false, false, NULL);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize cert store (%s)",
+            keeto_strerror(rc));
+    }
+    for (size_t i = 0; i < sizeof post_process_key_lt /
+        sizeof post_process_key_lt[0]; i++) {
+
+        char x509_path[BUFFER_SIZE];
+        snprintf(x509_path, sizeof x509_path, "%s/%s", X509CERTSDIR,
+            post_process_key_lt[i].file);
+        FILE *x509_file = fopen(x509_path, "r");
+        if (x509_file == NULL) {
+            ck_abort_msg("failed to open '%s' (%s)", x509_path,
+                strerror(errno));
+        }
+        X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+        fclose(x509_file);
+        if (x509 == NULL) {
+            ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+        }
+        unsigned char *der = NULL;
+        int length = i2d_X509(x509, &der);
+        X509_free(x509);
+        if (length <= 0) {
+            ck_abort_msg("failed to encode x509 from pem file '%s'",
+                x509_path);
+        }
+        post_process_der[i] = der;
+        /* a truncated certificate fails to decode in its worker */
+        post_process_der_length[i] = post_process_key_lt[i].broken ?
+            (size_t) length / 2 : (size_t) length;
+    }
+}
+
+void
+teardown_post_process_keys()
+{
+    for (size_t i = 0; i < sizeof post_process_der /
+        sizeof post_process_der[0]; i++) {
+
+        OPENSSL_free(post_process_der[i]);
+        post_process_der[i] = NULL;
+    }
+    free_cert_store();
+    cleanup_openssl();
+}
+
+static struct keeto_access_profiles *
+get_post_process_access_profiles()
+{
+    struct keeto_access_profiles *access_profiles = new_access_profiles();
+    if (access_profiles == NULL) {
+        ck_abort_msg("failed to allocate memory for access profiles buffer");
+    }
+    struct keeto_access_profile *access_profile = NULL;
+    struct keeto_key_provider *key_provider = NULL;
+    for (size_t i = 0; i < sizeof post_process_key_lt /
+        sizeof post_process_key_lt[0]; i++) {
+
+        struct keeto_post_process_key_entry *entry = &post_process_key_lt[i];
+        if (access_profile == NULL ||
+            strcmp(access_profile->uid, entry->access_profile) != 0) {
+
+            access_profile = new_access_profile();
+            if (access_profile == NULL) {
+                ck_abort_msg("failed to allocate memory for access profile "
+                    "buffer");
+            }
+            TAILQ_INSERT_TAIL(access_profiles, access_profile, next);
+            access_profile->uid = strdup(entry->access_profile);
+            access_profile->key_providers = new_key_providers();
+            if (access_profile->uid == NULL ||
+                access_profile->key_providers == NULL) {
+
+                ck_abort_msg("failed to allocate memory for access profile");
+            }
+            key_provider = NULL;
+        }
+        if (key_provider == NULL ||
+            strcmp(key_provider->uid, entry->key_provider) != 0) {
+
+            key_provider = new_key_provider();
+            if (key_provider == NULL) {
+                ck_abort_msg("failed to allocate memory for key provider "
+                    "buffer");
+            }
+            TAILQ_INSERT_TAIL(access_profile->key_providers, key_provider,
+                next);
+            key_provider->uid = strdup(entry->key_provider);
+            key_provider->keys = new_keys();
+            if (key_provider->uid == NULL || key_provider->keys == NULL) {
+                ck_abort_msg("failed to allocate memory for key provider");
+            }
+        }
+        struct keeto_key *key = new_key();
+        if (key == NULL) {
+            ck_abort_msg("failed to allocate memory for key buffer");
+        }
+        key->der = post_process_der[i];
+        key->der_length = post_process_der_length[i];
+        TAILQ_INSERT_TAIL(key_provider->keys, key, next);
+    }
+    return access_profiles;
+}
+
+static struct keeto_keystore_records *
+get_post_process_keystore_records(
+    struct keeto_access_profiles *access_profiles,
+    struct keeto_post_process_results *results)
+{
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    if (keystore_records == NULL) {
+        ck_abort_msg("failed to allocate memory for keystore records buffer");
+    }
+    struct keeto_access_profile *access_profile = NULL;
+    TAILQ_FOREACH(access_profile, access_profiles, next) {
+        int rc = post_process_access_profile(access_profile, results,
+            keystore_records);
+        ck_assert(rc == KEETO_OK || rc == KEETO_NO_KEY_PROVIDER);
+    }
+    return keystore_records;
+}
+
+/*
+ * post_process_keys()
+ */
+START_TEST
+(t_post_process_keys)
+{
+    long threads = post_process_threads_lt[_i];
+    size_t count = sizeof post_process_key_lt / sizeof post_process_key_lt[0];
+    struct keeto_prevalidation prevalidation;
+    memset(&prevalidation, 0, sizeof prevalidation);
+    struct keeto_expiry expiry = { true, 0 };
+
+    /* single-threaded path: keys are post processed when visited */
+    struct keeto_access_profiles *exp_access_profiles =
+        get_post_process_access_profiles();
+    int *exp_results = NULL;
+    int rc = post_process_keys(exp_access_profiles, 1, &prevalidation,
+        &expiry, NULL, &exp_results);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert(exp_results == NULL);
+    struct keeto_post_process_results results = { NULL, 0, &prevalidation,
+        &expiry, NULL };
+    struct keeto_keystore_records *exp_keystore_records =
+        get_post_process_keystore_records(exp_access_profiles, &results);
+    ck_assert(!SIMPLEQ_EMPTY(exp_keystore_records));
+
+    /* result of each key in visiting order */
+    struct keeto_access_profiles *ref_access_profiles =
+        get_post_process_access_profiles();
+    int ref_results[sizeof post_process_key_lt /
+        sizeof post_process_key_lt[0]];
+    size_t i = 0;
+    struct keeto_access_profile *access_profile = NULL;
+    struct keeto_key_provider *key_provider = NULL;
+    struct keeto_key *key = NULL;
+    TAILQ_FOREACH(access_profile, ref_access_profiles, next) {
+        TAILQ_FOREACH(key_provider, access_profile->key_providers, next) {
+            TAILQ_FOREACH(key, key_provider->keys, next) {
+                ref_results[i++] = post_process_key(key, &prevalidation,
+                    &expiry, NULL);
+            }
+        }
+    }
+    ck_assert_int_eq(count, i);
+
+    /* worker scheduling must neither change results nor their order */
+    for (int run = 0; run < POST_PROCESS_RUNS; run++) {
+        struct keeto_access_profiles *access_profiles =
+            get_post_process_access_profiles();
+        /* certificates shared by the threads through the memo */
+        struct keeto_x509_memo *x509_memo = new_x509_memo();
+        ck_assert(x509_memo != NULL);
+        int *thread_results = NULL;
+        rc = post_process_keys(access_profiles, threads, &prevalidation,
+            &expiry, x509_memo, &thread_results);
+        ck_assert_int_eq(KEETO_OK, rc);
+        ck_assert(thread_results != NULL);
+        for (i = 0; i < count; i++) {
+            ck_assert_int_eq(ref_results[i], thread_results[i]);
+            if (post_process_key_lt[i].broken) {
+                ck_assert_int_eq(KEETO_X509_ERR, thread_results[i]);
+            }
+        }
+
+        results.results = thread_results;
+        results.next = 0;
+        struct keeto_keystore_records *keystore_records =
+            get_post_process_keystore_records(access_profiles, &results);
+        ck_assert_int_eq(count, results.next);
+        struct keeto_keystore_record *exp_keystore_record =
+            SIMPLEQ_FIRST(exp_keystore_records);
+        struct keeto_keystore_record *keystore_record = NULL;
+        SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+            ck_assert(exp_keystore_record != NULL);
+            ck_assert_str_eq(exp_keystore_record->uid, keystore_record->uid);
+            ck_assert_str_eq(exp_keystore_record->ssh_keytype,
+                keystore_record->ssh_keytype);
+            ck_assert_str_eq(exp_keystore_record->ssh_key,
+                keystore_record->ssh_key);
+            ck_assert_str_eq(exp_keystore_record->ssh_key_fp_sha256,
+                keystore_record->ssh_key_fp_sha256);
+            ck_assert_str_eq(exp_keystore_record->expiry_time_option,
+                keystore_record->expiry_time_option);
+            exp_keystore_record = SIMPLEQ_NEXT(exp_keystore_record, next);
+        }
+        ck_assert(exp_keystore_record == NULL);
+
+        free_keystore_records(keystore_records);
+        free(thread_results);
+        free_access_profiles(access_profiles);
+        free_x509_memo(x509_memo);
+    }
+    free_access_profiles(ref_access_profiles);
+    free_keystore_records(exp_keystore_records);
+    free_access_profiles(exp_access_profiles);
+}
+END_TEST
+
+/*
+ * write_keystore()
+ */
+static void
+add_check_keystore_record(struct keeto_keystore_records *keystore_records,
+    char *uid, char *ssh_key)
+{
+    struct keeto_keystore_record *keystore_record = new_keystore_record();
+    if (keystore_record == NULL) {
+        ck_abort_msg("failed to allocate memory for keystore record buffer");
+    }
+    keystore_record->uid = uid;
+    keystore_record->ssh_keytype = "ssh-rsa";
+    keystore_record->ssh_key = ssh_key;
+    keystore_record->ssh_key_fp_md5 = "md5";
+    keystore_record->ssh_key_fp_sha256 = "sha256";
+    SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+}
+
+START_TEST
+(t_write_keystore)
+{
+    enum keeto_keystore_change change = write_keystore_lt[_i].change;
+    bool exp_rewrite = write_keystore_lt[_i].exp_rewrite;
+
+    if (change == KEYSTORE_CHANGE_OWNER && geteuid() != 0) {
+        /* changing the owner requires root */
+        return;
+    }
+    unlink(KEYSTORE);
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    if (keystore_records == NULL) {
+        ck_abort_msg("failed to allocate memory for keystore records buffer");
+    }
+    add_check_keystore_record(keystore_records, "foo", "AAAAB3NzaC1yc2EA");
+    add_check_keystore_record(keystore_records, "bar", "AAAAB3NzaC1yc2EB");
+    int rc = write_keystore(KEYSTORE, keystore_records);
+    ck_assert_int_eq(KEETO_OK, rc);
+    struct stat exp_stat;
+    rc = stat(KEYSTORE, &exp_stat);
+    ck_assert_int_eq(0, rc);
+    ck_assert_int_eq(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH,
+        exp_stat.st_mode & 07777);
+
+    FILE *keystore_file = NULL;
+    switch (change) {
+    case KEYSTORE_CHANGE_NONE:
+        break;
+    case KEYSTORE_CHANGE_RECORDS:
+        add_check_keystore_record(keystore_records, "baz", "AAAAB3NzaC1yc2EC");
+        break;
+    case KEYSTORE_CHANGE_DATA:
+        /* same size, different content */
+        keystore_file = fopen(KEYSTORE, "r+");
+        if (keystore_file == NULL) {
+            ck_abort_msg("failed to open '%s' (%s)", KEYSTORE,
+                strerror(errno));
+        }
+        fputc('#', keystore_file);
+        fclose(keystore_file);
+        break;
+    case KEYSTORE_CHANGE_MODE:
+        rc = chmod(KEYSTORE, S_IRUSR | S_IWUSR);
+        ck_assert_int_eq(0, rc);
+        break;
+    case KEYSTORE_CHANGE_OWNER:
+        rc = chown(KEYSTORE, 1, -1);
+        ck_assert_int_eq(0, rc);
+        break;
+    }
+    struct stat changed_stat;
+    rc = stat(KEYSTORE, &changed_stat);
+    ck_assert_int_eq(0, rc);
+
+    rc = write_keystore(KEYSTORE, keystore_records);
+    ck_assert_int_eq(KEETO_OK, rc);
+    struct stat stat_buffer;
+    rc = stat(KEYSTORE, &stat_buffer);
+    ck_assert_int_eq(0, rc);
+    /* a rewrite replaces the file */
+    if (exp_rewrite) {
+        ck_assert(stat_buffer.st_ino != changed_stat.st_ino);
+    } else {
+        ck_assert(stat_buffer.st_ino == exp_stat.st_ino);
+        ck_assert(stat_buffer.st_mtim.tv_sec == exp_stat.st_mtim.tv_sec);
+        ck_assert(stat_buffer.st_mtim.tv_nsec == exp_stat.st_mtim.tv_nsec);
+    }
+    ck_assert(stat_buffer.st_uid == geteuid());
+    ck_assert_int_eq(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH,
+        stat_buffer.st_mode & 07777);
+
+    /* the rewritten file is left alone by the next write */
+    rc = write_keystore(KEYSTORE, keystore_records);
+    ck_assert_int_eq(KEETO_OK, rc);
+    struct stat next_stat;
+    rc = stat(KEYSTORE, &next_stat);
+    ck_assert_int_eq(0, rc);
+    ck_assert(next_stat.st_ino == stat_buffer.st_ino);
+    free_keystore_records(keystore_records);
+}
+END_TEST
+
+/*
+ * add_expiry_time_from_x509()
+ */
+START_TEST
+(t_add_expiry_time_from_x509)
+{
+    char *file = add_expiry_time_lt[_i].file;
+    time_t max_lifetime = add_expiry_time_lt[_i].max_lifetime;
+    time_t not_after = add_expiry_time_lt[_i].not_after;
+
+    char x509_path[BUFFER_SIZE];
+    snprintf(x509_path, sizeof x509_path, "%s/%s", X509CERTSDIR, file);
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    fclose(x509_file);
+    if (x509 == NULL) {
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+
+    struct keeto_expiry expiry = { true, max_lifetime };
+    struct keeto_key key;
+    memset(&key, 0, sizeof key);
+    time_t before = time(NULL);
+    int rc = add_expiry_time_from_x509(x509, &expiry, &key);
+    time_t after = time(NULL);
+    X509_free(x509);
+    ck_assert_int_eq(KEETO_OK, rc);
+    time_t expiry_time = 0;
+    ck_assert(parse_expiry_time(key.expiry_time_option, &expiry_time));
+    /* now is taken between before and after */
+    time_t exp_min = not_after;
+    time_t exp_max = not_after;
+    if (max_lifetime > 0 && before + max_lifetime < not_after) {
+        exp_min = before + max_lifetime;
+    }
+    if (max_lifetime > 0 && after + max_lifetime < not_after) {
+        exp_max = after + max_lifetime;
+    }
+    ck_assert(expiry_time >= exp_min && expiry_time <= exp_max);
+    free(key.expiry_time_option);
+}
+END_TEST
+
+Suite *
+make_keystore_suite(void)
+{
+    Suite *s = suite_create("keystore");
+    TCase *tc_post_process_keys = tcase_create("post_process_keys");
+    TCase *tc_write_keystore = tcase_create("write_keystore");
+    TCase *tc_add_expiry_time = tcase_create("add_expiry_time");
+
+    /* add test cases to suite */
+    if (OPENSSL_THREAD_SAFE) {
+        suite_add_tcase(s, tc_post_process_keys);
+    }
+    suite_add_tcase(s, tc_write_keystore);
+    suite_add_tcase(s, tc_add_expiry_time);
+
+    /*
+     * post process keys test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_post_process_keys,
+        setup_post_process_keys, teardown_post_process_keys);
+    /* post_process_keys() */
+    int post_process_threads_lt_items = sizeof post_process_threads_lt /
+        sizeof post_process_threads_lt[0];
+    tcase_add_loop_test(tc_post_process_keys, t_post_process_keys, 0,
+        post_process_threads_lt_items);
+
+    /*
+     * write keystore test cases
+     */
+
+    /* write_keystore() */
+    int write_keystore_lt_items = sizeof write_keystore_lt /
+        sizeof write_keystore_lt[0];
+    tcase_add_loop_test(tc_write_keystore, t_write_keystore, 0,
+        write_keystore_lt_items);
+
+    /*
+     * add expiry time test cases
+     */
+
+    /* add_expiry_time_from_x509() */
+    int add_expiry_time_lt_items = sizeof add_expiry_time_lt /
+        sizeof add_expiry_time_lt[0];
+    tcase_add_loop_test(tc_add_expiry_time, t_add_expiry_time_from_x509, 0,
+        add_expiry_time_lt_items);
+
+    return s;
+}
+
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_CHECK_KEYSTORE_H
+#define KEETO_CHECK_KEYSTORE_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <check.h>
+
+#include "../src/keeto-keystore.h"
+
+struct keeto_post_process_key_entry {
+    char *access_profile;
+    char *key_provider;
+    char *file;
+    bool broken;
+};
+
+/* changes made between two writes of a keystore */
+enum keeto_keystore_change {
+    KEYSTORE_CHANGE_NONE,
+    KEYSTORE_CHANGE_RECORDS,
+    KEYSTORE_CHANGE_DATA,
+    KEYSTORE_CHANGE_MODE,
+    KEYSTORE_CHANGE_OWNER
+};
+
+struct keeto_write_keystore_entry {
+    enum keeto_keystore_change change;
+    bool exp_rewrite;
+};
+
+/*
+ * expiry time of a key. max_lifetime is counted from now - the expected
+ * expiry is the earlier of not_after and now + max_lifetime.
+ */
+struct keeto_add_expiry_time_entry {
+    char *file;
+    time_t max_lifetime;
+    time_t not_after;
+};
+
+Suite *make_keystore_suite(void);
+
+#endif /* KEETO_CHECK_KEYSTORE_H */
+
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keeto-check-ldap.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "../src/keeto-error.h"
+#define KEETO_ATTR_PROJECTION 1
+#include "../src/keeto-ldap.c"
+
+#define DN_FILTER_BUFFER_SIZE 64
+
+static struct keeto_create_dn_filter_entry create_dn_filter_lt[] = {
+    { NULL, { "cn=foo,dc=keeto,dc=io" }, 1,
+        "(|(entryDN=cn=foo,dc=keeto,dc=io))" },
+    { NULL, { "cn=foo,dc=keeto,dc=io", "cn=bar,dc=keeto,dc=io" }, 2,
+        "(|(entryDN=cn=foo,dc=keeto,dc=io)(entryDN=cn=bar,dc=keeto,dc=io))" },
+    { "(objectClass=keetoKeystoreOptions)", { "cn=foo,dc=keeto,dc=io" }, 1,
+        "(&(objectClass=keetoKeystoreOptions)"
+        "(|(entryDN=cn=foo,dc=keeto,dc=io)))" },
+    /* only count dns are part of the filter */
+    { NULL, { "cn=foo", "cn=bar", "cn=baz" }, 2,
+        "(|(entryDN=cn=foo)(entryDN=cn=bar))" },
+    /* dns must not be able to alter the filter */
+    { NULL, { "cn=foo)(entryDN=*", "cn=f\\2Coo,dc=keeto" }, 2,
+        "(|(entryDN=cn=foo\\29\\28entryDN=\\2A)"
+        "(entryDN=cn=f\\5C2Coo,dc=keeto))" }
+};
+
+static struct keeto_create_equality_filter_entry create_equality_filter_lt[] = {
+    { "uid", "keeto", 64, KEETO_OK, "(uid=keeto)" },
+    { "member", "cn=foo,dc=keeto,dc=io", 64, KEETO_OK,
+        "(member=cn=foo,dc=keeto,dc=io)" },
+    /* values must not be able to alter the filter */
+    { "uid", "*", 64, KEETO_OK, "(uid=\\2A)" },
+    { "member", "cn=f\\2Coo)(uid=*", 64, KEETO_OK,
+        "(member=cn=f\\5C2Coo\\29\\28uid=\\2A)" },
+    /* filter does not fit into the buffer */
+    { "uid", "keeto", 11, KEETO_SYSTEM_ERR, NULL },
+    { "uid", "keeto", 12, KEETO_OK, "(uid=keeto)" }
+};
+
+static struct keeto_get_member_kind_entry get_member_kind_lt[] = {
+    { KEY_PROVIDER_GROUP_ENTRY, 1, true, KEY_PROVIDER_ENTRY },
+    { TARGET_KEYSTORE_GROUP_ENTRY, 1, true, TARGET_KEYSTORE_ENTRY },
+    { KEY_PROVIDER_ENTRY, 1, false, 0 },
+    { TARGET_KEYSTORE_ENTRY, 1, false, 0 },
+    { KEYSTORE_OPTIONS_ENTRY, 1, false, 0 },
+    /* the tree is not followed any deeper */
+    { KEY_PROVIDER_GROUP_ENTRY, LDAP_TREE_MAX_DEPTH, false, 0 },
+    { TARGET_KEYSTORE_GROUP_ENTRY, LDAP_TREE_MAX_DEPTH, false, 0 },
+    { KEY_PROVIDER_GROUP_ENTRY, LDAP_TREE_MAX_DEPTH + 1, false, 0 }
+};
+
+static struct keeto_attr_projection_entry attr_projection_lt[] = {
+    { { "uid", NULL }, "uid", KEETO_OK },
+    { { "uid", "member", LDAP_DN_ATTR, NULL }, "member", KEETO_OK },
+    { { "uid", "member", LDAP_DN_ATTR, NULL }, LDAP_DN_ATTR, KEETO_OK },
+    /* attribute names are case insensitive */
+    { { "memberUid", NULL }, "MEMBERUID", KEETO_OK },
+    { { "uid", NULL }, "member", KEETO_LDAP_NO_SUCH_ATTR },
+    { { "uid", "member", NULL }, "memberUid", KEETO_LDAP_NO_SUCH_ATTR },
+    /* entries might be searched for no attributes (LDAP_NO_ATTRS) */
+    { { NULL }, "uid", KEETO_LDAP_NO_SUCH_ATTR }
+};
+
+/* entries are only compared by address */
+static char attr_projection_entries[2];
+#define ATTR_PROJECTION_ENTRY(i) ((LDAPMessage *) &attr_projection_entries[i])
+
+/*
+ * create_equality_filter()
+ */
+START_TEST
+(t_create_equality_filter)
+{
+    char *attr = create_equality_filter_lt[_i].attr;
+    char *value = create_equality_filter_lt[_i].value;
+    size_t buffer_size = create_equality_filter_lt[_i].buffer_size;
+    int exp_res = create_equality_filter_lt[_i].exp_res;
+    char *exp_result = create_equality_filter_lt[_i].exp_result;
+
+    char buffer[buffer_size];
+    int rc = create_equality_filter(attr, value, buffer, buffer_size);
+    ck_assert_int_eq(exp_res, rc);
+    if (rc == KEETO_OK) {
+        ck_assert_str_eq(exp_result, buffer);
+    }
+}
+END_TEST
+
+START_TEST
+(t_create_member_filter)
+{
+    /* the search asking which groups have a key provider as member */
+    char member_filter[DN_FILTER_BUFFER_SIZE];
+    int rc = create_equality_filter("member", "cn=foo,dc=keeto,dc=io",
+        member_filter, sizeof member_filter);
+    ck_assert_int_eq(KEETO_OK, rc);
+    char *dns[] = { "cn=g1,dc=keeto,dc=io", "cn=g2,dc=keeto,dc=io" };
+    char *filter = NULL;
+    rc = create_dn_filter(member_filter, dns, 2, &filter);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq("(&(member=cn=foo,dc=keeto,dc=io)"
+        "(|(entryDN=cn=g1,dc=keeto,dc=io)(entryDN=cn=g2,dc=keeto,dc=io)))",
+        filter);
+    free(filter);
+}
+END_TEST
+
+/*
+ * create_dn_filter()
+ */
+START_TEST
+(t_create_dn_filter)
+{
+    char *filter = create_dn_filter_lt[_i].filter;
+    char **dns = create_dn_filter_lt[_i].dns;
+    int count = create_dn_filter_lt[_i].count;
+    char *exp_result = create_dn_filter_lt[_i].exp_result;
+
+    char *dn_filter = NULL;
+    int rc = create_dn_filter(filter, dns, count, &dn_filter);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq(exp_result, dn_filter);
+    free(dn_filter);
+}
+END_TEST
+
+START_TEST
+(t_create_dn_filter_chunk)
+{
+    char *dns[LDAP_PREFETCH_CHUNK_SIZE];
+    size_t exp_length = strlen("(&(objectClass=foo)(|))");
+    for (int i = 0; i < LDAP_PREFETCH_CHUNK_SIZE; i++) {
+        dns[i] = malloc(DN_FILTER_BUFFER_SIZE);
+        ck_assert(NULL != dns[i]);
+        snprintf(dns[i], DN_FILTER_BUFFER_SIZE, "cn=user%d,dc=keeto,dc=io", i);
+        exp_length += strlen("(entryDN=)") + strlen(dns[i]);
+    }
+
+    char *dn_filter = NULL;
+    int rc = create_dn_filter("(objectClass=foo)", dns,
+        LDAP_PREFETCH_CHUNK_SIZE, &dn_filter);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(exp_length, strlen(dn_filter));
+    char *prefix = "(&(objectClass=foo)(|(entryDN=cn=user0,dc=keeto,dc=io)";
+    ck_assert(strncmp(prefix, dn_filter, strlen(prefix)) == 0);
+    char *suffix = "(entryDN=cn=user127,dc=keeto,dc=io)))";
+    ck_assert_str_eq(suffix, dn_filter + exp_length - strlen(suffix));
+    free(dn_filter);
+    for (int i = 0; i < LDAP_PREFETCH_CHUNK_SIZE; i++) {
+        free(dns[i]);
+    }
+}
+END_TEST
+
+/*
+ * get_member_kind()
+ */
+START_TEST
+(t_get_member_kind)
+{
+    enum keeto_ldap_entry_kind kind = get_member_kind_lt[_i].kind;
+    int depth = get_member_kind_lt[_i].depth;
+    bool exp_result = get_member_kind_lt[_i].exp_result;
+    enum keeto_ldap_entry_kind exp_member_kind =
+        get_member_kind_lt[_i].exp_member_kind;
+
+    enum keeto_ldap_entry_kind member_kind = LDAP_ENTRY_KIND_COUNT;
+    bool result = get_member_kind(kind, depth, &member_kind);
+    ck_assert_int_eq(exp_result, result);
+    if (result) {
+        ck_assert_int_eq(exp_member_kind, member_kind);
+    } else {
+        ck_assert_int_eq(LDAP_ENTRY_KIND_COUNT, member_kind);
+    }
+}
+END_TEST
+
+/*
+ * get_attr_projection()
+ */
+START_TEST
+(t_get_attr_projection)
+{
+    char **attrs = attr_projection_lt[_i].attrs;
+    char *attr = attr_projection_lt[_i].attr;
+    int exp_res = attr_projection_lt[_i].exp_res;
+
+    add_attr_projection(ATTR_PROJECTION_ENTRY(0), attrs);
+    int rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), attr);
+    ck_assert_int_eq(exp_res, rc);
+    free_attr_projections();
+}
+END_TEST
+
+START_TEST
+(t_get_attr_projection_unregistered)
+{
+    char *attrs[] = { "uid", NULL };
+
+    int rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "uid");
+    ck_assert_int_eq(KEETO_LDAP_NO_SUCH_ENTRY, rc);
+    add_attr_projection(ATTR_PROJECTION_ENTRY(0), attrs);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(1), "uid");
+    ck_assert_int_eq(KEETO_LDAP_NO_SUCH_ENTRY, rc);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "uid");
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    /* the registry is emptied after every login */
+    free_attr_projections();
+    ck_assert_ptr_eq(NULL, attr_projections);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "uid");
+    ck_assert_int_eq(KEETO_LDAP_NO_SUCH_ENTRY, rc);
+}
+END_TEST
+
+START_TEST
+(t_add_attr_projection_reused)
+{
+    char *attrs[] = { "uid", NULL };
+    char *reused_attrs[] = { "member", NULL };
+
+    /* the memory of a freed entry is reused by a newer entry */
+    add_attr_projection(ATTR_PROJECTION_ENTRY(0), attrs);
+    add_attr_projection(ATTR_PROJECTION_ENTRY(0), reused_attrs);
+    ck_assert_ptr_ne(NULL, attr_projections);
+    ck_assert_ptr_eq(NULL, attr_projections->next);
+    int rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "member");
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "uid");
+    ck_assert_int_eq(KEETO_LDAP_NO_SUCH_ATTR, rc);
+
+    /* other entries keep their attributes */
+    add_attr_projection(ATTR_PROJECTION_ENTRY(1), attrs);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(1), "uid");
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "member");
+    ck_assert_int_eq(KEETO_OK, rc);
+    free_attr_projections();
+}
+END_TEST
+
+static void *
+run_attr_projection_thread(void *arg)
+{
+    int *rc = arg;
+    char *attrs[] = { "member", NULL };
+
+    /* entries registered by other threads are not visible */
+    rc[0] = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "uid");
+    add_attr_projection(ATTR_PROJECTION_ENTRY(0), attrs);
+    rc[1] = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "member");
+    free_attr_projections();
+    return NULL;
+}
+
+START_TEST
+(t_get_attr_projection_thread)
+{
+    char *attrs[] = { "uid", NULL };
+    int thread_rc[2] = { KEETO_OK, KEETO_SYSTEM_ERR };
+    pthread_t thread;
+
+    add_attr_projection(ATTR_PROJECTION_ENTRY(0), attrs);
+    int rc = pthread_create(&thread, NULL, run_attr_projection_thread,
+        thread_rc);
+    ck_assert_int_eq(0, rc);
+    rc = pthread_join(thread, NULL);
+    ck_assert_int_eq(0, rc);
+    ck_assert_int_eq(KEETO_LDAP_NO_SUCH_ENTRY, thread_rc[0]);
+    ck_assert_int_eq(KEETO_OK, thread_rc[1]);
+
+    /* the other thread did neither alter nor free the entries */
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "uid");
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = get_attr_projection(ATTR_PROJECTION_ENTRY(0), "member");
+    ck_assert_int_eq(KEETO_LDAP_NO_SUCH_ATTR, rc);
+    free_attr_projections();
+}
+END_TEST
+
+Suite *
+make_ldap_suite(void)
+{
+    Suite *s = suite_create("ldap");
+    TCase *tc_main = tcase_create("main");
+
+    /* add test cases to suite */
+    suite_add_tcase(s, tc_main);
+
+    /*
+     * main test cases
+     */
+
+    /* create_equality_filter() */
+    int create_equality_filter_lt_items = sizeof create_equality_filter_lt /
+        sizeof create_equality_filter_lt[0];
+    tcase_add_loop_test(tc_main, t_create_equality_filter, 0,
+        create_equality_filter_lt_items);
+    tcase_add_test(tc_main, t_create_member_filter);
+
+    /* create_dn_filter() */
+    int create_dn_filter_lt_items = sizeof create_dn_filter_lt /
+        sizeof create_dn_filter_lt[0];
+    tcase_add_loop_test(tc_main, t_create_dn_filter, 0,
+        create_dn_filter_lt_items);
+    tcase_add_test(tc_main, t_create_dn_filter_chunk);
+
+    /* get_member_kind() */
+    int get_member_kind_lt_items = sizeof get_member_kind_lt /
+        sizeof get_member_kind_lt[0];
+    tcase_add_loop_test(tc_main, t_get_member_kind, 0,
+        get_member_kind_lt_items);
+
+    /* get_attr_projection() */
+    int attr_projection_lt_items = sizeof attr_projection_lt /
+        sizeof attr_projection_lt[0];
+    tcase_add_loop_test(tc_main, t_get_attr_projection, 0,
+        attr_projection_lt_items);
+    tcase_add_test(tc_main, t_get_attr_projection_unregistered);
+    tcase_add_test(tc_main, t_add_attr_projection_reused);
+    tcase_add_test(tc_main, t_get_attr_projection_thread);
+
+    return s;
+}
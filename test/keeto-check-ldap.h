@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2014-2017 Sebastian Roland <seroland86@gmail.com>
+ *
+ * This file is part of Keeto.
+ *
+ * Keeto is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Keeto is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Keeto.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEETO_CHECK_LDAP_H
+#define KEETO_CHECK_LDAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <check.h>
+
+#define CREATE_DN_FILTER_MAX_DNS 3
+#define ATTR_PROJECTION_MAX_ATTRS 4
+
+struct keeto_create_dn_filter_entry {
+    char *filter;
+    char *dns[CREATE_DN_FILTER_MAX_DNS];
+    int count;
+    char *exp_result;
+};
+
+struct keeto_create_equality_filter_entry {
+    char *attr;
+    char *value;
+    size_t buffer_size;
+    int exp_res;
+    char *exp_result;
+};
+
+/* kind and member kind are enum keeto_ldap_entry_kind */
+struct keeto_get_member_kind_entry {
+    int kind;
+    int depth;
+    bool exp_result;
+    int exp_member_kind;
+};
+
+struct keeto_attr_projection_entry {
+    char *attrs[ATTR_PROJECTION_MAX_ATTRS];
+    char *attr;
+    int exp_res;
+};
+
+Suite *make_ldap_suite(void);
+
+#endif /* KEETO_CHECK_LDAP_H */
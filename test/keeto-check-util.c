@@ -20,16 +20,26 @@
 #include "keeto-check-util.h"
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <check.h>
 #include <ldap.h>
 #include <syslog.h>
 #include <bits/types.h>
+#include <openssl/evp.h>
 #include <sys/stat.h>
 
+#include "../src/keeto-breaker.h"
 #include "../src/keeto-error.h"
+#include "../src/keeto-health.h"
+#include "../src/keeto-kcache.h"
+#include "../src/keeto-keydb.h"
 #include "../src/keeto-util.h"
+#include "../src/keeto-util-encode.h"
 
 static struct keeto_file_readable_entry file_readable_lt[] = {
     { FILEREADABLEDIR "/file-none", 0, false },
@@ -64,6 +74,33 @@ static struct keeto_check_uid_entry check_uid_lt[] = {
     { "_foo", false }
 };
 
+/* simple patterns are matched without regexec() - others are not */
+static struct keeto_check_uid_regex_entry check_uid_regex_lt[] = {
+    { "^[a-z_][a-z0-9_-]*$", "_keeto-user", true },
+    { "^[a-z_][a-z0-9_-]*$", "keeto.user", false },
+    { "^[a-z0-9.]{3,8}$", "kee.to", true },
+    { "^[a-z0-9.]{3,8}$", "ke", false },
+    { "^[a-z0-9.]{3,8}$", "keeto.user", false },
+    { "^u[0-9]{4}$", "u1234", true },
+    { "^u[0-9]{4}$", "u123", false },
+    { "^[-a]b?$", "-b", true },
+    { "^[-a]b?$", "ab", true },
+    { "^[-a]b?$", "bb", false },
+    { "^[a-z]+$", "keeto", true },
+    { "^[a-z]+$", "keeto1", false },
+    { "^a*b$", "aaab", true },
+    { "^a*b$", "aaa", false },
+    { "^[^0-9]+$", "keeto", true },
+    { "^[^0-9]+$", "keeto1", false },
+    { "^(keeto|user)$", "user", true },
+    { "^(keeto|user)$", "users", false },
+    { "keeto", "my-keeto-user", true },
+    { "^.*$", "../authorized_keys/root", false },
+    { "^.*$", "..", false },
+    { "^.*$", "keeto\nuser", false },
+    { "^.*$", "", false }
+};
+
 static struct keeto_substitute_token_entry substitute_token_lt[] = {
     { 'u', "foo", "/home/%u/", 1024, "/home/foo/" },
     { 'u', "foo", "/home/%u/", 3, "/h" },
@@ -90,6 +127,208 @@ static struct keeto_get_rdn_from_dn_entry get_rdn_from_dn_lt[] = {
     { "www.xy.z", KEETO_LDAP_ERR, NULL }
 };
 
+static struct keeto_normalize_dn_entry normalize_dn_lt[] = {
+    { "cn=foo,dc=keeto,dc=io", KEETO_OK, "cn=foo,dc=keeto,dc=io" },
+    { "CN=Foo,DC=Keeto,DC=IO", KEETO_OK, "cn=foo,dc=keeto,dc=io" },
+    { "cn = foo , dc = keeto , dc = io", KEETO_OK, "cn=foo,dc=keeto,dc=io" },
+    { "www.xy.z", KEETO_LDAP_ERR, NULL }
+};
+
+#define ENCODE_FOX "The quick brown fox jumps over the lazy dog"
+/* multiple of the block lengths of the simd encoders (12, 16, 24, 32) */
+#define ENCODE_BLOCK_LENGTH 48
+#define ENCODE_MAX_LENGTH 4096
+#define ENCODE_CANARY 0x5a
+#define ENCODE_CANARY_LENGTH 64
+
+/* longer inputs are partly encoded with simd if available */
+static struct keeto_encode_hex_entry encode_hex_lt[] = {
+    { "", '\0', "" },
+    { "f", ':', "66" },
+    { "fo", ':', "66:6f" },
+    { "0123456789abcdef", ':',
+        "30:31:32:33:34:35:36:37:38:39:61:62:63:64:65:66" },
+    { "0123456789abcdef", '\0', "30313233343536373839616263646566" },
+    { ENCODE_FOX, ':',
+        "54:68:65:20:71:75:69:63:6b:20:62:72:6f:77:6e:20:"
+        "66:6f:78:20:6a:75:6d:70:73:20:6f:76:65:72:20:74:"
+        "68:65:20:6c:61:7a:79:20:64:6f:67" },
+    { ENCODE_FOX, '\0',
+        "54686520717569636b2062726f776e20666f78206a756d7073206f76"
+        "657220746865206c617a7920646f67" },
+    { ENCODE_FOX ". " ENCODE_FOX ".", ':',
+        "54:68:65:20:71:75:69:63:6b:20:62:72:6f:77:6e:20:"
+        "66:6f:78:20:6a:75:6d:70:73:20:6f:76:65:72:20:74:"
+        "68:65:20:6c:61:7a:79:20:64:6f:67:2e:20:54:68:65:"
+        "20:71:75:69:63:6b:20:62:72:6f:77:6e:20:66:6f:78:"
+        "20:6a:75:6d:70:73:20:6f:76:65:72:20:74:68:65:20:"
+        "6c:61:7a:79:20:64:6f:67:2e" },
+    { ENCODE_FOX ". " ENCODE_FOX ".", '\0',
+        "54686520717569636b2062726f776e20666f78206a756d7073206f76"
+        "657220746865206c617a7920646f672e2054686520717569636b2062"
+        "726f776e20666f78206a756d7073206f76657220746865206c617a79"
+        "20646f672e" }
+};
+
+/* every level is forced if the cpu supports it */
+static enum keeto_simd_level encode_level_lt[] = {
+    KEETO_SIMD_NONE,
+    KEETO_SIMD_SSSE3,
+    KEETO_SIMD_AVX2
+};
+
+static struct keeto_encode_base64_entry encode_base64_lt[] = {
+    { "", true, "" },
+    { "", false, "" },
+    { "f", true, "Zg==" },
+    { "f", false, "Zg" },
+    { "fo", true, "Zm8=" },
+    { "fo", false, "Zm8" },
+    { "foo", true, "Zm9v" },
+    { "foo", false, "Zm9v" },
+    { "foob", true, "Zm9vYg==" },
+    { "foob", false, "Zm9vYg" },
+    { "fooba", true, "Zm9vYmE=" },
+    { "fooba", false, "Zm9vYmE" },
+    { "foobar", true, "Zm9vYmFy" },
+    { "foobar", false, "Zm9vYmFy" },
+    { ENCODE_FOX, true,
+        "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRv"
+        "Zw==" },
+    { ENCODE_FOX, false,
+        "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRv"
+        "Zw" },
+    { ENCODE_FOX ". " ENCODE_FOX ".", true,
+        "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRv"
+        "Zy4gVGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5"
+        "IGRvZy4=" },
+    { ENCODE_FOX ". " ENCODE_FOX ".", false,
+        "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRv"
+        "Zy4gVGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5"
+        "IGRvZy4" }
+};
+
+static struct keeto_dedupe_keystore_records_entry dedupe_keystore_records_lt[] = {
+    /* distinct keys */
+    { { { "AAAA", "foo", NULL, NULL }, { "BBBB", "foo", NULL, NULL } },
+      { { "AAAA", "foo", NULL, NULL }, { "BBBB", "foo", NULL, NULL } } },
+    /* exact duplicates */
+    { { { "AAAA", "foo", "cmd", "10.0.0.1" },
+        { "AAAA", "foo", "cmd", "10.0.0.1" },
+        { "AAAA", "foo", "cmd", "10.0.0.1" } },
+      { { "AAAA", "foo", "cmd", "10.0.0.1" } } },
+    { { { "AAAA", "foo", NULL, NULL }, { "BBBB", "bar", NULL, NULL },
+        { "AAAA", "foo", NULL, NULL } },
+      { { "AAAA", "foo", NULL, NULL }, { "BBBB", "bar", NULL, NULL } } },
+    /* different uid or command */
+    { { { "AAAA", "foo", NULL, NULL }, { "AAAA", "bar", NULL, NULL } },
+      { { "AAAA", "foo", NULL, NULL }, { "AAAA", "bar", NULL, NULL } } },
+    { { { "AAAA", "foo", "cmd", NULL }, { "AAAA", "foo", NULL, NULL },
+        { "AAAA", "foo", "other", NULL } },
+      { { "AAAA", "foo", "cmd", NULL }, { "AAAA", "foo", NULL, NULL },
+        { "AAAA", "foo", "other", NULL } } },
+    /* earlier record without from option covers later ones */
+    { { { "AAAA", "foo", NULL, NULL }, { "AAAA", "bar", NULL, NULL },
+        { "AAAA", "foo", NULL, "10.0.0.1" } },
+      { { "AAAA", "foo", NULL, NULL }, { "AAAA", "bar", NULL, NULL } } },
+    /* later record without from option widens the previous record */
+    { { { "AAAA", "foo", "cmd", "10.0.0.1" }, { "BBBB", "foo", NULL, NULL },
+        { "AAAA", "foo", "cmd", NULL } },
+      { { "AAAA", "foo", "cmd", NULL }, { "BBBB", "foo", NULL, NULL } } },
+    /* ... but only if no other record of the key is in between */
+    { { { "AAAA", "foo", NULL, "10.0.0.1" }, { "AAAA", "bar", NULL, NULL },
+        { "AAAA", "foo", NULL, NULL } },
+      { { "AAAA", "foo", NULL, "10.0.0.1" }, { "AAAA", "bar", NULL, NULL },
+        { "AAAA", "foo", NULL, NULL } } },
+    /* different from options */
+    { { { "AAAA", "foo", NULL, "10.0.0.1" },
+        { "AAAA", "foo", NULL, "10.0.0.2" },
+        { "AAAA", "foo", NULL, "10.0.0.1" } },
+      { { "AAAA", "foo", NULL, "10.0.0.1" },
+        { "AAAA", "foo", NULL, "10.0.0.2" } } },
+    /* earlier record expiring the same time or later covers later ones */
+    { { { "AAAA", "foo", NULL, NULL, "20310101000000" },
+        { "AAAA", "foo", NULL, "10.0.0.1", "20300101000000" },
+        { "AAAA", "foo", NULL, NULL, "20310101000000" } },
+      { { "AAAA", "foo", NULL, NULL, "20310101000000" } } },
+    { { { "AAAA", "foo", NULL, NULL, NULL },
+        { "AAAA", "foo", NULL, NULL, "20300101000000" } },
+      { { "AAAA", "foo", NULL, NULL, NULL } } },
+    /* later record expiring the same time or later widens the previous */
+    { { { "AAAA", "foo", NULL, "10.0.0.1", "20300101000000" },
+        { "AAAA", "foo", NULL, NULL, "20310101000000" } },
+      { { "AAAA", "foo", NULL, NULL, "20310101000000" } } },
+    { { { "AAAA", "foo", NULL, NULL, "20300101000000" },
+        { "AAAA", "foo", NULL, NULL, NULL } },
+      { { "AAAA", "foo", NULL, NULL, NULL } } },
+    /* ... but is kept if it expires earlier */
+    { { { "AAAA", "foo", NULL, "10.0.0.1", "20310101000000" },
+        { "AAAA", "foo", NULL, NULL, "20300101000000" } },
+      { { "AAAA", "foo", NULL, "10.0.0.1", "20310101000000" },
+        { "AAAA", "foo", NULL, NULL, "20300101000000" } } }
+};
+
+static char *parse_expiry_time_neg_lt[] = {
+    "",
+    "2030010100000",
+    "203001010000000",
+    "2030-1-1000000",
+    "20300101 00000"
+};
+
+/* updates are applied in order */
+static struct keeto_update_keydb_entry update_keydb_lt[] = {
+    { "alice", "environment=\"KEETOREALUSER=alice\" ssh-rsa AAAA\n\n" },
+    { "bob", "environment=\"KEETOREALUSER=bob\" ssh-rsa BBBB\n\n" },
+    { "alice", "environment=\"KEETOREALUSER=carol\" ssh-rsa CCCC\n\n" },
+    { "bo", "environment=\"KEETOREALUSER=bo\" ssh-rsa DDDD\n\n" },
+    { "bob", NULL },
+    { "dave", NULL },
+    { "alice", "environment=\"KEETOREALUSER=carol\" ssh-rsa CCCC\n\n" },
+    { "bob", "" },
+    { "bo", NULL }
+};
+
+static struct keeto_health_ewma_entry health_ewma_lt[] = {
+    { { 100 }, 100 },
+    { { 100, 900 }, 200 },
+    { { 1000, 200 }, 900 },
+    { { 100, 100, 100, 100 }, 100 },
+    { { 800, 1600, 1600 }, 987 }
+};
+
+#define BREAKER_THRESHOLD 3
+#define BREAKER_INTERVAL 60
+
+static struct keeto_breaker_entry breaker_lt[] = {
+    { "", KEETO_BREAKER_CLOSED, true },
+    { "ff", KEETO_BREAKER_CLOSED, true },
+    { "fff", KEETO_BREAKER_OPEN, false },
+    { "ffff", KEETO_BREAKER_OPEN, false },
+    /* only consecutive failures open the breaker */
+    { "ffsff", KEETO_BREAKER_CLOSED, true },
+    /* a single probe is allowed after the interval */
+    { "fffi", KEETO_BREAKER_OPEN, true },
+    { "fffir", KEETO_BREAKER_HALF_OPEN, false },
+    { "fffirs", KEETO_BREAKER_CLOSED, true },
+    { "fffirsff", KEETO_BREAKER_CLOSED, true },
+    { "fffirf", KEETO_BREAKER_OPEN, false },
+    { "fffirfi", KEETO_BREAKER_OPEN, true },
+    /* probes that do not report back are repeated */
+    { "fffiri", KEETO_BREAKER_HALF_OPEN, true }
+};
+
+/* four failures without any latency samples */
+static struct keeto_health_decay_entry health_decay_lt[] = {
+    { 0, 8000 },
+    { 59, 8000 },
+    { 60, 4000 },
+    { 120, 2000 },
+    { 179, 2000 },
+    { 180, 0 },
+    { 3600, 0 }
+};
+
 /*
  * str_to_enum()
  */
@@ -173,6 +412,68 @@ START_TEST
 }
 END_TEST
 
+START_TEST
+(t_check_uid_regex)
+{
+    char *regex = check_uid_regex_lt[_i].regex;
+    char *uid = check_uid_regex_lt[_i].uid;
+    bool exp_result = check_uid_regex_lt[_i].exp_result;
+
+    bool uid_valid = !exp_result;
+    int rc = check_uid(regex, uid, &uid_valid);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to check uid");
+    }
+    ck_assert_int_eq(exp_result, uid_valid);
+    free_uid_validator();
+}
+END_TEST
+
+START_TEST
+(t_check_uid_invalid_regex)
+{
+    bool uid_valid = false;
+    int rc = check_uid("^[a-z]{2,1}$", "keeto", &uid_valid);
+    ck_assert_int_eq(KEETO_REGEX_ERR, rc);
+    rc = check_uid("[", "keeto", &uid_valid);
+    ck_assert_int_eq(KEETO_REGEX_ERR, rc);
+}
+END_TEST
+
+START_TEST
+(t_check_uid_other_regex)
+{
+    int rc = init_uid_validator("^[a-z]+$");
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    /* a regex other than the one in use is compiled for the check only */
+    bool uid_valid = false;
+    rc = check_uid("^[0-9]+$", "123", &uid_valid);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(true, uid_valid);
+    rc = check_uid("^[0-9]+$", "keeto", &uid_valid);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(false, uid_valid);
+    rc = check_uid("^[a-z]+$", "keeto", &uid_valid);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(true, uid_valid);
+    free_uid_validator();
+}
+END_TEST
+
+/*
+ * validate_uid_regex()
+ */
+START_TEST
+(t_validate_uid_regex)
+{
+    ck_assert_int_eq(KEETO_OK, validate_uid_regex("^[a-z][-a-z0-9]{0,31}$"));
+    ck_assert_int_eq(KEETO_OK, validate_uid_regex("^(foo|bar)$"));
+    ck_assert_int_eq(KEETO_REGEX_ERR, validate_uid_regex("^[a-z]{2,1}$"));
+    ck_assert_int_eq(KEETO_REGEX_ERR, validate_uid_regex("["));
+}
+END_TEST
+
 /*
  * substitute_token()
  */
@@ -216,6 +517,971 @@ START_TEST
 }
 END_TEST
 
+/*
+ * normalize_dn()
+ */
+START_TEST
+(t_normalize_dn)
+{
+    char *dn = normalize_dn_lt[_i].dn;
+    int exp_res = normalize_dn_lt[_i].exp_res;
+    char *exp_result = normalize_dn_lt[_i].exp_result;
+
+    char *normalized_dn = NULL;
+    int rc = normalize_dn(dn, &normalized_dn);
+    ck_assert_int_eq(exp_res, rc);
+    switch (rc) {
+    case KEETO_OK:
+        ck_assert_str_eq(exp_result, normalized_dn);
+        break;
+    default:
+        ck_assert(NULL == normalized_dn);
+    }
+    free(normalized_dn);
+}
+END_TEST
+
+/*
+ * memo_get() / memo_put()
+ */
+START_TEST
+(t_memo)
+{
+    struct keeto_memo *memo = new_memo(2, &free);
+    ck_assert(NULL != memo);
+
+    void *value = NULL;
+    int rc = memo_get(memo, "cn=foo,dc=keeto,dc=io", &value);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    ck_assert_int_eq(1, memo->misses);
+
+    char *keys[] = {
+        "cn=foo,dc=keeto,dc=io",
+        "cn=bar,dc=keeto,dc=io",
+        "cn=baz,dc=keeto,dc=io"
+    };
+    for (size_t i = 0; i < sizeof keys / sizeof keys[0]; i++) {
+        rc = memo_put(memo, keys[i], strdup(keys[i]));
+        ck_assert_int_eq(KEETO_OK, rc);
+    }
+    for (size_t i = 0; i < sizeof keys / sizeof keys[0]; i++) {
+        rc = memo_get(memo, keys[i], &value);
+        ck_assert_int_eq(KEETO_OK, rc);
+        ck_assert_str_eq(keys[i], value);
+    }
+    /* keys are case insensitive */
+    rc = memo_get(memo, "CN=Foo,DC=keeto,DC=io", &value);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq("cn=foo,dc=keeto,dc=io", value);
+    ck_assert_int_eq(4, memo->hits);
+
+    /* replace value */
+    rc = memo_put(memo, "cn=foo,dc=keeto,dc=io", strdup("foo"));
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = memo_get(memo, "cn=foo,dc=keeto,dc=io", &value);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq("foo", value);
+
+    free_memo(memo);
+}
+END_TEST
+
+/*
+ * get_deadline() / get_remaining_time()
+ */
+START_TEST
+(t_get_remaining_time)
+{
+    struct timeval timeout = { 0, 200000 };
+    struct timespec deadline = get_deadline(timeout);
+    struct timeval remaining = { 0, 0 };
+    bool left = get_remaining_time(&deadline, &remaining);
+    ck_assert(left);
+    ck_assert_int_eq(0, remaining.tv_sec);
+    ck_assert(remaining.tv_usec > 0 && remaining.tv_usec <= 200000);
+
+    /* the budget is shared by all calls until the deadline */
+    usleep(100000);
+    struct timeval remaining_later = { 0, 0 };
+    left = get_remaining_time(&deadline, &remaining_later);
+    ck_assert(left);
+    ck_assert(remaining_later.tv_usec < remaining.tv_usec);
+    usleep(150000);
+    left = get_remaining_time(&deadline, &remaining);
+    ck_assert(!left);
+
+    struct timeval no_timeout = { 0, 0 };
+    deadline = get_deadline(no_timeout);
+    left = get_remaining_time(&deadline, &remaining);
+    ck_assert(!left);
+}
+END_TEST
+
+/*
+ * encode_hex() / encode_base64()
+ */
+START_TEST
+(t_encode_hex)
+{
+    char *src = encode_hex_lt[_i].src;
+    char delimiter = encode_hex_lt[_i].delimiter;
+    char *exp_result = encode_hex_lt[_i].exp_result;
+
+    size_t src_length = strlen(src);
+    char dst[HEX_LENGTH(src_length, delimiter) + 1];
+    size_t length = encode_hex((unsigned char *) src, src_length, delimiter,
+        dst);
+    ck_assert_int_eq(strlen(exp_result), length);
+    ck_assert_str_eq(exp_result, dst);
+}
+END_TEST
+
+START_TEST
+(t_encode_base64)
+{
+    char *src = encode_base64_lt[_i].src;
+    bool pad = encode_base64_lt[_i].pad;
+    char *exp_result = encode_base64_lt[_i].exp_result;
+
+    size_t src_length = strlen(src);
+    char dst[BASE64_LENGTH(src_length) + 1];
+    size_t length = encode_base64((unsigned char *) src, src_length, pad,
+        dst);
+    ck_assert_int_eq(strlen(exp_result), length);
+    ck_assert_str_eq(exp_result, dst);
+}
+END_TEST
+
+/*
+ * encode_hex_with_level() / encode_base64_with_level()
+ */
+static void
+get_check_hex(const unsigned char *src, size_t src_length, char delimiter,
+    char *ret)
+{
+    *ret = '\0';
+    for (size_t i = 0; i < src_length; i++) {
+        if (i > 0 && delimiter != '\0') {
+            *ret++ = delimiter;
+        }
+        ret += sprintf(ret, "%02x", src[i]);
+    }
+}
+
+static void
+get_check_base64(const unsigned char *src, size_t src_length, bool pad,
+    char *ret)
+{
+    EVP_EncodeBlock((unsigned char *) ret, src, src_length);
+    if (!pad) {
+        ret[strcspn(ret, "=")] = '\0';
+    }
+}
+
+/* all lengths up to 256 bytes and the ones around multiples of 48 bytes */
+static bool
+is_check_encode_length(size_t length)
+{
+    size_t rest = length % ENCODE_BLOCK_LENGTH;
+    return length <= 256 || rest <= 4 || rest >= ENCODE_BLOCK_LENGTH - 4;
+}
+
+static void
+check_encode_result(const char *encoder, int level, size_t src_length,
+    const char *exp_result, const char *dst, size_t length)
+{
+    size_t exp_length = strlen(exp_result);
+    bool intact = true;
+    for (size_t i = exp_length + 1; i < exp_length + 1 + ENCODE_CANARY_LENGTH;
+        i++) {
+
+        intact = intact && dst[i] == ENCODE_CANARY;
+    }
+    if (exp_length != length || strcmp(exp_result, dst) != 0 || !intact) {
+        ck_abort_msg("%s encoder (level %d) failed for %zu bytes", encoder,
+            level, src_length);
+    }
+}
+
+START_TEST
+(t_encode_with_level)
+{
+    enum keeto_simd_level level = encode_level_lt[_i];
+    if (level > get_simd_level()) {
+        /* not supported by the cpu */
+        return;
+    }
+
+    unsigned char src[ENCODE_MAX_LENGTH];
+    for (size_t i = 0; i < sizeof src; i++) {
+        src[i] = i * 167 + 13;
+    }
+    size_t dst_size = ENCODE_MAX_LENGTH * 3 + 1 + ENCODE_CANARY_LENGTH;
+    char *exp_result = malloc(dst_size);
+    char *dst = malloc(dst_size);
+    if (exp_result == NULL || dst == NULL) {
+        ck_abort_msg("failed to allocate memory for encode buffers");
+    }
+
+    char delimiters[] = { ':', '\0' };
+    bool pads[] = { true, false };
+    for (size_t src_length = 0; src_length <= ENCODE_MAX_LENGTH;
+        src_length++) {
+
+        if (!is_check_encode_length(src_length)) {
+            continue;
+        }
+        for (int i = 0; i < 2; i++) {
+            get_check_hex(src, src_length, delimiters[i], exp_result);
+            memset(dst, ENCODE_CANARY, dst_size);
+            size_t length = encode_hex_with_level(src, src_length,
+                delimiters[i], level, dst);
+            check_encode_result("hex", level, src_length, exp_result, dst,
+                length);
+
+            get_check_base64(src, src_length, pads[i], exp_result);
+            memset(dst, ENCODE_CANARY, dst_size);
+            length = encode_base64_with_level(src, src_length, pads[i], level,
+                dst);
+            check_encode_result("base64", level, src_length, exp_result, dst,
+                length);
+        }
+    }
+    free(dst);
+    free(exp_result);
+}
+END_TEST
+
+/*
+ * dedupe_keystore_records()
+ */
+static bool
+is_same_option(const char *option_a, const char *option_b)
+{
+    if (option_a == NULL || option_b == NULL) {
+        return option_a == option_b;
+    }
+    return strcmp(option_a, option_b) == 0;
+}
+
+START_TEST
+(t_dedupe_keystore_records)
+{
+    struct keeto_dedupe_record *records =
+        dedupe_keystore_records_lt[_i].records;
+    struct keeto_dedupe_record *exp_records =
+        dedupe_keystore_records_lt[_i].exp_records;
+
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    ck_assert_ptr_ne(NULL, keystore_records);
+    size_t count = 0;
+    for (; count < DEDUPE_MAX_RECORDS && records[count].ssh_key != NULL;
+        count++) {
+        struct keeto_keystore_record *keystore_record = new_keystore_record();
+        ck_assert_ptr_ne(NULL, keystore_record);
+        keystore_record->uid = records[count].uid;
+        keystore_record->ssh_keytype = "ssh-rsa";
+        keystore_record->ssh_key = records[count].ssh_key;
+        keystore_record->command_option = records[count].command_option;
+        keystore_record->from_option = records[count].from_option;
+        keystore_record->expiry_time_option =
+            records[count].expiry_time_option;
+        SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+    }
+    size_t exp_count = 0;
+    while (exp_count < DEDUPE_MAX_RECORDS &&
+        exp_records[exp_count].ssh_key != NULL) {
+        exp_count++;
+    }
+
+    size_t removed = 0;
+    int rc = dedupe_keystore_records(keystore_records, &removed);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(count - exp_count, removed);
+    size_t i = 0;
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        ck_assert(i < exp_count);
+        ck_assert_str_eq(exp_records[i].ssh_key, keystore_record->ssh_key);
+        ck_assert_str_eq(exp_records[i].uid, keystore_record->uid);
+        ck_assert(is_same_option(exp_records[i].command_option,
+            keystore_record->command_option));
+        ck_assert(is_same_option(exp_records[i].from_option,
+            keystore_record->from_option));
+        ck_assert(is_same_option(exp_records[i].expiry_time_option,
+            keystore_record->expiry_time_option));
+        i++;
+    }
+    ck_assert_int_eq(exp_count, i);
+    free_keystore_records(keystore_records);
+}
+END_TEST
+
+/*
+ * limit_keystore_records()
+ */
+START_TEST
+(t_limit_keystore_records)
+{
+    static char oversized_key[KEETO_KEYSTORE_MAX_RECORD_SIZE];
+    memset(oversized_key, 'A', sizeof oversized_key - 1);
+
+    /* the oversized record and the records beyond the limit are removed */
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    ck_assert_ptr_ne(NULL, keystore_records);
+    struct keeto_keystore_record *second_record = NULL;
+    for (int i = 0; i < KEETO_KEYSTORE_MAX_RECORDS + 3; i++) {
+        struct keeto_keystore_record *keystore_record = new_keystore_record();
+        ck_assert_ptr_ne(NULL, keystore_record);
+        keystore_record->uid = "keeto";
+        keystore_record->ssh_keytype = "ssh-rsa";
+        keystore_record->ssh_key = i == 1 ? oversized_key : "AAAA";
+        if (i == 1) {
+            second_record = keystore_record;
+        }
+        SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+    }
+    ck_assert(get_keystore_record_size(second_record) >
+        KEETO_KEYSTORE_MAX_RECORD_SIZE);
+
+    size_t removed = 0;
+    limit_keystore_records(keystore_records, &removed);
+    ck_assert_int_eq(3, removed);
+    int count = 0;
+    struct keeto_keystore_record *keystore_record = NULL;
+    SIMPLEQ_FOREACH(keystore_record, keystore_records, next) {
+        ck_assert_str_eq("AAAA", keystore_record->ssh_key);
+        count++;
+    }
+    ck_assert_int_eq(KEETO_KEYSTORE_MAX_RECORDS, count);
+
+    limit_keystore_records(keystore_records, &removed);
+    ck_assert_int_eq(0, removed);
+    free_keystore_records(keystore_records);
+}
+END_TEST
+
+/*
+ * format_expiry_time() / parse_expiry_time()
+ */
+START_TEST
+(t_format_expiry_time)
+{
+    time_t expiry = time(NULL) + 86400;
+    char *expiry_time = NULL;
+    int rc = format_expiry_time(expiry, &expiry_time);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(EXPIRY_TIME_LENGTH, strlen(expiry_time));
+    time_t result = 0;
+    bool valid = parse_expiry_time(expiry_time, &result);
+    ck_assert(valid);
+    ck_assert(result == expiry);
+    free(expiry_time);
+}
+END_TEST
+
+START_TEST
+(t_parse_expiry_time_neg)
+{
+    char *expiry_time = parse_expiry_time_neg_lt[_i];
+    time_t result = 0;
+    bool valid = parse_expiry_time(expiry_time, &result);
+    ck_assert(!valid);
+}
+END_TEST
+
+START_TEST
+(t_get_keystore_records_expiry)
+{
+    struct keeto_keystore_records *keystore_records = new_keystore_records();
+    ck_assert_ptr_ne(NULL, keystore_records);
+    time_t result = 0;
+    bool found = get_keystore_records_expiry(keystore_records, &result);
+    ck_assert(!found);
+
+    char *expiry_times[] = { NULL, "20310101000000", "20300101000000" };
+    for (size_t i = 0; i < sizeof expiry_times / sizeof expiry_times[0];
+        i++) {
+        struct keeto_keystore_record *keystore_record = new_keystore_record();
+        ck_assert_ptr_ne(NULL, keystore_record);
+        keystore_record->expiry_time_option = expiry_times[i];
+        SIMPLEQ_INSERT_TAIL(keystore_records, keystore_record, next);
+    }
+    time_t exp_result = 0;
+    bool valid = parse_expiry_time("20300101000000", &exp_result);
+    ck_assert(valid);
+    found = get_keystore_records_expiry(keystore_records, &result);
+    ck_assert(found);
+    ck_assert(result == exp_result);
+    free_keystore_records(keystore_records);
+}
+END_TEST
+
+/*
+ * get_health_score() / record_health_success() / record_health_failure()
+ */
+static struct keeto_health_server *
+get_check_health_server(struct keeto_health *health, const char *uri)
+{
+    for (int i = 0; i < KEETO_HEALTH_MAX_SERVERS; i++) {
+        struct keeto_health_server *server = &health->table->servers[i];
+        if (strcmp(server->uri, uri) == 0) {
+            return server;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * allow_breaker_request() / record_breaker_success() /
+ * record_breaker_failure()
+ */
+START_TEST
+(t_breaker)
+{
+    unlink(BREAKERFILE);
+    struct keeto_breaker *breaker = NULL;
+    int rc = open_breaker(BREAKERFILE, &breaker);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    char *events = breaker_lt[_i].events;
+    for (int i = 0; events[i] != '\0'; i++) {
+        switch (events[i]) {
+        case 'f':
+            record_breaker_failure(breaker, BREAKER_THRESHOLD);
+            break;
+        case 's':
+            record_breaker_success(breaker);
+            break;
+        case 'r':
+            allow_breaker_request(breaker, BREAKER_INTERVAL);
+            break;
+        case 'i':
+            breaker->state->changed_at -= BREAKER_INTERVAL;
+            break;
+        default:
+            ck_abort_msg("unknown breaker event '%c'", events[i]);
+        }
+    }
+    ck_assert_int_eq(breaker_lt[_i].exp_state, breaker->state->state);
+    ck_assert_int_eq(breaker_lt[_i].exp_allow,
+        allow_breaker_request(breaker, BREAKER_INTERVAL));
+    close_breaker(breaker);
+}
+END_TEST
+
+START_TEST
+(t_breaker_shared)
+{
+    unlink(BREAKERFILE);
+    struct keeto_breaker *breaker = NULL;
+    int rc = open_breaker(BREAKERFILE, &breaker);
+    ck_assert_int_eq(KEETO_OK, rc);
+    for (int i = 0; i < BREAKER_THRESHOLD; i++) {
+        record_breaker_failure(breaker, BREAKER_THRESHOLD);
+    }
+    close_breaker(breaker);
+
+    /* the state is shared - reopen it like another process would */
+    rc = open_breaker(BREAKERFILE, &breaker);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(KEETO_BREAKER_OPEN, breaker->state->state);
+    ck_assert_int_eq(false, allow_breaker_request(breaker, BREAKER_INTERVAL));
+    breaker->state->magic = 0;
+    close_breaker(breaker);
+
+    /* files of other versions are reset */
+    rc = open_breaker(BREAKERFILE, &breaker);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(KEETO_BREAKER_CLOSED, breaker->state->state);
+    ck_assert_int_eq(0, breaker->state->failures);
+    close_breaker(breaker);
+
+    /* files writable by others are not trusted */
+    rc = chmod(BREAKERFILE, S_IRUSR | S_IWUSR | S_IWOTH);
+    ck_assert_int_eq(0, rc);
+    rc = open_breaker(BREAKERFILE, &breaker);
+    ck_assert_int_eq(KEETO_SYSTEM_ERR, rc);
+    unlink(BREAKERFILE);
+}
+END_TEST
+
+START_TEST
+(t_health_ewma)
+{
+    unlink(HEALTHFILE);
+    struct keeto_health *health = NULL;
+    int rc = open_health(HEALTHFILE, &health);
+    ck_assert_int_eq(KEETO_OK, rc);
+    char *uri = "ldap://localhost";
+    ck_assert_int_eq(0, get_health_score(health, uri));
+
+    unsigned long *samples = health_ewma_lt[_i].samples;
+    for (int i = 0; i < HEALTH_MAX_SAMPLES && samples[i] != 0; i++) {
+        record_health_success(health, uri, samples[i]);
+    }
+    ck_assert_int_eq(health_ewma_lt[_i].exp_score,
+        get_health_score(health, uri));
+    close_health(health);
+}
+END_TEST
+
+START_TEST
+(t_health_decay)
+{
+    unlink(HEALTHFILE);
+    struct keeto_health *health = NULL;
+    int rc = open_health(HEALTHFILE, &health);
+    ck_assert_int_eq(KEETO_OK, rc);
+    char *uri = "ldap://localhost";
+    for (int i = 0; i < 4; i++) {
+        record_health_failure(health, uri);
+    }
+    struct keeto_health_server *server = get_check_health_server(health, uri);
+    ck_assert_ptr_ne(NULL, server);
+    server->last_failure = time(NULL) - health_decay_lt[_i].elapsed;
+    ck_assert_int_eq(health_decay_lt[_i].exp_score,
+        get_health_score(health, uri));
+    close_health(health);
+}
+END_TEST
+
+START_TEST
+(t_health_recovery)
+{
+    unlink(HEALTHFILE);
+    struct keeto_health *health = NULL;
+    int rc = open_health(HEALTHFILE, &health);
+    ck_assert_int_eq(KEETO_OK, rc);
+    char *uri = "ldap://localhost";
+    for (int i = 0; i < 4; i++) {
+        record_health_failure(health, uri);
+    }
+    /* every success halves the failures */
+    record_health_success(health, uri, 10);
+    ck_assert_int_eq(10 + 2 * 2000, get_health_score(health, uri));
+    record_health_success(health, uri, 10);
+    ck_assert_int_eq(10 + 1 * 2000, get_health_score(health, uri));
+    record_health_success(health, uri, 10);
+    ck_assert_int_eq(10, get_health_score(health, uri));
+    close_health(health);
+}
+END_TEST
+
+START_TEST
+(t_health_order)
+{
+    unlink(HEALTHFILE);
+    struct keeto_health *health = NULL;
+    int rc = open_health(HEALTHFILE, &health);
+    ck_assert_int_eq(KEETO_OK, rc);
+    record_health_success(health, "ldap://fast", 20);
+    record_health_success(health, "ldap://slow", 900);
+    record_health_success(health, "ldap://failed", 20);
+    record_health_failure(health, "ldap://failed");
+    close_health(health);
+
+    /* the table is shared - reopen it like another process would */
+    rc = open_health(HEALTHFILE, &health);
+    ck_assert_int_eq(KEETO_OK, rc);
+    unsigned long unknown = get_health_score(health, "ldap://unknown");
+    unsigned long fast = get_health_score(health, "ldap://fast");
+    unsigned long slow = get_health_score(health, "ldap://slow");
+    unsigned long failed = get_health_score(health, "ldap://failed");
+    ck_assert_int_eq(0, unknown);
+    ck_assert(unknown < fast);
+    ck_assert(fast < slow);
+    ck_assert(slow < failed);
+    close_health(health);
+}
+END_TEST
+
+START_TEST
+(t_health_replace_oldest)
+{
+    unlink(HEALTHFILE);
+    struct keeto_health *health = NULL;
+    int rc = open_health(HEALTHFILE, &health);
+    ck_assert_int_eq(KEETO_OK, rc);
+    char uri[KEETO_HEALTH_URI_SIZE];
+    for (int i = 0; i <= KEETO_HEALTH_MAX_SERVERS; i++) {
+        snprintf(uri, sizeof uri, "ldap://server%d", i);
+        record_health_success(health, uri, 100);
+        struct keeto_health_server *server = get_check_health_server(health,
+            uri);
+        ck_assert_ptr_ne(NULL, server);
+        server->last_used = i + 1;
+    }
+    /* the least recently used server has been replaced */
+    ck_assert_int_eq(0, get_health_score(health, "ldap://server0"));
+    snprintf(uri, sizeof uri, "ldap://server%d", KEETO_HEALTH_MAX_SERVERS);
+    ck_assert_int_eq(100, get_health_score(health, uri));
+    close_health(health);
+}
+END_TEST
+
+/*
+ * store_kcache() / lookup_kcache()
+ */
+static void
+get_check_kcache_digest(unsigned int i, unsigned char *digest)
+{
+    memset(digest, 0xab, KEETO_KCACHE_DIGEST_SIZE);
+    memcpy(digest, &i, sizeof i);
+}
+
+START_TEST
+(t_kcache_store_lookup)
+{
+    unlink(KEYCACHE);
+    struct keeto_kcache *kcache = NULL;
+    int rc = open_kcache(KEYCACHE, &kcache);
+    ck_assert_int_eq(KEETO_OK, rc);
+    /* the file is shared - open it like another process would */
+    struct keeto_kcache *other_kcache = NULL;
+    rc = open_kcache(KEYCACHE, &other_kcache);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    unsigned char digest[KEETO_KCACHE_DIGEST_SIZE];
+    get_check_kcache_digest(1, digest);
+    struct keeto_kcache_value value = { "ssh-rsa", "AAAAB3NzaC1yc2E", "md5",
+        "sha256" };
+    rc = store_kcache(kcache, digest, &value);
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = store_kcache(other_kcache, digest, &value);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(1, kcache->table->count);
+
+    struct keeto_kcache_value cached = { NULL, NULL, NULL, NULL };
+    rc = lookup_kcache(other_kcache, digest, &cached);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq(value.keytype, cached.keytype);
+    ck_assert_str_eq(value.key, cached.key);
+    ck_assert_str_eq(value.fp_md5, cached.fp_md5);
+    ck_assert_str_eq(value.fp_sha256, cached.fp_sha256);
+    free_kcache_value(&cached);
+
+    get_check_kcache_digest(2, digest);
+    rc = lookup_kcache(other_kcache, digest, &cached);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    close_kcache(other_kcache);
+    close_kcache(kcache);
+}
+END_TEST
+
+START_TEST
+(t_kcache_torn_record)
+{
+    unlink(KEYCACHE);
+    struct keeto_kcache *kcache = NULL;
+    int rc = open_kcache(KEYCACHE, &kcache);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    unsigned char digest[KEETO_KCACHE_DIGEST_SIZE];
+    get_check_kcache_digest(1, digest);
+    struct keeto_kcache_value value = { "ssh-rsa", "AAAAB3NzaC1yc2E", "md5",
+        "sha256" };
+    rc = store_kcache(kcache, digest, &value);
+    ck_assert_int_eq(KEETO_OK, rc);
+    /* damage the payload like a crash while writing would */
+    kcache->table->data[sizeof (struct keeto_kcache_record)] ^= 0xff;
+
+    struct keeto_kcache_value cached = { NULL, NULL, NULL, NULL };
+    rc = lookup_kcache(kcache, digest, &cached);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    /* storing the record again replaces the torn one */
+    rc = store_kcache(kcache, digest, &value);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(1, kcache->table->count);
+    rc = lookup_kcache(kcache, digest, &cached);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq(value.key, cached.key);
+    free_kcache_value(&cached);
+    close_kcache(kcache);
+}
+END_TEST
+
+START_TEST
+(t_kcache_rotate)
+{
+    unlink(KEYCACHE);
+    struct keeto_kcache *kcache = NULL;
+    int rc = open_kcache(KEYCACHE, &kcache);
+    ck_assert_int_eq(KEETO_OK, rc);
+    struct keeto_kcache *other_kcache = NULL;
+    rc = open_kcache(KEYCACHE, &other_kcache);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    size_t key_length = 64 * 1024;
+    char *key = malloc(key_length + 1);
+    ck_assert_ptr_ne(NULL, key);
+    memset(key, 'A', key_length);
+    key[key_length] = '\0';
+    struct keeto_kcache_value value = { "ssh-rsa", key, "md5", "sha256" };
+    size_t record_size = sizeof (struct keeto_kcache_record) +
+        sizeof "ssh-rsa" + key_length + 1 + sizeof "md5" + sizeof "sha256";
+    unsigned int records = KEETO_KCACHE_MAX_SIZE / record_size;
+
+    /* the record that does not fit anymore starts the cache over */
+    unsigned char digest[KEETO_KCACHE_DIGEST_SIZE];
+    for (unsigned int i = 0; i <= records; i++) {
+        get_check_kcache_digest(i, digest);
+        rc = store_kcache(kcache, digest, &value);
+        ck_assert_int_eq(KEETO_OK, rc);
+    }
+    ck_assert_int_eq(1, kcache->table->count);
+    ck_assert_int_eq(record_size, kcache->table->used);
+
+    struct keeto_kcache_value cached = { NULL, NULL, NULL, NULL };
+    get_check_kcache_digest(0, digest);
+    rc = lookup_kcache(other_kcache, digest, &cached);
+    ck_assert_int_eq(KEETO_NO_CACHE_ENTRY, rc);
+    get_check_kcache_digest(records, digest);
+    rc = lookup_kcache(other_kcache, digest, &cached);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_str_eq(key, cached.key);
+    free_kcache_value(&cached);
+
+    free(key);
+    close_kcache(other_kcache);
+    close_kcache(kcache);
+}
+END_TEST
+
+/*
+ * update_keydb() / lookup_keydb()
+ */
+#define KEYDB_SHARD_FILE_SIZE (sizeof KEYSTOREDB + sizeof ".ff.lock")
+
+static void
+remove_check_keydb()
+{
+    for (int i = 0; i < KEETO_KEYDB_SHARDS; i++) {
+        char shard_file[KEYDB_SHARD_FILE_SIZE];
+        snprintf(shard_file, sizeof shard_file, "%s.%02x", KEYSTOREDB, i);
+        unlink(shard_file);
+        strcat(shard_file, ".lock");
+        unlink(shard_file);
+    }
+}
+
+/* returns the number of shard files. ret holds their inodes (or 0) */
+static int
+get_check_keydb_shards(ino_t *ret)
+{
+    int shards = 0;
+    for (int i = 0; i < KEETO_KEYDB_SHARDS; i++) {
+        char shard_file[KEYDB_SHARD_FILE_SIZE];
+        snprintf(shard_file, sizeof shard_file, "%s.%02x", KEYSTOREDB, i);
+        struct stat stat_buffer;
+        ret[i] = 0;
+        if (stat(shard_file, &stat_buffer) == 0) {
+            ret[i] = stat_buffer.st_ino;
+            shards++;
+        }
+    }
+    return shards;
+}
+
+START_TEST
+(t_update_keydb)
+{
+    remove_check_keydb();
+    for (int i = 0; i <= _i; i++) {
+        char *owner = update_keydb_lt[i].owner;
+        char *value = update_keydb_lt[i].value;
+        struct keeto_keydb_entry entry = { owner, strlen(owner), value,
+            value != NULL ? strlen(value) : 0 };
+        int rc = update_keydb(KEYSTOREDB, owner, &entry, value != NULL ? 1 : 0);
+        ck_assert_int_eq(KEETO_OK, rc);
+    }
+
+    /* the last update of an owner determines its value */
+    for (int i = 0; i <= _i; i++) {
+        char *owner = update_keydb_lt[i].owner;
+        char *exp_value = NULL;
+        for (int j = 0; j <= _i; j++) {
+            if (strcmp(owner, update_keydb_lt[j].owner) == 0) {
+                exp_value = update_keydb_lt[j].value;
+            }
+        }
+        struct keeto_keydb *keydb = NULL;
+        int rc = open_keydb(KEYSTOREDB, owner, &keydb);
+        if (rc == KEETO_NO_SUCH_VALUE) {
+            /* the shard of the owner has never been written */
+            ck_assert(exp_value == NULL);
+            continue;
+        }
+        ck_assert_int_eq(KEETO_OK, rc);
+        const char *value = NULL;
+        size_t value_length = 0;
+        rc = lookup_keydb(keydb, owner, strlen(owner), &value, &value_length);
+        if (exp_value == NULL) {
+            ck_assert_int_eq(KEETO_NO_SUCH_VALUE, rc);
+            close_keydb(keydb);
+            continue;
+        }
+        ck_assert_int_eq(KEETO_OK, rc);
+        ck_assert_int_eq(strlen(exp_value), value_length);
+        ck_assert(memcmp(exp_value, value, value_length) == 0);
+        close_keydb(keydb);
+    }
+}
+END_TEST
+
+START_TEST
+(t_update_keydb_owner)
+{
+    remove_check_keydb();
+    /* keys are owned by the part up to the first nul byte */
+    struct keeto_keydb_entry entries[] = {
+        { "alice", 5, "keystore", 8 },
+        { "alice\0fp1", 9, "record1", 7 },
+        { "alice\0fp2", 9, "record2", 7 }
+    };
+    struct keeto_keydb_entry other_entries[] = {
+        { "alice2", 6, "keystore", 8 },
+        { "alic", 4, "keystore", 8 }
+    };
+    int rc = update_keydb(KEYSTOREDB, "alice", entries, 3);
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = update_keydb(KEYSTOREDB, "alice2", &other_entries[0], 1);
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = update_keydb(KEYSTOREDB, "alic", &other_entries[1], 1);
+    ck_assert_int_eq(KEETO_OK, rc);
+    rc = update_keydb(KEYSTOREDB, "alice", entries, 2);
+    ck_assert_int_eq(KEETO_OK, rc);
+
+    struct keeto_keydb *keydb = NULL;
+    rc = open_keydb(KEYSTOREDB, "alice", &keydb);
+    ck_assert_int_eq(KEETO_OK, rc);
+    const char *value = NULL;
+    size_t value_length = 0;
+    rc = lookup_keydb(keydb, "alice\0fp1", 9, &value, &value_length);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(7, value_length);
+    ck_assert(memcmp("record1", value, value_length) == 0);
+    rc = lookup_keydb(keydb, "alice\0fp2", 9, &value, &value_length);
+    ck_assert_int_eq(KEETO_NO_SUCH_VALUE, rc);
+    close_keydb(keydb);
+
+    char *others[] = { "alice2", "alic" };
+    for (int i = 0; i < 2; i++) {
+        rc = open_keydb(KEYSTOREDB, others[i], &keydb);
+        ck_assert_int_eq(KEETO_OK, rc);
+        rc = lookup_keydb(keydb, others[i], strlen(others[i]), &value,
+            &value_length);
+        ck_assert_int_eq(KEETO_OK, rc);
+        close_keydb(keydb);
+    }
+}
+END_TEST
+
+START_TEST
+(t_update_keydb_many)
+{
+    remove_check_keydb();
+    int owners = 1000;
+    for (int i = 0; i < owners; i++) {
+        char owner[16];
+        snprintf(owner, sizeof owner, "user%d", i);
+        struct keeto_keydb_entry entry = { owner, strlen(owner), owner,
+            strlen(owner) };
+        int rc = update_keydb(KEYSTOREDB, owner, &entry, 1);
+        ck_assert_int_eq(KEETO_OK, rc);
+    }
+
+    /* the owners are spread over the shards */
+    ino_t inodes[KEETO_KEYDB_SHARDS];
+    int shards = get_check_keydb_shards(inodes);
+    ck_assert(shards > 1);
+    for (int i = 0; i < owners; i++) {
+        char owner[16];
+        snprintf(owner, sizeof owner, "user%d", i);
+        struct keeto_keydb *keydb = NULL;
+        int rc = open_keydb(KEYSTOREDB, owner, &keydb);
+        ck_assert_int_eq(KEETO_OK, rc);
+        const char *value = NULL;
+        size_t value_length = 0;
+        rc = lookup_keydb(keydb, owner, strlen(owner), &value, &value_length);
+        ck_assert_int_eq(KEETO_OK, rc);
+        ck_assert_int_eq(strlen(owner), value_length);
+        ck_assert(memcmp(owner, value, value_length) == 0);
+        rc = lookup_keydb(keydb, "user", strlen("user"), &value,
+            &value_length);
+        ck_assert_int_eq(KEETO_NO_SUCH_VALUE, rc);
+        close_keydb(keydb);
+    }
+}
+END_TEST
+
+START_TEST
+(t_update_keydb_shard)
+{
+    remove_check_keydb();
+    struct keeto_keydb_entry entries[] = {
+        { "alice", 5, "keystore", 8 },
+        { "alice\0fp1", 9, "record1", 7 }
+    };
+    int rc = update_keydb(KEYSTOREDB, "alice", entries, 2);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ino_t alice_inodes[KEETO_KEYDB_SHARDS];
+    ck_assert_int_eq(1, get_check_keydb_shards(alice_inodes));
+
+    /* find an owner stored in another shard */
+    char owner[16];
+    ino_t inodes[KEETO_KEYDB_SHARDS];
+    for (int i = 0; ; i++) {
+        ck_assert(i < 1000);
+        snprintf(owner, sizeof owner, "user%d", i);
+        struct keeto_keydb_entry entry = { owner, strlen(owner), "keystore",
+            8 };
+        rc = update_keydb(KEYSTOREDB, owner, &entry, 1);
+        ck_assert_int_eq(KEETO_OK, rc);
+        if (get_check_keydb_shards(inodes) == 2) {
+            break;
+        }
+        remove_check_keydb();
+        rc = update_keydb(KEYSTOREDB, "alice", entries, 2);
+        ck_assert_int_eq(KEETO_OK, rc);
+        get_check_keydb_shards(alice_inodes);
+    }
+    /* updating another owner leaves the shard of alice alone */
+    int alice_shard = 0;
+    while (alice_inodes[alice_shard] == 0) {
+        alice_shard++;
+    }
+    ck_assert(inodes[alice_shard] == alice_inodes[alice_shard]);
+
+    /* an unchanged update does not touch the shard */
+    rc = update_keydb(KEYSTOREDB, "alice", entries, 2);
+    ck_assert_int_eq(KEETO_OK, rc);
+    get_check_keydb_shards(inodes);
+    ck_assert(inodes[alice_shard] == alice_inodes[alice_shard]);
+
+    /* a missing, an additional or a changed entry rewrites the shard */
+    struct keeto_keydb_entry changed_entries[] = {
+        { "alice", 5, "keystore", 8 },
+        { "alice\0fp1", 9, "record2", 7 },
+        { "alice\0fp2", 9, "record2", 7 }
+    };
+    size_t counts[] = { 1, 2, 3 };
+    struct keeto_keydb_entry *updates[] = { entries, changed_entries,
+        changed_entries };
+    for (int i = 0; i < 3; i++) {
+        ino_t exp_inodes[KEETO_KEYDB_SHARDS];
+        get_check_keydb_shards(exp_inodes);
+        rc = update_keydb(KEYSTOREDB, "alice", updates[i], counts[i]);
+        ck_assert_int_eq(KEETO_OK, rc);
+        get_check_keydb_shards(inodes);
+        ck_assert(inodes[alice_shard] != exp_inodes[alice_shard]);
+        for (int j = 0; j < KEETO_KEYDB_SHARDS; j++) {
+            ck_assert(j == alice_shard || inodes[j] == exp_inodes[j]);
+        }
+    }
+}
+END_TEST
+
 Suite *
 make_util_suite(void)
 {
@@ -241,6 +1507,14 @@ make_util_suite(void)
     /* check_uid() */
     int check_uid_lt_items = sizeof check_uid_lt / sizeof check_uid_lt[0];
     tcase_add_loop_test(tc_main, t_check_uid, 0, check_uid_lt_items);
+    int check_uid_regex_lt_items = sizeof check_uid_regex_lt /
+        sizeof check_uid_regex_lt[0];
+    tcase_add_loop_test(tc_main, t_check_uid_regex, 0,
+        check_uid_regex_lt_items);
+    tcase_add_test(tc_main, t_check_uid_invalid_regex);
+    tcase_add_test(tc_main, t_check_uid_other_regex);
+    /* validate_uid_regex() */
+    tcase_add_test(tc_main, t_validate_uid_regex);
 
     /* substitute_token() */
     int substitute_token_lt_items = sizeof substitute_token_lt /
@@ -252,6 +1526,77 @@ make_util_suite(void)
         sizeof get_rdn_from_dn_lt[0];
     tcase_add_loop_test(tc_main, t_get_rdn_from_dn, 0, get_rdn_from_dn_lt_items);
 
+    /* normalize_dn() */
+    int normalize_dn_lt_items = sizeof normalize_dn_lt /
+        sizeof normalize_dn_lt[0];
+    tcase_add_loop_test(tc_main, t_normalize_dn, 0, normalize_dn_lt_items);
+
+    /* memo_get() / memo_put() */
+    tcase_add_test(tc_main, t_memo);
+
+    /* get_deadline() / get_remaining_time() */
+    tcase_add_test(tc_main, t_get_remaining_time);
+
+    /* encode_hex() */
+    int encode_hex_lt_items = sizeof encode_hex_lt / sizeof encode_hex_lt[0];
+    tcase_add_loop_test(tc_main, t_encode_hex, 0, encode_hex_lt_items);
+
+    /* encode_base64() */
+    int encode_base64_lt_items = sizeof encode_base64_lt /
+        sizeof encode_base64_lt[0];
+    tcase_add_loop_test(tc_main, t_encode_base64, 0, encode_base64_lt_items);
+
+    /* encode_hex_with_level() / encode_base64_with_level() */
+    int encode_level_lt_items = sizeof encode_level_lt /
+        sizeof encode_level_lt[0];
+    tcase_add_loop_test(tc_main, t_encode_with_level, 0,
+        encode_level_lt_items);
+
+    /* dedupe_keystore_records() */
+    int dedupe_keystore_records_lt_items = sizeof dedupe_keystore_records_lt /
+        sizeof dedupe_keystore_records_lt[0];
+    tcase_add_loop_test(tc_main, t_dedupe_keystore_records, 0,
+        dedupe_keystore_records_lt_items);
+
+    /* limit_keystore_records() */
+    tcase_add_test(tc_main, t_limit_keystore_records);
+
+    /* format_expiry_time() / parse_expiry_time() */
+    tcase_add_test(tc_main, t_format_expiry_time);
+    int parse_expiry_time_neg_lt_items = sizeof parse_expiry_time_neg_lt /
+        sizeof parse_expiry_time_neg_lt[0];
+    tcase_add_loop_test(tc_main, t_parse_expiry_time_neg, 0,
+        parse_expiry_time_neg_lt_items);
+    tcase_add_test(tc_main, t_get_keystore_records_expiry);
+
+    /* allow_breaker_request() / record_breaker_*() */
+    int breaker_lt_items = sizeof breaker_lt / sizeof breaker_lt[0];
+    tcase_add_loop_test(tc_main, t_breaker, 0, breaker_lt_items);
+    tcase_add_test(tc_main, t_breaker_shared);
+
+    /* get_health_score() / record_health_*() */
+    int health_ewma_lt_items = sizeof health_ewma_lt /
+        sizeof health_ewma_lt[0];
+    tcase_add_loop_test(tc_main, t_health_ewma, 0, health_ewma_lt_items);
+    int health_decay_lt_items = sizeof health_decay_lt /
+        sizeof health_decay_lt[0];
+    tcase_add_loop_test(tc_main, t_health_decay, 0, health_decay_lt_items);
+    tcase_add_test(tc_main, t_health_recovery);
+    tcase_add_test(tc_main, t_health_order);
+    tcase_add_test(tc_main, t_health_replace_oldest);
+    /* store_kcache() / lookup_kcache() */
+    tcase_add_test(tc_main, t_kcache_store_lookup);
+    tcase_add_test(tc_main, t_kcache_torn_record);
+    tcase_add_test(tc_main, t_kcache_rotate);
+
+    /* update_keydb() / lookup_keydb() */
+    int update_keydb_lt_items = sizeof update_keydb_lt /
+        sizeof update_keydb_lt[0];
+    tcase_add_loop_test(tc_main, t_update_keydb, 0, update_keydb_lt_items);
+    tcase_add_test(tc_main, t_update_keydb_owner);
+    tcase_add_test(tc_main, t_update_keydb_many);
+    tcase_add_test(tc_main, t_update_keydb_shard);
+
     return s;
 }
 
@@ -35,6 +35,12 @@ struct keeto_check_uid_entry {
     bool exp_result;
 };
 
+struct keeto_check_uid_regex_entry {
+    char *regex;
+    char *uid;
+    bool exp_result;
+};
+
 struct keeto_substitute_token_entry {
     char token;
     char *subst;
@@ -49,6 +55,70 @@ struct keeto_get_rdn_from_dn_entry {
     char *exp_result;
 };
 
+struct keeto_normalize_dn_entry {
+    char *dn;
+    int exp_res;
+    char *exp_result;
+};
+
+struct keeto_encode_hex_entry {
+    char *src;
+    char delimiter;
+    char *exp_result;
+};
+
+struct keeto_encode_base64_entry {
+    char *src;
+    bool pad;
+    char *exp_result;
+};
+
+struct keeto_update_keydb_entry {
+    char *owner;
+    /* NULL removes the entries of owner */
+    char *value;
+};
+
+#define DEDUPE_MAX_RECORDS 4
+
+/* records end at the first record without ssh_key */
+struct keeto_dedupe_record {
+    char *ssh_key;
+    char *uid;
+    char *command_option;
+    char *from_option;
+    char *expiry_time_option;
+};
+
+struct keeto_dedupe_keystore_records_entry {
+    struct keeto_dedupe_record records[DEDUPE_MAX_RECORDS];
+    struct keeto_dedupe_record exp_records[DEDUPE_MAX_RECORDS];
+};
+
+#define HEALTH_MAX_SAMPLES 4
+
+/* samples end at the first 0 */
+struct keeto_health_ewma_entry {
+    unsigned long samples[HEALTH_MAX_SAMPLES];
+    unsigned long exp_score;
+};
+
+struct keeto_health_decay_entry {
+    /* seconds since the last failure */
+    int elapsed;
+    unsigned long exp_score;
+};
+
+/*
+ * events: 'f' failure, 's' success, 'r' request and 'i' interval
+ * passed. exp_state is checked before exp_allow.
+ */
+struct keeto_breaker_entry {
+    char *events;
+    int exp_state;
+    bool exp_allow;
+};
+
 Suite *make_util_suite(void);
 
 #endif /* KEETO_CHECK_UTIL_H */
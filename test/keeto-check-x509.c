@@ -23,23 +23,54 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <check.h>
+#include <openssl/asn1.h>
+#include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <openssl/ossl_typ.h>
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 
+#include "../src/keeto-crl.h"
 #include "../src/keeto-openssl.h"
 #include "../src/keeto-x509.c"
 
 #define BUFFER_SIZE 4096
+#define STAMP_DIR "cert_store_stamp"
 
 static struct keeto_get_ssh_key_fp_entry keeto_get_ssh_key_fp_entry_lt[] = {
     { "md5", KEETO_DIGEST_MD5 },
     { "sha256", KEETO_DIGEST_SHA256 }
 };
 
+/* hash values of the crl's in the cert store */
+static char *crl_index_lt[] = {
+    "2b6fe42f",
+    "4afa65f8",
+    "6a9578bd"
+};
+
+/* the directory mtime is reset after every change */
+static struct keeto_cert_store_stamp_entry cert_store_stamp_lt[] = {
+    { CERT_STORE_UNCHANGED, false },
+    { CERT_STORE_OVERWRITTEN, true },
+    { CERT_STORE_REPOINTED, true },
+    { CERT_STORE_REMOVED, true }
+};
+
+/* hashed names are followed - the crl's are only used as link targets */
+static char *stamp_dir_files[] = {
+    "crl-a.pem",
+    "crl-b.pem",
+    "0a1b2c3d.0",
+    "0a1b2c3d.r0"
+};
+
 static struct keeto_validate_x509_entry validate_x509_no_crl_check_lt[] = {
     { X509CERTSDIR "/revoked.pem", true },
     { X509CERTSDIR "/trusted-ca-expired.pem", false },
@@ -75,7 +106,7 @@ void
 setup_validate_x509_no_crl_check()
 {
     init_openssl();
-    int rc = init_cert_store(CERTSTOREDIR, false);
+    int rc = init_cert_store(CERTSTOREDIR, false, false, NULL);
     if (rc != KEETO_OK) {
         ck_abort_msg("failed to initialize cert store (%s)",
             keeto_strerror(rc));
@@ -86,16 +117,127 @@ void
 setup_validate_x509_crl_check()
 {
     init_openssl();
-    int rc = init_cert_store(CERTSTOREDIR, true);
+    int rc = init_cert_store(CERTSTOREDIR, true, false, NULL);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize cert store (%s)",
+            keeto_strerror(rc));
+    }
+}
+
+void
+setup_validate_x509_crl_check_preloaded()
+{
+    init_openssl();
+    int rc = init_cert_store(CERTSTOREDIR, true, true, NULL);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize cert store (%s)",
+            keeto_strerror(rc));
+    }
+}
+
+void
+setup_validate_x509_crl_check_snapshot()
+{
+    init_openssl();
+    unlink(CERTSTORESNAPSHOT);
+    /* first initialization writes the snapshot - second one loads it */
+    int rc = init_cert_store(CERTSTOREDIR, true, true, CERTSTORESNAPSHOT);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize cert store (%s)",
+            keeto_strerror(rc));
+    }
+    free_cert_store();
+    rc = init_cert_store(CERTSTOREDIR, true, true, CERTSTORESNAPSHOT);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize cert store from snapshot (%s)",
+            keeto_strerror(rc));
+    }
+}
+
+void
+setup_validate_x509_crl_check_cached()
+{
+    init_openssl();
+    int rc = init_cert_store(CERTSTOREDIR, true, false, NULL);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize cert store (%s)",
+            keeto_strerror(rc));
+    }
+    unlink(VALIDATIONCACHE);
+    rc = init_validation_cache(VALIDATIONCACHE, 3600);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize validation cache (%s)",
+            keeto_strerror(rc));
+    }
+}
+
+static void
+write_check_crl_index(const char *hash)
+{
+    char crl_path[BUFFER_SIZE];
+    snprintf(crl_path, sizeof crl_path, "%s/%s.r0", CERTSTOREDIR, hash);
+    FILE *crl_file = fopen(crl_path, "r");
+    if (crl_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", crl_path, strerror(errno));
+    }
+    X509_CRL *crl = PEM_read_X509_CRL(crl_file, NULL, NULL, NULL);
+    fclose(crl_file);
+    if (crl == NULL) {
+        ck_abort_msg("failed to read crl from pem file '%s'", crl_path);
+    }
+    char index_path[BUFFER_SIZE];
+    snprintf(index_path, sizeof index_path, "%s/%s.i0", CRLINDEXDIR, hash);
+    int rc = write_crl_index(crl, true, index_path);
+    X509_CRL_free(crl);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to write crl index (%s)", keeto_strerror(rc));
+    }
+}
+
+void
+setup_validate_x509_crl_index()
+{
+    init_openssl();
+    int rc = init_cert_store(CERTSTOREDIR, false, false, NULL);
     if (rc != KEETO_OK) {
         ck_abort_msg("failed to initialize cert store (%s)",
             keeto_strerror(rc));
     }
+    rc = mkdir(CRLINDEXDIR, S_IRWXU);
+    if (rc == -1 && errno != EEXIST) {
+        ck_abort_msg("failed to create '%s' (%s)", CRLINDEXDIR,
+            strerror(errno));
+    }
+    for (size_t i = 0; i < sizeof crl_index_lt / sizeof crl_index_lt[0];
+        i++) {
+
+        write_check_crl_index(crl_index_lt[i]);
+    }
+    rc = init_crl_index(CRLINDEXDIR);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize crl index (%s)",
+            keeto_strerror(rc));
+    }
+}
+
+void
+setup_key_data_from_x509_cached()
+{
+    init_openssl();
+    unlink(KEYCACHE);
+    int rc = init_key_cache(KEYCACHE);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to initialize key cache (%s)",
+            keeto_strerror(rc));
+    }
 }
 
 void
 teardown()
 {
+    free_key_cache();
+    free_validation_cache();
+    free_crl_index();
     free_cert_store();
     cert_store = NULL;
     cleanup_openssl();
@@ -151,36 +293,26 @@ START_TEST
             fclose(keystore_records_file);
             ck_abort_msg("failed to obtain rsa key");
         }
-        /* get ssh key blob */
-        unsigned char *blob = NULL;
-        size_t blob_length;
-        int rc = get_ssh_key_blob_from_rsa(ssh_keytype, rsa, &blob, &blob_length);
-        if (rc != KEETO_OK) {
-            RSA_free(rsa);
-            EVP_PKEY_free(pkey);
-            fclose(keystore_records_file);
-            ck_abort_msg("failed to obtain ssh key blob from rsa (%s)",
-                keeto_strerror(rc));
-        }
-        char *ssh_key = NULL;
-        rc = blob_to_base64(blob, blob_length, &ssh_key);
+        /* encode ssh key */
+        unsigned char arena[BUFFER_SIZE * 2];
+        struct keeto_ssh_key_encoding encoding;
+        ck_assert(get_ssh_key_encoding_size(ssh_keytype, rsa) <=
+            sizeof arena);
+        int rc = encode_ssh_key_from_rsa(ssh_keytype, rsa, arena,
+            sizeof arena, &encoding);
         if (rc != KEETO_OK) {
-            free(blob);
             RSA_free(rsa);
             EVP_PKEY_free(pkey);
             fclose(keystore_records_file);
-            ck_abort_msg("failed to base64 encode ssh key (%s)",
-                keeto_strerror(rc));
+            ck_abort_msg("failed to encode ssh key (%s)", keeto_strerror(rc));
         }
         char keystore_record[BUFFER_SIZE];
         snprintf(keystore_record, sizeof keystore_record, "%s %s", ssh_keytype,
-            ssh_key);
+            encoding.key);
         ck_assert_str_eq(exp_keystore_record, keystore_record);
 
-        free(blob);
         RSA_free(rsa);
         EVP_PKEY_free(pkey);
-        free(ssh_key);
     }
     fclose(keystore_records_file);
 }
@@ -241,39 +373,80 @@ START_TEST
             fclose(fingerprints_file);
             ck_abort_msg("failed to obtain rsa key");
         }
-        /* get ssh key blob */
-        unsigned char *blob = NULL;
-        size_t blob_length;
-        int rc = get_ssh_key_blob_from_rsa(ssh_keytype, rsa, &blob, &blob_length);
+        /* encode ssh key */
+        unsigned char arena[BUFFER_SIZE * 2];
+        struct keeto_ssh_key_encoding encoding;
+        ck_assert(get_ssh_key_encoding_size(ssh_keytype, rsa) <=
+            sizeof arena);
+        int rc = encode_ssh_key_from_rsa(ssh_keytype, rsa, arena,
+            sizeof arena, &encoding);
         if (rc != KEETO_OK) {
             RSA_free(rsa);
             EVP_PKEY_free(pkey);
             fclose(fingerprints_file);
-            ck_abort_msg("failed to obtain ssh key blob from rsa (%s)",
-                keeto_strerror(rc));
-        }
-        char *fingerprint = NULL;
-        rc = get_ssh_key_fingerprint_from_blob(blob, blob_length, algo,
-            &fingerprint);
-        if (rc != KEETO_OK) {
-            free(blob);
-            RSA_free(rsa);
-            EVP_PKEY_free(pkey);
-            fclose(fingerprints_file);
-            ck_abort_msg("failed to obtain fingerprint for ssh key (%s)",
-                keeto_strerror(rc));
+            ck_abort_msg("failed to encode ssh key (%s)", keeto_strerror(rc));
         }
+        char *fingerprint = algo == KEETO_DIGEST_MD5 ? encoding.fp_md5 :
+            encoding.fp_sha256;
         ck_assert_str_eq(exp_fingerprint, fingerprint);
 
-        free(blob);
         RSA_free(rsa);
         EVP_PKEY_free(pkey);
-        free(fingerprint);
     }
     fclose(fingerprints_file);
 }
 END_TEST
 
+static void
+get_check_digest(X509 *x509, struct keeto_x509_digest *ret)
+{
+    struct keeto_key key = { .x509 = x509 };
+    get_key_digest(&key, ret);
+    if (!ret->valid) {
+        ck_abort_msg("failed to obtain certificate digest");
+    }
+}
+
+/*
+ * get_key_digest()
+ */
+START_TEST
+(t_get_key_digest)
+{
+    char *x509_path = validate_x509_no_crl_check_lt[_i].file;
+
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        fclose(x509_file);
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+    fclose(x509_file);
+
+    /* the digest of the der encoding equals the one of the certificate */
+    unsigned char *der = NULL;
+    int der_length = i2d_X509(x509, &der);
+    if (der_length <= 0) {
+        free_x509(x509);
+        ck_abort_msg("failed to encode certificate");
+    }
+    struct keeto_key key = { .der = der, .der_length = der_length };
+    struct keeto_x509_digest digest;
+    get_key_digest(&key, &digest);
+    struct keeto_x509_digest exp_digest;
+    get_check_digest(x509, &exp_digest);
+    ck_assert(digest.valid);
+    ck_assert_int_eq(0, memcmp(exp_digest.data, digest.data,
+        sizeof digest.data));
+    OPENSSL_free(der);
+    free_x509(x509);
+}
+END_TEST
+
 /*
  * validate_x509()
  */
@@ -297,7 +470,9 @@ START_TEST
     }
     fclose(x509_file);
 
-    int rc = validate_x509(x509, &valid);
+    struct keeto_x509_digest digest;
+    get_check_digest(x509, &digest);
+    int rc = validate_x509(x509, &digest, &valid);
     if (rc != KEETO_OK) {
         free_x509(x509);
         ck_abort_msg("failed to validate certificate (%s)", keeto_strerror(rc));
@@ -328,7 +503,9 @@ START_TEST
     }
     fclose(x509_file);
 
-    int rc = validate_x509(x509, &valid);
+    struct keeto_x509_digest digest;
+    get_check_digest(x509, &digest);
+    int rc = validate_x509(x509, &digest, &valid);
     if (rc != KEETO_OK) {
         free_x509(x509);
         ck_abort_msg("failed to validate certificate (%s)", keeto_strerror(rc));
@@ -339,6 +516,462 @@ START_TEST
 }
 END_TEST
 
+/*
+ * is_crl_index_outdated()
+ */
+START_TEST
+(t_is_crl_index_outdated)
+{
+    ck_assert_int_eq(false, is_crl_index_outdated(CRLINDEXDIR));
+    ck_assert_int_eq(true, is_crl_index_outdated(CERTSTOREDIR));
+
+    /* rewritten like keeto-crl-compile does */
+    write_check_crl_index(crl_index_lt[0]);
+    ck_assert_int_eq(true, is_crl_index_outdated(CRLINDEXDIR));
+
+    int rc = init_crl_index(CRLINDEXDIR);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(false, is_crl_index_outdated(CRLINDEXDIR));
+}
+END_TEST
+
+/*
+ * lookup_crl_index()
+ */
+START_TEST
+(t_lookup_crl_index_long_serial)
+{
+    char index_path[BUFFER_SIZE];
+    snprintf(index_path, sizeof index_path, "%s/%s.i0", CRLINDEXDIR,
+        crl_index_lt[0]);
+    struct keeto_crl_index *index = NULL;
+    int rc = open_crl_index(index_path, &index);
+    if (rc != KEETO_OK) {
+        ck_abort_msg("failed to open crl index (%s)", keeto_strerror(rc));
+    }
+    BIGNUM *bn = BN_new();
+    ASN1_INTEGER *serial = ASN1_INTEGER_new();
+    if (bn == NULL || serial == NULL) {
+        ck_abort_msg("failed to allocate serial number");
+    }
+
+    /* 20 octets (the maximum allowed by rfc 5280) */
+    bool revoked = true;
+    BN_set_bit(bn, 20 * 8 - 2);
+    BN_to_ASN1_INTEGER(bn, serial);
+    rc = lookup_crl_index(index, serial, &revoked);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(false, revoked);
+
+    /* the revocation status of a serial without key is unknown */
+    BN_set_bit(bn, 24 * 8);
+    BN_to_ASN1_INTEGER(bn, serial);
+    rc = lookup_crl_index(index, serial, &revoked);
+    ck_assert_int_eq(KEETO_X509_ERR, rc);
+
+    ASN1_INTEGER_free(serial);
+    BN_free(bn);
+    close_crl_index(index);
+}
+END_TEST
+
+static struct keeto_prevalidate_x509_entry prevalidate_x509_lt[] = {
+    { X509CERTSDIR "/not-yet-valid.pem", false, KEETO_X509_NOT_YET_VALID },
+    { X509CERTSDIR "/revoked.pem", true, KEETO_X509_ACCEPTED },
+    { X509CERTSDIR "/trusted-ca-expired.pem", false, KEETO_X509_EXPIRED },
+    { X509CERTSDIR "/trusted-ca-wrong-ku-non-critical.pem", false,
+        KEETO_X509_WRONG_KEY_USAGE },
+    { X509CERTSDIR "/trusted-ca-wrong-ku.pem", false,
+        KEETO_X509_WRONG_KEY_USAGE },
+    { X509CERTSDIR "/trusted-ca-wrong-xku-non-critical.pem", false,
+        KEETO_X509_WRONG_KEY_USAGE },
+    { X509CERTSDIR "/trusted-ca-wrong-xku.pem", false,
+        KEETO_X509_WRONG_KEY_USAGE },
+    { X509CERTSDIR "/unknown-issuer.pem", false, KEETO_X509_ACCEPTED },
+    { X509CERTSDIR "/unknown-issuer.pem", true, KEETO_X509_UNKNOWN_ISSUER },
+    { X509CERTSDIR "/unsupported-key-type.pem", false,
+        KEETO_X509_UNSUPPORTED_KEY_TYPE },
+    { X509CERTSDIR "/valid1.pem", true, KEETO_X509_ACCEPTED },
+    { X509CERTSDIR "/valid2.pem", true, KEETO_X509_ACCEPTED },
+    { X509CERTSDIR "/valid3.pem", true, KEETO_X509_ACCEPTED },
+    { X509CERTSDIR "/valid4.pem", true, KEETO_X509_ACCEPTED }
+};
+
+START_TEST
+(t_validate_x509_crl_check_cached)
+{
+    char *x509_path = validate_x509_crl_check_lt[_i].file;
+    bool exp_result = validate_x509_crl_check_lt[_i].exp_result;
+
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        fclose(x509_file);
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+    fclose(x509_file);
+
+    /* second validation is answered by the validation cache if valid */
+    struct keeto_x509_digest digest;
+    get_check_digest(x509, &digest);
+    for (int i = 0; i < 2; i++) {
+        bool valid = false;
+        int rc = validate_x509(x509, &digest, &valid);
+        if (rc != KEETO_OK) {
+            free_x509(x509);
+            ck_abort_msg("failed to validate certificate (%s)",
+                keeto_strerror(rc));
+        }
+        ck_assert_int_eq(exp_result, valid);
+    }
+    free_x509(x509);
+}
+END_TEST
+
+/*
+ * add_key_data_from_x509()
+ */
+START_TEST
+(t_add_key_data_from_x509_cached)
+{
+    char *x509_path = validate_x509_no_crl_check_lt[_i].file;
+
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        fclose(x509_file);
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+    fclose(x509_file);
+
+    struct keeto_key *exp_key = new_key();
+    if (exp_key == NULL) {
+        free_x509(x509);
+        ck_abort_msg("failed to allocate memory for key buffer");
+    }
+    int rc = derive_key_data_from_x509(x509, exp_key);
+    if (rc != KEETO_OK) {
+        free_key(exp_key);
+        free_x509(x509);
+        ck_abort_msg("failed to derive key data (%s)", keeto_strerror(rc));
+    }
+    struct keeto_x509_digest digest;
+    get_check_digest(x509, &digest);
+
+    /*
+     * the first run stores the key data. the second run looks it up in
+     * memory and the third one in the reopened key cache file.
+     */
+    for (int i = 0; i < 3; i++) {
+        if (i == 2) {
+            free_key_cache();
+            rc = init_key_cache(KEYCACHE);
+            ck_assert_int_eq(KEETO_OK, rc);
+        }
+        struct keeto_key *key = new_key();
+        if (key == NULL) {
+            free_key(exp_key);
+            free_x509(x509);
+            ck_abort_msg("failed to allocate memory for key buffer");
+        }
+        rc = add_key_data_from_x509(x509, &digest, key);
+        ck_assert_int_eq(KEETO_OK, rc);
+        ck_assert_str_eq(exp_key->ssh_key->keytype, key->ssh_key->keytype);
+        ck_assert_str_eq(exp_key->ssh_key->key, key->ssh_key->key);
+        ck_assert_str_eq(exp_key->ssh_key_fp_md5, key->ssh_key_fp_md5);
+        ck_assert_str_eq(exp_key->ssh_key_fp_sha256, key->ssh_key_fp_sha256);
+        free_key(key);
+    }
+    free_key(exp_key);
+    free_x509(x509);
+}
+END_TEST
+
+/*
+ * prevalidate_x509()
+ */
+START_TEST
+(t_prevalidate_x509)
+{
+    char *x509_path = prevalidate_x509_lt[_i].file;
+    bool check_issuer = prevalidate_x509_lt[_i].check_issuer;
+    enum keeto_x509_reject exp_result = prevalidate_x509_lt[_i].exp_result;
+
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        fclose(x509_file);
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+    fclose(x509_file);
+
+    enum keeto_x509_reject result = prevalidate_x509(x509, check_issuer);
+    ck_assert_int_eq(exp_result, result);
+    free_x509(x509);
+}
+END_TEST
+
+/*
+ * decode_key_x509()
+ */
+START_TEST
+(t_decode_key_x509)
+{
+    char *x509_path = validate_x509_no_crl_check_lt[_i].file;
+
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        fclose(x509_file);
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+    fclose(x509_file);
+
+    unsigned char *der = NULL;
+    int der_length = i2d_X509(x509, &der);
+    if (der_length <= 0) {
+        free_x509(x509);
+        ck_abort_msg("failed to encode x509 from pem file '%s'", x509_path);
+    }
+
+    struct keeto_key *key = new_key();
+    if (key == NULL) {
+        OPENSSL_free(der);
+        free_x509(x509);
+        ck_abort_msg("failed to allocate memory for key buffer");
+    }
+    key->der = der;
+    key->der_length = der_length;
+
+    /* decoded certificate is released again */
+    int rc = decode_key_x509(key, NULL, NULL);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(0, X509_cmp(x509, key->x509));
+    release_key_x509(key);
+    ck_assert_ptr_eq(NULL, key->x509);
+
+    /* truncated certificate */
+    key->der_length = der_length / 2;
+    rc = decode_key_x509(key, NULL, NULL);
+    ck_assert_int_eq(KEETO_X509_ERR, rc);
+    ck_assert_ptr_eq(NULL, key->x509);
+
+    free_key(key);
+    OPENSSL_free(der);
+    free_x509(x509);
+}
+END_TEST
+
+START_TEST
+(t_decode_key_x509_memo)
+{
+    char *x509_path = validate_x509_no_crl_check_lt[_i].file;
+
+    FILE *x509_file = fopen(x509_path, "r");
+    if (x509_file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", x509_path, strerror(errno));
+    }
+    X509 *x509 = PEM_read_X509(x509_file, NULL, NULL, NULL);
+    fclose(x509_file);
+    if (x509 == NULL) {
+        ck_abort_msg("failed to read x509 from pem file '%s'", x509_path);
+    }
+    unsigned char *der = NULL;
+    int der_length = i2d_X509(x509, &der);
+    ck_assert(der_length > 0);
+    /* a copy of the der encoding as held by another ldap entry */
+    unsigned char *der_copy = malloc(der_length);
+    ck_assert(NULL != der_copy);
+    memcpy(der_copy, der, der_length);
+
+    struct keeto_x509_memo *x509_memo = new_x509_memo();
+    ck_assert(NULL != x509_memo);
+    struct keeto_key *keys[2] = { new_key(), new_key() };
+    ck_assert(NULL != keys[0] && NULL != keys[1]);
+    keys[0]->der = der;
+    keys[0]->der_length = der_length;
+    keys[1]->der = der_copy;
+    keys[1]->der_length = der_length;
+
+    /* the certificate is decoded once and shared */
+    struct keeto_x509_digest digest;
+    for (int i = 0; i < 2; i++) {
+        get_key_digest(keys[i], &digest);
+        int rc = decode_key_x509(keys[i], &digest, x509_memo);
+        ck_assert_int_eq(KEETO_OK, rc);
+        ck_assert_int_eq(0, X509_cmp(x509, keys[i]->x509));
+    }
+    ck_assert_ptr_eq(keys[0]->x509, keys[1]->x509);
+    ck_assert_int_eq(1, x509_memo->memo->hits);
+
+    /* the memo keeps the certificate until it is freed */
+    release_key_x509(keys[0]);
+    ck_assert_ptr_eq(NULL, keys[0]->x509);
+    get_key_digest(keys[0], &digest);
+    int rc = decode_key_x509(keys[0], &digest, x509_memo);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_ptr_eq(keys[0]->x509, keys[1]->x509);
+    release_key_x509(keys[0]);
+    release_key_x509(keys[1]);
+
+    /* undecodable certificates are not memoized */
+    keys[1]->der_length = der_length / 2;
+    get_key_digest(keys[1], &digest);
+    rc = decode_key_x509(keys[1], &digest, x509_memo);
+    ck_assert_int_eq(KEETO_X509_ERR, rc);
+    ck_assert_ptr_eq(NULL, keys[1]->x509);
+    rc = decode_key_x509(keys[1], &digest, x509_memo);
+    ck_assert_int_eq(KEETO_X509_ERR, rc);
+
+    free_x509_memo(x509_memo);
+    free_key(keys[0]);
+    free_key(keys[1]);
+    free(der_copy);
+    OPENSSL_free(der);
+    free_x509(x509);
+}
+END_TEST
+
+/*
+ * get_cert_store_stamp() / get_cert_store_dir_hashes()
+ */
+static void
+write_stamp_dir_file(const char *name, const char *content)
+{
+    char path[BUFFER_SIZE];
+    snprintf(path, sizeof path, "%s/%s", STAMP_DIR, name);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        ck_abort_msg("failed to open '%s' (%s)", path, strerror(errno));
+    }
+    fputs(content, file);
+    fclose(file);
+}
+
+static void
+reset_stamp_dir_times(void)
+{
+    struct timespec times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    for (size_t i = 0; i < sizeof stamp_dir_files / sizeof stamp_dir_files[0];
+        i++) {
+
+        char path[BUFFER_SIZE];
+        snprintf(path, sizeof path, "%s/%s", STAMP_DIR, stamp_dir_files[i]);
+        utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+    }
+    int rc = utimensat(AT_FDCWD, STAMP_DIR, times, 0);
+    if (rc == -1) {
+        ck_abort_msg("failed to set times of '%s' (%s)", STAMP_DIR,
+            strerror(errno));
+    }
+}
+
+static void
+create_stamp_dir(void)
+{
+    for (size_t i = 0; i < sizeof stamp_dir_files / sizeof stamp_dir_files[0];
+        i++) {
+
+        char path[BUFFER_SIZE];
+        snprintf(path, sizeof path, "%s/%s", STAMP_DIR, stamp_dir_files[i]);
+        unlink(path);
+    }
+    int rc = mkdir(STAMP_DIR, S_IRWXU);
+    if (rc == -1 && errno != EEXIST) {
+        ck_abort_msg("failed to create '%s' (%s)", STAMP_DIR,
+            strerror(errno));
+    }
+    write_stamp_dir_file("crl-a.pem", "a");
+    write_stamp_dir_file("crl-b.pem", "b");
+    write_stamp_dir_file("0a1b2c3d.0", "c");
+    rc = symlink("crl-a.pem", STAMP_DIR "/0a1b2c3d.r0");
+    if (rc == -1) {
+        ck_abort_msg("failed to create symlink (%s)", strerror(errno));
+    }
+    reset_stamp_dir_times();
+}
+
+static void
+get_check_stamps(struct keeto_cert_store_stamp *stamp,
+    struct keeto_cert_store_stamp *dir_stamp, uint64_t *generation)
+{
+    int rc = get_cert_store_stamp(STAMP_DIR, stamp);
+    ck_assert_int_eq(KEETO_OK, rc);
+    unsigned long *hashes = NULL;
+    size_t count = 0;
+    rc = get_cert_store_dir_hashes(STAMP_DIR, dir_stamp, &hashes, &count);
+    ck_assert_int_eq(KEETO_OK, rc);
+    ck_assert_int_eq(1, count);
+    ck_assert(hashes[0] == 0x0a1b2c3dUL);
+    free(hashes);
+    rc = init_cert_store(STAMP_DIR, false, false, NULL);
+    ck_assert_int_eq(KEETO_OK, rc);
+    *generation = get_validation_generation();
+}
+
+START_TEST
+(t_get_cert_store_stamp)
+{
+    enum keeto_cert_store_change change = cert_store_stamp_lt[_i].change;
+    bool exp_changed = cert_store_stamp_lt[_i].exp_changed;
+
+    init_openssl();
+    create_stamp_dir();
+    struct keeto_cert_store_stamp stamp, dir_stamp;
+    uint64_t generation;
+    get_check_stamps(&stamp, &dir_stamp, &generation);
+    /* the lazy and the preloaded cert store share the stamp */
+    ck_assert_int_eq(0, memcmp(&stamp, &dir_stamp, sizeof stamp));
+    ck_assert_int_eq(false, is_cert_store_outdated(STAMP_DIR, false));
+
+    switch (change) {
+    case CERT_STORE_UNCHANGED:
+        break;
+    case CERT_STORE_OVERWRITTEN:
+        write_stamp_dir_file("0a1b2c3d.0", "d");
+        break;
+    case CERT_STORE_REPOINTED:
+        unlink(STAMP_DIR "/0a1b2c3d.r0");
+        ck_assert_int_eq(0, symlink("crl-b.pem", STAMP_DIR "/0a1b2c3d.r0"));
+        break;
+    case CERT_STORE_REMOVED:
+        unlink(STAMP_DIR "/0a1b2c3d.r0");
+        break;
+    }
+    reset_stamp_dir_times();
+    if (change == CERT_STORE_OVERWRITTEN) {
+        struct timespec times[2] = { { 1000000001, 0 }, { 1000000001, 0 } };
+        utimensat(AT_FDCWD, STAMP_DIR "/0a1b2c3d.0", times, 0);
+    }
+
+    ck_assert_int_eq(exp_changed, is_cert_store_outdated(STAMP_DIR, false));
+    struct keeto_cert_store_stamp new_stamp, new_dir_stamp;
+    uint64_t new_generation;
+    get_check_stamps(&new_stamp, &new_dir_stamp, &new_generation);
+    ck_assert_int_eq(0, memcmp(&new_stamp, &new_dir_stamp, sizeof new_stamp));
+    ck_assert_int_eq(exp_changed,
+        memcmp(&stamp, &new_stamp, sizeof stamp) != 0);
+    ck_assert_int_eq(exp_changed, generation != new_generation);
+    free_cert_store();
+}
+END_TEST
+
 Suite *
 make_x509_suite(void)
 {
@@ -347,11 +980,31 @@ make_x509_suite(void)
     TCase *tc_validate_x509_no_crl_check =
         tcase_create("validate_x509_no_crl_check");
     TCase *tc_validate_x509_crl_check = tcase_create("validate_x509_crl_check");
+    TCase *tc_validate_x509_crl_check_preloaded =
+        tcase_create("validate_x509_crl_check_preloaded");
+    TCase *tc_validate_x509_crl_check_snapshot =
+        tcase_create("validate_x509_crl_check_snapshot");
+    TCase *tc_validate_x509_crl_check_cached =
+        tcase_create("validate_x509_crl_check_cached");
+    TCase *tc_validate_x509_crl_index = tcase_create("validate_x509_crl_index");
+    TCase *tc_key_data_from_x509_cached =
+        tcase_create("key_data_from_x509_cached");
+    TCase *tc_decode_key_x509 = tcase_create("decode_key_x509");
+    TCase *tc_prevalidate_x509 = tcase_create("prevalidate_x509");
+    TCase *tc_cert_store_stamp = tcase_create("cert_store_stamp");
 
     /* add test cases to suite */
     suite_add_tcase(s, tc_ssh_key_from_rsa);
     suite_add_tcase(s, tc_validate_x509_no_crl_check);
     suite_add_tcase(s, tc_validate_x509_crl_check);
+    suite_add_tcase(s, tc_validate_x509_crl_check_preloaded);
+    suite_add_tcase(s, tc_validate_x509_crl_check_snapshot);
+    suite_add_tcase(s, tc_validate_x509_crl_check_cached);
+    suite_add_tcase(s, tc_validate_x509_crl_index);
+    suite_add_tcase(s, tc_key_data_from_x509_cached);
+    suite_add_tcase(s, tc_decode_key_x509);
+    suite_add_tcase(s, tc_prevalidate_x509);
+    suite_add_tcase(s, tc_cert_store_stamp);
 
     /*
      * ssh key from rsa test cases
@@ -394,6 +1047,102 @@ make_x509_suite(void)
     tcase_add_loop_test(tc_validate_x509_crl_check, t_validate_x509_crl_check,
         0, validate_x509_crl_check_lt_items);
 
+    /*
+     * validate x509 - crl check with preloaded cert store test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_validate_x509_crl_check_preloaded,
+        setup_validate_x509_crl_check_preloaded, teardown);
+    /* validate_x509() */
+    tcase_add_loop_test(tc_validate_x509_crl_check_preloaded,
+        t_validate_x509_crl_check, 0, validate_x509_crl_check_lt_items);
+
+    /*
+     * validate x509 - crl check with cert store snapshot test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_validate_x509_crl_check_snapshot,
+        setup_validate_x509_crl_check_snapshot, teardown);
+    /* validate_x509() */
+    tcase_add_loop_test(tc_validate_x509_crl_check_snapshot,
+        t_validate_x509_crl_check, 0, validate_x509_crl_check_lt_items);
+
+    /*
+     * validate x509 - crl check with validation cache test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_validate_x509_crl_check_cached,
+        setup_validate_x509_crl_check_cached, teardown);
+    /* validate_x509() */
+    tcase_add_loop_test(tc_validate_x509_crl_check_cached,
+        t_validate_x509_crl_check_cached, 0, validate_x509_crl_check_lt_items);
+
+    /*
+     * validate x509 - crl index test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_validate_x509_crl_index,
+        setup_validate_x509_crl_index, teardown);
+    /* validate_x509() */
+    tcase_add_loop_test(tc_validate_x509_crl_index, t_validate_x509_crl_check,
+        0, validate_x509_crl_check_lt_items);
+    /* is_crl_index_outdated() */
+    tcase_add_test(tc_validate_x509_crl_index, t_is_crl_index_outdated);
+    /* lookup_crl_index() */
+    tcase_add_test(tc_validate_x509_crl_index, t_lookup_crl_index_long_serial);
+
+    /*
+     * key data from x509 with key cache test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_key_data_from_x509_cached,
+        setup_key_data_from_x509_cached, teardown);
+    /* add_key_data_from_x509() */
+    tcase_add_loop_test(tc_key_data_from_x509_cached,
+        t_add_key_data_from_x509_cached, 0,
+        validate_x509_no_crl_check_lt_items);
+
+    /*
+     * decode key x509 test cases
+     */
+
+    /* decode_key_x509() */
+    tcase_add_loop_test(tc_decode_key_x509, t_decode_key_x509, 0,
+        validate_x509_no_crl_check_lt_items);
+    tcase_add_loop_test(tc_decode_key_x509, t_decode_key_x509_memo, 0,
+        validate_x509_no_crl_check_lt_items);
+    /* get_key_digest() */
+    tcase_add_loop_test(tc_decode_key_x509, t_get_key_digest, 0,
+        validate_x509_no_crl_check_lt_items);
+
+    /*
+     * prevalidate x509 test cases
+     */
+
+    /* setup / teardown */
+    tcase_add_unchecked_fixture(tc_prevalidate_x509,
+        setup_validate_x509_no_crl_check, teardown);
+    /* prevalidate_x509() */
+    int prevalidate_x509_lt_items = sizeof prevalidate_x509_lt /
+        sizeof prevalidate_x509_lt[0];
+    tcase_add_loop_test(tc_prevalidate_x509, t_prevalidate_x509, 0,
+        prevalidate_x509_lt_items);
+
+    /*
+     * cert store stamp test cases
+     */
+
+    /* get_cert_store_stamp() / get_cert_store_dir_hashes() */
+    int cert_store_stamp_lt_items = sizeof cert_store_stamp_lt /
+        sizeof cert_store_stamp_lt[0];
+    tcase_add_loop_test(tc_cert_store_stamp, t_get_cert_store_stamp, 0,
+        cert_store_stamp_lt_items);
+
     return s;
 }
 
@@ -30,6 +30,24 @@ struct keeto_validate_x509_entry {
     bool exp_result;
 };
 
+struct keeto_prevalidate_x509_entry {
+    char *file;
+    bool check_issuer;
+    enum keeto_x509_reject exp_result;
+};
+
+enum keeto_cert_store_change {
+    CERT_STORE_UNCHANGED,
+    CERT_STORE_OVERWRITTEN,
+    CERT_STORE_REPOINTED,
+    CERT_STORE_REMOVED
+};
+
+struct keeto_cert_store_stamp_entry {
+    enum keeto_cert_store_change change;
+    bool exp_changed;
+};
+
 struct keeto_get_ssh_key_fp_entry {
     char *digest;
     enum keeto_digests algo;
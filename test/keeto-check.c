@@ -21,7 +21,11 @@
 
 #include <check.h>
 
+#include "keeto-check-cache.h"
 #include "keeto-check-config.h"
+#include "keeto-check-ipc.h"
+#include "keeto-check-keystore.h"
+#include "keeto-check-ldap.h"
 #include "keeto-check-log.h"
 #include "keeto-check-util.h"
 #include "keeto-check-x509.h"
@@ -34,6 +38,10 @@ main(int argc, char **argv)
     srunner_add_suite(sr, make_log_suite());
     srunner_add_suite(sr, make_util_suite());
     srunner_add_suite(sr, make_x509_suite());
+    srunner_add_suite(sr, make_keystore_suite());
+    srunner_add_suite(sr, make_ldap_suite());
+    srunner_add_suite(sr, make_ipc_suite());
+    srunner_add_suite(sr, make_cache_suite());
 
     srunner_run_all(sr, CK_VERBOSE);
     int number_failed = srunner_ntests_failed(sr);